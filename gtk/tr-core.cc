@@ -1556,7 +1556,7 @@ static void update_foreach(GtkTreeModel* model, GtkTreeIter* iter)
     double newRecheckProgress;
     gboolean oldActive;
     gboolean newActive;
-    tr_stat const* st;
+    tr_stat st;
     tr_torrent* tor;
 
     /* get the old states */
@@ -1579,21 +1579,22 @@ static void update_foreach(GtkTreeModel* model, GtkTreeIter* iter)
         TR_ARG_TUPLE(MC_SPEED_DOWN, &oldDownSpeed),
         -1);
 
-    /* get the new states */
-    st = tr_torrentStat(tor);
-    newActive = is_torrent_active(st);
-    newActivity = st->activity;
-    newFinished = st->finished;
+    /* get the new states. This runs for every torrent every second,
+       so use the snapshot instead of making the session recalculate them */
+    tr_torrentStatSnapshot(tor, &st, nullptr, 0);
+    newActive = is_torrent_active(&st);
+    newActivity = st.activity;
+    newFinished = st.finished;
     newPriority = tr_torrentGetPriority(tor);
-    newQueuePosition = st->queuePosition;
+    newQueuePosition = st.queuePosition;
     newTrackers = build_torrent_trackers_hash(tor);
-    newUpSpeed = st->pieceUploadSpeed_KBps;
-    newDownSpeed = st->pieceDownloadSpeed_KBps;
-    newRecheckProgress = st->recheckProgress;
-    newActivePeerCount = st->peersSendingToUs + st->peersGettingFromUs + st->webseedsSendingToUs;
-    newDownloadPeerCount = st->peersSendingToUs;
-    newUploadPeerCount = st->peersGettingFromUs + st->webseedsSendingToUs;
-    newError = st->error;
+    newUpSpeed = st.pieceUploadSpeed_KBps;
+    newDownSpeed = st.pieceDownloadSpeed_KBps;
+    newRecheckProgress = st.recheckProgress;
+    newActivePeerCount = st.peersSendingToUs + st.peersGettingFromUs + st.webseedsSendingToUs;
+    newDownloadPeerCount = st.peersSendingToUs;
+    newUploadPeerCount = st.peersGettingFromUs + st.webseedsSendingToUs;
+    newError = st.error;
 
     /* updating the model triggers off resort/refresh,
        so don't do it unless something's actually changed... */
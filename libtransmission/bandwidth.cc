@@ -7,6 +7,7 @@
  */
 
 #include <algorithm>
+#include <climits> /* INT_MAX */
 #include <cstring> /* memset() */
 
 #include "transmission.h"
@@ -148,6 +149,14 @@ void Bandwidth::allocateBandwidth(
     }
 }
 
+/* TCP sockets send everything they're handed in a single writev(). When no
+ * speed limit applies there's no bandwidth to ration, so hand over the whole
+ * outbuf instead of a few kilobytes per syscall */
+static bool writesWholeBuffer(tr_peerIo const* io, tr_direction dir)
+{
+    return dir == TR_UP && io->socket.type == TR_PEER_SOCKET_TYPE_TCP && !io->bandwidth->isThrottled(dir);
+}
+
 void Bandwidth::phaseOne(std::vector<tr_peerIo*>& peerArray, tr_direction dir)
 {
     /* First phase of IO. Tries to distribute bandwidth fairly to keep faster
@@ -164,7 +173,7 @@ void Bandwidth::phaseOne(std::vector<tr_peerIo*>& peerArray, tr_direction dir)
         /* value of 3000 bytes chosen so that when using uTP we'll send a full-size
          * frame right away and leave enough buffered data for the next frame to go
          * out in a timely manner. */
-        size_t const increment = 3000;
+        size_t const increment = writesWholeBuffer(peerArray[i], dir) ? INT_MAX : 3000;
 
         int const bytes_used = tr_peerIoFlush(peerArray[i], dir, increment);
 
@@ -194,7 +203,13 @@ void Bandwidth::allocate(tr_direction dir, unsigned int period_msec)
     for (auto* io : tmp)
     {
         tr_peerIoRef(io);
-        tr_peerIoFlushOutgoingProtocolMsgs(io);
+
+        /* protocol messages go out ahead of everyone's piece data, unless
+         * phaseOne() is about to send them in the same writev() as the peer's */
+        if (!writesWholeBuffer(io, dir))
+        {
+            tr_peerIoFlushOutgoingProtocolMsgs(io);
+        }
 
         switch (io->priority)
         {
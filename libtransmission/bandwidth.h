@@ -181,6 +181,21 @@ public:
         return this->band_[dir].is_limited_;
     }
 
+    /**
+     * @return true if this bandwidth or any parent whose limits it honors throttles its peer-ios
+     */
+    [[nodiscard]] bool isThrottled(tr_direction dir) const
+    {
+        TR_ASSERT(tr_isDirection(dir));
+
+        if (this->band_[dir].is_limited_)
+        {
+            return true;
+        }
+
+        return this->parent_ != nullptr && this->band_[dir].honor_parent_limits_ && this->parent_->isThrottled(dir);
+    }
+
     /**
      * Almost all the time we do want to honor a parents' bandwidth cap, so that
      * (for example) a peer is constrained by a per-torrent cap and the global cap.
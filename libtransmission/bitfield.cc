@@ -8,6 +8,7 @@
 
 #include <algorithm>
 #include <cstring> /* memset */
+#include <functional> /* std::greater_equal */
 
 #include "transmission.h"
 #include "bitfield.h"
@@ -61,6 +62,13 @@ size_t Bitfield::countRangeImpl(size_t begin, size_t end) const
         return 0;
     }
 
+    if (this->sparse_)
+    {
+        auto const* const indices = this->sparseIndices();
+        auto const* const indices_end = indices + this->true_count_;
+        return std::lower_bound(indices, indices_end, end) - std::lower_bound(indices, indices_end, begin);
+    }
+
     if (first_byte >= this->alloc_count_)
     {
         return 0;
@@ -126,6 +134,11 @@ bool Bitfield::readBit(size_t n) const
         return false;
     }
 
+    if (this->sparse_)
+    {
+        return std::binary_search(this->sparseIndices(), this->sparseIndices() + this->true_count_, n);
+    }
+
     if (n >> 3U >= this->alloc_count_)
     {
         return false;
@@ -142,6 +155,18 @@ bool Bitfield::readBit(size_t n) const
 
 bool Bitfield::isValid() const
 {
+    if (this->sparse_)
+    {
+        auto const* const indices = this->sparseIndices();
+        auto const* const indices_end = indices + this->true_count_;
+        TR_ASSERT(this->bits_ != nullptr);
+        TR_ASSERT(this->true_count_ > 0);
+        TR_ASSERT(this->true_count_ * sizeof(uint32_t) <= this->alloc_count_);
+        TR_ASSERT(std::adjacent_find(indices, indices_end, std::greater_equal<>()) == indices_end);
+        TR_ASSERT(indices_end[-1] < this->bit_count_);
+        return true;
+    }
+
     TR_ASSERT((this->alloc_count_ == 0) == (this->bits_ == nullptr));
     TR_ASSERT(this->bits_ == nullptr || this->true_count_ == this->countArray());
 
@@ -177,7 +202,16 @@ void* Bitfield::getRaw(size_t* byte_count) const
     size_t const n = getStorageSize(this->bit_count_);
     uint8_t* newBits = tr_new0(uint8_t, n);
 
-    if (this->alloc_count_ != 0)
+    if (this->sparse_)
+    {
+        auto const* const indices = this->sparseIndices();
+
+        for (size_t i = 0; i < this->true_count_; ++i)
+        {
+            newBits[indices[i] >> 3U] |= 0x80 >> (indices[i] & 7U);
+        }
+    }
+    else if (this->alloc_count_ != 0)
     {
         TR_ASSERT(this->alloc_count_ <= n);
         std::memcpy(newBits, this->bits_, this->alloc_count_);
@@ -191,8 +225,108 @@ void* Bitfield::getRaw(size_t* byte_count) const
     return newBits;
 }
 
+bool Bitfield::sparseFits(size_t true_count) const
+{
+    // only worth it while the indices take much less room than the bitmap would
+    return this->bit_count_ != 0 && this->bit_count_ <= UINT32_MAX && true_count <= SparseMaxCount &&
+        true_count * sizeof(uint32_t) * 2 <= getStorageSize(this->bit_count_);
+}
+
+void Bitfield::sparseInsert(size_t bit)
+{
+    TR_ASSERT(bit < this->bit_count_);
+
+    size_t const count = this->sparse_ ? this->true_count_ : 0;
+
+    if ((count + 1) * sizeof(uint32_t) > this->alloc_count_)
+    {
+        size_t const capacity = std::min(SparseMaxCount, std::max(size_t{ 4 }, count * 2));
+        this->bits_ = tr_renew(uint8_t, this->bits_, capacity * sizeof(uint32_t));
+        this->alloc_count_ = capacity * sizeof(uint32_t);
+    }
+
+    auto* const indices = this->sparseIndices();
+    auto* const pos = std::lower_bound(indices, indices + count, bit);
+    std::memmove(pos + 1, pos, (indices + count - pos) * sizeof(uint32_t));
+    *pos = static_cast<uint32_t>(bit);
+    this->sparse_ = true;
+}
+
+void Bitfield::sparseErase(size_t bit)
+{
+    auto* const indices = this->sparseIndices();
+    auto* const indices_end = indices + this->true_count_;
+    auto* const pos = std::lower_bound(indices, indices_end, bit);
+
+    TR_ASSERT(pos != indices_end && *pos == bit);
+
+    std::memmove(pos, pos + 1, (indices_end - pos - 1) * sizeof(uint32_t));
+}
+
+void Bitfield::densify()
+{
+    TR_ASSERT(this->sparse_);
+
+    auto const* const indices = this->sparseIndices();
+    size_t const n = getStorageSize(size_t{ indices[this->true_count_ - 1] } + 1);
+    auto* const bits = tr_new0(uint8_t, n);
+
+    for (size_t i = 0; i < this->true_count_; ++i)
+    {
+        bits[indices[i] >> 3U] |= 0x80 >> (indices[i] & 7U);
+    }
+
+    tr_free(this->bits_);
+    this->bits_ = bits;
+    this->alloc_count_ = n;
+    this->sparse_ = false;
+}
+
+void Bitfield::maybeSparsify()
+{
+    if (this->sparse_ || this->bits_ == nullptr || !this->sparseFits(this->true_count_))
+    {
+        return;
+    }
+
+    auto* const indices = tr_new(uint32_t, this->true_count_);
+    size_t n = 0;
+
+    for (size_t byte = 0; byte < this->alloc_count_; ++byte)
+    {
+        for (size_t bit = 0; this->bits_[byte] != 0 && bit < 8; ++bit)
+        {
+            if ((this->bits_[byte] << bit & 0x80) != 0)
+            {
+                indices[n++] = static_cast<uint32_t>(byte * 8 + bit);
+            }
+        }
+    }
+
+    TR_ASSERT(n == this->true_count_);
+
+    if (indices[n - 1] >= this->bit_count_)
+    {
+        // unbounded data from a peer; keep it as it is
+        tr_free(indices);
+        return;
+    }
+
+    tr_free(this->bits_);
+    this->bits_ = reinterpret_cast<uint8_t*>(indices);
+    this->alloc_count_ = n * sizeof(uint32_t);
+    this->sparse_ = true;
+
+    TR_ASSERT(this->isValid());
+}
+
 void Bitfield::ensureBitsAlloced(size_t n)
 {
+    if (this->sparse_)
+    {
+        this->densify();
+    }
+
     size_t bytes_needed;
     bool const has_all = this->hasAll();
 
@@ -235,6 +369,7 @@ void Bitfield::freeArray()
     tr_free(this->bits_);
     this->bits_ = nullptr;
     this->alloc_count_ = 0;
+    this->sparse_ = false;
 }
 
 void Bitfield::setTrueCount(size_t n)
@@ -315,6 +450,13 @@ void Bitfield::setFromBitfield(Bitfield const& src)
     {
         this->setHasNone();
     }
+    else if (src.sparse_)
+    {
+        size_t byte_count = 0;
+        void* raw = src.getRaw(&byte_count);
+        this->setRaw(raw, byte_count, true);
+        tr_free(raw);
+    }
     else
     {
         this->setRaw(src.bits_, src.alloc_count_, true);
@@ -334,7 +476,8 @@ void Bitfield::setRaw(void const* newBits, size_t byte_count, bool bounded)
     this->bits_ = static_cast<uint8_t*>(tr_memdup(newBits, byte_count));
     this->alloc_count_ = byte_count;
 
-    if (bounded)
+    /* a lazily-sized source, e.g. from setFromBitfield(), can be shorter than the storage */
+    if (bounded && byte_count * 8 > this->bit_count_)
     {
         /* ensure the excess newBits are set to '0' */
         int const excess_bit_count = byte_count * 8 - this->bit_count_;
@@ -349,6 +492,7 @@ void Bitfield::setRaw(void const* newBits, size_t byte_count, bool bounded)
     }
 
     this->rebuildTrueCount();
+    this->maybeSparsify();
 }
 
 void Bitfield::setFromFlags(bool const* flags, size_t n)
@@ -368,11 +512,22 @@ void Bitfield::setFromFlags(bool const* flags, size_t n)
     }
 
     this->setTrueCount(trueCount);
+    this->maybeSparsify();
 }
 
 void Bitfield::setBit(size_t bit)
 {
-    if (!this->readBit(bit) && this->ensureNthBitAlloced(bit))
+    if (this->readBit(bit))
+    {
+        return;
+    }
+
+    if (bit < this->bit_count_ && (this->sparse_ || this->bits_ == nullptr) && this->sparseFits(this->true_count_ + 1))
+    {
+        this->sparseInsert(bit);
+        this->incTrueCount(1);
+    }
+    else if (this->ensureNthBitAlloced(bit))
     {
         size_t const offset = bit >> 3U;
 
@@ -436,7 +591,15 @@ void Bitfield::clearBit(size_t bit)
 {
     TR_ASSERT(this->isValid());
 
-    if (this->readBit(bit) && this->ensureNthBitAlloced(bit))
+    if (this->sparse_)
+    {
+        if (this->readBit(bit))
+        {
+            this->sparseErase(bit);
+            this->decTrueCount(1);
+        }
+    }
+    else if (this->readBit(bit) && this->ensureNthBitAlloced(bit))
     {
         this->bits_[bit >> 3U] &= 0xff7f >> (bit & 7U);
         this->decTrueCount(1);
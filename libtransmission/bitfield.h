@@ -16,7 +16,15 @@
 #include "tr-macros.h"
 #include "tr-assert.h"
 
-/// @brief Implementation of the BitTorrent spec's Bitfield array of bits
+/**
+ * @brief Implementation of the BitTorrent spec's Bitfield array of bits
+ *
+ * Storage is only allocated when it's needed: a bitfield with all or none
+ * of its bits set holds no array, and one with only a few bits set keeps
+ * their sorted indices instead of the full bitmap. A peer that has just
+ * joined the swarm is typically announced with a handful of HAVEs, so this
+ * keeps most peers' `have` small on torrents with many pieces.
+ */
 struct Bitfield
 {
 public:
@@ -105,6 +113,12 @@ public:
         return bit_count_;
     }
 
+    /// @brief How many bytes of storage are allocated, whichever representation is in use
+    [[nodiscard]] size_t getAllocatedBytes() const
+    {
+        return alloc_count_;
+    }
+
 private:
     [[nodiscard]] constexpr size_t countArray() const;
     [[nodiscard]] size_t countRangeImpl(size_t begin, size_t end) const;
@@ -113,6 +127,15 @@ private:
     {
         return (bit_count >> 3) + ((bit_count & 7) != 0 ? 1 : 0);
     }
+    [[nodiscard]] uint32_t* sparseIndices() const
+    {
+        return reinterpret_cast<uint32_t*>(bits_);
+    }
+    [[nodiscard]] bool sparseFits(size_t true_count) const;
+    void sparseInsert(size_t bit);
+    void sparseErase(size_t bit);
+    void densify();
+    void maybeSparsify();
     void ensureBitsAlloced(size_t n);
     bool ensureNthBitAlloced(size_t nth);
     void freeArray();
@@ -125,6 +148,9 @@ private:
     [[nodiscard]] bool isValid() const;
 #endif
 
+    /// @brief Most bits that are kept as a list of indices before switching to a bitmap
+    static constexpr size_t SparseMaxCount = 256;
+
     uint8_t* bits_ = nullptr;
     size_t alloc_count_ = 0;
     size_t bit_count_ = 0;
@@ -143,4 +169,7 @@ private:
     // Special cases for when full or empty but we don't know the bitCount.
     // This occurs when a magnet link's peers send have all / have none
     OperationMode hint_ = NORMAL;
+
+    /// @brief If true, bits_ holds the sorted indices of the true_count_ set bits instead of a bitmap
+    bool sparse_ = false;
 };
@@ -6,10 +6,11 @@
  *
  */
 
+#include <algorithm>
 #include <errno.h>
 #include <stdio.h>
-#include <stdlib.h> /* bsearch(), qsort() */
 #include <string.h>
+#include <vector>
 
 #include "transmission.h"
 #include "blocklist.h"
@@ -30,29 +31,97 @@ struct tr_ipv4_range
     uint32_t end;
 };
 
+/* an IPv6 address in host byte order, split into its high and low halves */
+struct tr_ipv6_key
+{
+    uint64_t hi;
+    uint64_t lo;
+};
+
+static bool operator<(tr_ipv6_key const& a, tr_ipv6_key const& b)
+{
+    return a.hi != b.hi ? a.hi < b.hi : a.lo < b.lo;
+}
+
+struct tr_ipv6_range
+{
+    struct tr_ipv6_key begin;
+    struct tr_ipv6_key end;
+};
+
+/*
+ * The compiled .bin format is this header, then the sorted and merged
+ * IPv4 ranges, then the sorted and merged IPv6 ranges, all in host byte
+ * order so that the file can be mapped and used as-is. Files written by
+ * older versions have no header and hold only IPv4 ranges.
+ */
+struct tr_blocklist_header
+{
+    char magic[8];
+    uint32_t ipv4Count;
+    uint32_t ipv6Count;
+};
+
+static char const BlocklistMagic[8] = { 'T', 'R', 'B', 'L', 'O', 'C', 'K', '2' };
+
 struct tr_blocklistFile
 {
     bool isEnabled;
     tr_sys_file_t fd;
-    size_t ruleCount;
     uint64_t byteCount;
     char* filename;
-    struct tr_ipv4_range* rules;
+    void* map;
+    struct tr_ipv4_range const* ipv4;
+    size_t ipv4Count;
+    struct tr_ipv6_range const* ipv6;
+    size_t ipv6Count;
 };
 
 static void blocklistClose(tr_blocklistFile* b)
 {
-    if (b->rules != nullptr)
+    if (b->map != nullptr)
     {
-        tr_sys_file_unmap(b->rules, b->byteCount, nullptr);
+        tr_sys_file_unmap(b->map, b->byteCount, nullptr);
         tr_sys_file_close(b->fd, nullptr);
-        b->rules = nullptr;
-        b->ruleCount = 0;
+        b->map = nullptr;
+        b->ipv4 = nullptr;
+        b->ipv4Count = 0;
+        b->ipv6 = nullptr;
+        b->ipv6Count = 0;
         b->byteCount = 0;
         b->fd = TR_BAD_SYS_FILE;
     }
 }
 
+static bool blocklistParseMap(tr_blocklistFile* b)
+{
+    auto const* base = static_cast<uint8_t const*>(b->map);
+    auto const* header = static_cast<struct tr_blocklist_header const*>(b->map);
+
+    if (b->byteCount < sizeof(struct tr_blocklist_header) ||
+        memcmp(header->magic, BlocklistMagic, sizeof(BlocklistMagic)) != 0)
+    {
+        /* legacy format */
+        b->ipv4 = static_cast<struct tr_ipv4_range const*>(b->map);
+        b->ipv4Count = b->byteCount / sizeof(struct tr_ipv4_range);
+        return b->byteCount % sizeof(struct tr_ipv4_range) == 0;
+    }
+
+    uint64_t const ipv4Bytes = uint64_t{ header->ipv4Count } * sizeof(struct tr_ipv4_range);
+    uint64_t const ipv6Bytes = uint64_t{ header->ipv6Count } * sizeof(struct tr_ipv6_range);
+
+    if (sizeof(struct tr_blocklist_header) + ipv4Bytes + ipv6Bytes != b->byteCount)
+    {
+        return false;
+    }
+
+    b->ipv4 = reinterpret_cast<struct tr_ipv4_range const*>(base + sizeof(struct tr_blocklist_header));
+    b->ipv4Count = header->ipv4Count;
+    b->ipv6 = reinterpret_cast<struct tr_ipv6_range const*>(base + sizeof(struct tr_blocklist_header) + ipv4Bytes);
+    b->ipv6Count = header->ipv6Count;
+    return true;
+}
+
 static void blocklistLoad(tr_blocklistFile* b)
 {
     tr_sys_file_t fd;
@@ -85,9 +154,9 @@ static void blocklistLoad(tr_blocklistFile* b)
         return;
     }
 
-    b->rules = static_cast<struct tr_ipv4_range*>(tr_sys_file_map_for_reading(fd, 0, byteCount, &error));
+    b->map = tr_sys_file_map_for_reading(fd, 0, byteCount, &error);
 
-    if (b->rules == nullptr)
+    if (b->map == nullptr)
     {
         tr_logAddError(err_fmt, b->filename, error->message);
         tr_sys_file_close(fd, nullptr);
@@ -97,39 +166,27 @@ static void blocklistLoad(tr_blocklistFile* b)
 
     b->fd = fd;
     b->byteCount = byteCount;
-    b->ruleCount = byteCount / sizeof(struct tr_ipv4_range);
+
+    if (!blocklistParseMap(b))
+    {
+        tr_logAddError(err_fmt, b->filename, _("Invalid blocklist file"));
+        blocklistClose(b);
+        return;
+    }
 
     base = tr_sys_path_basename(b->filename, nullptr);
-    tr_logAddInfo(_("Blocklist \"%s\" contains %zu entries"), base, b->ruleCount);
+    tr_logAddInfo(_("Blocklist \"%s\" contains %zu entries"), base, b->ipv4Count + b->ipv6Count);
     tr_free(base);
 }
 
 static void blocklistEnsureLoaded(tr_blocklistFile* b)
 {
-    if (b->rules == nullptr)
+    if (b->map == nullptr)
     {
         blocklistLoad(b);
     }
 }
 
-static int compareAddressToRange(void const* va, void const* vb)
-{
-    auto const* a = static_cast<uint32_t const*>(va);
-    auto const* b = static_cast<struct tr_ipv4_range const*>(vb);
-
-    if (*a < b->begin)
-    {
-        return -1;
-    }
-
-    if (*a > b->end)
-    {
-        return 1;
-    }
-
-    return 0;
-}
-
 static void blocklistDelete(tr_blocklistFile* b)
 {
     blocklistClose(b);
@@ -173,7 +230,7 @@ int tr_blocklistFileGetRuleCount(tr_blocklistFile const* b)
 {
     blocklistEnsureLoaded((tr_blocklistFile*)b);
 
-    return b->ruleCount;
+    return b->ipv4Count + b->ipv6Count;
 }
 
 bool tr_blocklistFileIsEnabled(tr_blocklistFile* b)
@@ -188,32 +245,6 @@ void tr_blocklistFileSetEnabled(tr_blocklistFile* b, bool isEnabled)
     b->isEnabled = isEnabled;
 }
 
-bool tr_blocklistFileHasAddress(tr_blocklistFile* b, tr_address const* addr)
-{
-    TR_ASSERT(tr_address_is_valid(addr));
-
-    uint32_t needle;
-
-    if (!b->isEnabled || addr->type == TR_AF_INET6)
-    {
-        return false;
-    }
-
-    blocklistEnsureLoaded(b);
-
-    if (b->rules == nullptr || b->ruleCount == 0)
-    {
-        return false;
-    }
-
-    needle = ntohl(addr->addr.addr4.s_addr);
-
-    auto const* range = static_cast<struct tr_ipv4_range const*>(
-        bsearch(&needle, b->rules, b->ruleCount, sizeof(struct tr_ipv4_range), compareAddressToRange));
-
-    return range != nullptr;
-}
-
 /*
  * P2P plaintext format: "comment:x.x.x.x-y.y.y.y"
  * http://wiki.phoenixlabs.org/wiki/P2P_Format
@@ -345,17 +376,116 @@ static bool parseLine(char const* line, struct tr_ipv4_range* range)
     return parseLine1(line, range) || parseLine2(line, range) || parseLine3(line, range);
 }
 
-static int compareAddressRangesByFirstAddress(void const* va, void const* vb)
+static struct tr_ipv6_key toIPv6Key(struct in6_addr const* addr)
+{
+    struct tr_ipv6_key key = {};
+    uint8_t const* bytes = addr->s6_addr;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        key.hi = key.hi << 8 | bytes[i];
+        key.lo = key.lo << 8 | bytes[i + 8];
+    }
+
+    return key;
+}
+
+static bool parseIPv6Address(char const* str, struct tr_ipv6_key* key)
+{
+    tr_address addr;
+
+    if (!tr_address_from_string(&addr, str) || addr.type != TR_AF_INET6)
+    {
+        return false;
+    }
+
+    *key = toIPv6Key(&addr.addr.addr6);
+    return true;
+}
+
+/*
+ * IPv6 range: "2001:db8::1-2001:db8::ff"
+ */
+static bool parseLine4(char const* line, struct tr_ipv6_range* range)
+{
+    char begin[64];
+    char end[64];
+
+    return sscanf(line, " %63[0-9a-fA-F:.] - %63[0-9a-fA-F:.]", begin, end) == 2 &&
+        parseIPv6Address(begin, &range->begin) && parseIPv6Address(end, &range->end) && !(range->end < range->begin);
+}
+
+/*
+ * IPv6 CIDR notation: "2001:db8::/32"
+ */
+static bool parseLine5(char const* line, struct tr_ipv6_range* range)
 {
-    auto const* a = static_cast<struct tr_ipv4_range const*>(va);
-    auto const* b = static_cast<struct tr_ipv4_range const*>(vb);
+    char str[64];
+    unsigned int pflen;
+    struct tr_ipv6_key ip;
 
-    if (a->begin != b->begin)
+    if (sscanf(line, " %63[0-9a-fA-F:.]/%u", str, &pflen) != 2 || pflen > 128 || !parseIPv6Address(str, &ip))
     {
-        return a->begin < b->begin ? -1 : 1;
+        return false;
     }
 
-    return 0;
+    /* this is host order */
+    uint64_t const hiMask = pflen == 0 ? 0 : pflen >= 64 ? ~uint64_t{ 0 } : ~uint64_t{ 0 } << (64 - pflen);
+    uint64_t const loMask = pflen <= 64 ? 0 : pflen == 128 ? ~uint64_t{ 0 } : ~uint64_t{ 0 } << (128 - pflen);
+
+    range->begin.hi = ip.hi & hiMask;
+    range->begin.lo = ip.lo & loMask;
+    range->end.hi = ip.hi | ~hiMask;
+    range->end.lo = ip.lo | ~loMask;
+
+    return true;
+}
+
+static bool parseLine(char const* line, struct tr_ipv6_range* range)
+{
+    return parseLine4(line, range) || parseLine5(line, range);
+}
+
+/* sort the ranges by their first address and merge the ones that overlap */
+template<typename Range>
+static void sortAndMerge(std::vector<Range>& ranges)
+{
+    if (std::empty(ranges))
+    {
+        return;
+    }
+
+    std::sort(
+        std::begin(ranges),
+        std::end(ranges),
+        [](Range const& a, Range const& b) { return a.begin < b.begin; });
+
+    auto keep = std::begin(ranges);
+
+    for (auto it = std::next(keep), end = std::end(ranges); it != end; ++it)
+    {
+        if (keep->end < it->begin)
+        {
+            *++keep = *it;
+        }
+        else if (keep->end < it->end)
+        {
+            keep->end = it->end;
+        }
+    }
+
+    ranges.erase(std::next(keep), std::end(ranges));
+
+#ifdef TR_ENABLE_ASSERTS
+
+    /* sanity checks: make sure the rules are sorted in ascending order and don't overlap */
+    for (size_t i = 0; i < std::size(ranges); ++i)
+    {
+        TR_ASSERT(!(ranges[i].end < ranges[i].begin));
+        TR_ASSERT(i == 0 || ranges[i - 1].end < ranges[i].begin);
+    }
+
+#endif
 }
 
 int tr_blocklistFileSetContent(tr_blocklistFile* b, char const* filename)
@@ -365,9 +495,8 @@ int tr_blocklistFileSetContent(tr_blocklistFile* b, char const* filename)
     int inCount = 0;
     char line[2048];
     char const* err_fmt = _("Couldn't read \"%1$s\": %2$s");
-    struct tr_ipv4_range* ranges = nullptr;
-    size_t ranges_alloc = 0;
-    size_t ranges_count = 0;
+    auto ipv4 = std::vector<struct tr_ipv4_range>{};
+    auto ipv6 = std::vector<struct tr_ipv6_range>{};
     tr_error* error = nullptr;
 
     if (filename == nullptr)
@@ -400,69 +529,38 @@ int tr_blocklistFileSetContent(tr_blocklistFile* b, char const* filename)
     /* load the rules into memory */
     while (tr_sys_file_read_line(in, line, sizeof(line), nullptr))
     {
-        struct tr_ipv4_range range;
+        struct tr_ipv4_range range4;
+        struct tr_ipv6_range range6;
 
         ++inCount;
 
-        if (!parseLine(line, &range))
+        if (parseLine(line, &range4))
         {
-            /* don't try to display the actual lines - it causes issues */
-            tr_logAddError(_("blocklist skipped invalid address at line %d"), inCount);
-            continue;
+            ipv4.push_back(range4);
         }
-
-        if (ranges_alloc == ranges_count)
+        else if (parseLine(line, &range6))
         {
-            ranges_alloc += 4096; /* arbitrary */
-            ranges = tr_renew(struct tr_ipv4_range, ranges, ranges_alloc);
+            ipv6.push_back(range6);
         }
-
-        ranges[ranges_count++] = range;
-    }
-
-    if (ranges_count > 0) /* sort and merge */
-    {
-        struct tr_ipv4_range* keep = ranges;
-
-        /* sort */
-        qsort(ranges, ranges_count, sizeof(struct tr_ipv4_range), compareAddressRangesByFirstAddress);
-
-        /* merge */
-        for (size_t i = 1; i < ranges_count; ++i)
+        else
         {
-            struct tr_ipv4_range const* r = &ranges[i];
-
-            if (keep->end < r->begin)
-            {
-                *++keep = *r;
-            }
-            else if (keep->end < r->end)
-            {
-                keep->end = r->end;
-            }
+            /* don't try to display the actual lines - it causes issues */
+            tr_logAddError(_("blocklist skipped invalid address at line %d"), inCount);
         }
+    }
 
-        ranges_count = keep + 1 - ranges;
-
-#ifdef TR_ENABLE_ASSERTS
-
-        /* sanity checks: make sure the rules are sorted in ascending order and don't overlap */
-        {
-            for (size_t i = 0; i < ranges_count; ++i)
-            {
-                TR_ASSERT(ranges[i].begin <= ranges[i].end);
-            }
-
-            for (size_t i = 1; i < ranges_count; ++i)
-            {
-                TR_ASSERT(ranges[i - 1].end < ranges[i].begin);
-            }
-        }
+    sortAndMerge(ipv4);
+    sortAndMerge(ipv6);
 
-#endif
-    }
+    struct tr_blocklist_header header;
+    memcpy(header.magic, BlocklistMagic, sizeof(BlocklistMagic));
+    header.ipv4Count = std::size(ipv4);
+    header.ipv6Count = std::size(ipv6);
+    size_t const ruleCount = std::size(ipv4) + std::size(ipv6);
 
-    if (!tr_sys_file_write(out, ranges, sizeof(struct tr_ipv4_range) * ranges_count, nullptr, &error))
+    if (!tr_sys_file_write(out, &header, sizeof(header), nullptr, &error) ||
+        !tr_sys_file_write(out, std::data(ipv4), sizeof(struct tr_ipv4_range) * std::size(ipv4), nullptr, &error) ||
+        !tr_sys_file_write(out, std::data(ipv6), sizeof(struct tr_ipv6_range) * std::size(ipv6), nullptr, &error))
     {
         tr_logAddError(_("Couldn't save file \"%1$s\": %2$s"), b->filename, error->message);
         tr_error_free(error);
@@ -470,15 +568,123 @@ int tr_blocklistFileSetContent(tr_blocklistFile* b, char const* filename)
     else
     {
         char* base = tr_sys_path_basename(b->filename, nullptr);
-        tr_logAddInfo(_("Blocklist \"%s\" updated with %zu entries"), base, ranges_count);
+        tr_logAddInfo(_("Blocklist \"%s\" updated with %zu entries"), base, ruleCount);
         tr_free(base);
     }
 
-    tr_free(ranges);
     tr_sys_file_close(out, nullptr);
     tr_sys_file_close(in, nullptr);
 
     blocklistLoad(b);
 
-    return ranges_count;
+    return ruleCount;
+}
+
+/***
+****  The merged index of all the enabled blocklists.
+****
+****  Each address family's ranges are kept in Eytzinger (BFS) order, which
+****  makes the lookup a short branch-free descent whose first few levels
+****  share cache lines for every address.
+***/
+
+struct tr_blocklist_index
+{
+    /* 1-based; slot 0 is unused */
+    std::vector<struct tr_ipv4_range> ipv4;
+    std::vector<struct tr_ipv6_range> ipv6;
+};
+
+template<typename Range>
+static size_t buildEytzinger(std::vector<Range> const& sorted, std::vector<Range>& out, size_t i, size_t k)
+{
+    if (k < std::size(out))
+    {
+        i = buildEytzinger(sorted, out, i, 2 * k);
+        out[k] = sorted[i++];
+        i = buildEytzinger(sorted, out, i, 2 * k + 1);
+    }
+
+    return i;
+}
+
+template<typename Range>
+static std::vector<Range> toEytzinger(std::vector<Range> const& sorted)
+{
+    auto out = std::vector<Range>(std::size(sorted) + 1);
+    buildEytzinger(sorted, out, 0, 1);
+    return out;
+}
+
+template<typename Range, typename Key>
+static bool eytzingerContains(std::vector<Range> const& ranges, Key const& key)
+{
+    size_t const n = std::size(ranges);
+    size_t k = 1;
+
+    /* find the first range that ends at or after key... */
+    while (k < n)
+    {
+        k = 2 * k + (ranges[k].end < key ? 1 : 0);
+    }
+
+    /* ...by backing out of the right turns taken past it */
+    while ((k & 1) != 0)
+    {
+        k >>= 1;
+    }
+
+    k >>= 1;
+
+    /* ranges don't overlap, so that's the only one that can contain key */
+    return k != 0 && !(key < ranges[k].begin);
+}
+
+tr_blocklist_index* tr_blocklistIndexNew(std::list<tr_blocklistFile*> const& blocklists)
+{
+    auto ipv4 = std::vector<struct tr_ipv4_range>{};
+    auto ipv6 = std::vector<struct tr_ipv6_range>{};
+
+    for (auto* b : blocklists)
+    {
+        if (!b->isEnabled)
+        {
+            continue;
+        }
+
+        blocklistEnsureLoaded(b);
+
+        ipv4.insert(std::end(ipv4), b->ipv4, b->ipv4 + b->ipv4Count);
+        ipv6.insert(std::end(ipv6), b->ipv6, b->ipv6 + b->ipv6Count);
+    }
+
+    sortAndMerge(ipv4);
+    sortAndMerge(ipv6);
+
+    auto* index = new tr_blocklist_index{};
+    index->ipv4 = toEytzinger(ipv4);
+    index->ipv6 = toEytzinger(ipv6);
+    return index;
+}
+
+void tr_blocklistIndexFree(tr_blocklist_index* index)
+{
+    delete index;
+}
+
+bool tr_blocklistIndexHasAddress(tr_blocklist_index const* index, tr_address const* addr)
+{
+    TR_ASSERT(tr_address_is_valid(addr));
+
+    if (index == nullptr)
+    {
+        return false;
+    }
+
+    if (addr->type == TR_AF_INET)
+    {
+        return eytzingerContains(index->ipv4, uint32_t{ ntohl(addr->addr.addr4.s_addr) });
+    }
+
+    return eytzingerContains(index->ipv6, toIPv6Key(&addr->addr.addr6));
 }
@@ -12,6 +12,8 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <list>
+
 #include "tr-macros.h"
 
 struct tr_address;
@@ -32,6 +34,17 @@ bool tr_blocklistFileIsEnabled(tr_blocklistFile* b);
 
 void tr_blocklistFileSetEnabled(tr_blocklistFile* b, bool isEnabled);
 
-bool tr_blocklistFileHasAddress(tr_blocklistFile* b, struct tr_address const* addr);
-
 int tr_blocklistFileSetContent(tr_blocklistFile* b, char const* filename);
+
+/**
+ * A merged, read-only copy of every enabled blocklist's rules, so that
+ * checking an address costs one lookup no matter how many lists there are.
+ * It must be rebuilt when a blocklist is added, removed, changed, or toggled.
+ */
+struct tr_blocklist_index;
+
+tr_blocklist_index* tr_blocklistIndexNew(std::list<tr_blocklistFile*> const& blocklists);
+
+void tr_blocklistIndexFree(tr_blocklist_index* index);
+
+bool tr_blocklistIndexHasAddress(tr_blocklist_index const* index, struct tr_address const* addr);
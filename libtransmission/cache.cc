@@ -7,6 +7,13 @@
  */
 
 #include <stdlib.h> /* qsort() */
+#include <algorithm> /* std::sort() */
+#include <cstring> /* memcpy() */
+#include <list>
+#include <map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <event2/buffer.h>
 
@@ -15,6 +22,7 @@
 #include "inout.h"
 #include "log.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
+#include "perf.h"
 #include "ptrarray.h"
 #include "torrent.h"
 #include "tr-assert.h"
@@ -43,6 +51,29 @@ struct cache_block
     struct evbuffer* evbuf;
 };
 
+/* torrent id, block index */
+using read_ahead_key = std::pair<int, tr_block_index_t>;
+
+/* a clean copy of a block that tr_cacheReadAhead() loaded from disk */
+struct read_ahead_block
+{
+    tr_piece_index_t piece;
+    uint32_t offset;
+    std::vector<uint8_t> data;
+
+    time_t time;
+    bool used;
+    std::list<read_ahead_key>::iterator lru;
+};
+
+enum
+{
+    /* an unread read-ahead block can be dropped after this long */
+    READ_AHEAD_MAX_AGE_SECS = 30,
+    /* upper bound on the size of a single coalesced read */
+    READ_AHEAD_MAX_RUN_BLOCKS = 64
+};
+
 struct tr_cache
 {
     tr_ptrArray blocks;
@@ -53,6 +84,13 @@ struct tr_cache
     size_t disk_write_bytes;
     size_t cache_writes;
     size_t cache_write_bytes;
+
+    /* read-ahead blocks, plus their keys in load order.
+     * Blocks move from `read_ahead_unread' to `read_ahead_read' when they're read. */
+    std::map<read_ahead_key, read_ahead_block> read_ahead;
+    std::list<read_ahead_key> read_ahead_unread;
+    std::list<read_ahead_key> read_ahead_read;
+    tr_cache_read_ahead_stats read_ahead_stats;
 };
 
 /****
@@ -168,6 +206,7 @@ static int flushContiguous(tr_cache* cache, int pos, int n)
     tr_torrent* tor = b->tor;
     tr_piece_index_t const piece = b->piece;
     uint32_t const offset = b->offset;
+    auto const perf = tr_perf_scope{ tor->session, TR_PERF_CACHE_FLUSH };
 
     for (int i = 0; i < n; ++i)
     {
@@ -208,6 +247,219 @@ static int flushRuns(tr_cache* cache, struct run_info* runs, int n)
     return err;
 }
 
+/***
+****  Read-ahead
+***/
+
+/* read-ahead blocks only get the room that unwritten blocks aren't using */
+static size_t readAheadLimit(tr_cache const* cache)
+{
+    int const n = tr_ptrArraySize(&cache->blocks);
+    return cache->max_blocks > n ? cache->max_blocks - n : 0;
+}
+
+static void readAheadErase(tr_cache* cache, std::map<read_ahead_key, read_ahead_block>::iterator it)
+{
+    if (it->second.used)
+    {
+        cache->read_ahead_read.erase(it->second.lru);
+    }
+    else
+    {
+        cache->read_ahead_unread.erase(it->second.lru);
+        ++cache->read_ahead_stats.blocks_wasted;
+    }
+
+    cache->read_ahead.erase(it);
+}
+
+static void readAheadEraseOldest(tr_cache* cache, std::list<read_ahead_key> const& lru)
+{
+    readAheadErase(cache, cache->read_ahead.find(lru.front()));
+}
+
+/* drop expired blocks, then make room for `incoming' more by dropping
+ * blocks that were read already, then the oldest unread ones */
+static void readAheadTrim(tr_cache* cache, size_t incoming)
+{
+    time_t const oldest = tr_time() - READ_AHEAD_MAX_AGE_SECS;
+    size_t const limit = readAheadLimit(cache);
+
+    while (!std::empty(cache->read_ahead_unread) &&
+           cache->read_ahead.find(cache->read_ahead_unread.front())->second.time < oldest)
+    {
+        readAheadEraseOldest(cache, cache->read_ahead_unread);
+    }
+
+    while (!std::empty(cache->read_ahead_read) && std::size(cache->read_ahead) + incoming > limit)
+    {
+        readAheadEraseOldest(cache, cache->read_ahead_read);
+    }
+
+    while (!std::empty(cache->read_ahead_unread) && std::size(cache->read_ahead) + incoming > limit)
+    {
+        readAheadEraseOldest(cache, cache->read_ahead_unread);
+    }
+}
+
+/* drop a torrent's read-ahead blocks in [first...last] */
+static void readAheadDrop(tr_cache* cache, tr_torrent const* torrent, tr_block_index_t first, tr_block_index_t last)
+{
+    auto it = cache->read_ahead.lower_bound(std::make_pair(torrent->uniqueId, first));
+
+    while (it != std::end(cache->read_ahead) && it->first.first == torrent->uniqueId && it->first.second <= last)
+    {
+        readAheadErase(cache, it++);
+    }
+}
+
+static struct cache_block* findBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset);
+
+/* where does this block start in its piece? */
+static uint32_t blockOffset(tr_torrent const* tor, tr_block_index_t block)
+{
+    return (block % tor->blockCountInPiece) * tor->blockSize;
+}
+
+/* load blocks [first...first+n) with one read */
+static int readAheadLoadRun(tr_cache* cache, tr_torrent* tor, tr_block_index_t first, size_t n)
+{
+    tr_piece_index_t const piece = tr_torBlockPiece(tor, first);
+    uint32_t const offset = blockOffset(tor, first);
+    size_t len = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        len += tr_torBlockCountBytes(tor, first + i);
+    }
+
+    auto buf = std::vector<uint8_t>(len);
+    int const err = tr_ioRead(tor, piece, offset, len, std::data(buf));
+    ++cache->read_ahead_stats.disk_reads;
+
+    if (err != 0)
+    {
+        return err;
+    }
+
+    readAheadTrim(cache, n);
+
+    time_t const now = tr_time();
+    auto const* walk = std::data(buf);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        tr_block_index_t const block = first + i;
+        uint32_t const block_len = tr_torBlockCountBytes(tor, block);
+        auto const key = std::make_pair(tor->uniqueId, block);
+        auto& rb = cache->read_ahead[key];
+        rb.piece = tr_torBlockPiece(tor, block);
+        rb.offset = blockOffset(tor, block);
+        rb.data.assign(walk, walk + block_len);
+        rb.time = now;
+        rb.used = false;
+        rb.lru = cache->read_ahead_unread.insert(std::end(cache->read_ahead_unread), key);
+        walk += block_len;
+    }
+
+    cache->read_ahead_stats.blocks_loaded += n;
+    return 0;
+}
+
+/* ask the kernel to start reading blocks [first...first+n) */
+static int readAheadPrefetchRun(tr_torrent* tor, tr_block_index_t first, size_t n)
+{
+    uint32_t len = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        len += tr_torBlockCountBytes(tor, first + i);
+    }
+
+    return tr_ioPrefetch(tor, tr_torBlockPiece(tor, first), blockOffset(tor, first), len);
+}
+
+int tr_cacheReadAhead(tr_cache* cache, tr_torrent* torrent, tr_block_index_t* blocks, size_t n, size_t* budget)
+{
+    TR_ASSERT(tr_amInEventThread(torrent->session));
+    TR_ASSERT(budget != nullptr);
+
+    readAheadTrim(cache, 0);
+
+    /* only unread blocks are kept around on purpose,
+     * so that's what we can't make room for */
+    size_t const limit = readAheadLimit(cache);
+    size_t const room = limit > std::size(cache->read_ahead_unread) ? limit - std::size(cache->read_ahead_unread) : 0;
+
+    /* pick the uncached blocks with the highest priority */
+    auto seen = std::unordered_set<tr_block_index_t>{};
+    size_t n_load = 0;
+
+    for (size_t i = 0; i < n && n_load < room; ++i)
+    {
+        tr_block_index_t const block = blocks[i];
+
+        if (block >= torrent->blockCount || !seen.insert(block).second)
+        {
+            continue;
+        }
+
+        tr_piece_index_t const piece = tr_torBlockPiece(torrent, block);
+        uint32_t const offset = blockOffset(torrent, block);
+
+        if (!tr_torrentPieceIsComplete(torrent, piece) ||
+            cache->read_ahead.count(std::make_pair(torrent->uniqueId, block)) != 0 ||
+            findBlock(cache, torrent, piece, offset) != nullptr)
+        {
+            continue;
+        }
+
+        blocks[n_load++] = block;
+    }
+
+    /* load them in file order, coalescing neighbors */
+    std::sort(blocks, blocks + n_load);
+
+    int err = 0;
+
+    for (size_t i = 0; err == 0 && i < n_load;)
+    {
+        size_t run = 1;
+
+        while (i + run < n_load && run < READ_AHEAD_MAX_RUN_BLOCKS && blocks[i + run] == blocks[i] + run)
+        {
+            ++run;
+        }
+
+        /* load what the budget allows, and leave the rest of the run to the kernel */
+        size_t const load = std::min(run, *budget);
+
+        if (load > 0)
+        {
+            err = readAheadLoadRun(cache, torrent, blocks[i], load);
+            *budget -= load;
+        }
+
+        if (err == 0 && load < run)
+        {
+            err = readAheadPrefetchRun(torrent, blocks[i] + load, run - load);
+        }
+
+        i += run;
+    }
+
+    return err;
+}
+
+void tr_cacheGetReadAheadStats(tr_cache const* cache, tr_cache_read_ahead_stats* setme)
+{
+    *setme = cache->read_ahead_stats;
+}
+
+/***
+****
+***/
+
 static int cacheTrim(tr_cache* cache)
 {
     int err = 0;
@@ -232,6 +484,7 @@ static int cacheTrim(tr_cache* cache)
         tr_free(runs);
     }
 
+    readAheadTrim(cache, 0);
     return err;
 }
 
@@ -264,8 +517,7 @@ int64_t tr_cacheGetLimit(tr_cache const* cache)
 
 tr_cache* tr_cacheNew(int64_t max_bytes)
 {
-    tr_cache* cache = tr_new0(tr_cache, 1);
-    cache->blocks = {};
+    auto* cache = new tr_cache{};
     cache->max_bytes = max_bytes;
     cache->max_blocks = getMaxBlocks(max_bytes);
     return cache;
@@ -276,7 +528,7 @@ void tr_cacheFree(tr_cache* cache)
     TR_ASSERT(tr_ptrArrayEmpty(&cache->blocks));
 
     tr_ptrArrayDestruct(&cache->blocks, nullptr);
-    tr_free(cache);
+    delete cache;
 }
 
 /***
@@ -338,6 +590,8 @@ int tr_cacheWriteBlock(
 
     TR_ASSERT(cb->length == length);
 
+    readAheadDrop(cache, torrent, cb->block, cb->block);
+
     cb->time = tr_time();
 
     evbuffer_drain(cb->evbuf, evbuffer_get_length(cb->evbuf));
@@ -363,6 +617,23 @@ int tr_cacheReadBlock(
     if (cb != nullptr)
     {
         evbuffer_copyout(cb->evbuf, setme, len);
+        return 0;
+    }
+
+    auto const it = cache->read_ahead.find(std::make_pair(torrent->uniqueId, _tr_block(torrent, piece, offset)));
+
+    if (it != std::end(cache->read_ahead) && it->second.piece == piece && offset >= it->second.offset &&
+        offset + len <= it->second.offset + std::size(it->second.data))
+    {
+        auto& rb = it->second;
+        memcpy(setme, std::data(rb.data) + (offset - rb.offset), len);
+        ++cache->read_ahead_stats.hits;
+
+        if (!rb.used)
+        {
+            rb.used = true;
+            cache->read_ahead_read.splice(std::end(cache->read_ahead_read), cache->read_ahead_unread, rb.lru);
+        }
     }
     else
     {
@@ -372,12 +643,58 @@ int tr_cacheReadBlock(
     return err;
 }
 
+int tr_cacheReadBlocks(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme)
+{
+    TR_ASSERT(offset % torrent->blockSize == 0);
+
+    int err = 0;
+    uint32_t const end = offset + len;
+    uint32_t run = offset; /* where the current run of uncached blocks begins */
+
+    for (uint32_t o = offset; err == 0 && o < end;)
+    {
+        tr_block_index_t const block = _tr_block(torrent, piece, o);
+        uint32_t const n = std::min(end - o, tr_torBlockCountBytes(torrent, block));
+
+        if (findBlock(cache, torrent, piece, o) != nullptr ||
+            cache->read_ahead.count(std::make_pair(torrent->uniqueId, block)) != 0)
+        {
+            if (run < o)
+            {
+                err = tr_ioRead(torrent, piece, run, o - run, setme + (run - offset));
+            }
+
+            if (err == 0)
+            {
+                err = tr_cacheReadBlock(cache, torrent, piece, o, n, setme + (o - offset));
+            }
+
+            run = o + n;
+        }
+
+        o += n;
+    }
+
+    if (err == 0 && run < end)
+    {
+        err = tr_ioRead(torrent, piece, run, end - run, setme + (run - offset));
+    }
+
+    return err;
+}
+
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len)
 {
     int err = 0;
     struct cache_block const* const cb = findBlock(cache, torrent, piece, offset);
 
-    if (cb == nullptr)
+    if (cb == nullptr && cache->read_ahead.count(std::make_pair(torrent->uniqueId, _tr_block(torrent, piece, offset))) == 0)
     {
         err = tr_ioPrefetch(torrent, piece, offset, len);
     }
@@ -460,6 +777,8 @@ int tr_cacheFlushTorrent(tr_cache* cache, tr_torrent* torrent)
     int err = 0;
     int const pos = findBlockPos(cache, torrent, 0);
 
+    readAheadDrop(cache, torrent, 0, torrent->blockCount);
+
     /* flush out all the blocks in that torrent */
     while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
     {
@@ -49,8 +49,48 @@ int tr_cacheReadBlock(
     uint32_t len,
     uint8_t* setme);
 
+/**
+ * Like tr_cacheReadBlock(), but for a block-aligned span of several blocks
+ * in one piece. Cached blocks are copied from the cache, and each run of
+ * uncached blocks between them is read from disk with a single read.
+ */
+int tr_cacheReadBlocks(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme);
+
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len);
 
+/***
+****  Read-ahead
+***/
+
+struct tr_cache_read_ahead_stats
+{
+    uint64_t blocks_loaded; /* blocks read from disk ahead of demand */
+    uint64_t blocks_wasted; /* loaded blocks that were dropped before being read */
+    uint64_t disk_reads; /* the coalesced reads that loaded them */
+    uint64_t hits; /* block reads that were served from loaded blocks */
+};
+
+/**
+ * Load blocks into the cache so that tr_cacheReadBlock() won't need to
+ * touch the disk for them. `blocks' is in priority order and is sorted in
+ * place. Contiguous blocks are loaded with a single read. Blocks that are
+ * already cached or whose piece isn't complete are skipped, and the loaded
+ * blocks share the cache size limit with the unwritten ones.
+ *
+ * The reads block the caller, so at most `*budget' blocks are loaded and
+ * `*budget' is reduced by that many. The kernel is asked to prefetch the
+ * rest of the picked blocks instead.
+ */
+int tr_cacheReadAhead(tr_cache* cache, tr_torrent* torrent, tr_block_index_t* blocks, size_t n, size_t* budget);
+
+void tr_cacheGetReadAheadStats(tr_cache const* cache, tr_cache_read_ahead_stats* setme);
+
 /***
 ****
 ***/
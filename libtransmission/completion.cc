@@ -6,6 +6,8 @@
  *
  */
 
+#include <algorithm>
+
 #include "transmission.h"
 #include "completion.h"
 #include "torrent.h"
@@ -16,18 +18,108 @@
 ****
 ***/
 
+/* add or remove a block's bytes from the have-counters of the files it overlaps */
+static void fileBytesUpdate(tr_completion* cp, tr_block_index_t block, bool add)
+{
+    tr_torrent const* tor = cp->tor;
+    tr_info const* inf = &tor->info;
+    uint64_t const begin = (uint64_t)block * tor->blockSize;
+    uint64_t const end = begin + tr_torBlockCountBytes(tor, block);
+
+    /* find the first file in the block's piece that ends after this block begins */
+    auto const span = tr_torrentPieceFileSpan(tor, tr_torBlockPiece(tor, block));
+    tr_file const* const files_begin = inf->files;
+    tr_file const* const files_end = files_begin + inf->fileCount;
+    tr_file const* file = std::partition_point(
+        files_begin + span.first,
+        files_begin + span.last + 1,
+        [begin](tr_file const& f) { return f.offset + f.length <= begin; });
+
+    for (; file != files_end && file->offset < end; ++file)
+    {
+        uint64_t const overlap = std::min(end, file->offset + file->length) - std::max(begin, file->offset);
+        uint64_t* const have = &cp->fileBytesHave[file - files_begin];
+
+        if (add)
+        {
+            *have += overlap;
+        }
+        else
+        {
+            *have -= overlap;
+        }
+
+        TR_ASSERT(*have <= file->length);
+    }
+}
+
+/* recount every file's have-counter from the block bitfield */
+static void fileBytesRecount(tr_completion* cp)
+{
+    tr_torrent const* tor = cp->tor;
+
+    for (tr_file_index_t i = 0; i < tor->info.fileCount; ++i)
+    {
+        tr_file const* f = &tor->info.files[i];
+        uint64_t total = 0;
+
+        if (f->length != 0)
+        {
+            tr_block_index_t first;
+            tr_block_index_t last;
+            tr_torGetFileBlockRange(tor, i, &first, &last);
+
+            if (first == last)
+            {
+                if (tr_cpBlockIsComplete(cp, first))
+                {
+                    total = f->length;
+                }
+            }
+            else
+            {
+                /* the first block */
+                if (tr_cpBlockIsComplete(cp, first))
+                {
+                    total += tor->blockSize - f->offset % tor->blockSize;
+                }
+
+                /* the middle blocks */
+                if (first + 1 < last)
+                {
+                    uint64_t u = cp->blockBitfield->countRange(first + 1, last);
+                    u *= tor->blockSize;
+                    total += u;
+                }
+
+                /* the last block */
+                if (tr_cpBlockIsComplete(cp, last))
+                {
+                    total += f->offset + f->length - (uint64_t)tor->blockSize * last;
+                }
+            }
+        }
+
+        cp->fileBytesHave[i] = total;
+    }
+}
+
 static void tr_cpReset(tr_completion* cp)
 {
     cp->sizeNow = 0;
     cp->sizeWhenDoneIsDirty = true;
     cp->haveValidIsDirty = true;
     cp->blockBitfield->setHasNone();
+    std::fill_n(cp->fileBytesHave, cp->tor->info.fileCount, 0);
+    tr_torrentMarkStatDirty(cp->tor, TR_STAT_DIRTY_DESIRED_AVAILABLE);
 }
 
 void tr_cpConstruct(tr_completion* cp, tr_torrent* tor)
 {
     cp->tor = tor;
     cp->blockBitfield = new Bitfield(tor->blockCount);
+    tr_free(cp->fileBytesHave);
+    cp->fileBytesHave = tr_new0(uint64_t, tor->info.fileCount);
     tr_cpReset(cp);
 }
 
@@ -49,6 +141,8 @@ void tr_cpBlockInit(tr_completion* cp, Bitfield const& b)
     }
 
     TR_ASSERT(cp->sizeNow <= cp->tor->info.totalSize);
+
+    fileBytesRecount(cp);
 }
 
 /***
@@ -79,7 +173,9 @@ void tr_cpPieceRem(tr_completion* cp, tr_piece_index_t piece)
 {
     tr_block_index_t f;
     tr_block_index_t l;
-    tr_torrent const* tor = cp->tor;
+    tr_torrent* tor = cp->tor;
+    bool const wasComplete = tr_cpPieceIsComplete(cp, piece);
+    uint64_t removed = 0;
 
     tr_torGetPieceBlockRange(cp->tor, piece, &f, &l);
 
@@ -87,13 +183,26 @@ void tr_cpPieceRem(tr_completion* cp, tr_piece_index_t piece)
     {
         if (tr_cpBlockIsComplete(cp, i))
         {
-            cp->sizeNow -= tr_torBlockCountBytes(tor, i);
+            removed += tr_torBlockCountBytes(tor, i);
+            fileBytesUpdate(cp, i, false);
         }
     }
 
-    cp->haveValidIsDirty = true;
-    cp->sizeWhenDoneIsDirty = true;
+    cp->sizeNow -= removed;
+
+    /* keep the lazy fields current instead of forcing a full rescan */
+    if (!cp->haveValidIsDirty && wasComplete)
+    {
+        cp->haveValidLazy -= tr_torPieceCountBytes(tor, piece);
+    }
+
+    if (!cp->sizeWhenDoneIsDirty && tor->info.pieces[piece].dnd)
+    {
+        cp->sizeWhenDoneLazy -= removed;
+    }
+
     cp->blockBitfield->clearBitRange(f, l + 1);
+    tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_DESIRED_AVAILABLE);
 }
 
 void tr_cpPieceAdd(tr_completion* cp, tr_piece_index_t piece)
@@ -110,17 +219,29 @@ void tr_cpPieceAdd(tr_completion* cp, tr_piece_index_t piece)
 
 void tr_cpBlockAdd(tr_completion* cp, tr_block_index_t block)
 {
-    tr_torrent const* tor = cp->tor;
+    tr_torrent* tor = cp->tor;
 
     if (!tr_cpBlockIsComplete(cp, block))
     {
         tr_piece_index_t const piece = tr_torBlockPiece(cp->tor, block);
+        uint32_t const blockBytes = tr_torBlockCountBytes(tor, block);
 
         cp->blockBitfield->setBit(block);
-        cp->sizeNow += tr_torBlockCountBytes(tor, block);
+        cp->sizeNow += blockBytes;
+        fileBytesUpdate(cp, block, true);
+
+        /* keep the lazy fields current instead of forcing a full rescan */
+        if (!cp->haveValidIsDirty && tr_cpPieceIsComplete(cp, piece))
+        {
+            cp->haveValidLazy += tr_torPieceCountBytes(tor, piece);
+        }
+
+        if (!cp->sizeWhenDoneIsDirty && tor->info.pieces[piece].dnd)
+        {
+            cp->sizeWhenDoneLazy += blockBytes;
+        }
 
-        cp->haveValidIsDirty = true;
-        cp->sizeWhenDoneIsDirty = cp->sizeWhenDoneIsDirty || tor->info.pieces[piece].dnd;
+        tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_DESIRED_AVAILABLE);
     }
 }
 
@@ -287,17 +408,7 @@ size_t tr_cpMissingBytesInPiece(tr_completion const* cp, tr_piece_index_t piece)
 
 bool tr_cpFileIsComplete(tr_completion const* cp, tr_file_index_t i)
 {
-    if (cp->tor->info.files[i].length == 0)
-    {
-        return true;
-    }
-    else
-    {
-        tr_block_index_t f;
-        tr_block_index_t l;
-        tr_torGetFileBlockRange(cp->tor, i, &f, &l);
-        return cp->blockBitfield->countRange(f, l + 1) == (l + 1 - f);
-    }
+    return tr_cpFileBytesCompleted(cp, i) == cp->tor->info.files[i].length;
 }
 
 void* tr_cpCreatePieceBitfield(tr_completion const* cp, size_t* byte_count)
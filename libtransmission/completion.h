@@ -42,6 +42,10 @@ struct tr_completion
 
     /* number of bytes we want or have now. [0..sizeWhenDone] */
     uint64_t sizeNow;
+
+    /* number of bytes we have in each file, indexed by tr_file_index_t.
+       kept current as blocks are added and pieces are removed */
+    uint64_t* fileBytesHave;
 };
 
 /**
@@ -55,6 +59,7 @@ void tr_cpBlockInit(tr_completion* cp, Bitfield const& blocks);
 static inline void tr_cpDestruct(tr_completion* cp)
 {
     delete cp->blockBitfield;
+    tr_free(cp->fileBytesHave);
 }
 
 /**
@@ -124,6 +129,11 @@ static inline bool tr_cpBlockIsComplete(tr_completion const* cp, tr_block_index_
 
 bool tr_cpFileIsComplete(tr_completion const* cp, tr_file_index_t);
 
+constexpr uint64_t tr_cpFileBytesCompleted(tr_completion const* cp, tr_file_index_t i)
+{
+    return cp->fileBytesHave[i];
+}
+
 void* tr_cpCreatePieceBitfield(tr_completion const* cp, size_t* byte_count);
 
 constexpr void tr_cpInvalidateDND(tr_completion* cp)
@@ -8,6 +8,14 @@
 
 #include <string.h> /* memcpy(), memmove(), memset() */
 
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include <arc4.h>
 
 #include "transmission.h"
@@ -40,16 +48,26 @@ static uint8_t const dh_G[] = { 2 };
 ***
 **/
 
-static void ensureKeyExists(tr_crypto* crypto)
+static tr_dh_ctx_t makeKey(uint8_t* public_key)
 {
-    if (crypto->dh == nullptr)
-    {
-        size_t public_key_length;
+    size_t public_key_length;
+
+    tr_dh_ctx_t const dh = tr_dh_new(dh_P, sizeof(dh_P), dh_G, sizeof(dh_G));
+    tr_dh_make_key(dh, DH_PRIVKEY_LEN, public_key, &public_key_length);
+
+    TR_ASSERT(public_key_length == KEY_LEN);
 
-        crypto->dh = tr_dh_new(dh_P, sizeof(dh_P), dh_G, sizeof(dh_G));
-        tr_dh_make_key(crypto->dh, DH_PRIVKEY_LEN, crypto->myPublicKey, &public_key_length);
+    return dh;
+}
+
+static bool keyPoolTake(tr_dh_key_pool* pool, tr_dh_ctx_t* setme_dh, uint8_t* setme_public_key);
 
-        TR_ASSERT(public_key_length == KEY_LEN);
+static void ensureKeyExists(tr_crypto* crypto)
+{
+    if (crypto->dh == nullptr &&
+        (crypto->keyPool == nullptr || !keyPoolTake(crypto->keyPool, &crypto->dh, crypto->myPublicKey)))
+    {
+        crypto->dh = makeKey(crypto->myPublicKey);
     }
 }
 
@@ -76,7 +94,26 @@ void tr_cryptoDestruct(tr_crypto* crypto)
 bool tr_cryptoComputeSecret(tr_crypto* crypto, uint8_t const* peerPublicKey)
 {
     ensureKeyExists(crypto);
-    crypto->mySecret = tr_dh_agree(crypto->dh, peerPublicKey, KEY_LEN);
+    return tr_cryptoSetSecret(crypto, tr_cryptoAgree(crypto, peerPublicKey));
+}
+
+void tr_cryptoSetKeyPool(tr_crypto* crypto, tr_dh_key_pool* pool)
+{
+    crypto->keyPool = pool;
+}
+
+tr_dh_secret_t tr_cryptoAgree(tr_crypto const* crypto, uint8_t const* peerPublicKey)
+{
+    TR_ASSERT(crypto->dh != nullptr);
+
+    return tr_dh_agree(crypto->dh, peerPublicKey, KEY_LEN);
+}
+
+bool tr_cryptoSetSecret(tr_crypto* crypto, tr_dh_secret_t secret)
+{
+    TR_ASSERT(crypto->mySecret == nullptr);
+
+    crypto->mySecret = secret;
     return crypto->mySecret != nullptr;
 }
 
@@ -189,3 +226,124 @@ bool tr_cryptoHasTorrentHash(tr_crypto const* crypto)
 
     return crypto->torrentHashIsSet;
 }
+
+/***
+****  DH key pool
+***/
+
+struct tr_dh_key
+{
+    tr_dh_ctx_t dh;
+    std::array<uint8_t, KEY_LEN> public_key;
+};
+
+struct tr_dh_key_pool
+{
+    size_t size;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<tr_dh_key> keys;
+    std::deque<std::function<void()>> jobs;
+    tr_dh_key_pool_stats stats;
+    bool is_closing;
+
+    std::thread worker;
+};
+
+static void keyPoolWork(tr_dh_key_pool* pool)
+{
+    auto lock = std::unique_lock(pool->mutex);
+
+    for (;;)
+    {
+        pool->cv.wait(
+            lock,
+            [pool]() { return pool->is_closing || !std::empty(pool->jobs) || std::size(pool->keys) < pool->size; });
+
+        if (!std::empty(pool->jobs))
+        {
+            auto job = std::move(pool->jobs.front());
+            pool->jobs.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+        else if (pool->is_closing)
+        {
+            break;
+        }
+        else
+        {
+            lock.unlock();
+            auto key = tr_dh_key{};
+            key.dh = makeKey(std::data(key.public_key));
+            lock.lock();
+            pool->keys.push_back(key);
+        }
+    }
+}
+
+static bool keyPoolTake(tr_dh_key_pool* pool, tr_dh_ctx_t* setme_dh, uint8_t* setme_public_key)
+{
+    auto lock = std::unique_lock(pool->mutex);
+
+    if (std::empty(pool->keys))
+    {
+        ++pool->stats.misses;
+        return false;
+    }
+
+    auto const& key = pool->keys.back();
+    *setme_dh = key.dh;
+    memcpy(setme_public_key, std::data(key.public_key), KEY_LEN);
+    pool->keys.pop_back();
+    ++pool->stats.hits;
+
+    lock.unlock();
+    pool->cv.notify_one();
+    return true;
+}
+
+tr_dh_key_pool* tr_dhKeyPoolNew(size_t size)
+{
+    auto* pool = new tr_dh_key_pool{};
+    pool->size = size;
+    pool->keys.reserve(size);
+    pool->worker = std::thread(keyPoolWork, pool);
+    return pool;
+}
+
+void tr_dhKeyPoolFree(tr_dh_key_pool* pool)
+{
+    {
+        auto const lock = std::lock_guard(pool->mutex);
+        pool->is_closing = true;
+    }
+
+    pool->cv.notify_one();
+    pool->worker.join();
+
+    for (auto const& key : pool->keys)
+    {
+        tr_dh_free(key.dh);
+    }
+
+    delete pool;
+}
+
+void tr_dhKeyPoolRun(tr_dh_key_pool* pool, std::function<void()> job)
+{
+    {
+        auto const lock = std::lock_guard(pool->mutex);
+        pool->jobs.push_back(std::move(job));
+    }
+
+    pool->cv.notify_one();
+}
+
+void tr_dhKeyPoolGetStats(tr_dh_key_pool* pool, tr_dh_key_pool_stats* setme)
+{
+    auto const lock = std::lock_guard(pool->mutex);
+    *setme = pool->stats;
+}
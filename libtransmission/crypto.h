@@ -15,6 +15,7 @@
 #endif
 
 #include <inttypes.h>
+#include <functional>
 
 #include "crypto-utils.h"
 #include "tr-macros.h"
@@ -30,6 +31,8 @@ enum
     KEY_LEN = 96
 };
 
+struct tr_dh_key_pool;
+
 /** @brief Holds state information for encrypted peer communications */
 struct tr_crypto
 {
@@ -38,6 +41,7 @@ struct tr_crypto
     tr_dh_ctx_t dh;
     uint8_t myPublicKey[KEY_LEN];
     tr_dh_secret_t mySecret;
+    struct tr_dh_key_pool* keyPool;
     uint8_t torrentHash[SHA_DIGEST_LENGTH];
     bool isIncoming;
     bool torrentHashIsSet;
@@ -57,6 +61,20 @@ bool tr_cryptoHasTorrentHash(tr_crypto const* crypto);
 
 bool tr_cryptoComputeSecret(tr_crypto* crypto, uint8_t const* peerPublicKey);
 
+/** @brief take our key pair from `pool' instead of generating it when it's first needed */
+void tr_cryptoSetKeyPool(tr_crypto* crypto, struct tr_dh_key_pool* pool);
+
+/**
+ * @brief compute the secret shared with the peer without storing it.
+ *
+ * Our key pair must already exist. This only reads `crypto', so it can be
+ * called from another thread as long as `crypto' isn't changed meanwhile.
+ * The result is handed to tr_cryptoSetSecret().
+ */
+tr_dh_secret_t tr_cryptoAgree(tr_crypto const* crypto, uint8_t const* peerPublicKey);
+
+bool tr_cryptoSetSecret(tr_crypto* crypto, tr_dh_secret_t secret);
+
 uint8_t const* tr_cryptoGetMyPublicKey(tr_crypto const* crypto, int* setme_len);
 
 void tr_cryptoDecryptInit(tr_crypto* crypto);
@@ -75,6 +93,31 @@ bool tr_cryptoSecretKeySha1(
     size_t append_data_size,
     uint8_t* hash);
 
+/***
+****  DH key pool
+***/
+
+struct tr_dh_key_pool_stats
+{
+    uint64_t hits; /* key pairs that were ready when a handshake needed one */
+    uint64_t misses; /* key pairs that had to be generated on the spot */
+};
+
+/**
+ * @brief start a worker thread that keeps `size' key pairs ready.
+ *
+ * The worker also runs the jobs given to tr_dhKeyPoolRun(), which take
+ * priority over refilling the pool.
+ */
+tr_dh_key_pool* tr_dhKeyPoolNew(size_t size);
+
+/** @brief stop the worker after it has run the remaining jobs */
+void tr_dhKeyPoolFree(tr_dh_key_pool* pool);
+
+void tr_dhKeyPoolRun(tr_dh_key_pool* pool, std::function<void()> job);
+
+void tr_dhKeyPoolGetStats(tr_dh_key_pool* pool, tr_dh_key_pool_stats* setme);
+
 /* @} */
 
 #endif // TR_ENCRYPTION_H
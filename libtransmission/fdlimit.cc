@@ -9,7 +9,18 @@
 #include <algorithm>
 #include <cerrno>
 #include <cinttypes>
+#include <cstdint> /* SIZE_MAX */
 #include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#ifdef HAVE_POSIX_MADVISE
+#include <sys/mman.h> /* posix_madvise() */
+#endif
+
+#ifdef __linux__
+#include <sys/vfs.h> /* fstatfs() */
+#endif
 
 #include "transmission.h"
 #include "error.h"
@@ -122,6 +133,15 @@ struct tr_cached_file
     int torrent_id;
     tr_file_index_t file_index;
     time_t used_at;
+
+    /* see tr_fdFileGetMapping() */
+    void const* map;
+    uint64_t map_size;
+    bool map_failed;
+
+    /* see tr_fileset */
+    struct tr_cached_file* lru_prev;
+    struct tr_cached_file* lru_next;
 };
 
 static constexpr bool cached_file_is_open(struct tr_cached_file const* o)
@@ -264,32 +284,99 @@ FAIL:
 ****
 ***/
 
+/* The open files are kept in a fixed number of slots, indexed by
+ * (torrent id, file index) and threaded on an LRU list: the most recently
+ * used slot is at the head and closed slots are kept at the tail, so both
+ * lookups and finding a slot to (re)use are O(1). */
 struct tr_fileset
 {
-    struct tr_cached_file* begin;
-    struct tr_cached_file const* end;
+    std::vector<tr_cached_file> slots;
+    std::unordered_map<uint64_t, tr_cached_file*> index;
+    tr_cached_file* lru_head = nullptr;
+    tr_cached_file* lru_tail = nullptr;
+
+    /* how much address space the slots' read-only mappings use */
+    uint64_t mapped_bytes = 0;
+
+    tr_fd_file_cache_stats stats = {};
 };
 
+/* keep the mappings well inside the address space, particularly on 32-bit systems */
+static auto constexpr MaxMappedBytes = uint64_t{ sizeof(void*) >= 8 ? (uint64_t{ 16 } << 30) : (uint64_t{ 256 } << 20) };
+
+static constexpr uint64_t fileset_key(int torrent_id, tr_file_index_t i)
+{
+    return (uint64_t(uint32_t(torrent_id)) << 32) | i;
+}
+
+static void fileset_lru_unlink(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    (o->lru_prev != nullptr ? o->lru_prev->lru_next : set->lru_head) = o->lru_next;
+    (o->lru_next != nullptr ? o->lru_next->lru_prev : set->lru_tail) = o->lru_prev;
+    o->lru_prev = o->lru_next = nullptr;
+}
+
+static void fileset_lru_push_front(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    o->lru_prev = nullptr;
+    o->lru_next = set->lru_head;
+    (set->lru_head != nullptr ? set->lru_head->lru_prev : set->lru_tail) = o;
+    set->lru_head = o;
+}
+
+static void fileset_lru_push_back(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    o->lru_next = nullptr;
+    o->lru_prev = set->lru_tail;
+    (set->lru_tail != nullptr ? set->lru_tail->lru_next : set->lru_head) = o;
+    set->lru_tail = o;
+}
+
 static void fileset_construct(struct tr_fileset* set, int n)
 {
-    set->begin = tr_new(struct tr_cached_file, n);
-    set->end = set->begin + n;
+    set->slots.assign(n, tr_cached_file{ false, TR_BAD_SYS_FILE, 0, 0, 0, nullptr, 0, false, nullptr, nullptr });
+    set->index.clear();
+    set->index.reserve(n);
+    set->lru_head = set->lru_tail = nullptr;
 
-    for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+    for (auto& o : set->slots)
     {
-        *o = { false, TR_BAD_SYS_FILE, 0, 0, 0 };
+        fileset_lru_push_back(set, &o);
     }
 }
 
+static void fileset_unmap(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    if (o->map != nullptr)
+    {
+        tr_sys_file_unmap(o->map, o->map_size, nullptr);
+        set->mapped_bytes -= o->map_size;
+        o->map = nullptr;
+        o->map_size = 0;
+    }
+
+    o->map_failed = false;
+}
+
+/* close a slot's file and move the slot to the tail for reuse */
+static void fileset_close(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    set->index.erase(fileset_key(o->torrent_id, o->file_index));
+    fileset_unmap(set, o);
+    cached_file_close(o);
+    fileset_lru_unlink(set, o);
+    fileset_lru_push_back(set, o);
+}
+
 static void fileset_close_all(struct tr_fileset* set)
 {
     if (set != nullptr)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        for (auto& o : set->slots)
         {
-            if (cached_file_is_open(o))
+            if (cached_file_is_open(&o))
             {
-                cached_file_close(o);
+                fileset_close(set, &o);
             }
         }
     }
@@ -298,19 +385,20 @@ static void fileset_close_all(struct tr_fileset* set)
 static void fileset_destruct(struct tr_fileset* set)
 {
     fileset_close_all(set);
-    tr_free(set->begin);
-    set->end = set->begin = nullptr;
+    set->slots.clear();
+    set->index.clear();
+    set->lru_head = set->lru_tail = nullptr;
 }
 
 static void fileset_close_torrent(struct tr_fileset* set, int torrent_id)
 {
     if (set != nullptr)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        for (auto& o : set->slots)
         {
-            if (o->torrent_id == torrent_id && cached_file_is_open(o))
+            if (o.torrent_id == torrent_id && cached_file_is_open(&o))
             {
-                cached_file_close(o);
+                fileset_close(set, &o);
             }
         }
     }
@@ -320,46 +408,124 @@ static struct tr_cached_file* fileset_lookup(struct tr_fileset* set, int torrent
 {
     if (set != nullptr)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        auto const it = set->index.find(fileset_key(torrent_id, i));
+
+        if (it != std::end(set->index))
         {
-            if (torrent_id == o->torrent_id && i == o->file_index && cached_file_is_open(o))
-            {
-                return o;
-            }
+            TR_ASSERT(cached_file_is_open(it->second));
+            return it->second;
         }
     }
 
     return nullptr;
 }
 
+/* mark a slot as the most recently used */
+static void fileset_touch(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    o->used_at = tr_time();
+
+    if (set->lru_head != o)
+    {
+        fileset_lru_unlink(set, o);
+        fileset_lru_push_front(set, o);
+    }
+}
+
 static struct tr_cached_file* fileset_get_empty_slot(struct tr_fileset* set)
 {
-    struct tr_cached_file* cull = nullptr;
+    struct tr_cached_file* o = set != nullptr ? set->lru_tail : nullptr;
 
-    if (set != nullptr && set->begin != nullptr)
+    /* the tail is either an unused slot or the least recently used file */
+    if (o != nullptr && cached_file_is_open(o))
     {
-        /* try to find an unused slot */
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
-        {
-            if (!cached_file_is_open(o))
-            {
-                return o;
-            }
-        }
+        fileset_close(set, o);
+        ++set->stats.evictions;
+    }
+
+    return o;
+}
+
+/* A mapped file that shrinks underneath us raises SIGBUS on access, and
+ * network filesystems can do that at any time, so don't map files there. */
+static bool file_is_safe_to_map([[maybe_unused]] tr_sys_file_t fd)
+{
+#ifdef __linux__
+
+    struct statfs buf;
+
+    if (fstatfs(fd, &buf) != 0)
+    {
+        return false;
+    }
 
-        /* all slots are full... recycle the least recently used */
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+    switch ((unsigned long)buf.f_type)
+    {
+    case 0x6969: /* NFS */
+    case 0x517B: /* SMB */
+    case 0xFF534D42: /* CIFS */
+    case 0xFE534D42: /* SMB2 */
+    case 0x65735546: /* FUSE */
+    case 0x01021997: /* 9P */
+        return false;
+
+    default:
+        return true;
+    }
+
+#else
+
+    return true;
+
+#endif
+}
+
+static struct tr_cached_file* fileset_map(struct tr_fileset* set, struct tr_cached_file* o, uint64_t file_size)
+{
+    if (o->map != nullptr || o->map_failed)
+    {
+        return o->map != nullptr ? o : nullptr;
+    }
+
+    /* only map files whose size we expect, so that reads stay inside the file */
+    auto info = tr_sys_path_info{};
+    o->map_failed = file_size == 0 || file_size > MaxMappedBytes || file_size > SIZE_MAX ||
+        !tr_sys_file_get_info(o->fd, &info, nullptr) || info.size != file_size || !file_is_safe_to_map(o->fd);
+
+    if (o->map_failed)
+    {
+        return nullptr;
+    }
+
+    /* make room by unmapping the least recently used files */
+    for (struct tr_cached_file* it = set->lru_tail; it != nullptr && set->mapped_bytes + file_size > MaxMappedBytes;
+         it = it->lru_prev)
+    {
+        if (it != o && it->map != nullptr)
         {
-            if (cull == nullptr || o->used_at < cull->used_at)
-            {
-                cull = o;
-            }
+            fileset_unmap(set, it);
         }
+    }
 
-        cached_file_close(cull);
+    o->map = tr_sys_file_map_for_reading(o->fd, 0, file_size, nullptr);
+
+    if (o->map == nullptr)
+    {
+        o->map_failed = true;
+        return nullptr;
     }
 
-    return cull;
+    o->map_size = file_size;
+    set->mapped_bytes += file_size;
+
+#ifdef HAVE_POSIX_MADVISE
+
+    /* peers usually ask for a piece's blocks in order */
+    posix_madvise(const_cast<void*>(o->map), file_size, POSIX_MADV_SEQUENTIAL);
+
+#endif
+
+    return o;
 }
 
 /***
@@ -380,12 +546,9 @@ static void ensureSessionFdInfoExists(tr_session* session)
 
     if (session->fdInfo == nullptr)
     {
-        struct tr_fdInfo* i;
-        int const FILE_CACHE_SIZE = 32;
-
         /* Create the local file cache */
-        i = tr_new0(struct tr_fdInfo, 1);
-        fileset_construct(&i->fileset, FILE_CACHE_SIZE);
+        auto* const i = new tr_fdInfo{};
+        fileset_construct(&i->fileset, TR_DEFAULT_OPEN_FILE_LIMIT);
         session->fdInfo = i;
     }
 }
@@ -396,11 +559,44 @@ void tr_fdClose(tr_session* session)
     {
         struct tr_fdInfo* i = session->fdInfo;
         fileset_destruct(&i->fileset);
-        tr_free(i);
+        delete i;
         session->fdInfo = nullptr;
     }
 }
 
+void tr_fdSetFileLimit(tr_session* session, int limit)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    limit = std::max(limit, 1);
+    ensureSessionFdInfoExists(session);
+    struct tr_fileset* set = &session->fdInfo->fileset;
+
+    if (int(std::size(set->slots)) != limit)
+    {
+        fileset_destruct(set);
+        fileset_construct(set, limit);
+    }
+}
+
+int tr_fdGetFileLimit(tr_session* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    ensureSessionFdInfoExists(session);
+    return std::size(session->fdInfo->fileset.slots);
+}
+
+void tr_fdGetFileCacheStats(tr_session* session, tr_fd_file_cache_stats* setme)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    ensureSessionFdInfoExists(session);
+    struct tr_fileset const* set = &session->fdInfo->fileset;
+    *setme = set->stats;
+    setme->open_files = std::size(set->index);
+}
+
 /***
 ****
 ***/
@@ -418,9 +614,10 @@ static struct tr_fileset* get_fileset(tr_session* session)
 
 void tr_fdFileClose(tr_session* s, tr_torrent const* tor, tr_file_index_t i)
 {
+    struct tr_fileset* set = get_fileset(s);
     struct tr_cached_file* o;
 
-    if ((o = fileset_lookup(get_fileset(s), tr_torrentId(tor), i)) != nullptr)
+    if ((o = fileset_lookup(set, tr_torrentId(tor), i)) != nullptr)
     {
         /* flush writable files so that their mtimes will be
          * up-to-date when this function returns to the caller... */
@@ -429,20 +626,27 @@ void tr_fdFileClose(tr_session* s, tr_torrent const* tor, tr_file_index_t i)
             tr_sys_file_flush(o->fd, nullptr);
         }
 
-        cached_file_close(o);
+        fileset_close(set, o);
     }
 }
 
 tr_sys_file_t tr_fdFileGetCached(tr_session* s, int torrent_id, tr_file_index_t i, bool writable)
 {
-    struct tr_cached_file* o = fileset_lookup(get_fileset(s), torrent_id, i);
+    struct tr_fileset* set = get_fileset(s);
+    struct tr_cached_file* o = fileset_lookup(set, torrent_id, i);
 
     if (o == nullptr || (writable && !o->is_writable))
     {
+        if (set != nullptr)
+        {
+            ++set->stats.misses;
+        }
+
         return TR_BAD_SYS_FILE;
     }
 
-    o->used_at = tr_time();
+    ++set->stats.hits;
+    fileset_touch(set, o);
     return o->fd;
 }
 
@@ -460,6 +664,20 @@ bool tr_fdFileGetCachedMTime(tr_session* s, int torrent_id, tr_file_index_t i, t
     return success;
 }
 
+uint8_t const* tr_fdFileGetMapping(tr_session* s, int torrent_id, tr_file_index_t i, uint64_t file_size)
+{
+    struct tr_fileset* set = get_fileset(s);
+    struct tr_cached_file* o = fileset_lookup(set, torrent_id, i);
+
+    if (o == nullptr || (o = fileset_map(set, o, file_size)) == nullptr)
+    {
+        return nullptr;
+    }
+
+    fileset_touch(set, o);
+    return static_cast<uint8_t const*>(o->map);
+}
+
 void tr_fdTorrentClose(tr_session* session, int torrent_id)
 {
     TR_ASSERT(tr_sessionIsLocked(session));
@@ -482,13 +700,19 @@ tr_sys_file_t tr_fdFileCheckout(
 
     if (o != nullptr && writable && !o->is_writable)
     {
-        cached_file_close(o); /* close it so we can reopen in rw mode */
+        fileset_close(set, o); /* close it so we can reopen in rw mode */
     }
     else if (o == nullptr)
     {
         o = fileset_get_empty_slot(set);
     }
 
+    if (o == nullptr)
+    {
+        errno = EINVAL;
+        return TR_BAD_SYS_FILE;
+    }
+
     if (!cached_file_is_open(o))
     {
         int const err = cached_file_open(o, filename, writable, allocation, file_size);
@@ -506,7 +730,8 @@ tr_sys_file_t tr_fdFileCheckout(
     dbgmsg("checking out '%s'", filename);
     o->torrent_id = torrent_id;
     o->file_index = i;
-    o->used_at = tr_time();
+    set->index.insert_or_assign(fileset_key(torrent_id, i), o);
+    fileset_touch(set, o);
     return o->fd;
 }
 
@@ -51,6 +51,17 @@ tr_sys_file_t tr_fdFileCheckout(
 
 tr_sys_file_t tr_fdFileGetCached(tr_session* session, int torrent_id, tr_file_index_t file_num, bool doWrite);
 
+/**
+ * Get a read-only memory map of a cached file, mapping it if needed.
+ *
+ * Only maps files whose size on disk is exactly `file_size'. Mappings are
+ * released when the file is closed or evicted from the cache, or when
+ * the total mapped size would exceed a limit.
+ *
+ * @return the mapped file, or nullptr if it isn't cached or can't be mapped.
+ */
+uint8_t const* tr_fdFileGetMapping(tr_session* session, int torrent_id, tr_file_index_t file_num, uint64_t file_size);
+
 bool tr_fdFileGetCachedMTime(tr_session* session, int torrent_id, tr_file_index_t file_num, time_t* mtime);
 
 /**
@@ -68,6 +79,27 @@ void tr_fdFileClose(tr_session* session, tr_torrent const* tor, tr_file_index_t
  */
 void tr_fdTorrentClose(tr_session* session, int torrentId);
 
+/* the default number of local files to keep open */
+#define TR_DEFAULT_OPEN_FILE_LIMIT 32
+
+/**
+ * Set how many local files may be kept open at once.
+ * Changing the limit closes all the currently-open files.
+ */
+void tr_fdSetFileLimit(tr_session* session, int limit);
+
+int tr_fdGetFileLimit(tr_session* session);
+
+struct tr_fd_file_cache_stats
+{
+    uint64_t hits; /* tr_fdFileGetCached() found the file already open */
+    uint64_t misses; /* ...or didn't, and the caller had to open it */
+    uint64_t evictions; /* open files closed to make room for another */
+    size_t open_files;
+};
+
+void tr_fdGetFileCacheStats(tr_session* session, tr_fd_file_cache_stats* setme);
+
 /***********************************************************************
  * Sockets
  **********************************************************************/
@@ -9,20 +9,26 @@
 #include <errno.h>
 #include <string.h> /* strcmp(), strlen(), strncmp() */
 
+#include <chrono>
+
 #include <event2/buffer.h>
 #include <event2/event.h>
 
 #include "transmission.h"
 #include "clients.h"
+#include "crypto.h"
 #include "crypto-utils.h"
 #include "handshake.h"
 #include "log.h"
 #include "peer-io.h"
 #include "peer-mgr.h"
+#include "perf.h"
 #include "session.h"
+#include "timer-wheel.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "tr-dht.h"
+#include "trevent.h" /* tr_runInEventThread() */
 #include "utils.h"
 
 /* enable LibTransmission extension protocol */
@@ -101,10 +107,14 @@ enum handshake_state_t
     AWAITING_VC,
     AWAITING_CRYPTO_SELECT,
     AWAITING_PAD_D,
+    /* either, while the DH secret is computed in the background */
+    AWAITING_SECRET,
     /* */
     N_STATES
 };
 
+struct handshake_secret_job;
+
 struct tr_handshake
 {
     bool haveReadAnythingFromPeer;
@@ -123,7 +133,11 @@ struct tr_handshake
     uint8_t myReq1[SHA_DIGEST_LENGTH];
     handshakeDoneCB doneCB;
     void* doneUserData;
-    struct event* timeout_timer;
+    tr_timer timeout_timer;
+    struct handshake_secret_job* secretJob;
+    uint64_t startedAt;
+    uint64_t dhUsec;
+    bool didDh;
 };
 
 /**
@@ -155,7 +169,8 @@ static char const* getStateName(handshake_state_t const state)
         "awaiting yb", /* AWAITING_YB */
         "awaiting vc", /* AWAITING_VC */
         "awaiting crypto select", /* AWAITING_CRYPTO_SELECT */
-        "awaiting pad d" /* AWAITING_PAD_D */
+        "awaiting pad d", /* AWAITING_PAD_D */
+        "awaiting secret" /* AWAITING_SECRET */
     };
 
     return state < N_STATES ? state_strings[state] : "unknown state";
@@ -282,6 +297,135 @@ static handshake_parse_err_t parseHandshake(tr_handshake* handshake, struct evbu
     return HANDSHAKE_OK;
 }
 
+/***
+****
+****  DIFFIE-HELLMAN
+****
+***/
+
+static uint64_t usecSince(std::chrono::steady_clock::time_point begin)
+{
+    auto const elapsed = std::chrono::steady_clock::now() - begin;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+static uint8_t const* getMyPublicKey(tr_handshake* handshake, int* setme_len)
+{
+    auto const begin = std::chrono::steady_clock::now();
+    uint8_t const* const key = tr_cryptoGetMyPublicKey(handshake->crypto, setme_len);
+    handshake->dhUsec += usecSince(begin);
+    handshake->didDh = true;
+    return key;
+}
+
+using secretReadyFunc = ReadState (*)(tr_handshake* handshake);
+
+struct handshake_secret_job
+{
+    tr_session* session;
+    tr_handshake* handshake; /* nullptr if the handshake ended while we were busy */
+    tr_peerIo* io;
+    tr_crypto const* crypto;
+    uint8_t peerPublicKey[KEY_LEN];
+    tr_dh_secret_t secret;
+    secretReadyFunc onSecretReady;
+};
+
+static void onSecretComputed(void* vjob)
+{
+    auto* job = static_cast<struct handshake_secret_job*>(vjob);
+    tr_handshake* const handshake = job->handshake;
+
+    tr_sessionLock(job->session);
+
+    if (handshake == nullptr)
+    {
+        tr_dh_secret_free(job->secret);
+    }
+    else
+    {
+        handshake->secretJob = nullptr;
+
+        /* anything else the peer sent meanwhile is padding,
+         * which the next state skips when more data arrives */
+        if (tr_cryptoSetSecret(handshake->crypto, job->secret))
+        {
+            (*job->onSecretReady)(handshake);
+        }
+        else
+        {
+            tr_handshakeDone(handshake, false);
+        }
+    }
+
+    tr_peerIoUnref(job->io); /* balanced by the ref in computeSecret() */
+    tr_sessionUnlock(job->session);
+    delete job;
+}
+
+/* Compute the secret shared with the peer and then call onSecretReady().
+ * If the session has a DH worker, the modexp is done there and the
+ * handshake waits in AWAITING_SECRET meanwhile. */
+static ReadState computeSecret(tr_handshake* handshake, uint8_t const* peerPublicKey, secretReadyFunc onSecretReady)
+{
+    tr_dh_key_pool* const pool = handshake->session->dhKeyPool;
+
+    if (pool == nullptr)
+    {
+        auto const begin = std::chrono::steady_clock::now();
+        bool const ok = tr_cryptoComputeSecret(handshake->crypto, peerPublicKey);
+        handshake->dhUsec += usecSince(begin);
+        handshake->didDh = true;
+        return ok ? (*onSecretReady)(handshake) : tr_handshakeDone(handshake, false);
+    }
+
+    /* the worker needs our key pair to exist already */
+    int len;
+    getMyPublicKey(handshake, &len);
+
+    auto* job = new handshake_secret_job{};
+    job->session = handshake->session;
+    job->handshake = handshake;
+    job->io = handshake->io;
+    job->crypto = handshake->crypto;
+    memcpy(job->peerPublicKey, peerPublicKey, KEY_LEN);
+    job->onSecretReady = onSecretReady;
+
+    /* the io owns the tr_crypto that the worker reads */
+    tr_peerIoRef(job->io);
+
+    handshake->secretJob = job;
+    setState(handshake, AWAITING_SECRET);
+
+    tr_dhKeyPoolRun(
+        pool,
+        [job]()
+        {
+            job->secret = tr_cryptoAgree(job->crypto, job->peerPublicKey);
+            tr_runInEventThread(job->session, onSecretComputed, job);
+        });
+
+    return READ_LATER;
+}
+
+static void histogramAdd(uint64_t* histogram, uint64_t value)
+{
+    size_t bucket = 0;
+
+    while (value != 0 && bucket + 1 < TR_HANDSHAKE_HISTOGRAM_SIZE)
+    {
+        value >>= 1;
+        ++bucket;
+    }
+
+    ++histogram[bucket];
+}
+
+void tr_handshakeGetStats(tr_session const* session, tr_handshake_stats* setme)
+{
+    *setme = session->handshakeStats;
+}
+
 /***
 ****
 ****  OUTGOING CONNECTIONS
@@ -297,7 +441,7 @@ static void sendYa(tr_handshake* handshake)
     char* walk = outbuf;
 
     /* add our public key (Ya) */
-    public_key = tr_cryptoGetMyPublicKey(handshake->crypto, &len);
+    public_key = getMyPublicKey(handshake, &len);
     TR_ASSERT(len == KEY_LEN);
     TR_ASSERT(public_key != nullptr);
     memcpy(walk, public_key, len);
@@ -370,11 +514,12 @@ static void computeRequestHash(tr_handshake const* handshake, char const* name,
     tr_cryptoSecretKeySha1(handshake->crypto, name, 4, nullptr, 0, hash);
 }
 
+static ReadState sendCryptoProvide(tr_handshake* handshake);
+
 static ReadState readYb(tr_handshake* handshake, struct evbuffer* inbuf)
 {
     bool isEncrypted;
     uint8_t yb[KEY_LEN];
-    struct evbuffer* outbuf;
     size_t needlen = HANDSHAKE_NAME_LEN;
 
     if (evbuffer_get_length(inbuf) < needlen)
@@ -408,15 +553,14 @@ static ReadState readYb(tr_handshake* handshake, struct evbuffer* inbuf)
 
     /* compute the secret */
     evbuffer_remove(inbuf, yb, KEY_LEN);
+    return computeSecret(handshake, yb, sendCryptoProvide);
+}
 
-    if (!tr_cryptoComputeSecret(handshake->crypto, yb))
-    {
-        return tr_handshakeDone(handshake, false);
-    }
-
+static ReadState sendCryptoProvide(tr_handshake* handshake)
+{
     /* now send these: HASH('req1', S), HASH('req2', SKEY) xor HASH('req3', S),
      * ENCRYPT(VC, crypto_provide, len(PadC), PadC, len(IA)), ENCRYPT(IA) */
-    outbuf = evbuffer_new();
+    struct evbuffer* outbuf = evbuffer_new();
 
     /* HASH('req1', S) */
     {
@@ -723,13 +867,11 @@ static ReadState readPeerId(tr_handshake* handshake, struct evbuffer* inbuf)
     return tr_handshakeDone(handshake, !connected_to_self);
 }
 
+static ReadState sendYb(tr_handshake* handshake);
+
 static ReadState readYa(tr_handshake* handshake, struct evbuffer* inbuf)
 {
     uint8_t ya[KEY_LEN];
-    uint8_t* walk;
-    uint8_t outbuf[KEY_LEN + PadB_MAXLEN];
-    uint8_t const* myKey;
-    int len;
 
     dbgmsg(handshake, "in readYa... need %d, have %zu", KEY_LEN, evbuffer_get_length(inbuf));
 
@@ -740,18 +882,22 @@ static ReadState readYa(tr_handshake* handshake, struct evbuffer* inbuf)
 
     /* read the incoming peer's public key */
     evbuffer_remove(inbuf, ya, KEY_LEN);
+    return computeSecret(handshake, ya, sendYb);
+}
 
-    if (!tr_cryptoComputeSecret(handshake->crypto, ya))
-    {
-        return tr_handshakeDone(handshake, false);
-    }
+static ReadState sendYb(tr_handshake* handshake)
+{
+    uint8_t* walk;
+    uint8_t outbuf[KEY_LEN + PadB_MAXLEN];
+    uint8_t const* myKey;
+    int len;
 
     computeRequestHash(handshake, "req1", handshake->myReq1);
 
     /* send our public key to the peer */
     dbgmsg(handshake, "sending B->A: Diffie Hellman Yb, PadB");
     walk = outbuf;
-    myKey = tr_cryptoGetMyPublicKey(handshake->crypto, &len);
+    myKey = getMyPublicKey(handshake, &len);
     memcpy(walk, myKey, len);
     walk += len;
     len = tr_rand_int(PadB_MAXLEN);
@@ -1004,6 +1150,7 @@ static ReadState canRead(tr_peerIo* io, void* vhandshake, size_t* piece)
 
     ReadState ret;
     auto* handshake = static_cast<tr_handshake*>(vhandshake);
+    auto const perf = tr_perf_scope{ handshake->session, TR_PERF_HANDSHAKE };
 
     struct evbuffer* inbuf = tr_peerIoGetReadBuffer(io);
     bool readyForMore = true;
@@ -1065,6 +1212,10 @@ static ReadState canRead(tr_peerIo* io, void* vhandshake, size_t* piece)
             ret = readPadD(handshake, inbuf);
             break;
 
+        case AWAITING_SECRET:
+            ret = READ_LATER;
+            break;
+
         default:
 #ifdef TR_ENABLE_ASSERTS
             TR_ASSERT_MSG(false, "unhandled handshake state %d", (int)handshake->state);
@@ -1111,12 +1262,17 @@ static bool fireDoneFunc(tr_handshake* handshake, bool isConnected)
 
 static void tr_handshakeFree(tr_handshake* handshake)
 {
+    if (handshake->secretJob != nullptr)
+    {
+        handshake->secretJob->handshake = nullptr;
+    }
+
     if (handshake->io != nullptr)
     {
         tr_peerIoUnref(handshake->io); /* balanced by the ref in tr_handshakeNew */
     }
 
-    event_free(handshake->timeout_timer);
+    tr_sessionRemoveTimer(handshake->session, &handshake->timeout_timer);
     tr_free(handshake);
 }
 
@@ -1125,6 +1281,19 @@ static ReadState tr_handshakeDone(tr_handshake* handshake, bool isOK)
     bool success;
 
     dbgmsg(handshake, "handshakeDone: %s", isOK ? "connected" : "aborting");
+
+    tr_handshake_stats* const stats = &handshake->session->handshakeStats;
+
+    if (isOK)
+    {
+        histogramAdd(stats->duration_msec, tr_time_msec() - handshake->startedAt);
+    }
+
+    if (handshake->didDh)
+    {
+        histogramAdd(stats->dh_usec, handshake->dhUsec);
+    }
+
     tr_peerIoSetIOFuncs(handshake->io, nullptr, nullptr, nullptr, nullptr);
 
     success = fireDoneFunc(handshake, isOK);
@@ -1203,7 +1372,7 @@ static void gotError(tr_peerIo* io, short what, void* vhandshake)
 ***
 **/
 
-static void handshakeTimeout([[maybe_unused]] evutil_socket_t s, [[maybe_unused]] short type, void* handshake)
+static void handshakeTimeout(void* handshake)
 {
     tr_handshakeAbort(static_cast<tr_handshake*>(handshake));
 }
@@ -1220,8 +1389,10 @@ tr_handshake* tr_handshakeNew(tr_peerIo* io, tr_encryption_mode encryptionMode,
     handshake->doneCB = doneCB;
     handshake->doneUserData = doneUserData;
     handshake->session = session;
-    handshake->timeout_timer = evtimer_new(session->event_base, handshakeTimeout, handshake);
-    tr_timerAdd(handshake->timeout_timer, HANDSHAKE_TIMEOUT_SEC, 0);
+    handshake->startedAt = tr_time_msec();
+    handshake->timeout_timer.callback = handshakeTimeout;
+    handshake->timeout_timer.user_data = handshake;
+    tr_sessionAddTimer(session, &handshake->timeout_timer, HANDSHAKE_TIMEOUT_SEC * 1000);
 
     tr_peerIoRef(io); /* balanced by the unref in tr_handshakeFree */
     tr_peerIoSetIOFuncs(handshake->io, canRead, nullptr, gotError, handshake);
@@ -42,4 +42,23 @@ void tr_handshakeAbort(tr_handshake* handshake);
 
 tr_peerIo* tr_handshakeStealIO(tr_handshake* handshake);
 
+enum
+{
+    TR_HANDSHAKE_HISTOGRAM_SIZE = 16
+};
+
+/* Log2 histograms: bucket 0 counts zeroes, bucket i counts values in
+   [2^(i-1), 2^i), and the last bucket also counts everything bigger. */
+struct tr_handshake_stats
+{
+    /* how long each successful handshake took, in msec */
+    uint64_t duration_msec[TR_HANDSHAKE_HISTOGRAM_SIZE];
+
+    /* how long each encrypted handshake kept the event thread busy
+       with Diffie-Hellman math, in usec */
+    uint64_t dh_usec[TR_HANDSHAKE_HISTOGRAM_SIZE];
+};
+
+void tr_handshakeGetStats(tr_session const* session, tr_handshake_stats* setme);
+
 /** @} */
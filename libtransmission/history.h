@@ -15,12 +15,16 @@
 #include <array>
 #include <cstddef> // size_t
 #include <ctime> // time_t
+#include <memory> // std::unique_ptr
 #include <numeric> // std::accumulate
 
 /**
  * A short-term memory object that remembers how many times something
  * happened over the last N seconds. tr_peer uses it to count how many
  * bytes transferred to estimate the speed over the last N seconds.
+ *
+ * Every peer has several of these and most of them never record
+ * anything, so the slices aren't allocated until the first add().
  */
 class tr_recentHistory
 {
@@ -32,13 +36,20 @@ public:
      */
     void add(time_t now, size_t n)
     {
-        if (slices[newest].time != now)
+        if (!slices)
+        {
+            slices = std::make_unique<slices_t>();
+        }
+
+        auto& s = *slices;
+
+        if (s[newest].time != now)
         {
             newest = (newest + 1) % TR_RECENT_HISTORY_PERIOD_SEC;
-            slices[newest].time = now;
+            s[newest].time = now;
         }
 
-        slices[newest].n += n;
+        s[newest].n += n;
     }
 
     /**
@@ -48,11 +59,16 @@ public:
      */
     size_t count(time_t now, unsigned int age_sec) const
     {
+        if (!slices)
+        {
+            return 0;
+        }
+
         time_t const oldest = now - age_sec;
 
         return std::accumulate(
-            std::begin(slices),
-            std::end(slices),
+            std::begin(*slices),
+            std::end(*slices),
             size_t{ 0 },
             [&oldest](size_t sum, auto const& slice) { return slice.time >= oldest ? sum + slice.n : sum; });
     }
@@ -68,5 +84,7 @@ private:
         time_t time = 0;
     };
 
-    std::array<slice_t, TR_RECENT_HISTORY_PERIOD_SEC> slices = {};
+    using slices_t = std::array<slice_t, TR_RECENT_HISTORY_PERIOD_SEC>;
+
+    std::unique_ptr<slices_t> slices;
 };
@@ -8,8 +8,8 @@
 
 #include <algorithm>
 #include <cerrno>
-#include <cstdlib> /* bsearch() */
-#include <cstring> /* memcmp() */
+#include <cstdlib> /* abort() */
+#include <cstring> /* memcmp(), memcpy() */
 
 #include "transmission.h"
 #include "cache.h" /* tr_cacheReadBlock() */
@@ -20,6 +20,8 @@
 #include "inout.h"
 #include "log.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
+#include "perf.h"
+#include "session.h"
 #include "stats.h" /* tr_statsFileCreated() */
 #include "torrent.h"
 #include "tr-assert.h"
@@ -122,7 +124,17 @@ static int readOrWriteBytes(
     {
         tr_error* error = nullptr;
 
-        if (ioMode == TR_IO_READ)
+        /* complete files are no longer written to, so we can read them from a memory map */
+        uint8_t const* const map = ioMode == TR_IO_READ && session->isMmapEnabled &&
+                tr_cpFileIsComplete(&tor->completion, fileIndex) ?
+            tr_fdFileGetMapping(session, tr_torrentId(tor), fileIndex, file->length) :
+            nullptr;
+
+        if (map != nullptr)
+        {
+            memcpy(buf, map + fileOffset, buflen);
+        }
+        else if (ioMode == TR_IO_READ)
         {
             if (!tr_sys_file_read_at(fd, buf, buflen, fileOffset, nullptr, &error))
             {
@@ -153,24 +165,6 @@ static int readOrWriteBytes(
     return err;
 }
 
-static int compareOffsetToFile(void const* a, void const* b)
-{
-    auto const offset = *static_cast<uint64_t const*>(a);
-    auto const* file = static_cast<tr_file const*>(b);
-
-    if (offset < file->offset)
-    {
-        return -1;
-    }
-
-    if (offset >= file->offset + file->length)
-    {
-        return 1;
-    }
-
-    return 0;
-}
-
 void tr_ioFindFileLocation(
     tr_torrent const* tor,
     tr_piece_index_t pieceIndex,
@@ -183,9 +177,13 @@ void tr_ioFindFileLocation(
     uint64_t const offset = tr_pieceOffset(tor, pieceIndex, pieceOffset, 0);
     TR_ASSERT(offset < tor->info.totalSize);
 
-    auto const* file = static_cast<tr_file const*>(
-        bsearch(&offset, tor->info.files, tor->info.fileCount, sizeof(tr_file), compareOffsetToFile));
-    TR_ASSERT(file != nullptr);
+    /* only the files in this piece's span can hold the byte */
+    auto const span = tr_torrentPieceFileSpan(tor, pieceIndex);
+    tr_file const* const file = std::partition_point(
+        tor->info.files + span.first,
+        tor->info.files + span.last + 1,
+        [offset](tr_file const& f) { return f.offset + f.length <= offset; });
+    TR_ASSERT(file <= tor->info.files + span.last);
 
     *fileIndex = file - tor->info.files;
     *fileOffset = offset - file->offset;
@@ -239,6 +237,7 @@ static int readOrWritePiece(
 
 int tr_ioRead(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint8_t* buf)
 {
+    auto const perf = tr_perf_scope{ tor->session, TR_PERF_DISK_READ };
     return readOrWritePiece(tor, TR_IO_READ, pieceIndex, begin, buf, len);
 }
 
@@ -249,6 +248,7 @@ int tr_ioPrefetch(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin,
 
 int tr_ioWrite(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint8_t const* buf)
 {
+    auto const perf = tr_perf_scope{ tor->session, TR_PERF_DISK_WRITE };
     return readOrWritePiece(tor, TR_IO_WRITE, pieceIndex, begin, (uint8_t*)buf, len);
 }
 
@@ -268,6 +268,7 @@ static bool recalculateHash(tr_torrent* tor, tr_piece_index_t pieceIndex, uint8_
     size_t const buflen = tor->blockSize;
     void* const buffer = tr_malloc(buflen);
     tr_sha1_ctx_t sha;
+    auto hash_usec = uint64_t{};
 
     TR_ASSERT(buffer != nullptr);
     TR_ASSERT(buflen > 0);
@@ -287,13 +288,20 @@ static bool recalculateHash(tr_torrent* tor, tr_piece_index_t pieceIndex, uint8_
             break;
         }
 
+        auto const hash_begin = tr_perfNowUsec();
         tr_sha1_update(sha, buffer, len);
+        hash_usec += tr_perfNowUsec() - hash_begin;
         offset += len;
         bytesLeft -= len;
     }
 
     tr_sha1_final(sha, success ? setme : nullptr);
 
+    if (success)
+    {
+        tr_perfAdd(tor->session, TR_PERF_HASH, hash_usec);
+    }
+
     tr_free(buffer);
     return success;
 }
@@ -301,6 +309,7 @@ static bool recalculateHash(tr_torrent* tor, tr_piece_index_t pieceIndex, uint8_
 bool tr_ioTestPiece(tr_torrent* tor, tr_piece_index_t piece)
 {
     uint8_t hash[SHA_DIGEST_LENGTH];
+    uint8_t const* const expected = tr_torrentPieceHash(tor, piece);
 
-    return recalculateHash(tor, piece, hash) && memcmp(hash, tor->info.pieces[piece].hash, SHA_DIGEST_LENGTH) == 0;
+    return expected != nullptr && recalculateHash(tor, piece, hash) && memcmp(hash, expected, SHA_DIGEST_LENGTH) == 0;
 }
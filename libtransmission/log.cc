@@ -24,6 +24,8 @@ static bool myQueueEnabled = false;
 static tr_log_message* myQueue = nullptr;
 static tr_log_message** myQueueTail = &myQueue;
 static int myQueueLength = 0;
+static tr_log_listener_func myListener = nullptr;
+static void* myListenerUserData = nullptr;
 
 #ifndef _WIN32
 
@@ -101,6 +103,14 @@ bool tr_logGetQueueEnabled(void)
     return myQueueEnabled;
 }
 
+void tr_logSetListener(tr_log_listener_func func, void* user_data)
+{
+    tr_lockLock(getMessageLock());
+    myListener = func;
+    myListenerUserData = user_data;
+    tr_lockUnlock(getMessageLock());
+}
+
 tr_log_message* tr_logGetQueue(void)
 {
     tr_log_message* ret;
@@ -245,6 +255,11 @@ void tr_logAddMessage(char const* file, int line, tr_log_level level, char const
 
     if (!tr_str_is_empty(buf))
     {
+        if (myListener != nullptr && level <= TR_LOG_INFO)
+        {
+            (*myListener)(level, name, buf, myListenerUserData);
+        }
+
         if (tr_logGetQueueEnabled())
         {
             tr_log_message* newmsg;
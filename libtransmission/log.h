@@ -53,6 +53,12 @@ void tr_logAddMessage(char const* file, int line, tr_log_level level, char const
 
 tr_sys_file_t tr_logGetFile(void);
 
+/* called for each error or info message, from whichever thread logged it,
+ * while the message lock is held. Pass nullptr to remove the listener. */
+using tr_log_listener_func = void (*)(tr_log_level level, char const* name, char const* message, void* user_data);
+
+void tr_logSetListener(tr_log_listener_func func, void* user_data);
+
 /** @brief return true if deep logging has been enabled by the user, false otherwise */
 bool tr_logGetDeepEnabled(void);
 
@@ -8,8 +8,13 @@
 
 #include <algorithm>
 #include <cerrno>
+#include <condition_variable>
 #include <cstdlib> /* qsort */
 #include <cstring> /* strcmp, strlen */
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <event2/util.h> /* evutil_ascii_strcasecmp() */
 
@@ -188,6 +193,7 @@ tr_metainfo_builder* tr_metaInfoBuilderCreate(char const* topFileArg)
     qsort(ret->files, ret->fileCount, sizeof(tr_metainfo_builder_file), builderFileCompare);
 
     tr_metaInfoBuilderSetPieceSize(ret, bestPieceSize(ret->totalSize));
+    tr_metaInfoBuilderSetThreadCount(ret, 0);
 
     return ret;
 }
@@ -222,6 +228,16 @@ bool tr_metaInfoBuilderSetPieceSize(tr_metainfo_builder* b, uint32_t bytes)
     return true;
 }
 
+void tr_metaInfoBuilderSetThreadCount(tr_metainfo_builder* b, uint32_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(1U, std::thread::hardware_concurrency());
+    }
+
+    b->threadCount = threadCount;
+}
+
 void tr_metaInfoBuilderFree(tr_metainfo_builder* builder)
 {
     if (builder != nullptr)
@@ -250,80 +266,207 @@ void tr_metaInfoBuilderFree(tr_metainfo_builder* builder)
 *****
 ****/
 
-static uint8_t* getHashInfo(tr_metainfo_builder* b)
+/* reads the builder's files back-to-back as one stream, a piece at a time */
+struct piece_reader
+{
+    tr_metainfo_builder* b;
+    uint32_t fileIndex;
+    uint64_t off;
+    uint64_t totalRemain;
+    tr_sys_file_t fd;
+};
+
+static bool readerFail(piece_reader* r, tr_error* error, int fallback_errno)
+{
+    tr_metainfo_builder* b = r->b;
+
+    b->my_errno = error != nullptr ? error->code : fallback_errno;
+    tr_strlcpy(b->errfile, b->files[r->fileIndex].filename, sizeof(b->errfile));
+    b->result = TR_MAKEMETA_IO_READ;
+    tr_error_free(error);
+    return false;
+}
+
+static bool readerOpen(piece_reader* r)
 {
-    uint32_t fileIndex = 0;
-    uint8_t* ret = tr_new0(uint8_t, SHA_DIGEST_LENGTH * b->pieceCount);
-    uint8_t* walk = ret;
-    uint64_t off = 0;
     tr_error* error = nullptr;
 
-    if (b->totalSize == 0)
+    r->fd = tr_sys_file_open(r->b->files[r->fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
+
+    return r->fd != TR_BAD_SYS_FILE || readerFail(r, error, EIO);
+}
+
+static void readerClose(piece_reader* r)
+{
+    if (r->fd != TR_BAD_SYS_FILE)
     {
-        return ret;
+        tr_sys_file_close(r->fd, nullptr);
+        r->fd = TR_BAD_SYS_FILE;
     }
+}
 
-    auto* const buf = static_cast<uint8_t*>(tr_malloc(b->pieceSize));
-    b->pieceIndex = 0;
-    uint64_t totalRemain = b->totalSize;
+/* read the next piece into `buf', which must hold at least b->pieceSize bytes */
+static bool readerNextPiece(piece_reader* r, uint8_t* buf, uint32_t* setme_len)
+{
+    tr_metainfo_builder const* b = r->b;
+    uint8_t* bufptr = buf;
+    uint32_t const thisPieceSize = std::min(uint64_t{ b->pieceSize }, r->totalRemain);
+    uint64_t leftInPiece = thisPieceSize;
 
-    tr_sys_file_t fd = tr_sys_file_open(b->files[fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
-    if (fd == TR_BAD_SYS_FILE)
+    while (leftInPiece != 0)
     {
-        b->my_errno = error->code;
-        tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
-        b->result = TR_MAKEMETA_IO_READ;
-        tr_free(buf);
-        tr_free(ret);
-        tr_error_free(error);
-        return nullptr;
+        if (r->fd == TR_BAD_SYS_FILE && !readerOpen(r))
+        {
+            return false;
+        }
+
+        uint64_t const n_this_pass = std::min(b->files[r->fileIndex].size - r->off, leftInPiece);
+        uint64_t n_read = 0;
+        tr_error* error = nullptr;
+
+        if (n_this_pass != 0 && (!tr_sys_file_read(r->fd, bufptr, n_this_pass, &n_read, &error) || n_read == 0))
+        {
+            /* the file is shorter than when we scanned it, or unreadable */
+            return readerFail(r, error, EIO);
+        }
+
+        bufptr += n_read;
+        r->off += n_read;
+        leftInPiece -= n_read;
+
+        if (r->off == b->files[r->fileIndex].size)
+        {
+            r->off = 0;
+            readerClose(r);
+            ++r->fileIndex;
+        }
     }
 
-    while (totalRemain != 0)
+    TR_ASSERT(bufptr - buf == (int)thisPieceSize);
+    r->totalRemain -= thisPieceSize;
+    *setme_len = thisPieceSize;
+    return true;
+}
+
+static bool hashPiecesSerially(piece_reader* r, uint8_t* hashes)
+{
+    tr_metainfo_builder* b = r->b;
+    auto* const buf = static_cast<uint8_t*>(tr_malloc(b->pieceSize));
+    bool ok = true;
+
+    while (r->totalRemain != 0)
     {
         TR_ASSERT(b->pieceIndex < b->pieceCount);
 
-        uint8_t* bufptr = buf;
-        uint32_t const thisPieceSize = std::min(uint64_t{ b->pieceSize }, totalRemain);
-        uint64_t leftInPiece = thisPieceSize;
+        uint32_t len = 0;
 
-        while (leftInPiece != 0)
+        if (!readerNextPiece(r, buf, &len))
         {
-            uint64_t const n_this_pass = std::min(b->files[fileIndex].size - off, leftInPiece);
-            uint64_t n_read = 0;
-            (void)tr_sys_file_read(fd, bufptr, n_this_pass, &n_read, nullptr);
-            bufptr += n_read;
-            off += n_read;
-            leftInPiece -= n_read;
-
-            if (off == b->files[fileIndex].size)
-            {
-                off = 0;
-                tr_sys_file_close(fd, nullptr);
-                fd = TR_BAD_SYS_FILE;
+            ok = false;
+            break;
+        }
 
-                if (++fileIndex < b->fileCount)
-                {
-                    fd = tr_sys_file_open(b->files[fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
-
-                    if (fd == TR_BAD_SYS_FILE)
-                    {
-                        b->my_errno = error->code;
-                        tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
-                        b->result = TR_MAKEMETA_IO_READ;
-                        tr_free(buf);
-                        tr_free(ret);
-                        tr_error_free(error);
-                        return nullptr;
-                    }
-                }
+        tr_sha1(hashes + SHA_DIGEST_LENGTH * b->pieceIndex, buf, (int)len, nullptr);
+
+        if (b->abortFlag)
+        {
+            b->result = TR_MAKEMETA_CANCELLED;
+            break;
+        }
+
+        ++b->pieceIndex;
+    }
+
+    tr_free(buf);
+    return ok;
+}
+
+/* the most memory hashPiecesInParallel() will use for piece buffers */
+static auto constexpr ParallelHashBufferBytes = size_t{ 64 * 1024 * 1024 };
+
+/**
+ * The calling thread streams pieces into a small ring of buffers while
+ * b->threadCount workers hash them. Pieces finish out of order, but each
+ * worker writes its digest straight into that piece's slot in `hashes'.
+ * b->pieceIndex counts the pieces hashed so far, as in the serial path.
+ *
+ * There are never more workers than CPU cores, and the ring never takes
+ * more than ParallelHashBufferBytes, so big pieces get fewer buffers.
+ */
+static bool hashPiecesInParallel(piece_reader* r, uint8_t* hashes)
+{
+    struct piece_job
+    {
+        size_t buffer;
+        tr_piece_index_t piece;
+        uint32_t len;
+    };
+
+    tr_metainfo_builder* b = r->b;
+    uint32_t const coreCount = std::max(1U, std::thread::hardware_concurrency());
+    uint32_t workerCount = std::min({ b->threadCount, b->pieceCount, coreCount });
+
+    /* two buffers per worker keeps them busy while the next piece is read,
+       but the reader needs one and each worker needs one at the very least */
+    size_t const maxBufferCount = std::max(size_t{ 2 }, ParallelHashBufferBytes / b->pieceSize);
+    size_t const bufferCount = std::min(size_t{ workerCount } * 2, maxBufferCount);
+    workerCount = std::min(workerCount, uint32_t(bufferCount - 1));
+
+    auto buffers = std::vector<std::vector<uint8_t>>(bufferCount, std::vector<uint8_t>(b->pieceSize));
+    auto freeBuffers = std::vector<size_t>{};
+    auto jobs = std::deque<piece_job>{};
+    auto mutex = std::mutex{};
+    auto cv = std::condition_variable{};
+    bool readerDone = false;
+    uint32_t hashed = 0;
+
+    for (size_t i = 0; i < buffers.size(); ++i)
+    {
+        freeBuffers.push_back(i);
+    }
+
+    auto const worker = [&]()
+    {
+        auto lock = std::unique_lock(mutex);
+
+        for (;;)
+        {
+            cv.wait(lock, [&]() { return !jobs.empty() || readerDone; });
+
+            if (jobs.empty())
+            {
+                return;
             }
+
+            piece_job const job = jobs.front();
+            jobs.pop_front();
+
+            lock.unlock();
+            tr_sha1(hashes + SHA_DIGEST_LENGTH * job.piece, std::data(buffers[job.buffer]), (int)job.len, nullptr);
+            lock.lock();
+
+            freeBuffers.push_back(job.buffer);
+            b->pieceIndex = ++hashed;
+            cv.notify_all();
         }
+    };
+
+    auto workers = std::vector<std::thread>{};
 
-        TR_ASSERT(bufptr - buf == (int)thisPieceSize);
-        TR_ASSERT(leftInPiece == 0);
-        tr_sha1(walk, buf, (int)thisPieceSize, nullptr);
-        walk += SHA_DIGEST_LENGTH;
+    for (uint32_t i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back(worker);
+    }
+
+    bool ok = true;
+
+    for (tr_piece_index_t piece = 0; r->totalRemain != 0; ++piece)
+    {
+        auto lock = std::unique_lock(mutex);
+        cv.wait(lock, [&]() { return !freeBuffers.empty(); });
+        size_t const buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+        lock.unlock();
 
         if (b->abortFlag)
         {
@@ -331,19 +474,59 @@ static uint8_t* getHashInfo(tr_metainfo_builder* b)
             break;
         }
 
-        totalRemain -= thisPieceSize;
-        ++b->pieceIndex;
+        uint32_t len = 0;
+
+        if (!readerNextPiece(r, std::data(buffers[buffer]), &len))
+        {
+            ok = false;
+            break;
+        }
+
+        lock.lock();
+        jobs.push_back({ buffer, piece, len });
+        cv.notify_all();
     }
 
-    TR_ASSERT(b->abortFlag || walk - ret == (int)(SHA_DIGEST_LENGTH * b->pieceCount));
-    TR_ASSERT(b->abortFlag || !totalRemain);
+    {
+        auto const lock = std::lock_guard(mutex);
+        readerDone = true;
+        cv.notify_all();
+    }
 
-    if (fd != TR_BAD_SYS_FILE)
+    for (auto& thread : workers)
     {
-        tr_sys_file_close(fd, nullptr);
+        thread.join();
+    }
+
+    TR_ASSERT(!ok || b->abortFlag || hashed == b->pieceCount);
+    return ok;
+}
+
+static uint8_t* getHashInfo(tr_metainfo_builder* b)
+{
+    uint8_t* ret = tr_new0(uint8_t, SHA_DIGEST_LENGTH * b->pieceCount);
+
+    if (b->totalSize == 0)
+    {
+        return ret;
+    }
+
+    b->pieceIndex = 0;
+
+    auto reader = piece_reader{ b, 0, 0, b->totalSize, TR_BAD_SYS_FILE };
+    bool const ok = b->threadCount > 1 && b->pieceCount > 1 ? hashPiecesInParallel(&reader, ret) :
+                                                              hashPiecesSerially(&reader, ret);
+
+    readerClose(&reader);
+
+    TR_ASSERT(!ok || b->abortFlag || reader.totalRemain == 0);
+
+    if (!ok)
+    {
+        tr_free(ret);
+        ret = nullptr;
     }
 
-    tr_free(buf);
     return ret;
 }
 
@@ -41,6 +41,10 @@ struct tr_metainfo_builder
     uint32_t pieceCount;
     bool isFolder;
 
+    /* number of threads used to hash pieces.
+       see tr_metaInfoBuilderSetThreadCount() */
+    uint32_t threadCount;
+
     /**
     ***  These are set inside tr_makeMetaInfo()
     ***  by copying the arguments passed to it,
@@ -90,6 +94,15 @@ tr_metainfo_builder* tr_metaInfoBuilderCreate(char const* topFile);
  */
 bool tr_metaInfoBuilderSetPieceSize(tr_metainfo_builder* builder, uint32_t bytes);
 
+/**
+ * Call this before tr_makeMetaInfo() to override how many threads hash
+ * the pieces. tr_metaInfoBuilderCreate() defaults to one per CPU core.
+ * Passing 0 restores that default. No more threads than CPU cores are
+ * started, and fewer when the pieces are big enough that their buffers
+ * would take more than 64 MiB.
+ */
+void tr_metaInfoBuilderSetThreadCount(tr_metainfo_builder* builder, uint32_t threadCount);
+
 void tr_metaInfoBuilderFree(tr_metainfo_builder*);
 
 /**
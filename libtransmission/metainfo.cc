@@ -8,7 +8,10 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint> /* uintptr_t */
 #include <string.h> /* strlen() */
+#include <string>
+#include <vector>
 
 #include <event2/buffer.h>
 
@@ -235,6 +238,30 @@ static bool getfile(char** setme, bool* is_adjusted, char const* root, tr_varian
     return success;
 }
 
+/* the names parsed from the metainfo are stored back-to-back in inf->fileNamePool
+ * to save a heap allocation per file; only names that change later, e.g. when
+ * a file is renamed, get allocations of their own */
+static bool isPooledFileName(tr_info const* inf, char const* name)
+{
+    auto const pos = reinterpret_cast<uintptr_t>(name);
+    auto const pool = reinterpret_cast<uintptr_t>(inf->fileNamePool);
+    return pool <= pos && pos < pool + inf->fileNamePoolSize;
+}
+
+void tr_metainfoSetFileName(tr_info* inf, tr_file_index_t i, char* name)
+{
+    TR_ASSERT(i < inf->fileCount);
+
+    tr_file* const file = &inf->files[i];
+
+    if (!isPooledFileName(inf, file->name))
+    {
+        tr_free(file->name);
+    }
+
+    file->name = name;
+}
+
 static char const* parseFiles(tr_info* inf, tr_variant* files, tr_variant const* length)
 {
     int64_t len;
@@ -261,6 +288,10 @@ static char const* parseFiles(tr_info* inf, tr_variant* files, tr_variant const*
         inf->fileCount = tr_variantListSize(files);
         inf->files = tr_new0(tr_file, inf->fileCount);
 
+        auto pool = std::string{};
+        auto offsets = std::vector<size_t>{};
+        offsets.reserve(inf->fileCount);
+
         for (tr_file_index_t i = 0; i < inf->fileCount; i++)
         {
             tr_variant* file;
@@ -281,12 +312,18 @@ static char const* parseFiles(tr_info* inf, tr_variant* files, tr_variant const*
             }
 
             bool is_file_adjusted;
-            if (!getfile(&inf->files[i].name, &is_file_adjusted, root_name, path, buf))
+            char* name;
+            if (!getfile(&name, &is_file_adjusted, root_name, path, buf))
             {
                 result = "path";
                 break;
             }
 
+            offsets.push_back(std::size(pool));
+            pool.append(name);
+            pool.push_back('\0');
+            tr_free(name);
+
             if (!tr_variantDictFindInt(file, TR_KEY_length, &len))
             {
                 result = "length";
@@ -299,13 +336,26 @@ static char const* parseFiles(tr_info* inf, tr_variant* files, tr_variant const*
         }
 
         evbuffer_free(buf);
+
+        if (result == nullptr)
+        {
+            inf->fileNamePoolSize = std::size(pool);
+            inf->fileNamePool = static_cast<char*>(tr_memdup(std::data(pool), std::size(pool)));
+
+            for (tr_file_index_t i = 0; i < inf->fileCount; ++i)
+            {
+                inf->files[i].name = inf->fileNamePool + offsets[i];
+            }
+        }
     }
     else if (tr_variantGetInt(length, &len)) /* single-file mode */
     {
         inf->isFolder = false;
         inf->fileCount = 1;
         inf->files = tr_new0(tr_file, 1);
-        inf->files[0].name = tr_strdup(root_name);
+        inf->fileNamePoolSize = strlen(root_name) + 1;
+        inf->fileNamePool = tr_strdup(root_name);
+        inf->files[0].name = inf->fileNamePool;
         inf->files[0].length = len;
         inf->files[0].is_renamed = is_root_adjusted;
         inf->totalSize += len;
@@ -706,11 +756,7 @@ static char const* tr_metainfoParseImpl(
 
         inf->pieceCount = len / SHA_DIGEST_LENGTH;
         inf->pieces = tr_new0(tr_piece, inf->pieceCount);
-
-        for (tr_piece_index_t pi = 0; pi < inf->pieceCount; ++pi)
-        {
-            memcpy(inf->pieces[pi].hash, &raw[pi * SHA_DIGEST_LENGTH], SHA_DIGEST_LENGTH);
-        }
+        inf->pieceHashes = static_cast<uint8_t*>(tr_memdup(raw, len));
     }
 
     /* files */
@@ -768,6 +814,72 @@ bool tr_metainfoParse(
     return success;
 }
 
+bool tr_metainfoLoadPieceHashes(tr_info* inf)
+{
+    if (inf->pieceHashes != nullptr)
+    {
+        return true;
+    }
+
+    if (inf->torrent == nullptr)
+    {
+        return false;
+    }
+
+    /* map the .torrent file instead of reading it into a buffer; only the
+       info dict's "pieces" string gets copied out */
+    tr_sys_file_t const fd = tr_sys_file_open(inf->torrent, TR_SYS_FILE_READ, 0, nullptr);
+    if (fd == TR_BAD_SYS_FILE)
+    {
+        return false;
+    }
+
+    tr_sys_path_info file_info;
+    void* map = nullptr;
+    if (tr_sys_file_get_info(fd, &file_info, nullptr) && file_info.size > 0)
+    {
+        map = tr_sys_file_map_for_reading(fd, 0, file_info.size, nullptr);
+    }
+
+    tr_variant top;
+    bool const parsed = map != nullptr && tr_variantFromBenc(&top, map, file_info.size) == 0;
+
+    if (map != nullptr)
+    {
+        tr_sys_file_unmap(map, file_info.size, nullptr);
+    }
+
+    tr_sys_file_close(fd, nullptr);
+
+    if (!parsed)
+    {
+        return false;
+    }
+
+    tr_variant* infoDict;
+    uint8_t const* raw;
+    size_t len;
+
+    if (tr_variantDictFindDict(&top, TR_KEY_info, &infoDict) && tr_variantDictFindRaw(infoDict, TR_KEY_pieces, &raw, &len) &&
+        len == size_t{ inf->pieceCount } * SHA_DIGEST_LENGTH)
+    {
+        /* make sure the file on disk is still the torrent we parsed */
+        size_t blen;
+        char* bstr = tr_variantToStr(infoDict, TR_VARIANT_FMT_BENC, &blen);
+        uint8_t hash[SHA_DIGEST_LENGTH];
+        tr_sha1(hash, bstr, (int)blen, nullptr);
+        tr_free(bstr);
+
+        if (memcmp(hash, inf->hash, SHA_DIGEST_LENGTH) == 0)
+        {
+            inf->pieceHashes = static_cast<uint8_t*>(tr_memdup(raw, len));
+        }
+    }
+
+    tr_variantFree(&top);
+    return inf->pieceHashes != nullptr;
+}
+
 void tr_metainfoFree(tr_info* inf)
 {
     for (unsigned int i = 0; i < inf->webseedCount; i++)
@@ -777,11 +889,17 @@ void tr_metainfoFree(tr_info* inf)
 
     for (tr_file_index_t ff = 0; ff < inf->fileCount; ff++)
     {
-        tr_free(inf->files[ff].name);
+        if (!isPooledFileName(inf, inf->files[ff].name))
+        {
+            tr_free(inf->files[ff].name);
+        }
     }
 
+    tr_free(inf->fileNamePool);
+
     tr_free(inf->webseeds);
     tr_free(inf->pieces);
+    tr_free(inf->pieceHashes);
     tr_free(inf->files);
     tr_free(inf->comment);
     tr_free(inf->creator);
@@ -29,6 +29,18 @@ bool tr_metainfoParse(
     bool* setmeHasInfoDict,
     size_t* setmeInfoDictLength);
 
+/**
+ * @brief Reload inf->pieceHashes from the .torrent file at inf->torrent.
+ * @return true if inf->pieceHashes is available on return
+ */
+bool tr_metainfoLoadPieceHashes(tr_info* inf);
+
+/**
+ * @brief Replace inf->files[i].name with `name', which must be tr_malloc()ed.
+ *        This takes ownership of `name' and frees the old one if needed.
+ */
+void tr_metainfoSetFileName(tr_info* inf, tr_file_index_t i, char* name);
+
 void tr_metainfoRemoveSaved(tr_session const* session, tr_info const* info);
 
 char* tr_metainfoGetBasename(tr_info const*, enum tr_metainfo_basename_format format);
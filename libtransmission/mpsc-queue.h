@@ -0,0 +1,104 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <atomic>
+
+/**
+ * A link in a tr_mpsc_queue. Queued types derive from it, so queueing
+ * an item doesn't allocate.
+ */
+struct tr_mpsc_node
+{
+    std::atomic<tr_mpsc_node*> next{ nullptr };
+};
+
+/**
+ * An unbounded lock-free queue with many producers and one consumer.
+ *
+ * push() is one atomic exchange and a store, and is safe to call from
+ * any thread. pop() must only be called from the consumer's thread.
+ *
+ * A push that is in progress while pop() runs can make the items queued
+ * behind it briefly invisible, so pop() can return nullptr while the
+ * queue isn't empty. Consumers that sleep while the queue is empty must
+ * have producers wake them after push() returns, not before.
+ */
+template<typename T>
+class tr_mpsc_queue
+{
+public:
+    tr_mpsc_queue() = default;
+    tr_mpsc_queue(tr_mpsc_queue const&) = delete;
+    tr_mpsc_queue& operator=(tr_mpsc_queue const&) = delete;
+
+    void push(T* item)
+    {
+        push_node(item);
+    }
+
+    /* the oldest item, or nullptr if there's none that can be taken yet */
+    T* pop()
+    {
+        auto* head = head_;
+        auto* next = head->next.load(std::memory_order_acquire);
+
+        if (head == &stub_)
+        {
+            if (next == nullptr)
+            {
+                return nullptr;
+            }
+
+            head_ = next;
+            head = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next != nullptr)
+        {
+            head_ = next;
+            return static_cast<T*>(head);
+        }
+
+        if (head != tail_.load(std::memory_order_acquire))
+        {
+            /* a producer has claimed the tail but not linked it yet */
+            return nullptr;
+        }
+
+        /* `head` is the last item; put the stub behind it so it can be taken */
+        push_node(&stub_);
+        next = head->next.load(std::memory_order_acquire);
+
+        if (next != nullptr)
+        {
+            head_ = next;
+            return static_cast<T*>(head);
+        }
+
+        return nullptr;
+    }
+
+private:
+    void push_node(tr_mpsc_node* node)
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        auto* const prev = tail_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    tr_mpsc_node stub_;
+    tr_mpsc_node* head_ = &stub_;
+    std::atomic<tr_mpsc_node*> tail_{ &stub_ };
+};
@@ -7,6 +7,7 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <cerrno>
 #include <cstdint>
 #include <cstring>
@@ -340,6 +341,47 @@ static void event_read_cb(evutil_socket_t fd, [[maybe_unused]] short event, void
     }
 }
 
+#ifdef MSG_MORE
+
+/* Like evbuffer_write_atmost(), but when more data is queued behind
+ * `howmuch` -- e.g. the rest didn't fit in this pass's bandwidth -- the
+ * kernel is told so with MSG_MORE and holds back a trailing partial
+ * segment until the next write fills it. */
+static int sendBufferAtMost(struct evbuffer* buf, evutil_socket_t fd, size_t howmuch)
+{
+    auto constexpr MaxIov = int{ 64 };
+    auto vec = std::array<evbuffer_iovec, MaxIov>{};
+    auto iov = std::array<iovec, MaxIov>{};
+
+    int const n_vec = std::min(evbuffer_peek(buf, howmuch, nullptr, std::data(vec), MaxIov), MaxIov);
+    int n_iov = 0;
+    size_t len = 0;
+
+    /* the last chain peeked can run past `howmuch` */
+    for (; n_iov < n_vec && len < howmuch; ++n_iov)
+    {
+        iov[n_iov].iov_base = vec[n_iov].iov_base;
+        iov[n_iov].iov_len = std::min(vec[n_iov].iov_len, howmuch - len);
+        len += iov[n_iov].iov_len;
+    }
+
+    auto msg = msghdr{};
+    msg.msg_iov = std::data(iov);
+    msg.msg_iovlen = n_iov;
+
+    int const flags = len < evbuffer_get_length(buf) ? MSG_MORE : 0;
+    auto const n = sendmsg(fd, &msg, flags);
+
+    if (n > 0)
+    {
+        evbuffer_drain(buf, n);
+    }
+
+    return int(n);
+}
+
+#endif
+
 static int tr_evbuffer_write(tr_peerIo* io, int fd, size_t howmuch)
 {
     int e;
@@ -347,10 +389,18 @@ static int tr_evbuffer_write(tr_peerIo* io, int fd, size_t howmuch)
     char errstr[256];
 
     EVUTIL_SET_SOCKET_ERROR(0);
+#ifdef MSG_MORE
+    n = sendBufferAtMost(io->outbuf, fd, howmuch);
+#else
     n = evbuffer_write_atmost(io->outbuf, fd, howmuch);
+#endif
     e = EVUTIL_SOCKET_ERROR();
     dbgmsg(io, "wrote %d to peer (%s)", n, (n == -1 ? tr_net_strerror(errstr, sizeof(errstr), e) : ""));
 
+    auto& stats = io->session->peerWriteStats;
+    ++stats.calls;
+    stats.bytes += std::max(n, 0);
+
     return n;
 }
 
@@ -654,6 +704,7 @@ static tr_peerIo* tr_peerIoNew(
 
     auto* io = new tr_peerIo{ session, *addr, port, isSeed };
     tr_cryptoConstruct(&io->crypto, torrentHash, isIncoming);
+    tr_cryptoSetKeyPool(&io->crypto, session->dhKeyPool);
     io->socket = socket;
     io->bandwidth = new Bandwidth(parent);
     io->bandwidth->setPeer(io);
@@ -1217,6 +1268,30 @@ static inline void maybeDecryptBuffer(tr_peerIo* io, struct evbuffer* buf, size_
     }
 }
 
+/* decrypt the first `size` bytes of `buffer` into `out`, reading them straight from its chains */
+static void decryptBufferTo(tr_crypto* crypto, struct evbuffer* buffer, size_t size, uint8_t* out)
+{
+    struct evbuffer_ptr pos;
+    struct evbuffer_iovec iovec;
+
+    evbuffer_ptr_set(buffer, &pos, 0, EVBUFFER_PTR_SET);
+
+    while (size > 0 && evbuffer_peek(buffer, size, &pos, &iovec, 1) > 0)
+    {
+        size_t const n = std::min(size, iovec.iov_len);
+        tr_cryptoDecrypt(crypto, n, iovec.iov_base, out);
+        out += n;
+        size -= n;
+
+        if (size > 0 && evbuffer_ptr_set(buffer, &pos, n, EVBUFFER_PTR_ADD) != 0)
+        {
+            break;
+        }
+    }
+
+    TR_ASSERT(size == 0);
+}
+
 void tr_peerIoReadBytesToBuf(tr_peerIo* io, struct evbuffer* inbuf, struct evbuffer* outbuf, size_t byteCount)
 {
     TR_ASSERT(tr_isPeerIo(io));
@@ -1224,11 +1299,8 @@ void tr_peerIoReadBytesToBuf(tr_peerIo* io, struct evbuffer* inbuf, struct evbuf
 
     size_t const old_length = evbuffer_get_length(outbuf);
 
-    /* append it to outbuf */
-    struct evbuffer* tmp = evbuffer_new();
-    evbuffer_remove_buffer(inbuf, tmp, byteCount);
-    evbuffer_add_buffer(outbuf, tmp);
-    evbuffer_free(tmp);
+    /* whole chains change owners; only a partial one at the end is copied */
+    evbuffer_remove_buffer(inbuf, outbuf, byteCount);
 
     maybeDecryptBuffer(io, outbuf, old_length, byteCount);
 }
@@ -1245,8 +1317,9 @@ void tr_peerIoReadBytes(tr_peerIo* io, struct evbuffer* inbuf, void* bytes, size
         break;
 
     case PEER_ENCRYPTION_RC4:
-        evbuffer_remove(inbuf, bytes, byteCount);
-        tr_cryptoDecrypt(&io->crypto, byteCount, bytes, bytes);
+        /* one pass over the data instead of a copy and then a decrypt */
+        decryptBufferTo(&io->crypto, inbuf, byteCount, static_cast<uint8_t*>(bytes));
+        evbuffer_drain(inbuf, byteCount);
         break;
 
     default:
@@ -1451,3 +1524,8 @@ int tr_peerIoFlushOutgoingProtocolMsgs(tr_peerIo* io)
 
     return tr_peerIoFlush(io, TR_UP, byteCount);
 }
+
+void tr_peerIoGetWriteStats(tr_session const* session, tr_peer_write_stats* setme)
+{
+    *setme = session->peerWriteStats;
+}
@@ -308,6 +308,7 @@ static inline void evbuffer_add_hton_64(struct evbuffer* buf, uint64_t val)
     evbuffer_add_uint64(buf, val);
 }
 
+/* move `byteCount` bytes to `outbuf`. Whole chains of `inbuf` change owners instead of being copied */
 void tr_peerIoReadBytesToBuf(tr_peerIo* io, struct evbuffer* inbuf, struct evbuffer* outbuf, size_t byteCount);
 
 void tr_peerIoReadBytes(tr_peerIo* io, struct evbuffer* inbuf, void* bytes, size_t byteCount);
@@ -358,6 +359,18 @@ int tr_peerIoFlush(tr_peerIo* io, tr_direction dir, size_t byteLimit);
 
 int tr_peerIoFlushOutgoingProtocolMsgs(tr_peerIo* io);
 
+struct tr_peer_write_stats
+{
+    /* bytes written to TCP peers, and the write syscalls it took */
+    uint64_t bytes;
+    uint64_t calls;
+
+    /* HAVE messages not sent because the peer already had the piece */
+    uint64_t haves_suppressed;
+};
+
+void tr_peerIoGetWriteStats(tr_session const* session, tr_peer_write_stats* setme);
+
 /**
 ***
 **/
@@ -11,6 +11,7 @@
 #include <climits> /* INT_MAX */
 #include <cstdlib> /* qsort */
 #include <cstring> /* memcpy, memcmp, strstr */
+#include <memory>
 #include <vector>
 
 #include <event2/event.h>
@@ -32,9 +33,11 @@
 #include "peer-io.h"
 #include "peer-mgr.h"
 #include "peer-msgs.h"
+#include "perf.h"
 #include "ptrarray.h"
 #include "session.h"
 #include "stats.h" /* tr_statsAddUploaded, tr_statsAddDownloaded */
+#include "timer-wheel.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "tr-utp.h"
@@ -52,10 +55,15 @@ enum
     OPTIMISTIC_UNCHOKE_MULTIPLIER = 4,
     /* how frequently to reallocate bandwidth */
     BANDWIDTH_PERIOD_MSEC = 500,
+    /* how many blocks readAheadPulse() may read from disk per bandwidth period,
+       which bounds how long it stalls the event thread. 2 MiB with 16 KiB blocks */
+    READ_AHEAD_PULSE_BLOCKS = 128,
     /* how frequently to age out old piece request lists */
     REFILL_UPKEEP_PERIOD_MSEC = (10 * 1000),
     /* how frequently to decide which peers live and die */
     RECONNECT_PERIOD_MSEC = 500,
+    /* how frequently to see which peers are due for a ut_pex message */
+    PEX_PERIOD_MSEC = (10 * 1000),
     /* when many peers are available, keep idle ones this long */
     MIN_UPLOAD_IDLE_SECS = (60),
     /* when few peers are available, keep idle ones this long */
@@ -210,6 +218,9 @@ public:
     int maxPeers = 0;
     time_t lastCancel = 0;
 
+    std::shared_ptr<tr_pex_snapshot> pexSnapshot;
+    time_t pexSnapshotBuiltAt = 0;
+
     /* Before the endgame this should be 0. In endgame, is contains the average
      * number of pending requests per peer. Only peers which have more pending
      * requests are considered 'fast' are allowed to request a block that's
@@ -221,10 +232,11 @@ struct tr_peerMgr
 {
     tr_session* session;
     tr_ptrArray incomingHandshakes; /* tr_handshake */
-    struct event* bandwidthTimer;
-    struct event* rechokeTimer;
-    struct event* refillUpkeepTimer;
-    struct event* atomTimer;
+    tr_timer bandwidthTimer;
+    tr_timer rechokeTimer;
+    tr_timer refillUpkeepTimer;
+    tr_timer atomTimer;
+    tr_timer pexTimer;
 };
 
 #define tordbg(t, ...) tr_logAddDeepNamed(tr_torrentName((t)->tor), __VA_ARGS__)
@@ -383,6 +395,13 @@ static bool peerIsInUse(tr_swarm const* cs, struct peer_atom const* atom)
         getExistingHandshake(&s->manager->incomingHandshakes, &atom->addr) != nullptr;
 }
 
+/* the swarm's piece availability changed, so the torrent's
+   desiredAvailable stat needs to be recounted */
+static void swarmAvailabilityChanged(tr_swarm* s)
+{
+    tr_torrentMarkStatDirty(s->tor, TR_STAT_DIRTY_DESIRED_AVAILABLE);
+}
+
 static constexpr bool replicationExists(tr_swarm const* s)
 {
     return s->pieceReplication != nullptr;
@@ -393,6 +412,7 @@ static void replicationFree(tr_swarm* s)
     tr_free(s->pieceReplication);
     s->pieceReplication = nullptr;
     s->pieceReplicationSize = 0;
+    swarmAvailabilityChanged(s);
 }
 
 static void replicationNew(tr_swarm* s)
@@ -421,6 +441,8 @@ static void replicationNew(tr_swarm* s)
 
         s->pieceReplication[piece_i] = r;
     }
+
+    swarmAvailabilityChanged(s);
 }
 
 static void swarmFree(void* vs)
@@ -486,21 +508,19 @@ tr_peerMgr* tr_peerMgrNew(tr_session* session)
     return m;
 }
 
-static void deleteTimer(struct event** t)
+static void deleteTimer(tr_session* session, tr_timer* t)
 {
-    if (*t != nullptr)
-    {
-        event_free(*t);
-        *t = nullptr;
-    }
+    tr_sessionRemoveTimer(session, t);
+    t->callback = nullptr;
 }
 
 static void deleteTimers(struct tr_peerMgr* m)
 {
-    deleteTimer(&m->atomTimer);
-    deleteTimer(&m->bandwidthTimer);
-    deleteTimer(&m->rechokeTimer);
-    deleteTimer(&m->refillUpkeepTimer);
+    deleteTimer(m->session, &m->atomTimer);
+    deleteTimer(m->session, &m->pexTimer);
+    deleteTimer(m->session, &m->bandwidthTimer);
+    deleteTimer(m->session, &m->rechokeTimer);
+    deleteTimer(m->session, &m->refillUpkeepTimer);
 }
 
 void tr_peerMgrFree(tr_peerMgr* manager)
@@ -566,6 +586,7 @@ static void atomSetSeed(tr_swarm* s, struct peer_atom* atom)
     tordbg(s, "marking peer %s as a seed", tr_atomAddrStr(atom));
     atom->flags |= ADDED_F_SEED_FLAG;
     s->poolIsAllSeedsDirty = true;
+    swarmAvailabilityChanged(s);
 }
 
 bool tr_peerMgrPeerIsSeed(tr_torrent const* tor, tr_address const* addr)
@@ -1183,6 +1204,7 @@ static void tr_incrReplicationOfPiece(tr_swarm* s, size_t const index)
 
     /* One more replication of this piece is present in the swarm */
     ++s->pieceReplication[index];
+    swarmAvailabilityChanged(s);
 
     /* we only resort the piece if the list is already sorted */
     if (s->pieceSortState == PIECES_SORTED_BY_WEIGHT)
@@ -1208,6 +1230,8 @@ static void tr_incrReplicationFromBitfield(tr_swarm* s, Bitfield const* b)
         }
     }
 
+    swarmAvailabilityChanged(s);
+
     if (s->pieceSortState == PIECES_SORTED_BY_WEIGHT)
     {
         invalidatePieceSorting(s);
@@ -1226,6 +1250,8 @@ static void tr_incrReplication(tr_swarm* s)
     {
         ++s->pieceReplication[i];
     }
+
+    swarmAvailabilityChanged(s);
 }
 
 /**
@@ -1236,6 +1262,8 @@ static void tr_decrReplicationFromBitfield(tr_swarm* s, Bitfield const* b)
     TR_ASSERT(replicationExists(s));
     TR_ASSERT(s->pieceReplicationSize == s->tor->info.pieceCount);
 
+    swarmAvailabilityChanged(s);
+
     if (b->hasAll())
     {
         for (size_t i = 0; i < s->pieceReplicationSize; ++i)
@@ -1443,7 +1471,7 @@ bool tr_peerMgrDidPeerRequest(tr_torrent const* tor, tr_peer const* peer, tr_blo
 }
 
 /* cancel requests that are too old */
-static void refillUpkeep([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vmgr)
+static void refillUpkeep(void* vmgr)
 {
     time_t now;
     time_t too_old;
@@ -1527,7 +1555,7 @@ static void refillUpkeep([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] s
     }
 
     tr_free(cancel);
-    tr_timerAddMsec(mgr->refillUpkeepTimer, REFILL_UPKEEP_PERIOD_MSEC);
+    tr_sessionAddTimer(mgr->session, &mgr->refillUpkeepTimer, REFILL_UPKEEP_PERIOD_MSEC);
     managerUnlock(mgr);
 }
 
@@ -1927,6 +1955,7 @@ static void createBitTorrentPeer(tr_torrent* tor, tr_peerIo* io, struct peer_ato
     atom->peer = peer;
 
     tr_ptrArrayInsertSorted(&swarm->peers, peer, peerCompare);
+    swarmAvailabilityChanged(swarm);
     ++swarm->stats.peerCount;
     ++swarm->stats.peerFromCount[atom->fromFirst];
 
@@ -2401,38 +2430,44 @@ int tr_peerMgrGetPeers(tr_torrent const* tor, tr_pex** setme_pex, uint8_t af, ui
     return count;
 }
 
-static void atomPulse(evutil_socket_t, short, void*);
-static void bandwidthPulse(evutil_socket_t, short, void*);
-static void rechokePulse(evutil_socket_t, short, void*);
-static void reconnectPulse(evutil_socket_t, short, void*);
+static void atomPulse(void*);
+static void bandwidthPulse(void*);
+static void pexPulse(void*);
+static void rechokePulse(void*);
+static void reconnectPulse(void*);
 
-static struct event* createTimer(tr_session* session, int msec, event_callback_fn callback, void* cbdata)
+static void createTimer(tr_session* session, tr_timer* timer, int msec, tr_timer::callback_t callback, void* cbdata)
 {
-    struct event* timer = evtimer_new(session->event_base, callback, cbdata);
-    tr_timerAddMsec(timer, msec);
-    return timer;
+    timer->callback = callback;
+    timer->user_data = cbdata;
+    tr_sessionAddTimer(session, timer, msec);
 }
 
 static void ensureMgrTimersExist(struct tr_peerMgr* m)
 {
-    if (m->atomTimer == nullptr)
+    if (m->atomTimer.callback == nullptr)
+    {
+        createTimer(m->session, &m->atomTimer, ATOM_PERIOD_MSEC, atomPulse, m);
+    }
+
+    if (m->bandwidthTimer.callback == nullptr)
     {
-        m->atomTimer = createTimer(m->session, ATOM_PERIOD_MSEC, atomPulse, m);
+        createTimer(m->session, &m->bandwidthTimer, BANDWIDTH_PERIOD_MSEC, bandwidthPulse, m);
     }
 
-    if (m->bandwidthTimer == nullptr)
+    if (m->pexTimer.callback == nullptr)
     {
-        m->bandwidthTimer = createTimer(m->session, BANDWIDTH_PERIOD_MSEC, bandwidthPulse, m);
+        createTimer(m->session, &m->pexTimer, PEX_PERIOD_MSEC, pexPulse, m);
     }
 
-    if (m->rechokeTimer == nullptr)
+    if (m->rechokeTimer.callback == nullptr)
     {
-        m->rechokeTimer = createTimer(m->session, RECHOKE_PERIOD_MSEC, rechokePulse, m);
+        createTimer(m->session, &m->rechokeTimer, RECHOKE_PERIOD_MSEC, rechokePulse, m);
     }
 
-    if (m->refillUpkeepTimer == nullptr)
+    if (m->refillUpkeepTimer.callback == nullptr)
     {
-        m->refillUpkeepTimer = createTimer(m->session, REFILL_UPKEEP_PERIOD_MSEC, refillUpkeep, m);
+        createTimer(m->session, &m->refillUpkeepTimer, REFILL_UPKEEP_PERIOD_MSEC, refillUpkeep, m);
     }
 }
 
@@ -2446,11 +2481,12 @@ void tr_peerMgrStartTorrent(tr_torrent* tor)
     ensureMgrTimersExist(s->manager);
 
     s->isRunning = true;
+    swarmAvailabilityChanged(s);
     s->maxPeers = tor->maxConnectedPeers;
     s->pieceSortState = PIECES_UNSORTED;
 
     // rechoke soon
-    tr_timerAddMsec(s->manager->rechokeTimer, 100);
+    tr_sessionAddTimer(s->manager->session, &s->manager->rechokeTimer, 100);
 }
 
 static void removeAllPeers(tr_swarm*);
@@ -2784,6 +2820,8 @@ struct tr_peer_stat* tr_peerMgrPeerStats(tr_torrent const* tor, int* setmeCount)
 
         stat->pendingReqsToPeer = peer->pendingReqsToPeer;
         stat->pendingReqsToClient = peer->pendingReqsToClient;
+        stat->requestWindow = msgs->get_desired_request_count();
+        stat->rttMsec = msgs->get_request_rtt_msec();
 
         pch = stat->flagStr;
 
@@ -3309,7 +3347,7 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
     tr_free(choke);
 }
 
-static void rechokePulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vmgr)
+static void rechokePulse(void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     uint64_t const now = tr_time_msec();
@@ -3330,7 +3368,92 @@ static void rechokePulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] s
         }
     }
 
-    tr_timerAddMsec(mgr->rechokeTimer, RECHOKE_PERIOD_MSEC);
+    tr_sessionAddTimer(mgr->session, &mgr->rechokeTimer, RECHOKE_PERIOD_MSEC);
+    managerUnlock(mgr);
+}
+
+/***
+****
+****  PEX
+****
+***/
+
+static std::vector<tr_pex> getConnectedPex(tr_torrent const* tor, uint8_t af, int max_peer_count)
+{
+    tr_pex* pex = nullptr;
+    int const n = tr_peerMgrGetPeers(tor, &pex, af, TR_PEERS_CONNECTED, max_peer_count);
+    auto ret = std::vector<tr_pex>(pex, pex + n);
+    tr_free(pex);
+    return ret;
+}
+
+static bool pexListsAreEqual(std::vector<tr_pex> const& a, std::vector<tr_pex> const& b)
+{
+    return std::equal(
+        std::begin(a),
+        std::end(a),
+        std::begin(b),
+        std::end(b),
+        [](tr_pex const& pa, tr_pex const& pb) { return tr_pexCompare(&pa, &pb) == 0; });
+}
+
+std::shared_ptr<tr_pex_snapshot> tr_peerMgrGetPexSnapshot(tr_torrent* tor, int max_peer_count)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+
+    tr_swarm* s = tor->swarm;
+    time_t const now = tr_time();
+
+    managerLock(s->manager);
+
+    if (!s->pexSnapshot || now - s->pexSnapshotBuiltAt >= PEX_PERIOD_MSEC / 1000)
+    {
+        auto snapshot = std::make_shared<tr_pex_snapshot>();
+        snapshot->pex = getConnectedPex(tor, TR_AF_INET, max_peer_count);
+        snapshot->pex6 = getConnectedPex(tor, TR_AF_INET6, max_peer_count);
+        s->pexSnapshotBuiltAt = now;
+
+        /* if the swarm hasn't changed, peers that are up to date have nothing to do */
+        auto const& old = s->pexSnapshot;
+        if (!old || !pexListsAreEqual(old->pex, snapshot->pex) || !pexListsAreEqual(old->pex6, snapshot->pex6))
+        {
+            /* only keep one generation back; peers that are further behind get their own diff */
+            if (old)
+            {
+                old->previous.reset();
+            }
+
+            snapshot->previous = std::move(s->pexSnapshot);
+            s->pexSnapshot = std::move(snapshot);
+        }
+    }
+
+    auto ret = s->pexSnapshot;
+    managerUnlock(s->manager);
+    return ret;
+}
+
+static void pexPulse(void* vmgr)
+{
+    auto* mgr = static_cast<tr_peerMgr*>(vmgr);
+    time_t const now = tr_time();
+
+    managerLock(mgr);
+
+    for (auto* tor : mgr->session->torrents)
+    {
+        if (tor->isRunning && tr_torrentAllowsPex(tor))
+        {
+            tr_swarm* s = tor->swarm;
+
+            for (int i = 0, n = tr_ptrArraySize(&s->peers); i < n; ++i)
+            {
+                static_cast<tr_peerMsgs*>(tr_ptrArrayNth(&s->peers, i))->pex_pulse(now);
+            }
+        }
+    }
+
+    tr_sessionAddTimer(mgr->session, &mgr->pexTimer, PEX_PERIOD_MSEC);
     managerUnlock(mgr);
 }
 
@@ -3477,6 +3600,7 @@ static void removePeer(tr_swarm* s, tr_peer* peer)
     atom->time = tr_time();
 
     tr_ptrArrayRemoveSortedPointer(&s->peers, peer, peerCompare);
+    swarmAvailabilityChanged(s);
     --s->stats.peerCount;
     --s->stats.peerFromCount[atom->fromFirst];
 
@@ -3697,7 +3821,7 @@ static void enforceSessionPeerLimit(tr_session* session, uint64_t now)
 
 static void makeNewPeerConnections(tr_peerMgr* mgr, int const max);
 
-static void reconnectPulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vmgr)
+static void reconnectPulse(void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     time_t const now_sec = tr_time();
@@ -3756,6 +3880,68 @@ static void pumpAllPeers(tr_peerMgr* mgr)
     }
 }
 
+/* Load the blocks that each torrent's peers have asked us for into the cache.
+ * The peers' request queues are interleaved so that every peer's next blocks
+ * are planned before anyone's later ones. The reads run on the event thread
+ * under the session lock, so each pulse loads at most READ_AHEAD_PULSE_BLOCKS
+ * and only asks the kernel to prefetch the rest. Read errors are left for
+ * the upload itself to report. */
+static void readAheadPulse(tr_session* session)
+{
+    int const depth = session->readAheadDepth;
+
+    if (!session->isPrefetchEnabled || depth <= 0)
+    {
+        return;
+    }
+
+    size_t budget = READ_AHEAD_PULSE_BLOCKS;
+
+    auto peer_blocks = std::vector<tr_block_index_t>{};
+    auto peer_counts = std::vector<size_t>{};
+    auto blocks = std::vector<tr_block_index_t>{};
+
+    for (auto* tor : session->torrents)
+    {
+        tr_swarm* s = tor->swarm;
+        int const n_peers = tr_ptrArraySize(&s->peers);
+
+        if (!s->isRunning || n_peers == 0)
+        {
+            continue;
+        }
+
+        peer_blocks.resize(size_t(n_peers) * depth);
+        peer_counts.resize(n_peers);
+        size_t max_count = 0;
+
+        for (int i = 0; i < n_peers; ++i)
+        {
+            auto const* msgs = static_cast<tr_peerMsgs const*>(tr_ptrArrayNth(&s->peers, i));
+            peer_counts[i] = msgs->get_upload_request_blocks(&peer_blocks[size_t(i) * depth], depth);
+            max_count = std::max(max_count, peer_counts[i]);
+        }
+
+        blocks.clear();
+
+        for (size_t rank = 0; rank < max_count; ++rank)
+        {
+            for (int i = 0; i < n_peers; ++i)
+            {
+                if (rank < peer_counts[i])
+                {
+                    blocks.push_back(peer_blocks[size_t(i) * depth + rank]);
+                }
+            }
+        }
+
+        if (!std::empty(blocks))
+        {
+            tr_cacheReadAhead(session->cache, tor, std::data(blocks), std::size(blocks), &budget);
+        }
+    }
+}
+
 static void queuePulse(tr_session* session, tr_direction dir)
 {
     TR_ASSERT(tr_isSession(session));
@@ -3777,12 +3963,16 @@ static void queuePulse(tr_session* session, tr_direction dir)
     }
 }
 
-static void bandwidthPulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vmgr)
+static void bandwidthPulse(void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     tr_session* session = mgr->session;
+    auto const perf = tr_perf_scope{ session, TR_PERF_BANDWIDTH_PULSE };
     managerLock(mgr);
 
+    /* get the blocks we're about to upload off the disk in as few reads as possible */
+    readAheadPulse(session);
+
     pumpAllPeers(mgr);
 
     /* allocate bandwidth to the peers */
@@ -3817,9 +4007,9 @@ static void bandwidthPulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]]
     queuePulse(session, TR_UP);
     queuePulse(session, TR_DOWN);
 
-    reconnectPulse(0, 0, mgr);
+    reconnectPulse(mgr);
 
-    tr_timerAddMsec(mgr->bandwidthTimer, BANDWIDTH_PERIOD_MSEC);
+    tr_sessionAddTimer(mgr->session, &mgr->bandwidthTimer, BANDWIDTH_PERIOD_MSEC);
     managerUnlock(mgr);
 }
 
@@ -3884,7 +4074,7 @@ static int getMaxAtomCount(tr_torrent const* tor)
     return std::min(50, tor->maxConnectedPeers * 3);
 }
 
-static void atomPulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vmgr)
+static void atomPulse(void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     managerLock(mgr);
@@ -3955,7 +4145,7 @@ static void atomPulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] shor
         }
     }
 
-    tr_timerAddMsec(mgr->atomTimer, ATOM_PERIOD_MSEC);
+    tr_sessionAddTimer(mgr->session, &mgr->atomTimer, ATOM_PERIOD_MSEC);
     managerUnlock(mgr);
 }
 
@@ -13,6 +13,9 @@
 #endif
 
 #include <inttypes.h> /* uint16_t */
+#include <memory>
+#include <string>
+#include <vector>
 
 #ifdef _WIN32
 #include <winsock2.h> /* struct in_addr */
@@ -69,6 +72,29 @@ tr_address const* tr_peerAddress(tr_peer const*);
 
 int tr_pexCompare(void const* a, void const* b);
 
+/**
+ * The connected peers that a torrent tells its peers about in ut_pex messages.
+ *
+ * The peer manager builds one per torrent per PEX period and every
+ * connection diffs against it instead of collecting the list itself.
+ * A peer that was told about the previous snapshot gets the same diff
+ * as every other such peer, so its payload is built once and shared.
+ */
+struct tr_pex_snapshot
+{
+    std::vector<tr_pex> pex;
+    std::vector<tr_pex> pex6;
+
+    /* the snapshot this one replaced */
+    std::shared_ptr<tr_pex_snapshot> previous;
+
+    /* the benc'ed ut_pex payload that takes a peer from `previous` to this
+       snapshot, or an empty string if nothing changed. Set by the first
+       peer that sends it */
+    std::string payload;
+    bool hasPayload = false;
+};
+
 tr_peerMgr* tr_peerMgrNew(tr_session* session);
 
 void tr_peerMgrFree(tr_peerMgr* manager);
@@ -124,6 +150,9 @@ int tr_peerMgrGetPeers(
     uint8_t peer_list_mode,
     int max_peer_count);
 
+/* the torrent's current PEX snapshot, rebuilt if it's older than the PEX period */
+std::shared_ptr<tr_pex_snapshot> tr_peerMgrGetPexSnapshot(tr_torrent* tor, int max_peer_count);
+
 void tr_peerMgrStartTorrent(tr_torrent* tor);
 
 void tr_peerMgrStopTorrent(tr_torrent* tor);
@@ -7,11 +7,14 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <cerrno>
 #include <cstdarg>
 #include <cstdlib>
 #include <cstring>
-#include <memory> // std::unique_ptr
+#include <memory> // std::shared_ptr
+#include <string>
+#include <vector>
 
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
@@ -25,6 +28,8 @@
 #include "peer-io.h"
 #include "peer-mgr.h"
 #include "peer-msgs.h"
+#include "request-window.h"
+#include "ring-buffer.h"
 #include "session.h"
 #include "torrent.h"
 #include "torrent-magnet.h"
@@ -87,10 +92,8 @@ enum
     MAX_FAST_SET_SIZE = 3,
     /* how many blocks to keep prefetched per peer */
     PREFETCH_SIZE = 18,
-    /* when we're making requests from another peer,
-       batch them together to send enough requests to
-       meet our bandwidth goals for the next N seconds */
-    REQUEST_BUF_SECS = 10,
+    /* how many adjacent upload requests to serve with a single read */
+    MAX_COALESCED_REQUESTS = 8,
     /* defined in BEP #9 */
     METADATA_MSG_TYPE_REQUEST = 0,
     METADATA_MSG_TYPE_DATA = 1,
@@ -137,6 +140,12 @@ static peer_request blockToReq(tr_torrent const* tor, tr_block_index_t block)
     return ret;
 }
 
+/* only whole, block-aligned requests can be served from read-ahead blocks or share a read with their neighbors */
+static bool isWholeBlockRequest(tr_torrent const* tor, struct peer_request const* req)
+{
+    return req->offset % tor->blockSize == 0 && req->length == tr_torBlockCountBytes(tor, _tr_block(tor, req->index, req->offset));
+}
+
 /**
 ***
 **/
@@ -158,7 +167,6 @@ static void cancelAllRequestsToClient(tr_peerMsgsImpl* msgs);
 static void didWrite(tr_peerIo* io, size_t bytesWritten, bool wasPieceData, void* vmsgs);
 static void gotError(tr_peerIo* io, short what, void* vmsgs);
 static void peerPulse(void* vmsgs);
-static void pexPulse(evutil_socket_t fd, short what, void* vmsgs);
 static void protocolSendCancel(tr_peerMsgsImpl* msgs, struct peer_request const& req);
 static void protocolSendChoke(tr_peerMsgsImpl* msgs, bool choke);
 static void protocolSendHave(tr_peerMsgsImpl* msgs, tr_piece_index_t index);
@@ -169,16 +177,6 @@ static void tellPeerWhatWeHave(tr_peerMsgsImpl* msgs);
 static void updateDesiredRequestCount(tr_peerMsgsImpl* msgs);
 //zzz
 
-struct EventDeleter
-{
-    void operator()(struct event* ev) const
-    {
-        event_free(ev);
-    }
-};
-
-using UniqueTimer = std::unique_ptr<struct event, EventDeleter>;
-
 /**
  * Low-level communication state information about a connected peer.
  *
@@ -201,18 +199,11 @@ public:
         , outMessagesBatchPeriod{ LOW_PRIORITY_INTERVAL_SECS }
         , state{ AWAITING_BT_LENGTH }
         , torrent{ torrent_in }
-        , outMessages{ evbuffer_new() }
         , outMessagesBatchedAt{ 0 }
         , io{ io_in }
         , callback_{ callback }
         , callbackData_{ callbackData }
     {
-        if (tr_torrentAllowsPex(torrent))
-        {
-            pex_timer.reset(evtimer_new(torrent->session->event_base, pexPulse, this));
-            tr_timerAdd(pex_timer.get(), PEX_INTERVAL_SECS, 0);
-        }
-
         if (tr_peerIoSupportsUTP(io))
         {
             tr_address const* addr = tr_peerIoGetAddress(io, nullptr);
@@ -258,9 +249,7 @@ public:
             tr_peerIoUnref(this->io); /* balanced by the ref in handshakeDoneCB() */
         }
 
-        evbuffer_free(this->outMessages);
-        tr_free(this->pex6);
-        tr_free(this->pex);
+        free_out_messages();
     }
 
     bool is_transferring_pieces(uint64_t now, tr_direction direction, unsigned int* setme_Bps) const override
@@ -330,6 +319,16 @@ public:
         return tr_peerIoGetAge(io);
     }
 
+    int get_desired_request_count() const override
+    {
+        return desiredRequestCount;
+    }
+
+    uint32_t get_request_rtt_msec() const override
+    {
+        return requestWindow.rtt_msec();
+    }
+
     bool is_reading_block(tr_block_index_t block) const override
     {
         return state == AWAITING_BT_PIECE && block == _tr_block(torrent, incoming.blockReq.index, incoming.blockReq.offset);
@@ -337,9 +336,33 @@ public:
 
     void cancel_block_request(tr_block_index_t block) override
     {
+        requestWindow.request_dropped(block);
         protocolSendCancel(this, blockToReq(torrent, block));
     }
 
+    size_t get_upload_request_blocks(tr_block_index_t* setme, size_t max) const override
+    {
+        size_t n = 0;
+
+        for (size_t i = 0; i < std::size(peerAskedFor) && n < max; ++i)
+        {
+            auto const& req = peerAskedFor[i];
+
+            if (!tr_torrentReqIsValid(torrent, req.index, req.offset, req.length))
+            {
+                continue;
+            }
+
+            /* only whole blocks can be served from read-ahead blocks */
+            if (isWholeBlockRequest(torrent, &req))
+            {
+                setme[n++] = _tr_block(torrent, req.index, req.offset);
+            }
+        }
+
+        return n;
+    }
+
     void set_choke(bool peer_is_choked) override
     {
         time_t const now = tr_time();
@@ -369,9 +392,19 @@ public:
         peerPulse(this);
     }
 
+    void pex_pulse(time_t now) override;
+
     void on_piece_completed(tr_piece_index_t piece) override
     {
-        protocolSendHave(this, piece);
+        // a peer that has the piece won't ask us for it, so telling it is a wasted message
+        if (have.readBit(piece))
+        {
+            ++session->peerWriteStats.haves_suppressed;
+        }
+        else
+        {
+            protocolSendHave(this, piece);
+        }
 
         // since we have more pieces now, we might not be interested in this peer
         update_interest();
@@ -499,6 +532,30 @@ public:
         publish(e);
     }
 
+    evbuffer* out_messages()
+    {
+        if (outMessages == nullptr)
+        {
+            outMessages = evbuffer_new();
+        }
+
+        return outMessages;
+    }
+
+    size_t out_messages_length() const
+    {
+        return outMessages != nullptr ? evbuffer_get_length(outMessages) : 0;
+    }
+
+    void free_out_messages()
+    {
+        if (outMessages != nullptr)
+        {
+            evbuffer_free(outMessages);
+            outMessages = nullptr;
+        }
+    }
+
 private:
     bool calculate_active(tr_direction direction) const
     {
@@ -558,6 +615,7 @@ public:
     bool peerSentLtepHandshake = false;
 
     int desiredRequestCount = 0;
+    tr_request_window requestWindow;
 
     int prefetchCount = 0;
 
@@ -569,8 +627,6 @@ public:
     uint8_t state = AWAITING_BT_LENGTH;
     uint8_t ut_pex_id = 0;
     uint8_t ut_metadata_id = 0;
-    uint16_t pexCount = 0;
-    uint16_t pexCount6 = 0;
 
     tr_port dht_port = 0;
 
@@ -584,18 +640,22 @@ public:
 
     tr_torrent* const torrent;
 
-    evbuffer* const outMessages; /* all the non-piece messages */
+    /* all the non-piece messages. Most peers are idle most of the time,
+     * so the buffer is only allocated while there's a batch to send */
+    evbuffer* outMessages = nullptr;
 
-    struct peer_request peerAskedFor[REQQ] = {};
+    tr_ring_buffer<peer_request> peerAskedFor;
 
-    int peerAskedForMetadata[METADATA_REQQ] = {};
-    int peerAskedForMetadataCount = 0;
+    tr_ring_buffer<int> peerAskedForMetadata;
 
-    tr_pex* pex = nullptr;
-    tr_pex* pex6 = nullptr;
+    /* the peers this peer was last told about. Usually a torrent-wide snapshot */
+    std::shared_ptr<tr_pex_snapshot> pexSent;
 
     time_t clientSentAnythingAt = 0;
 
+    /* when we last sent a ut_pex message. See pex_pulse() */
+    time_t pexSentAt = tr_time();
+
     time_t chokeChangedAt = 0;
 
     /* when we started batching the outMessages */
@@ -608,8 +668,6 @@ public:
        value is zero and should be ignored. */
     int64_t reqq = 0;
 
-    UniqueTimer pex_timer;
-
     tr_peerIo* io = nullptr;
 
 private:
@@ -687,14 +745,14 @@ static void pokeBatchPeriod(tr_peerMsgsImpl* msgs, int interval)
 
 static void dbgOutMessageLen(tr_peerMsgsImpl* msgs)
 {
-    dbgmsg(msgs, "outMessage size is now %zu", evbuffer_get_length(msgs->outMessages));
+    dbgmsg(msgs, "outMessage size is now %zu", msgs->out_messages_length());
 }
 
 static void protocolSendReject(tr_peerMsgsImpl* msgs, struct peer_request const* req)
 {
     TR_ASSERT(tr_peerIoSupportsFEXT(msgs->io));
 
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
 
     evbuffer_add_uint32(out, sizeof(uint8_t) + 3 * sizeof(uint32_t));
     evbuffer_add_uint8(out, BT_FEXT_REJECT);
@@ -708,13 +766,14 @@ static void protocolSendReject(tr_peerMsgsImpl* msgs, struct peer_request const*
 
 static void protocolSendRequest(tr_peerMsgsImpl* msgs, struct peer_request const& req)
 {
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
 
     evbuffer_add_uint32(out, sizeof(uint8_t) + 3 * sizeof(uint32_t));
     evbuffer_add_uint8(out, BT_REQUEST);
     evbuffer_add_uint32(out, req.index);
     evbuffer_add_uint32(out, req.offset);
     evbuffer_add_uint32(out, req.length);
+    msgs->requestWindow.request_sent(tr_time_msec(), _tr_block(msgs->torrent, req.index, req.offset));
 
     dbgmsg(msgs, "requesting %u:%u->%u...", req.index, req.offset, req.length);
     dbgOutMessageLen(msgs);
@@ -723,7 +782,7 @@ static void protocolSendRequest(tr_peerMsgsImpl* msgs, struct peer_request const
 
 static void protocolSendCancel(tr_peerMsgsImpl* msgs, peer_request const& req)
 {
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
 
     evbuffer_add_uint32(out, sizeof(uint8_t) + 3 * sizeof(uint32_t));
     evbuffer_add_uint8(out, BT_CANCEL);
@@ -738,7 +797,7 @@ static void protocolSendCancel(tr_peerMsgsImpl* msgs, peer_request const& req)
 
 static void protocolSendPort(tr_peerMsgsImpl* msgs, uint16_t port)
 {
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
 
     dbgmsg(msgs, "sending Port %u", port);
     evbuffer_add_uint32(out, 3);
@@ -748,7 +807,7 @@ static void protocolSendPort(tr_peerMsgsImpl* msgs, uint16_t port)
 
 static void protocolSendHave(tr_peerMsgsImpl* msgs, tr_piece_index_t index)
 {
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
 
     evbuffer_add_uint32(out, sizeof(uint8_t) + sizeof(uint32_t));
     evbuffer_add_uint8(out, BT_HAVE);
@@ -766,7 +825,7 @@ static void protocolSendAllowedFast(tr_peerMsgs* msgs, uint32_t pieceIndex)
     TR_ASSERT(tr_peerIoSupportsFEXT(msgs->io));
 
     tr_peerIo* io = msgs->io;
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
 
     evbuffer_add_uint32(io, out, sizeof(uint8_t) + sizeof(uint32_t));
     evbuffer_add_uint8(io, out, BT_FEXT_ALLOWED_FAST);
@@ -780,7 +839,7 @@ static void protocolSendAllowedFast(tr_peerMsgs* msgs, uint32_t pieceIndex)
 
 static void protocolSendChoke(tr_peerMsgsImpl* msgs, bool choke)
 {
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
 
     evbuffer_add_uint32(out, sizeof(uint8_t));
     evbuffer_add_uint8(out, choke ? BT_CHOKE : BT_UNCHOKE);
@@ -794,7 +853,7 @@ static void protocolSendHaveAll(tr_peerMsgsImpl* msgs)
 {
     TR_ASSERT(tr_peerIoSupportsFEXT(msgs->io));
 
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
 
     evbuffer_add_uint32(out, sizeof(uint8_t));
     evbuffer_add_uint8(out, BT_FEXT_HAVE_ALL);
@@ -808,7 +867,7 @@ static void protocolSendHaveNone(tr_peerMsgsImpl* msgs)
 {
     TR_ASSERT(tr_peerIoSupportsFEXT(msgs->io));
 
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
 
     evbuffer_add_uint32(out, sizeof(uint8_t));
     evbuffer_add_uint8(out, BT_FEXT_HAVE_NONE);
@@ -910,7 +969,7 @@ static void sendInterest(tr_peerMsgsImpl* msgs, bool b)
 {
     TR_ASSERT(msgs != nullptr);
 
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
 
     dbgmsg(msgs, "Sending %s", b ? "Interested" : "Not Interested");
     evbuffer_add_uint32(out, sizeof(uint8_t));
@@ -922,30 +981,28 @@ static void sendInterest(tr_peerMsgsImpl* msgs, bool b)
 
 static bool popNextMetadataRequest(tr_peerMsgsImpl* msgs, int* piece)
 {
-    if (msgs->peerAskedForMetadataCount == 0)
+    if (msgs->peerAskedForMetadata.empty())
     {
         return false;
     }
 
-    *piece = msgs->peerAskedForMetadata[0];
-
-    tr_removeElementFromArray(msgs->peerAskedForMetadata, 0, sizeof(int), msgs->peerAskedForMetadataCount);
-    --msgs->peerAskedForMetadataCount;
+    *piece = msgs->peerAskedForMetadata.front();
+    msgs->peerAskedForMetadata.pop_front();
 
     return true;
 }
 
 static bool popNextRequest(tr_peerMsgsImpl* msgs, struct peer_request* setme)
 {
-    if (msgs->pendingReqsToClient == 0)
+    if (std::empty(msgs->peerAskedFor))
     {
         return false;
     }
 
-    *setme = msgs->peerAskedFor[0];
+    *setme = msgs->peerAskedFor.front();
 
-    tr_removeElementFromArray(msgs->peerAskedFor, 0, sizeof(struct peer_request), msgs->pendingReqsToClient);
-    --msgs->pendingReqsToClient;
+    msgs->peerAskedFor.pop_front();
+    msgs->pendingReqsToClient = std::size(msgs->peerAskedFor);
 
     return true;
 }
@@ -987,7 +1044,7 @@ static void sendLtepHandshake(tr_peerMsgsImpl* msgs)
     tr_variant val;
     bool allow_pex;
     struct evbuffer* payload;
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
     unsigned char const* ipv6 = tr_globalIPv6();
     static tr_quark version_quark = 0;
 
@@ -1220,15 +1277,15 @@ static void parseUtMetadata(tr_peerMsgsImpl* msgs, uint32_t msglen, struct evbuf
     if (msg_type == METADATA_MSG_TYPE_REQUEST)
     {
         if (piece >= 0 && tr_torrentHasMetadata(msgs->torrent) && !tr_torrentIsPrivate(msgs->torrent) &&
-            msgs->peerAskedForMetadataCount < METADATA_REQQ)
+            std::size(msgs->peerAskedForMetadata) < METADATA_REQQ)
         {
-            msgs->peerAskedForMetadata[msgs->peerAskedForMetadataCount++] = piece;
+            msgs->peerAskedForMetadata.push_back(piece);
         }
         else
         {
             tr_variant v;
             struct evbuffer* payload;
-            struct evbuffer* out = msgs->outMessages;
+            struct evbuffer* out = msgs->out_messages();
 
             /* build the rejection message */
             tr_variantInitDict(&v, 2);
@@ -1432,7 +1489,7 @@ static void prefetchPieces(tr_peerMsgsImpl* msgs)
 
     for (int i = msgs->prefetchCount; i < msgs->pendingReqsToClient && i < PREFETCH_SIZE; ++i)
     {
-        struct peer_request const* req = msgs->peerAskedFor + i;
+        struct peer_request const* req = &msgs->peerAskedFor[i];
 
         if (requestIsValid(msgs, req))
         {
@@ -1474,7 +1531,8 @@ static void peerMadeRequest(tr_peerMsgsImpl* msgs, struct peer_request const* re
 
     if (allow)
     {
-        msgs->peerAskedFor[msgs->pendingReqsToClient++] = *req;
+        msgs->peerAskedFor.push_back(*req);
+        msgs->pendingReqsToClient = std::size(msgs->peerAskedFor);
         prefetchPieces(msgs);
     }
     else if (fext)
@@ -1551,6 +1609,13 @@ static ReadState readBtPiece(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, size
             return READ_LATER;
         }
 
+        /* check the length before buffering any piece data */
+        if (!messageLengthIsCorrect(msgs, BT_PIECE, msgs->incoming.length))
+        {
+            dbgmsg(msgs, "bad packet - BT piece with a length of %d", (int)msgs->incoming.length);
+            return READ_ERR;
+        }
+
         tr_peerIoReadUint32(msgs->io, inbuf, &req->index);
         tr_peerIoReadUint32(msgs->io, inbuf, &req->offset);
         req->length = msgs->incoming.length - 9;
@@ -1638,6 +1703,7 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
     case BT_CHOKE:
         dbgmsg(msgs, "got Choke");
         msgs->client_is_choked_ = true;
+        msgs->requestWindow.reset_probe();
 
         if (!fext)
         {
@@ -1718,14 +1784,14 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
             msgs->cancelsSentToClient.add(tr_time(), 1);
             dbgmsg(msgs, "got a Cancel %u:%u->%u", r.index, r.offset, r.length);
 
-            for (int i = 0; i < msgs->pendingReqsToClient; ++i)
+            for (size_t i = 0; i < std::size(msgs->peerAskedFor); ++i)
             {
-                struct peer_request const* req = msgs->peerAskedFor + i;
+                struct peer_request const* req = &msgs->peerAskedFor[i];
 
                 if (req->index == r.index && req->offset == r.offset && req->length == r.length)
                 {
-                    tr_removeElementFromArray(msgs->peerAskedFor, i, sizeof(struct peer_request), msgs->pendingReqsToClient);
-                    --msgs->pendingReqsToClient;
+                    msgs->peerAskedFor.erase(i);
+                    msgs->pendingReqsToClient = std::size(msgs->peerAskedFor);
                     break;
                 }
             }
@@ -1825,6 +1891,7 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
 
             if (fext)
             {
+                msgs->requestWindow.request_dropped(_tr_block(msgs->torrent, r.index, r.offset));
                 msgs->publishGotRej(&r);
             }
             else
@@ -1884,6 +1951,8 @@ static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* data, struct p
         return 0;
     }
 
+    msgs->requestWindow.block_received(tr_time_msec(), block, req->length);
+
     if (tr_torrentPieceIsComplete(msgs->torrent, req->index))
     {
         dbgmsg(msgs, "we did ask for this message, but the piece is already complete...");
@@ -1982,39 +2051,29 @@ static void updateDesiredRequestCount(tr_peerMsgsImpl* msgs)
     }
     else
     {
-        int estimatedBlocksInPeriod;
-        unsigned int rate_Bps;
+        unsigned int limit_Bps = 0;
         unsigned int irate_Bps;
-        int const floor = 4;
-        int const seconds = REQUEST_BUF_SECS;
-        uint64_t const now = tr_time_msec();
 
         /* Get the rate limit we should use.
          * FIXME: this needs to consider all the other peers as well... */
-        rate_Bps = tr_peerGetPieceSpeed_Bps(msgs, now, TR_PEER_TO_CLIENT);
-
         if (tr_torrentUsesSpeedLimit(torrent, TR_PEER_TO_CLIENT))
         {
-            rate_Bps = std::min(rate_Bps, tr_torrentGetSpeedLimit_Bps(torrent, TR_PEER_TO_CLIENT));
+            limit_Bps = tr_torrentGetSpeedLimit_Bps(torrent, TR_PEER_TO_CLIENT);
         }
 
         /* honor the session limits, if enabled */
         if (tr_torrentUsesSessionLimits(torrent) &&
             tr_sessionGetActiveSpeedLimit_Bps(torrent->session, TR_PEER_TO_CLIENT, &irate_Bps))
         {
-            rate_Bps = std::min(rate_Bps, irate_Bps);
+            limit_Bps = limit_Bps == 0 ? irate_Bps : std::min(limit_Bps, irate_Bps);
         }
 
-        /* use this desired rate to figure out how
-         * many requests we should send to this peer */
-        estimatedBlocksInPeriod = (rate_Bps * seconds) / torrent->blockSize;
-        msgs->desiredRequestCount = std::max(floor, estimatedBlocksInPeriod);
-
         /* honor the peer's maximum request count, if specified */
-        if ((msgs->reqq > 0) && (msgs->desiredRequestCount > msgs->reqq))
-        {
-            msgs->desiredRequestCount = msgs->reqq;
-        }
+        int const maxRequests = msgs->reqq > 0 ? (int)std::min(msgs->reqq, int64_t{ tr_request_window::MaxWindow }) :
+                                                 tr_request_window::MaxWindow;
+
+        /* keep enough requests in flight to cover the bandwidth-delay product */
+        msgs->desiredRequestCount = msgs->requestWindow.size(torrent->blockSize, limit_Bps, maxRequests);
     }
 }
 
@@ -2026,7 +2085,7 @@ static void updateMetadataRequests(tr_peerMsgsImpl* msgs, time_t now)
     {
         tr_variant tmp;
         struct evbuffer* payload;
-        struct evbuffer* out = msgs->outMessages;
+        struct evbuffer* out = msgs->out_messages();
 
         /* build the data message */
         tr_variantInitDict(&tmp, 3);
@@ -2074,12 +2133,29 @@ static void updateBlockRequests(tr_peerMsgsImpl* msgs)
     }
 }
 
+static size_t flushOutMessages(tr_peerMsgsImpl* msgs, time_t now)
+{
+    size_t const len = msgs->out_messages_length();
+
+    if (len != 0)
+    {
+        dbgmsg(msgs, "flushing outMessages... to %p (length is %zu)", (void*)msgs->io, len);
+        tr_peerIoWriteBuf(msgs->io, msgs->out_messages(), false);
+        msgs->free_out_messages();
+        msgs->clientSentAnythingAt = now;
+        msgs->outMessagesBatchedAt = 0;
+        msgs->outMessagesBatchPeriod = LOW_PRIORITY_INTERVAL_SECS;
+    }
+
+    return len;
+}
+
 static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
 {
     int piece;
     size_t bytesWritten = 0;
     struct peer_request req;
-    bool const haveMessages = evbuffer_get_length(msgs->outMessages) != 0;
+    bool const haveMessages = msgs->out_messages_length() != 0;
     bool const fext = tr_peerIoSupportsFEXT(msgs->io);
 
     /**
@@ -2088,19 +2164,12 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
 
     if (haveMessages && msgs->outMessagesBatchedAt == 0) /* fresh batch */
     {
-        dbgmsg(msgs, "started an outMessages batch (length is %zu)", evbuffer_get_length(msgs->outMessages));
+        dbgmsg(msgs, "started an outMessages batch (length is %zu)", msgs->out_messages_length());
         msgs->outMessagesBatchedAt = now;
     }
     else if (haveMessages && now - msgs->outMessagesBatchedAt >= msgs->outMessagesBatchPeriod)
     {
-        size_t const len = evbuffer_get_length(msgs->outMessages);
-        /* flush the protocol messages */
-        dbgmsg(msgs, "flushing outMessages... to %p (length is %zu)", (void*)msgs->io, len);
-        tr_peerIoWriteBuf(msgs->io, msgs->outMessages, false);
-        msgs->clientSentAnythingAt = now;
-        msgs->outMessagesBatchedAt = 0;
-        msgs->outMessagesBatchPeriod = LOW_PRIORITY_INTERVAL_SECS;
-        bytesWritten += len;
+        bytesWritten += flushOutMessages(msgs, now);
     }
 
     /**
@@ -2109,45 +2178,45 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
 
     if (tr_peerIoGetWriteBufferSpace(msgs->io, now) >= METADATA_PIECE_SIZE && popNextMetadataRequest(msgs, &piece))
     {
-        size_t dataLen;
         bool ok = false;
 
-        auto* data = static_cast<char*>(tr_torrentGetMetadataPiece(msgs->torrent, piece, &dataLen));
+        /* RC4 encrypts the outgoing buffer in place, so only plaintext peers can share the info dict's memory */
+        struct evbuffer* data = evbuffer_new();
+        size_t const dataLen = tr_torrentAddMetadataPiece(msgs->torrent, piece, data, !msgs->is_encrypted());
 
-        if (data != nullptr)
+        if (dataLen > 0)
         {
-            tr_variant tmp;
-            struct evbuffer* payload;
-            struct evbuffer* out = msgs->outMessages;
+            struct evbuffer* out = msgs->out_messages();
 
-            /* build the data message */
-            tr_variantInitDict(&tmp, 3);
-            tr_variantDictAddInt(&tmp, TR_KEY_msg_type, METADATA_MSG_TYPE_DATA);
-            tr_variantDictAddInt(&tmp, TR_KEY_piece, piece);
-            tr_variantDictAddInt(&tmp, TR_KEY_total_size, msgs->torrent->infoDictLength);
-            payload = tr_variantToBuf(&tmp, TR_VARIANT_FMT_BENC);
+            /* build the data message. The keys are already in benc's sorted order */
+            char payload[128];
+            int const payloadLen = tr_snprintf(
+                payload,
+                sizeof(payload),
+                "d8:msg_typei%de5:piecei%de10:total_sizei%zuee",
+                int{ METADATA_MSG_TYPE_DATA },
+                piece,
+                msgs->torrent->infoDictLength);
 
             /* write it out as a LTEP message to our outMessages buffer */
-            evbuffer_add_uint32(out, 2 * sizeof(uint8_t) + evbuffer_get_length(payload) + dataLen);
+            evbuffer_add_uint32(out, 2 * sizeof(uint8_t) + payloadLen + dataLen);
             evbuffer_add_uint8(out, BT_LTEP);
             evbuffer_add_uint8(out, msgs->ut_metadata_id);
-            evbuffer_add_buffer(out, payload);
-            evbuffer_add(out, data, dataLen);
+            evbuffer_add(out, payload, payloadLen);
+            evbuffer_add_buffer(out, data);
             pokeBatchPeriod(msgs, HIGH_PRIORITY_INTERVAL_SECS);
             dbgOutMessageLen(msgs);
 
-            evbuffer_free(payload);
-            tr_variantFree(&tmp);
-            tr_free(data);
-
             ok = true;
         }
 
+        evbuffer_free(data);
+
         if (!ok) /* send a rejection message */
         {
             tr_variant tmp;
             struct evbuffer* payload;
-            struct evbuffer* out = msgs->outMessages;
+            struct evbuffer* out = msgs->out_messages();
 
             /* build the rejection message */
             tr_variantInitDict(&tmp, 2);
@@ -2179,28 +2248,74 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
         if (requestIsValid(msgs, &req) && tr_torrentPieceIsComplete(msgs->torrent, req.index))
         {
             bool err;
-            uint32_t const msglen = 4 + 1 + 4 + 4 + req.length;
-            struct evbuffer* out;
-            struct evbuffer_iovec iovec[1];
-
-            out = evbuffer_new();
-            evbuffer_expand(out, msglen);
-
-            evbuffer_add_uint32(out, sizeof(uint8_t) + 2 * sizeof(uint32_t) + req.length);
-            evbuffer_add_uint8(out, BT_PIECE);
-            evbuffer_add_uint32(out, req.index);
-            evbuffer_add_uint32(out, req.offset);
-
-            evbuffer_reserve_space(out, req.length, iovec, 1);
-            err = tr_cacheReadBlock(
-                      msgs->session->cache,
-                      msgs->torrent,
-                      req.index,
-                      req.offset,
-                      req.length,
-                      static_cast<uint8_t*>(iovec[0].iov_base)) != 0;
-            iovec[0].iov_len = req.length;
-            evbuffer_commit_space(out, iovec, 1);
+            auto reqs = std::array<peer_request, MAX_COALESCED_REQUESTS>{};
+            size_t n_reqs = 0;
+            uint32_t dataLen = 0;
+
+            reqs[n_reqs++] = req;
+            dataLen += req.length;
+
+            /* serve the requests queued right behind it in the same piece with the same read */
+            if (isWholeBlockRequest(msgs->torrent, &req))
+            {
+                size_t const space = tr_peerIoGetWriteBufferSpace(msgs->io, now);
+
+                while (n_reqs < std::size(reqs) && !std::empty(msgs->peerAskedFor))
+                {
+                    auto const& next = msgs->peerAskedFor.front();
+
+                    if (next.index != req.index || next.offset != req.offset + dataLen || !requestIsValid(msgs, &next) ||
+                        !isWholeBlockRequest(msgs->torrent, &next) || dataLen + next.length > space)
+                    {
+                        break;
+                    }
+
+                    popNextRequest(msgs, &reqs[n_reqs]);
+                    --msgs->prefetchCount;
+                    dataLen += reqs[n_reqs++].length;
+                }
+            }
+
+            uint32_t const headerLen = 4 + 1 + 4 + 4;
+            struct evbuffer* out = evbuffer_new();
+            evbuffer_expand(out, n_reqs * headerLen + dataLen);
+
+            if (n_reqs == 1)
+            {
+                struct evbuffer_iovec iovec[1];
+
+                evbuffer_add_uint32(out, sizeof(uint8_t) + 2 * sizeof(uint32_t) + req.length);
+                evbuffer_add_uint8(out, BT_PIECE);
+                evbuffer_add_uint32(out, req.index);
+                evbuffer_add_uint32(out, req.offset);
+
+                evbuffer_reserve_space(out, req.length, iovec, 1);
+                err = tr_cacheReadBlock(
+                          msgs->session->cache,
+                          msgs->torrent,
+                          req.index,
+                          req.offset,
+                          req.length,
+                          static_cast<uint8_t*>(iovec[0].iov_base)) != 0;
+                iovec[0].iov_len = req.length;
+                evbuffer_commit_space(out, iovec, 1);
+            }
+            else
+            {
+                auto data = std::vector<uint8_t>(dataLen);
+                err = tr_cacheReadBlocks(msgs->session->cache, msgs->torrent, req.index, req.offset, dataLen, std::data(data)) !=
+                    0;
+
+                for (size_t i = 0; !err && i < n_reqs; ++i)
+                {
+                    auto const& r = reqs[i];
+                    evbuffer_add_uint32(out, sizeof(uint8_t) + 2 * sizeof(uint32_t) + r.length);
+                    evbuffer_add_uint8(out, BT_PIECE);
+                    evbuffer_add_uint32(out, r.index);
+                    evbuffer_add_uint32(out, r.offset);
+                    evbuffer_add(out, std::data(data) + (r.offset - req.offset), r.length);
+                }
+            }
 
             /* check the piece if it needs checking... */
             if (!err && tr_torrentPieceNeedsCheck(msgs->torrent, req.index))
@@ -2220,18 +2335,24 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
             {
                 if (fext)
                 {
-                    protocolSendReject(msgs, &req);
+                    for (size_t i = 0; i < n_reqs; ++i)
+                    {
+                        protocolSendReject(msgs, &reqs[i]);
+                    }
                 }
             }
             else
             {
                 size_t const n = evbuffer_get_length(out);
-                dbgmsg(msgs, "sending block %u:%u->%u", req.index, req.offset, req.length);
-                TR_ASSERT(n == msglen);
+                dbgmsg(msgs, "sending %zu block(s) %u:%u->%u", n_reqs, req.index, req.offset, dataLen);
+                TR_ASSERT(n == n_reqs * headerLen + dataLen);
+
+                /* don't hold batched messages back when they can share a write with this piece data */
+                bytesWritten += flushOutMessages(msgs, now);
                 tr_peerIoWriteBuf(msgs->io, out, true);
                 bytesWritten += n;
                 msgs->clientSentAnythingAt = now;
-                msgs->blocksSentToPeer.add(tr_time(), 1);
+                msgs->blocksSentToPeer.add(tr_time(), n_reqs);
             }
 
             evbuffer_free(out);
@@ -2260,7 +2381,7 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
     if (msgs != nullptr && msgs->clientSentAnythingAt != 0 && now - msgs->clientSentAnythingAt > KEEPALIVE_INTERVAL_SECS)
     {
         dbgmsg(msgs, "sending a keepalive message");
-        evbuffer_add_uint32(msgs->outMessages, 0);
+        evbuffer_add_uint32(msgs->out_messages(), 0);
         pokeBatchPeriod(msgs, IMMEDIATE_PRIORITY_INTERVAL_SECS);
     }
 
@@ -2311,7 +2432,7 @@ static void sendBitfield(tr_peerMsgsImpl* msgs)
 
     void* bytes;
     size_t byte_count = 0;
-    struct evbuffer* out = msgs->outMessages;
+    struct evbuffer* out = msgs->out_messages();
 
     bytes = tr_torrentCreatePieceBitfield(msgs->torrent, &byte_count);
     evbuffer_add_uint32(out, sizeof(uint8_t) + byte_count);
@@ -2460,216 +2581,245 @@ static void tr_set_compare(
     }
 }
 
-static void sendPex(tr_peerMsgsImpl* msgs)
+static std::string buildPexPayload(PexDiffs const& diffs, PexDiffs const& diffs6)
 {
-    if (msgs->peerSupportsPex && tr_torrentAllowsPex(msgs->torrent))
-    {
-        PexDiffs diffs;
-        PexDiffs diffs6;
-        tr_pex* newPex = nullptr;
-        tr_pex* newPex6 = nullptr;
-        int const newCount = tr_peerMgrGetPeers(msgs->torrent, &newPex, TR_AF_INET, TR_PEERS_CONNECTED, MAX_PEX_PEER_COUNT);
-        int const newCount6 = tr_peerMgrGetPeers(msgs->torrent, &newPex6, TR_AF_INET6, TR_PEERS_CONNECTED, MAX_PEX_PEER_COUNT);
-
-        /* build the diffs */
-        diffs.added = tr_new(tr_pex, newCount);
-        diffs.addedCount = 0;
-        diffs.dropped = tr_new(tr_pex, msgs->pexCount);
-        diffs.droppedCount = 0;
-        diffs.elements = tr_new(tr_pex, newCount + msgs->pexCount);
-        diffs.elementCount = 0;
-        tr_set_compare(
-            msgs->pex,
-            msgs->pexCount,
-            newPex,
-            newCount,
-            tr_pexCompare,
-            sizeof(tr_pex),
-            pexDroppedCb,
-            pexAddedCb,
-            pexElementCb,
-            &diffs);
-        diffs6.added = tr_new(tr_pex, newCount6);
-        diffs6.addedCount = 0;
-        diffs6.dropped = tr_new(tr_pex, msgs->pexCount6);
-        diffs6.droppedCount = 0;
-        diffs6.elements = tr_new(tr_pex, newCount6 + msgs->pexCount6);
-        diffs6.elementCount = 0;
-        tr_set_compare(
-            msgs->pex6,
-            msgs->pexCount6,
-            newPex6,
-            newCount6,
-            tr_pexCompare,
-            sizeof(tr_pex),
-            pexDroppedCb,
-            pexAddedCb,
-            pexElementCb,
-            &diffs6);
-        dbgmsg(
-            msgs,
-            "pex: old peer count %d+%d, new peer count %d+%d, added %d+%d, removed %d+%d",
-            msgs->pexCount,
-            msgs->pexCount6,
-            newCount,
-            newCount6,
-            diffs.addedCount,
-            diffs6.addedCount,
-            diffs.droppedCount,
-            diffs6.droppedCount);
+    tr_variant val;
+    uint8_t* tmp;
+    uint8_t* walk;
+
+    tr_variantInitDict(&val, 3); /* ipv6 support: left as 3: speed vs. likelihood? */
+
+    if (diffs.addedCount > 0)
+    {
+        /* "added" */
+        tmp = walk = tr_new(uint8_t, diffs.addedCount * 6);
 
-        if (diffs.addedCount == 0 && diffs.droppedCount == 0 && diffs6.addedCount == 0 && diffs6.droppedCount == 0)
+        for (int i = 0; i < diffs.addedCount; ++i)
         {
-            tr_free(diffs.elements);
-            tr_free(diffs6.elements);
+            memcpy(walk, &diffs.added[i].addr.addr, 4);
+            walk += 4;
+            memcpy(walk, &diffs.added[i].port, 2);
+            walk += 2;
         }
-        else
+
+        TR_ASSERT(walk - tmp == diffs.addedCount * 6);
+        tr_variantDictAddRaw(&val, TR_KEY_added, tmp, walk - tmp);
+        tr_free(tmp);
+
+        /* "added.f"
+         * unset each holepunch flag because we don't support it. */
+        tmp = walk = tr_new(uint8_t, diffs.addedCount);
+
+        for (int i = 0; i < diffs.addedCount; ++i)
         {
-            tr_variant val;
-            uint8_t* tmp;
-            uint8_t* walk;
-            struct evbuffer* payload;
-            struct evbuffer* out = msgs->outMessages;
+            *walk++ = diffs.added[i].flags & ~ADDED_F_HOLEPUNCH;
+        }
 
-            /* update peer */
-            tr_free(msgs->pex);
-            msgs->pex = diffs.elements;
-            msgs->pexCount = diffs.elementCount;
-            tr_free(msgs->pex6);
-            msgs->pex6 = diffs6.elements;
-            msgs->pexCount6 = diffs6.elementCount;
+        TR_ASSERT(walk - tmp == diffs.addedCount);
+        tr_variantDictAddRaw(&val, TR_KEY_added_f, tmp, walk - tmp);
+        tr_free(tmp);
+    }
 
-            /* build the pex payload */
-            tr_variantInitDict(&val, 3); /* ipv6 support: left as 3: speed vs. likelihood? */
+    if (diffs.droppedCount > 0)
+    {
+        /* "dropped" */
+        tmp = walk = tr_new(uint8_t, diffs.droppedCount * 6);
 
-            if (diffs.addedCount > 0)
-            {
-                /* "added" */
-                tmp = walk = tr_new(uint8_t, diffs.addedCount * 6);
+        for (int i = 0; i < diffs.droppedCount; ++i)
+        {
+            memcpy(walk, &diffs.dropped[i].addr.addr, 4);
+            walk += 4;
+            memcpy(walk, &diffs.dropped[i].port, 2);
+            walk += 2;
+        }
 
-                for (int i = 0; i < diffs.addedCount; ++i)
-                {
-                    memcpy(walk, &diffs.added[i].addr.addr, 4);
-                    walk += 4;
-                    memcpy(walk, &diffs.added[i].port, 2);
-                    walk += 2;
-                }
+        TR_ASSERT(walk - tmp == diffs.droppedCount * 6);
+        tr_variantDictAddRaw(&val, TR_KEY_dropped, tmp, walk - tmp);
+        tr_free(tmp);
+    }
 
-                TR_ASSERT(walk - tmp == diffs.addedCount * 6);
-                tr_variantDictAddRaw(&val, TR_KEY_added, tmp, walk - tmp);
-                tr_free(tmp);
+    if (diffs6.addedCount > 0)
+    {
+        /* "added6" */
+        tmp = walk = tr_new(uint8_t, diffs6.addedCount * 18);
 
-                /* "added.f"
-                 * unset each holepunch flag because we don't support it. */
-                tmp = walk = tr_new(uint8_t, diffs.addedCount);
+        for (int i = 0; i < diffs6.addedCount; ++i)
+        {
+            memcpy(walk, &diffs6.added[i].addr.addr.addr6.s6_addr, 16);
+            walk += 16;
+            memcpy(walk, &diffs6.added[i].port, 2);
+            walk += 2;
+        }
 
-                for (int i = 0; i < diffs.addedCount; ++i)
-                {
-                    *walk++ = diffs.added[i].flags & ~ADDED_F_HOLEPUNCH;
-                }
+        TR_ASSERT(walk - tmp == diffs6.addedCount * 18);
+        tr_variantDictAddRaw(&val, TR_KEY_added6, tmp, walk - tmp);
+        tr_free(tmp);
 
-                TR_ASSERT(walk - tmp == diffs.addedCount);
-                tr_variantDictAddRaw(&val, TR_KEY_added_f, tmp, walk - tmp);
-                tr_free(tmp);
-            }
+        /* "added6.f"
+         * unset each holepunch flag because we don't support it. */
+        tmp = walk = tr_new(uint8_t, diffs6.addedCount);
 
-            if (diffs.droppedCount > 0)
-            {
-                /* "dropped" */
-                tmp = walk = tr_new(uint8_t, diffs.droppedCount * 6);
+        for (int i = 0; i < diffs6.addedCount; ++i)
+        {
+            *walk++ = diffs6.added[i].flags & ~ADDED_F_HOLEPUNCH;
+        }
 
-                for (int i = 0; i < diffs.droppedCount; ++i)
-                {
-                    memcpy(walk, &diffs.dropped[i].addr.addr, 4);
-                    walk += 4;
-                    memcpy(walk, &diffs.dropped[i].port, 2);
-                    walk += 2;
-                }
+        TR_ASSERT(walk - tmp == diffs6.addedCount);
+        tr_variantDictAddRaw(&val, TR_KEY_added6_f, tmp, walk - tmp);
+        tr_free(tmp);
+    }
 
-                TR_ASSERT(walk - tmp == diffs.droppedCount * 6);
-                tr_variantDictAddRaw(&val, TR_KEY_dropped, tmp, walk - tmp);
-                tr_free(tmp);
-            }
+    if (diffs6.droppedCount > 0)
+    {
+        /* "dropped6" */
+        tmp = walk = tr_new(uint8_t, diffs6.droppedCount * 18);
 
-            if (diffs6.addedCount > 0)
-            {
-                /* "added6" */
-                tmp = walk = tr_new(uint8_t, diffs6.addedCount * 18);
+        for (int i = 0; i < diffs6.droppedCount; ++i)
+        {
+            memcpy(walk, &diffs6.dropped[i].addr.addr.addr6.s6_addr, 16);
+            walk += 16;
+            memcpy(walk, &diffs6.dropped[i].port, 2);
+            walk += 2;
+        }
 
-                for (int i = 0; i < diffs6.addedCount; ++i)
-                {
-                    memcpy(walk, &diffs6.added[i].addr.addr.addr6.s6_addr, 16);
-                    walk += 16;
-                    memcpy(walk, &diffs6.added[i].port, 2);
-                    walk += 2;
-                }
+        TR_ASSERT(walk - tmp == diffs6.droppedCount * 18);
+        tr_variantDictAddRaw(&val, TR_KEY_dropped6, tmp, walk - tmp);
+        tr_free(tmp);
+    }
 
-                TR_ASSERT(walk - tmp == diffs6.addedCount * 18);
-                tr_variantDictAddRaw(&val, TR_KEY_added6, tmp, walk - tmp);
-                tr_free(tmp);
+    auto len = size_t{};
+    char* benc = tr_variantToStr(&val, TR_VARIANT_FMT_BENC, &len);
+    auto payload = std::string(benc, len);
+    tr_free(benc);
+    tr_variantFree(&val);
+    return payload;
+}
 
-                /* "added6.f"
-                 * unset each holepunch flag because we don't support it. */
-                tmp = walk = tr_new(uint8_t, diffs6.addedCount);
+static void sendPexPayload(tr_peerMsgsImpl* msgs, std::string const& payload)
+{
+    struct evbuffer* out = msgs->out_messages();
 
-                for (int i = 0; i < diffs6.addedCount; ++i)
-                {
-                    *walk++ = diffs6.added[i].flags & ~ADDED_F_HOLEPUNCH;
-                }
+    evbuffer_add_uint32(out, 2 * sizeof(uint8_t) + std::size(payload));
+    evbuffer_add_uint8(out, BT_LTEP);
+    evbuffer_add_uint8(out, msgs->ut_pex_id);
+    evbuffer_add(out, std::data(payload), std::size(payload));
+    pokeBatchPeriod(msgs, HIGH_PRIORITY_INTERVAL_SECS);
+    dbgmsg(msgs, "sending a pex message; outMessage size is now %zu", evbuffer_get_length(out));
+    dbgOutMessageLen(msgs);
+}
 
-                TR_ASSERT(walk - tmp == diffs6.addedCount);
-                tr_variantDictAddRaw(&val, TR_KEY_added6_f, tmp, walk - tmp);
-                tr_free(tmp);
-            }
+static void pexDiffsInit(PexDiffs* diffs, std::vector<tr_pex> const& sent, std::vector<tr_pex> const& current)
+{
+    diffs->added = tr_new(tr_pex, std::size(current));
+    diffs->addedCount = 0;
+    diffs->dropped = tr_new(tr_pex, std::size(sent));
+    diffs->droppedCount = 0;
+    diffs->elements = tr_new(tr_pex, std::size(current) + std::size(sent));
+    diffs->elementCount = 0;
+    tr_set_compare(
+        std::data(sent),
+        std::size(sent),
+        std::data(current),
+        std::size(current),
+        tr_pexCompare,
+        sizeof(tr_pex),
+        pexDroppedCb,
+        pexAddedCb,
+        pexElementCb,
+        diffs);
+}
 
-            if (diffs6.droppedCount > 0)
-            {
-                /* "dropped6" */
-                tmp = walk = tr_new(uint8_t, diffs6.droppedCount * 18);
+static void pexDiffsFree(PexDiffs* diffs)
+{
+    tr_free(diffs->added);
+    tr_free(diffs->dropped);
+    tr_free(diffs->elements);
+}
 
-                for (int i = 0; i < diffs6.droppedCount; ++i)
-                {
-                    memcpy(walk, &diffs6.dropped[i].addr.addr.addr6.s6_addr, 16);
-                    walk += 16;
-                    memcpy(walk, &diffs6.dropped[i].port, 2);
-                    walk += 2;
-                }
+static void sendPex(tr_peerMsgsImpl* msgs)
+{
+    msgs->pexSentAt = tr_time();
 
-                TR_ASSERT(walk - tmp == diffs6.droppedCount * 18);
-                tr_variantDictAddRaw(&val, TR_KEY_dropped6, tmp, walk - tmp);
-                tr_free(tmp);
-            }
+    if (!msgs->peerSupportsPex || !tr_torrentAllowsPex(msgs->torrent))
+    {
+        return;
+    }
 
-            /* write the pex message */
-            payload = tr_variantToBuf(&val, TR_VARIANT_FMT_BENC);
-            evbuffer_add_uint32(out, 2 * sizeof(uint8_t) + evbuffer_get_length(payload));
-            evbuffer_add_uint8(out, BT_LTEP);
-            evbuffer_add_uint8(out, msgs->ut_pex_id);
-            evbuffer_add_buffer(out, payload);
-            pokeBatchPeriod(msgs, HIGH_PRIORITY_INTERVAL_SECS);
-            dbgmsg(msgs, "sending a pex message; outMessage size is now %zu", evbuffer_get_length(out));
-            dbgOutMessageLen(msgs);
+    auto snapshot = tr_peerMgrGetPexSnapshot(msgs->torrent, MAX_PEX_PEER_COUNT);
 
-            evbuffer_free(payload);
-            tr_variantFree(&val);
+    if (msgs->pexSent == snapshot)
+    {
+        return;
+    }
+
+    /* peers that are one snapshot behind all get the same diff */
+    bool const isShareable = msgs->pexSent != nullptr && msgs->pexSent == snapshot->previous;
+
+    if (isShareable && snapshot->hasPayload)
+    {
+        if (!std::empty(snapshot->payload))
+        {
+            sendPexPayload(msgs, snapshot->payload);
         }
 
-        /* cleanup */
-        tr_free(diffs.added);
-        tr_free(diffs.dropped);
-        tr_free(newPex);
-        tr_free(diffs6.added);
-        tr_free(diffs6.dropped);
-        tr_free(newPex6);
+        msgs->pexSent = std::move(snapshot);
+        return;
     }
-}
 
-static void pexPulse([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vmsgs)
-{
-    auto* msgs = static_cast<tr_peerMsgsImpl*>(vmsgs);
+    auto const no_pex = std::vector<tr_pex>{};
+    auto const& sent = msgs->pexSent ? msgs->pexSent->pex : no_pex;
+    auto const& sent6 = msgs->pexSent ? msgs->pexSent->pex6 : no_pex;
+    PexDiffs diffs;
+    PexDiffs diffs6;
+    pexDiffsInit(&diffs, sent, snapshot->pex);
+    pexDiffsInit(&diffs6, sent6, snapshot->pex6);
+    dbgmsg(
+        msgs,
+        "pex: old peer count %zu+%zu, new peer count %zu+%zu, added %d+%d, removed %d+%d",
+        std::size(sent),
+        std::size(sent6),
+        std::size(snapshot->pex),
+        std::size(snapshot->pex6),
+        diffs.addedCount,
+        diffs6.addedCount,
+        diffs.droppedCount,
+        diffs6.droppedCount);
+
+    auto payload = std::string{};
+
+    if (diffs.addedCount != 0 || diffs.droppedCount != 0 || diffs6.addedCount != 0 || diffs6.droppedCount != 0)
+    {
+        payload = buildPexPayload(diffs, diffs6);
+        sendPexPayload(msgs, payload);
+    }
 
-    sendPex(msgs);
+    /* if MAX_PEX_ADDED cut the message short, the peer only knows about some of the snapshot */
+    if (size_t(diffs.elementCount) == std::size(snapshot->pex) && size_t(diffs6.elementCount) == std::size(snapshot->pex6))
+    {
+        if (isShareable)
+        {
+            snapshot->payload = std::move(payload);
+            snapshot->hasPayload = true;
+        }
 
-    TR_ASSERT(msgs->pex_timer);
-    tr_timerAdd(msgs->pex_timer.get(), PEX_INTERVAL_SECS, 0);
+        msgs->pexSent = std::move(snapshot);
+    }
+    else
+    {
+        auto told = std::make_shared<tr_pex_snapshot>();
+        told->pex.assign(diffs.elements, diffs.elements + diffs.elementCount);
+        told->pex6.assign(diffs6.elements, diffs6.elements + diffs6.elementCount);
+        msgs->pexSent = std::move(told);
+    }
+
+    pexDiffsFree(&diffs);
+    pexDiffsFree(&diffs6);
+}
+
+void tr_peerMsgsImpl::pex_pulse(time_t now)
+{
+    if (now - pexSentAt >= PEX_INTERVAL_SECS)
+    {
+        sendPex(this);
+    }
 }
@@ -48,15 +48,28 @@ public:
     virtual void update_active(tr_direction direction) = 0;
 
     virtual time_t get_connection_age() const = 0;
+
+    /* how many block requests we try to keep outstanding with this peer */
+    virtual int get_desired_request_count() const = 0;
+
+    /* the smoothed time between requesting a block and getting it, or 0 if unknown */
+    virtual uint32_t get_request_rtt_msec() const = 0;
     virtual bool is_reading_block(tr_block_index_t block) const = 0;
 
     virtual void cancel_block_request(tr_block_index_t block) = 0;
 
+    /* the blocks this peer has asked us for, in the order we'll send them */
+    virtual size_t get_upload_request_blocks(tr_block_index_t* setme, size_t max) const = 0;
+
     virtual void set_choke(bool peer_is_choked) = 0;
     virtual void set_interested(bool client_is_interested) = 0;
 
     virtual void pulse() = 0;
 
+    /* called periodically by the peer manager, which drives every peer's ut_pex
+       messages from one timer instead of giving each connection its own */
+    virtual void pex_pulse(time_t now) = 0;
+
     virtual void on_piece_completed(tr_piece_index_t) = 0;
 };
 
@@ -0,0 +1,65 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <chrono>
+
+#include "transmission.h"
+#include "perf.h"
+#include "session.h"
+#include "tr-assert.h"
+
+uint64_t tr_perfNowUsec()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static size_t histogramBucket(uint64_t value)
+{
+    size_t bucket = 0;
+
+    while (value != 0 && bucket + 1 < TR_PERF_HISTOGRAM_SIZE)
+    {
+        value >>= 1;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+void tr_perfAdd(tr_session* session, tr_perf_probe probe, uint64_t usec)
+{
+    TR_ASSERT(probe < TR_PERF_PROBE_COUNT);
+
+    auto& p = session->perfCounters.probes[probe];
+    p.count.fetch_add(1, std::memory_order_relaxed);
+    p.total_usec.fetch_add(usec, std::memory_order_relaxed);
+    p.usec[histogramBucket(usec)].fetch_add(1, std::memory_order_relaxed);
+
+    auto max = p.max_usec.load(std::memory_order_relaxed);
+    while (usec > max && !p.max_usec.compare_exchange_weak(max, usec, std::memory_order_relaxed))
+    {
+    }
+}
+
+void tr_perfGetStats(tr_session const* session, tr_perf_stats* setme)
+{
+    for (int i = 0; i < TR_PERF_PROBE_COUNT; ++i)
+    {
+        auto const& p = session->perfCounters.probes[i];
+        auto& counter = setme->probes[i];
+        counter.count = p.count.load(std::memory_order_relaxed);
+        counter.total_usec = p.total_usec.load(std::memory_order_relaxed);
+        counter.max_usec = p.max_usec.load(std::memory_order_relaxed);
+
+        for (int j = 0; j < TR_PERF_HISTOGRAM_SIZE; ++j)
+        {
+            counter.usec[j] = p.usec[j].load(std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,115 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <array>
+#include <atomic>
+#include <cstdint> // uint64_t
+
+struct tr_session;
+
+/**
+ * @addtogroup perf Performance counters
+ *
+ * Probes time the session's hot paths and count them in per-probe
+ * histograms. They're always compiled in: a probe costs two clock reads
+ * and a few relaxed atomic adds, so they can be left running in a daemon
+ * and read over RPC with "session-perf".
+ *
+ * @{
+ */
+
+enum tr_perf_probe
+{
+    TR_PERF_EVENT_LOOP, /* how late the session thread ran its timers */
+    TR_PERF_BANDWIDTH_PULSE, /* the peer manager's bandwidth pulse */
+    TR_PERF_CACHE_FLUSH, /* writing one run of blocks from the cache to disk */
+    TR_PERF_DISK_READ, /* one tr_ioRead() */
+    TR_PERF_DISK_WRITE, /* one tr_ioWrite() */
+    TR_PERF_HASH, /* SHA-1 of one piece, when it's completed or verified */
+    TR_PERF_RPC, /* handling one RPC request */
+    TR_PERF_HANDSHAKE, /* handling what a handshaking peer sent */
+    TR_PERF_PROBE_COUNT
+};
+
+enum
+{
+    /* wide enough that slow disk I/O and event loop stalls, which can take
+       seconds, still land in a bucket of their own instead of the last one */
+    TR_PERF_HISTOGRAM_SIZE = 32
+};
+
+/* What one probe has seen. usec is a log2 histogram like the ones in
+   tr_handshake_stats: bucket 0 counts zeroes, bucket i counts values in
+   [2^(i-1), 2^i), and the last bucket counts everything from 2^30 usec
+   (about 18 minutes) up. */
+struct tr_perf_counter
+{
+    uint64_t count;
+    uint64_t total_usec;
+    uint64_t max_usec;
+    uint64_t usec[TR_PERF_HISTOGRAM_SIZE];
+};
+
+struct tr_perf_stats
+{
+    tr_perf_counter probes[TR_PERF_PROBE_COUNT];
+};
+
+/* the live counters, kept in tr_session. Probes fire on several threads, so they're atomics */
+struct tr_perf_counters
+{
+    struct Probe
+    {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> total_usec;
+        std::atomic<uint64_t> max_usec;
+        std::array<std::atomic<uint64_t>, TR_PERF_HISTOGRAM_SIZE> usec;
+    };
+
+    std::array<Probe, TR_PERF_PROBE_COUNT> probes;
+};
+
+/* a monotonic clock in usec for timing probes */
+uint64_t tr_perfNowUsec();
+
+void tr_perfAdd(tr_session* session, tr_perf_probe probe, uint64_t usec);
+
+void tr_perfGetStats(tr_session const* session, tr_perf_stats* setme);
+
+/* times the scope it's declared in and adds the result to a probe */
+class tr_perf_scope
+{
+public:
+    tr_perf_scope(tr_session* session, tr_perf_probe probe)
+        : session_{ session }
+        , probe_{ probe }
+        , begin_usec_{ tr_perfNowUsec() }
+    {
+    }
+
+    ~tr_perf_scope()
+    {
+        tr_perfAdd(session_, probe_, tr_perfNowUsec() - begin_usec_);
+    }
+
+    tr_perf_scope(tr_perf_scope const&) = delete;
+    tr_perf_scope& operator=(tr_perf_scope const&) = delete;
+
+private:
+    tr_session* const session_;
+    tr_perf_probe const probe_;
+    uint64_t const begin_usec_;
+};
+
+/* @} */
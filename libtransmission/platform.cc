@@ -6,6 +6,8 @@
  *
  */
 
+#include <algorithm> // std::max()
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <list>
@@ -149,6 +151,7 @@ tr_thread* tr_threadNew(void (*func)(void*), void* arg)
 struct tr_lock
 {
     int depth;
+    tr_lock_stats stats;
 #ifdef _WIN32
     CRITICAL_SECTION lock;
     DWORD lockThread;
@@ -192,14 +195,37 @@ void tr_lockFree(tr_lock* l)
 void tr_lockLock(tr_lock* l)
 {
 #ifdef _WIN32
-    EnterCriticalSection(&l->lock);
+    bool const is_uncontended = TryEnterCriticalSection(&l->lock) != 0;
 #else
-    pthread_mutex_lock(&l->lock);
+    bool const is_uncontended = pthread_mutex_trylock(&l->lock) == 0;
 #endif
 
+    if (!is_uncontended)
+    {
+        /* another thread holds it, so time how long we wait for it */
+        auto const begin = std::chrono::steady_clock::now();
+
+#ifdef _WIN32
+        EnterCriticalSection(&l->lock);
+#else
+        pthread_mutex_lock(&l->lock);
+#endif
+
+        auto const waited = std::chrono::steady_clock::now() - begin;
+        auto const wait_usec = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(waited).count());
+        ++l->stats.contended;
+        l->stats.wait_usec += wait_usec;
+        l->stats.max_wait_usec = std::max(l->stats.max_wait_usec, wait_usec);
+    }
+
     TR_ASSERT(l->depth >= 0);
     TR_ASSERT(l->depth == 0 || tr_areThreadsEqual(l->lockThread, tr_getCurrentThread()));
 
+    if (l->depth == 0)
+    {
+        ++l->stats.acquisitions;
+    }
+
     l->lockThread = tr_getCurrentThread();
     ++l->depth;
 }
@@ -209,6 +235,13 @@ bool tr_lockHave(tr_lock const* l)
     return l->depth > 0 && tr_areThreadsEqual(l->lockThread, tr_getCurrentThread());
 }
 
+void tr_lockGetStats(tr_lock const* l, tr_lock_stats* setme)
+{
+    TR_ASSERT(tr_lockHave(l));
+
+    *setme = l->stats;
+}
+
 void tr_lockUnlock(tr_lock* l)
 {
     TR_ASSERT(l->depth > 0);
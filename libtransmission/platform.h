@@ -12,6 +12,8 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstdint> // uint64_t
+
 #define TR_PATH_DELIMITER '/'
 #define TR_PATH_DELIMITER_STR "/"
 
@@ -77,4 +79,16 @@ void tr_lockUnlock(tr_lock*);
 /** @brief return nonzero if the specified lock is locked */
 bool tr_lockHave(tr_lock const*);
 
+/** @brief how often a thread mutex object was taken, and how long threads waited for it */
+struct tr_lock_stats
+{
+    uint64_t acquisitions; /* times a thread that didn't already hold it took it */
+    uint64_t contended; /* how many of those had to wait for another thread to release it */
+    uint64_t wait_usec; /* total time spent waiting */
+    uint64_t max_wait_usec; /* longest single wait */
+};
+
+/** @brief get a thread mutex object's counters. The caller must hold the lock */
+void tr_lockGetStats(tr_lock const*, tr_lock_stats* setme);
+
 /* @} */
@@ -10,6 +10,7 @@
 #include <array>
 #include <cstring> // strlen()
 #include <iterator>
+#include <mutex>
 #include <string_view>
 #include <vector>
 
@@ -21,7 +22,8 @@
 namespace
 {
 
-auto constexpr my_static = std::array<std::string_view, 388>{ "",
+auto constexpr my_static = std::array<std::string_view, 447>{ "",
+                                                              "acquisitions",
                                                               "activeTorrentCount",
                                                               "activity-date",
                                                               "activityDate",
@@ -46,6 +48,7 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "anti-brute-force-threshold",
                                                               "arguments",
                                                               "bandwidth-priority",
+                                                              "bandwidth-pulse",
                                                               "bandwidthPriority",
                                                               "bind-address-ipv4",
                                                               "bind-address-ipv6",
@@ -56,8 +59,13 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "blocklist-updates-enabled",
                                                               "blocklist-url",
                                                               "blocks",
+                                                              "blocksLoaded",
+                                                              "blocksWasted",
                                                               "bytesCompleted",
+                                                              "bytesWritten",
+                                                              "cache-flush",
                                                               "cache-size-mb",
+                                                              "calls",
                                                               "clientIsChoked",
                                                               "clientIsInterested",
                                                               "clientName",
@@ -66,15 +74,18 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "compact-view",
                                                               "complete",
                                                               "config-dir",
+                                                              "contended",
                                                               "cookies",
                                                               "corrupt",
                                                               "corruptEver",
+                                                              "count",
                                                               "created by",
                                                               "created by.utf-8",
                                                               "creation date",
                                                               "creator",
                                                               "cumulative-stats",
                                                               "current-stats",
+                                                              "cursor",
                                                               "date",
                                                               "dateCreated",
                                                               "delete-local-data",
@@ -82,7 +93,13 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "destination",
                                                               "details-window-height",
                                                               "details-window-width",
+                                                              "dhKeyPoolHits",
+                                                              "dhKeyPoolMisses",
+                                                              "dhUsec",
                                                               "dht-enabled",
+                                                              "disk-read",
+                                                              "disk-write",
+                                                              "diskReads",
                                                               "display-name",
                                                               "dnd",
                                                               "done-date",
@@ -104,6 +121,7 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "downloading-time-seconds",
                                                               "dropped",
                                                               "dropped6",
+                                                              "durationMsec",
                                                               "e",
                                                               "editDate",
                                                               "encoding",
@@ -112,8 +130,13 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "errorString",
                                                               "eta",
                                                               "etaIdle",
+                                                              "event-loop",
+                                                              "event-queue-stats",
+                                                              "events",
+                                                              "evictions",
                                                               "failure reason",
                                                               "fields",
+                                                              "file-cache-stats",
                                                               "file-count",
                                                               "fileStats",
                                                               "filename",
@@ -122,6 +145,7 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "files-unwanted",
                                                               "files-wanted",
                                                               "filesAdded",
+                                                              "filter",
                                                               "filter-mode",
                                                               "filter-text",
                                                               "filter-trackers",
@@ -135,12 +159,18 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "fromLtep",
                                                               "fromPex",
                                                               "fromTracker",
+                                                              "handshake",
+                                                              "handshake-stats",
                                                               "hasAnnounced",
                                                               "hasScraped",
+                                                              "hash",
                                                               "hashString",
                                                               "have",
                                                               "haveUnchecked",
                                                               "haveValid",
+                                                              "havesSuppressed",
+                                                              "histogram",
+                                                              "hits",
                                                               "honorsSessionLimits",
                                                               "host",
                                                               "id",
@@ -180,9 +210,12 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "lastScrapeSucceeded",
                                                               "lastScrapeTime",
                                                               "lastScrapeTimedOut",
+                                                              "latencyUsec",
                                                               "leecherCount",
                                                               "leftUntilDone",
                                                               "length",
+                                                              "level",
+                                                              "limit",
                                                               "location",
                                                               "lpd-enabled",
                                                               "m",
@@ -197,8 +230,12 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "manualAnnounceTime",
                                                               "max-peers",
                                                               "maxConnectedPeers",
+                                                              "maxDepth",
+                                                              "maxUsec",
+                                                              "maxWaitUsec",
                                                               "memory-bytes",
                                                               "memory-units",
+                                                              "message",
                                                               "message-level",
                                                               "metadataPercentComplete",
                                                               "metadata_size",
@@ -206,6 +243,8 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "method",
                                                               "min interval",
                                                               "min_request_interval",
+                                                              "misses",
+                                                              "mmap-enabled",
                                                               "move",
                                                               "msg_type",
                                                               "mtimes",
@@ -215,7 +254,11 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "nextScrapeTime",
                                                               "nodes",
                                                               "nodes6",
+                                                              "offset",
                                                               "open-dialog-dir",
+                                                              "open-file-limit",
+                                                              "openFiles",
+                                                              "overflow",
                                                               "p",
                                                               "path",
                                                               "path.utf-8",
@@ -231,6 +274,7 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "peer-port-random-low",
                                                               "peer-port-random-on-start",
                                                               "peer-socket-tos",
+                                                              "peer-write-stats",
                                                               "peerIsChoked",
                                                               "peerIsInterested",
                                                               "peers",
@@ -277,6 +321,10 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "ratio-limit",
                                                               "ratio-limit-enabled",
                                                               "ratio-mode",
+                                                              "ratioMax",
+                                                              "ratioMin",
+                                                              "read-ahead-depth",
+                                                              "read-ahead-stats",
                                                               "recent-download-dir-1",
                                                               "recent-download-dir-2",
                                                               "recent-download-dir-3",
@@ -292,6 +340,7 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "rename-partial-files",
                                                               "reqq",
                                                               "result",
+                                                              "rpc",
                                                               "rpc-authentication-required",
                                                               "rpc-bind-address",
                                                               "rpc-enabled",
@@ -325,6 +374,7 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "seeding-time-seconds",
                                                               "session-count",
                                                               "session-id",
+                                                              "session-lock-stats",
                                                               "sessionCount",
                                                               "show-backup-trackers",
                                                               "show-extra-peer-details",
@@ -337,8 +387,10 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "size-bytes",
                                                               "size-units",
                                                               "sizeWhenDone",
+                                                              "sort",
                                                               "sort-mode",
                                                               "sort-reversed",
+                                                              "sortReverse",
                                                               "speed",
                                                               "speed-Bps",
                                                               "speed-bytes",
@@ -355,6 +407,7 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "tag",
                                                               "tier",
                                                               "time-checked",
+                                                              "timeout",
                                                               "torrent-added",
                                                               "torrent-added-notification-command",
                                                               "torrent-added-notification-enabled",
@@ -369,16 +422,20 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "torrentCount",
                                                               "torrentFile",
                                                               "torrents",
+                                                              "totalCount",
                                                               "totalSize",
+                                                              "totalUsec",
                                                               "total_size",
                                                               "tracker id",
                                                               "trackerAdd",
+                                                              "trackerHost",
                                                               "trackerRemove",
                                                               "trackerReplace",
                                                               "trackerStats",
                                                               "trackers",
                                                               "trash-can-enabled",
                                                               "trash-original-torrent-files",
+                                                              "type",
                                                               "umask",
                                                               "units",
                                                               "upload-slots-per-torrent",
@@ -403,12 +460,15 @@ auto constexpr my_static = std::array<std::string_view, 388>{ "",
                                                               "utp-enabled",
                                                               "v",
                                                               "version",
+                                                              "waitUsec",
+                                                              "wakeups",
                                                               "wanted",
                                                               "warning message",
                                                               "watch-dir",
                                                               "watch-dir-enabled",
                                                               "webseeds",
-                                                              "webseedsSendingToUs" };
+                                                              "webseedsSendingToUs",
+                                                              "writeCalls" };
 
 size_t constexpr quarks_are_sorted = ( //
     []() constexpr
@@ -426,17 +486,15 @@ size_t constexpr quarks_are_sorted = ( //
 
 static_assert(quarks_are_sorted, "Predefined quarks must be sorted by their string value");
 
+/* Quarks added at runtime. Torrents are parsed on worker threads too, so
+   this is guarded by a mutex. The strings themselves are never freed or
+   moved, so pointers handed out by tr_quark_get_string() stay valid after
+   the vector grows. */
 auto& my_runtime{ *new std::vector<std::string_view>{} };
+auto& my_runtime_mutex{ *new std::mutex{} };
 
-} // namespace
-
-bool tr_quark_lookup(void const* str, size_t len, tr_quark* setme)
+bool lookupStatic(std::string_view key, tr_quark* setme)
 {
-    auto constexpr n_static = std::size(my_static);
-    static_assert(n_static == TR_N_KEYS);
-
-    /* is it in our static array? */
-    auto const key = std::string_view{ static_cast<char const*>(str), len };
     auto constexpr sbegin = std::begin(my_static), send = std::end(my_static);
     auto const sit = std::lower_bound(sbegin, send, key);
     if (sit != send && *sit == key)
@@ -445,7 +503,12 @@ bool tr_quark_lookup(void const* str, size_t len, tr_quark* setme)
         return true;
     }
 
-    /* was it added during runtime? */
+    return false;
+}
+
+/* the caller must hold my_runtime_mutex */
+bool lookupRuntime(std::string_view key, tr_quark* setme)
+{
     auto const rbegin = std::begin(my_runtime), rend = std::end(my_runtime);
     auto const rit = std::find(rbegin, rend, key);
     if (rit != rend)
@@ -457,6 +520,26 @@ bool tr_quark_lookup(void const* str, size_t len, tr_quark* setme)
     return false;
 }
 
+} // namespace
+
+bool tr_quark_lookup(void const* str, size_t len, tr_quark* setme)
+{
+    auto constexpr n_static = std::size(my_static);
+    static_assert(n_static == TR_N_KEYS);
+
+    auto const key = std::string_view{ static_cast<char const*>(str), len };
+
+    /* is it in our static array? */
+    if (lookupStatic(key, setme))
+    {
+        return true;
+    }
+
+    /* was it added during runtime? */
+    auto const lock = std::lock_guard{ my_runtime_mutex };
+    return lookupRuntime(key, setme);
+}
+
 tr_quark tr_quark_new(void const* str, size_t len)
 {
     tr_quark ret = TR_KEY_NONE;
@@ -468,10 +551,17 @@ tr_quark tr_quark_new(void const* str, size_t len)
             len = strlen(static_cast<char const*>(str));
         }
 
-        if (!tr_quark_lookup(str, len, &ret))
+        auto const key = std::string_view{ static_cast<char const*>(str), len };
+
+        if (!lookupStatic(key, &ret))
         {
-            ret = TR_N_KEYS + std::size(my_runtime);
-            my_runtime.emplace_back(tr_strndup(str, len), len);
+            auto const lock = std::lock_guard{ my_runtime_mutex };
+
+            if (!lookupRuntime(key, &ret))
+            {
+                ret = TR_N_KEYS + std::size(my_runtime);
+                my_runtime.emplace_back(tr_strndup(str, len), len);
+            }
         }
     }
 
@@ -480,7 +570,17 @@ tr_quark tr_quark_new(void const* str, size_t len)
 
 char const* tr_quark_get_string(tr_quark q, size_t* len)
 {
-    auto const& tmp = q < TR_N_KEYS ? my_static[q] : my_runtime[q - TR_N_KEYS];
+    auto tmp = std::string_view{};
+
+    if (q < TR_N_KEYS)
+    {
+        tmp = my_static[q];
+    }
+    else
+    {
+        auto const lock = std::lock_guard{ my_runtime_mutex };
+        tmp = my_runtime[q - TR_N_KEYS];
+    }
 
     if (len != nullptr)
     {
@@ -23,6 +23,7 @@ using tr_quark = size_t;
 enum
 {
     TR_KEY_NONE, /* represented as an empty string */
+    TR_KEY_acquisitions,
     TR_KEY_activeTorrentCount, /* rpc */
     TR_KEY_activity_date, /* resume file */
     TR_KEY_activityDate, /* rpc */
@@ -47,6 +48,7 @@ enum
     TR_KEY_anti_brute_force_threshold, /* rpc */
     TR_KEY_arguments, /* rpc */
     TR_KEY_bandwidth_priority,
+    TR_KEY_bandwidth_pulse,
     TR_KEY_bandwidthPriority,
     TR_KEY_bind_address_ipv4,
     TR_KEY_bind_address_ipv6,
@@ -57,8 +59,13 @@ enum
     TR_KEY_blocklist_updates_enabled,
     TR_KEY_blocklist_url,
     TR_KEY_blocks,
+    TR_KEY_blocksLoaded,
+    TR_KEY_blocksWasted,
     TR_KEY_bytesCompleted,
+    TR_KEY_bytesWritten,
+    TR_KEY_cache_flush,
     TR_KEY_cache_size_mb,
+    TR_KEY_calls,
     TR_KEY_clientIsChoked,
     TR_KEY_clientIsInterested,
     TR_KEY_clientName,
@@ -67,15 +74,18 @@ enum
     TR_KEY_compact_view,
     TR_KEY_complete,
     TR_KEY_config_dir,
+    TR_KEY_contended,
     TR_KEY_cookies,
     TR_KEY_corrupt,
     TR_KEY_corruptEver,
+    TR_KEY_count,
     TR_KEY_created_by,
     TR_KEY_created_by_utf_8,
     TR_KEY_creation_date,
     TR_KEY_creator,
     TR_KEY_cumulative_stats,
     TR_KEY_current_stats,
+    TR_KEY_cursor, /* rpc */
     TR_KEY_date,
     TR_KEY_dateCreated,
     TR_KEY_delete_local_data,
@@ -83,7 +93,13 @@ enum
     TR_KEY_destination,
     TR_KEY_details_window_height,
     TR_KEY_details_window_width,
+    TR_KEY_dhKeyPoolHits,
+    TR_KEY_dhKeyPoolMisses,
+    TR_KEY_dhUsec,
     TR_KEY_dht_enabled,
+    TR_KEY_disk_read,
+    TR_KEY_disk_write,
+    TR_KEY_diskReads,
     TR_KEY_display_name,
     TR_KEY_dnd,
     TR_KEY_done_date,
@@ -105,6 +121,7 @@ enum
     TR_KEY_downloading_time_seconds,
     TR_KEY_dropped,
     TR_KEY_dropped6,
+    TR_KEY_durationMsec,
     TR_KEY_e,
     TR_KEY_editDate,
     TR_KEY_encoding,
@@ -113,8 +130,13 @@ enum
     TR_KEY_errorString,
     TR_KEY_eta,
     TR_KEY_etaIdle,
+    TR_KEY_event_loop,
+    TR_KEY_event_queue_stats,
+    TR_KEY_events, /* rpc */
+    TR_KEY_evictions,
     TR_KEY_failure_reason,
     TR_KEY_fields,
+    TR_KEY_file_cache_stats,
     TR_KEY_file_count,
     TR_KEY_fileStats,
     TR_KEY_filename,
@@ -123,6 +145,7 @@ enum
     TR_KEY_files_unwanted,
     TR_KEY_files_wanted,
     TR_KEY_filesAdded,
+    TR_KEY_filter, /* rpc */
     TR_KEY_filter_mode,
     TR_KEY_filter_text,
     TR_KEY_filter_trackers,
@@ -136,12 +159,18 @@ enum
     TR_KEY_fromLtep,
     TR_KEY_fromPex,
     TR_KEY_fromTracker,
+    TR_KEY_handshake,
+    TR_KEY_handshake_stats,
     TR_KEY_hasAnnounced,
     TR_KEY_hasScraped,
+    TR_KEY_hash,
     TR_KEY_hashString,
     TR_KEY_have,
     TR_KEY_haveUnchecked,
     TR_KEY_haveValid,
+    TR_KEY_havesSuppressed,
+    TR_KEY_histogram,
+    TR_KEY_hits,
     TR_KEY_honorsSessionLimits,
     TR_KEY_host,
     TR_KEY_id,
@@ -181,9 +210,12 @@ enum
     TR_KEY_lastScrapeSucceeded,
     TR_KEY_lastScrapeTime,
     TR_KEY_lastScrapeTimedOut,
+    TR_KEY_latencyUsec,
     TR_KEY_leecherCount,
     TR_KEY_leftUntilDone,
     TR_KEY_length,
+    TR_KEY_level, /* rpc */
+    TR_KEY_limit, /* rpc */
     TR_KEY_location,
     TR_KEY_lpd_enabled,
     TR_KEY_m,
@@ -198,8 +230,12 @@ enum
     TR_KEY_manualAnnounceTime,
     TR_KEY_max_peers,
     TR_KEY_maxConnectedPeers,
+    TR_KEY_maxDepth,
+    TR_KEY_maxUsec,
+    TR_KEY_maxWaitUsec,
     TR_KEY_memory_bytes,
     TR_KEY_memory_units,
+    TR_KEY_message, /* rpc */
     TR_KEY_message_level,
     TR_KEY_metadataPercentComplete,
     TR_KEY_metadata_size,
@@ -207,6 +243,8 @@ enum
     TR_KEY_method,
     TR_KEY_min_interval,
     TR_KEY_min_request_interval,
+    TR_KEY_misses,
+    TR_KEY_mmap_enabled,
     TR_KEY_move,
     TR_KEY_msg_type,
     TR_KEY_mtimes,
@@ -216,7 +254,11 @@ enum
     TR_KEY_nextScrapeTime,
     TR_KEY_nodes,
     TR_KEY_nodes6,
+    TR_KEY_offset, /* rpc */
     TR_KEY_open_dialog_dir,
+    TR_KEY_open_file_limit,
+    TR_KEY_openFiles,
+    TR_KEY_overflow, /* rpc */
     TR_KEY_p,
     TR_KEY_path,
     TR_KEY_path_utf_8,
@@ -232,6 +274,7 @@ enum
     TR_KEY_peer_port_random_low,
     TR_KEY_peer_port_random_on_start,
     TR_KEY_peer_socket_tos,
+    TR_KEY_peer_write_stats,
     TR_KEY_peerIsChoked,
     TR_KEY_peerIsInterested,
     TR_KEY_peers,
@@ -278,6 +321,10 @@ enum
     TR_KEY_ratio_limit,
     TR_KEY_ratio_limit_enabled,
     TR_KEY_ratio_mode,
+    TR_KEY_ratioMax, /* rpc */
+    TR_KEY_ratioMin, /* rpc */
+    TR_KEY_read_ahead_depth,
+    TR_KEY_read_ahead_stats,
     TR_KEY_recent_download_dir_1,
     TR_KEY_recent_download_dir_2,
     TR_KEY_recent_download_dir_3,
@@ -293,6 +340,7 @@ enum
     TR_KEY_rename_partial_files,
     TR_KEY_reqq,
     TR_KEY_result,
+    TR_KEY_rpc,
     TR_KEY_rpc_authentication_required,
     TR_KEY_rpc_bind_address,
     TR_KEY_rpc_enabled,
@@ -326,6 +374,7 @@ enum
     TR_KEY_seeding_time_seconds,
     TR_KEY_session_count,
     TR_KEY_session_id,
+    TR_KEY_session_lock_stats,
     TR_KEY_sessionCount,
     TR_KEY_show_backup_trackers,
     TR_KEY_show_extra_peer_details,
@@ -338,8 +387,10 @@ enum
     TR_KEY_size_bytes,
     TR_KEY_size_units,
     TR_KEY_sizeWhenDone,
+    TR_KEY_sort, /* rpc */
     TR_KEY_sort_mode,
     TR_KEY_sort_reversed,
+    TR_KEY_sortReverse, /* rpc */
     TR_KEY_speed,
     TR_KEY_speed_Bps,
     TR_KEY_speed_bytes,
@@ -356,6 +407,7 @@ enum
     TR_KEY_tag,
     TR_KEY_tier,
     TR_KEY_time_checked,
+    TR_KEY_timeout, /* rpc */
     TR_KEY_torrent_added,
     TR_KEY_torrent_added_notification_command,
     TR_KEY_torrent_added_notification_enabled,
@@ -370,16 +422,20 @@ enum
     TR_KEY_torrentCount,
     TR_KEY_torrentFile,
     TR_KEY_torrents,
+    TR_KEY_totalCount, /* rpc */
     TR_KEY_totalSize,
+    TR_KEY_totalUsec,
     TR_KEY_total_size,
     TR_KEY_tracker_id,
     TR_KEY_trackerAdd,
+    TR_KEY_trackerHost, /* rpc */
     TR_KEY_trackerRemove,
     TR_KEY_trackerReplace,
     TR_KEY_trackerStats,
     TR_KEY_trackers,
     TR_KEY_trash_can_enabled,
     TR_KEY_trash_original_torrent_files,
+    TR_KEY_type, /* rpc */
     TR_KEY_umask,
     TR_KEY_units,
     TR_KEY_upload_slots_per_torrent,
@@ -404,12 +460,15 @@ enum
     TR_KEY_utp_enabled,
     TR_KEY_v,
     TR_KEY_version,
+    TR_KEY_waitUsec,
+    TR_KEY_wakeups,
     TR_KEY_wanted,
     TR_KEY_warning_message,
     TR_KEY_watch_dir,
     TR_KEY_watch_dir_enabled,
     TR_KEY_webseeds,
     TR_KEY_webseedsSendingToUs,
+    TR_KEY_writeCalls,
     TR_N_KEYS
 };
 
@@ -0,0 +1,208 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <algorithm> // std::clamp(), std::max(), std::min()
+#include <cstdint> // uint32_t, uint64_t
+
+#include "transmission.h" // tr_block_index_t
+
+/**
+ * Decides how many block requests to keep outstanding with a peer.
+ *
+ * To keep the peer busy the window has to cover the bandwidth-delay
+ * product: the rate at which it delivers blocks times the round trip
+ * between sending a request and getting its block back. The window starts
+ * small and grows by one for every block received, doubling each round
+ * trip, until the delivery rate stops growing or the round trip doubles.
+ * From then on it follows twice the measured product.
+ *
+ * The round trip is timed on one request at a time. Samples taken while
+ * our own requests are queued up at the peer overstate it, so the window
+ * keeps the smallest sample. Every MinRttLifetimeMsec it shrinks for one
+ * round trip so that the queue drains and a fresh sample can be taken.
+ */
+class tr_request_window
+{
+public:
+    inline auto static constexpr MinWindow = int{ 4 };
+    inline auto static constexpr MaxWindow = int{ 500 };
+
+    void request_sent(uint64_t now_msec, tr_block_index_t block)
+    {
+        if (!slow_start_ && !probing_rtt_ && now_msec - min_rtt_at_ > MinRttLifetimeMsec)
+        {
+            /* stop timing requests that were queued behind a full window */
+            probing_rtt_ = true;
+            probe_sent_at_ = 0;
+            return;
+        }
+
+        if (probe_sent_at_ == 0 || now_msec - probe_sent_at_ > ProbeTimeoutMsec)
+        {
+            probe_block_ = block;
+            probe_sent_at_ = now_msec;
+            probe_bytes_ = 0;
+        }
+    }
+
+    void block_received(uint64_t now_msec, tr_block_index_t block, uint32_t bytes)
+    {
+        if (slow_start_)
+        {
+            window_ = std::min(window_ + 1, MaxWindow);
+        }
+
+        if (probe_sent_at_ == 0)
+        {
+            return;
+        }
+
+        probe_bytes_ += bytes;
+
+        if (block == probe_block_)
+        {
+            auto const rtt = std::max(uint64_t{ 1 }, now_msec - probe_sent_at_);
+            probe_sent_at_ = 0;
+            on_rtt_sample(now_msec, rtt);
+        }
+    }
+
+    /* call when the outstanding requests were dropped, e.g. the peer choked us */
+    void reset_probe()
+    {
+        probe_sent_at_ = 0;
+    }
+
+    /* call when one request won't be answered, e.g. it was rejected or we cancelled it */
+    void request_dropped(tr_block_index_t block)
+    {
+        if (probe_sent_at_ != 0 && block == probe_block_)
+        {
+            reset_probe();
+        }
+    }
+
+    /**
+     * @param block_size the torrent's block size
+     * @param rate_limit_Bps the download speed limit that applies to this peer, or 0 for none
+     * @param max the most requests the peer will queue
+     */
+    int size(uint32_t block_size, uint32_t rate_limit_Bps, int max) const
+    {
+        int n = window_;
+
+        if (probing_rtt_)
+        {
+            n = MinWindow;
+        }
+        else if (min_rtt_ != 0)
+        {
+            if (!slow_start_)
+            {
+                n = window_for(max_rate_Bps_, block_size);
+            }
+
+            if (rate_limit_Bps != 0)
+            {
+                n = std::min(n, window_for(rate_limit_Bps, block_size));
+            }
+        }
+
+        return std::clamp(n, std::min(MinWindow, max), max);
+    }
+
+    /* the smoothed round-trip time, or 0 if it hasn't been measured yet */
+    uint32_t rtt_msec() const
+    {
+        return srtt_;
+    }
+
+    uint32_t min_rtt_msec() const
+    {
+        return min_rtt_;
+    }
+
+    bool in_slow_start() const
+    {
+        return slow_start_;
+    }
+
+private:
+    inline auto static constexpr Gain = int{ 2 };
+    inline auto static constexpr MinRttLifetimeMsec = uint64_t{ 10000 };
+    inline auto static constexpr ProbeTimeoutMsec = uint64_t{ 30000 };
+    /* leave slow start after this many round trips without 25% more throughput */
+    inline auto static constexpr FullPipeRounds = int{ 3 };
+
+    int window_for(uint64_t rate_Bps, uint32_t block_size) const
+    {
+        auto const bdp = rate_Bps * min_rtt_ / 1000;
+        return int(std::min(uint64_t{ MaxWindow }, (Gain * bdp + block_size - 1) / block_size));
+    }
+
+    void on_rtt_sample(uint64_t now_msec, uint64_t rtt)
+    {
+        srtt_ = srtt_ == 0 ? uint32_t(rtt) : uint32_t((7 * uint64_t{ srtt_ } + rtt) / 8);
+
+        if (probing_rtt_ || min_rtt_ == 0 || rtt <= min_rtt_)
+        {
+            min_rtt_ = uint32_t(rtt);
+            min_rtt_at_ = now_msec;
+        }
+
+        if (probing_rtt_)
+        {
+            /* the window was drained, so this round's throughput doesn't mean anything */
+            probing_rtt_ = false;
+            return;
+        }
+
+        auto const rate = probe_bytes_ * 1000 / rtt;
+        max_rate_Bps_ = rate >= max_rate_Bps_ ? rate : (3 * max_rate_Bps_ + rate) / 4;
+
+        if (slow_start_)
+        {
+            if (rtt > 2 * uint64_t{ min_rtt_ })
+            {
+                /* our requests are piling up at the peer */
+                slow_start_ = false;
+            }
+            else if (4 * rate >= 5 * full_pipe_rate_Bps_)
+            {
+                full_pipe_rate_Bps_ = rate;
+                rounds_without_growth_ = 0;
+            }
+            else if (++rounds_without_growth_ >= FullPipeRounds)
+            {
+                slow_start_ = false;
+            }
+        }
+    }
+
+    int window_ = MinWindow;
+    bool slow_start_ = true;
+    bool probing_rtt_ = false;
+
+    tr_block_index_t probe_block_ = 0;
+    uint64_t probe_sent_at_ = 0;
+    uint64_t probe_bytes_ = 0;
+
+    uint32_t srtt_ = 0;
+    uint32_t min_rtt_ = 0;
+    uint64_t min_rtt_at_ = 0;
+
+    uint64_t max_rate_Bps_ = 0;
+    uint64_t full_pipe_rate_Bps_ = 0;
+    int rounds_without_growth_ = 0;
+};
@@ -31,14 +31,30 @@ constexpr int MAX_REMEMBERED_PEERS = 200;
 
 } // unnamed namespace
 
-static char* getResumeFilename(tr_torrent const* tor, enum tr_metainfo_basename_format format)
+static char* getResumeFilenameFromInfo(
+    tr_session const* session,
+    tr_info const* info,
+    enum tr_metainfo_basename_format format)
 {
-    char* base = tr_metainfoGetBasename(tr_torrentInfo(tor), format);
-    char* filename = tr_strdup_printf("%s" TR_PATH_DELIMITER_STR "%s.resume", tr_getResumeDir(tor->session), base);
+    char* base = tr_metainfoGetBasename(info, format);
+    char* filename = tr_strdup_printf("%s" TR_PATH_DELIMITER_STR "%s.resume", tr_getResumeDir(session), base);
     tr_free(base);
     return filename;
 }
 
+static char* getResumeFilename(tr_torrent const* tor, enum tr_metainfo_basename_format format)
+{
+    return getResumeFilenameFromInfo(tor->session, tr_torrentInfo(tor), format);
+}
+
+bool tr_torrentPreloadResume(tr_session const* session, tr_info const* info, tr_variant* setme)
+{
+    char* const filename = getResumeFilenameFromInfo(session, info, TR_METAINFO_BASENAME_HASH);
+    bool const ok = tr_variantFromFile(setme, TR_VARIANT_FMT_BENC, filename, nullptr);
+    tr_free(filename);
+    return ok;
+}
+
 /***
 ****
 ***/
@@ -455,8 +471,12 @@ static uint64_t loadFilenames(tr_variant* dict, tr_torrent* tor)
 
             if (tr_variantGetStr(tr_variantListChild(list, i), &str, &str_len) && str != nullptr && str_len != 0)
             {
-                tr_free(files[i].name);
-                files[i].name = tr_strndup(str, str_len);
+                /* names that were only sanitized are often unchanged; keep those in the pool */
+                if (strncmp(files[i].name, str, str_len) != 0 || files[i].name[str_len] != '\0')
+                {
+                    tr_metainfoSetFileName(&tor->info, i, tr_strndup(str, str_len));
+                }
+
                 files[i].is_renamed = true;
             }
         }
@@ -784,7 +804,7 @@ void tr_torrentSaveResume(tr_torrent* tor)
     tr_variantFree(&top);
 }
 
-static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRenameToHashOnlyName)
+static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, tr_ctor const* ctor, bool* didRenameToHashOnlyName)
 {
     TR_ASSERT(tr_isTorrent(tor));
 
@@ -804,8 +824,15 @@ static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRe
     }
 
     filename = getResumeFilename(tor, TR_METAINFO_BASENAME_HASH);
+    tr_variant* const preloaded = tr_ctorGetPreloadedResume(ctor);
 
-    if (!tr_variantFromFile(&top, TR_VARIANT_FMT_BENC, filename, &error))
+    if (preloaded != nullptr && tr_variantIsDict(preloaded))
+    {
+        /* already read off the event thread; take it */
+        top = *preloaded;
+        tr_variantInitBool(preloaded, false);
+    }
+    else if (!tr_variantFromFile(&top, TR_VARIANT_FMT_BENC, filename, &error))
     {
         tr_logAddTorDbg(tor, "Couldn't read \"%s\": %s", filename, error->message);
         tr_error_clear(&error);
@@ -1047,7 +1074,7 @@ uint64_t tr_torrentLoadResume(tr_torrent* tor, uint64_t fieldsToLoad, tr_ctor co
 
     ret |= useManditoryFields(tor, fieldsToLoad, ctor);
     fieldsToLoad &= ~ret;
-    ret |= loadFromFile(tor, fieldsToLoad, didRenameToHashOnlyName);
+    ret |= loadFromFile(tor, fieldsToLoad, ctor, didRenameToHashOnlyName);
     fieldsToLoad &= ~ret;
     ret |= useFallbackFields(tor, fieldsToLoad, ctor);
 
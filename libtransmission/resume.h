@@ -46,6 +46,12 @@ enum
  */
 uint64_t tr_torrentLoadResume(tr_torrent* tor, uint64_t fieldsToLoad, tr_ctor const* ctor, bool* didRenameToHashOnlyName);
 
+/**
+ * Read a torrent's .resume file ahead of time so that it can be handed
+ * to tr_torrentNew() via tr_ctorSetPreparsed(). Safe to call from any thread.
+ */
+bool tr_torrentPreloadResume(tr_session const* session, tr_info const* info, tr_variant* setme);
+
 void tr_torrentSaveResume(tr_torrent* tor);
 
 void tr_torrentRemoveResume(tr_torrent const* tor);
@@ -0,0 +1,138 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <algorithm> // std::max()
+#include <cstddef> // size_t
+#include <utility> // std::move()
+#include <vector>
+
+#include "tr-assert.h"
+
+/**
+ * A FIFO queue stored in a growable circular buffer.
+ *
+ * Pushing to the back and popping from the front are O(1), and the buffer
+ * grows and shrinks by powers of two to follow how many items are queued,
+ * so an idle queue holds no memory.
+ */
+template<typename T>
+class tr_ring_buffer
+{
+public:
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    size_t capacity() const
+    {
+        return std::size(items_);
+    }
+
+    /* the i'th item from the front */
+    T& operator[](size_t i)
+    {
+        TR_ASSERT(i < size_);
+        return items_[(head_ + i) & (capacity() - 1)];
+    }
+
+    T const& operator[](size_t i) const
+    {
+        TR_ASSERT(i < size_);
+        return items_[(head_ + i) & (capacity() - 1)];
+    }
+
+    T& front()
+    {
+        return (*this)[0];
+    }
+
+    void push_back(T const& item)
+    {
+        if (size_ == capacity())
+        {
+            resize(std::max(MinCapacity, 2 * capacity()));
+        }
+
+        items_[(head_ + size_) & (capacity() - 1)] = item;
+        ++size_;
+    }
+
+    void pop_front()
+    {
+        TR_ASSERT(size_ > 0);
+
+        head_ = (head_ + 1) & (capacity() - 1);
+        --size_;
+        maybeShrink();
+    }
+
+    /* remove the i'th item from the front, keeping the others in order */
+    void erase(size_t i)
+    {
+        TR_ASSERT(i < size_);
+
+        for (; i + 1 < size_; ++i)
+        {
+            (*this)[i] = std::move((*this)[i + 1]);
+        }
+
+        --size_;
+        maybeShrink();
+    }
+
+    void clear()
+    {
+        items_ = std::vector<T>{};
+        head_ = 0;
+        size_ = 0;
+    }
+
+private:
+    inline auto static constexpr MinCapacity = size_t{ 8 };
+
+    void resize(size_t new_capacity)
+    {
+        auto items = std::vector<T>(new_capacity);
+
+        for (size_t i = 0; i < size_; ++i)
+        {
+            items[i] = std::move((*this)[i]);
+        }
+
+        items_ = std::move(items);
+        head_ = 0;
+    }
+
+    void maybeShrink()
+    {
+        if (size_ == 0)
+        {
+            clear();
+        }
+        else if (capacity() > MinCapacity && size_ <= capacity() / 4)
+        {
+            resize(capacity() / 2);
+        }
+    }
+
+    std::vector<T> items_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+};
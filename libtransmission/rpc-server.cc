@@ -71,6 +71,8 @@ struct tr_rpc_server
 
     bool isStreamInitialized;
     z_stream stream;
+
+    std::list<struct tr_rpc_event_waiter*> eventWaiters;
 };
 
 #define dbgmsg(...) tr_logAddDeepNamed(MY_NAME, __VA_ARGS__)
@@ -487,12 +489,130 @@ static void rpc_response_func([[maybe_unused]] tr_session* session, tr_variant*
     tr_free(data);
 }
 
+/***
+****  Long-polling for the "session-events" method.
+****
+****  A "session-events" request with a positive "timeout" whose "cursor"
+****  is already up-to-date is parked here instead of being answered.
+****  It's executed once new events are published or the timeout passes.
+***/
+
+enum
+{
+    MAX_EVENTS_TIMEOUT_SECS = 60
+};
+
+struct tr_rpc_event_waiter
+{
+    struct evhttp_request* req;
+    /* kept because libevent clears req's connection once it closes */
+    struct evhttp_connection* evcon;
+    struct tr_rpc_server* server;
+    struct event* timer;
+    tr_variant request;
+};
+
+static void event_waiter_free(struct tr_rpc_event_waiter* waiter)
+{
+    event_free(waiter->timer);
+    tr_variantFree(&waiter->request);
+    tr_free(waiter);
+}
+
+static void on_event_waiter_timer([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vwaiter)
+{
+    auto* waiter = static_cast<struct tr_rpc_event_waiter*>(vwaiter);
+    struct tr_rpc_server* server = waiter->server;
+    server->eventWaiters.remove(waiter);
+
+    auto* data = tr_new0(struct rpc_response_data, 1);
+    data->req = waiter->req;
+    data->server = server;
+    tr_rpc_request_exec_json(server->session, &waiter->request, rpc_response_func, data);
+
+    event_waiter_free(waiter);
+}
+
+/* the client went away, or the server is stopping; drop its waiters unanswered */
+static void on_event_waiter_connection_closed(struct evhttp_connection* evcon, void* vserver)
+{
+    auto* server = static_cast<struct tr_rpc_server*>(vserver);
+    auto& waiters = server->eventWaiters;
+
+    for (auto it = std::begin(waiters); it != std::end(waiters);)
+    {
+        if ((*it)->evcon == evcon)
+        {
+            /* when the client hangs up, libevent detaches the unanswered
+               request and leaves it to us. When the server is stopping,
+               the connection is being freed and takes the request with it */
+            if (evhttp_request_get_connection((*it)->req) == nullptr)
+            {
+                evhttp_request_free((*it)->req);
+            }
+
+            event_waiter_free(*it);
+            it = waiters.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+/* If this is a "session-events" request that would return nothing new,
+ * take ownership of `top` and park the request until there's something
+ * to report. Returns true if the request was parked. */
+static bool maybe_wait_for_events(struct evhttp_request* req, struct tr_rpc_server* server, tr_variant* top)
+{
+    char const* method;
+    tr_variant* args;
+    int64_t cursor;
+    int64_t timeout;
+
+    if (!tr_variantDictFindStr(top, TR_KEY_method, &method, nullptr) || strcmp(method, "session-events") != 0 ||
+        !tr_variantDictFindDict(top, TR_KEY_arguments, &args) || !tr_variantDictFindInt(args, TR_KEY_timeout, &timeout) ||
+        timeout <= 0 || !tr_variantDictFindInt(args, TR_KEY_cursor, &cursor) ||
+        cursor != int64_t(server->session->rpcEventSeq))
+    {
+        return false;
+    }
+
+    auto* waiter = tr_new0(struct tr_rpc_event_waiter, 1);
+    waiter->req = req;
+    waiter->evcon = evhttp_request_get_connection(req);
+    waiter->server = server;
+    waiter->request = *top;
+    waiter->timer = evtimer_new(server->session->event_base, on_event_waiter_timer, waiter);
+    tr_timerAdd(waiter->timer, std::min(int(timeout), int(MAX_EVENTS_TIMEOUT_SECS)), 0);
+    server->eventWaiters.push_back(waiter);
+
+    evhttp_connection_set_closecb(waiter->evcon, on_event_waiter_connection_closed, server);
+    return true;
+}
+
+void tr_rpcOnEventsPublished(tr_rpc_server* server)
+{
+    /* answer on the next loop iteration so that a burst of events,
+     * e.g. from one "torrent-start" of many torrents, is sent together */
+    for (auto* waiter : server->eventWaiters)
+    {
+        tr_timerAdd(waiter->timer, 0, 0);
+    }
+}
+
 static void handle_rpc_from_json(struct evhttp_request* req, struct tr_rpc_server* server, char const* json, size_t json_len)
 {
     tr_variant top;
     bool have_content = tr_variantFromJson(&top, json, json_len) == 0;
     struct rpc_response_data* data;
 
+    if (have_content && maybe_wait_for_events(req, server, &top))
+    {
+        return;
+    }
+
     data = tr_new0(struct rpc_response_data, 1);
     data->req = req;
     data->server = server;
@@ -851,6 +971,14 @@ static void stopServer(tr_rpc_server* server)
     server->httpd = nullptr;
     evhttp_free(httpd);
 
+    /* evhttp_free() closes the connections, which should have dropped these */
+    for (auto* waiter : server->eventWaiters)
+    {
+        event_waiter_free(waiter);
+    }
+
+    server->eventWaiters.clear();
+
     tr_logAddNamedDbg(MY_NAME, "Stopped listening on %s:%d", address, port);
 }
 
@@ -20,6 +20,9 @@ tr_rpc_server* tr_rpcInit(tr_session* session, tr_variant* settings);
 
 void tr_rpcClose(tr_rpc_server** freeme);
 
+/* wake up any clients long-polling the "session-events" method */
+void tr_rpcOnEventsPublished(tr_rpc_server* server);
+
 void tr_rpcSetEnabled(tr_rpc_server* server, bool isEnabled);
 
 bool tr_rpcIsEnabled(tr_rpc_server const* server);
@@ -7,10 +7,16 @@
  */
 
 #include <algorithm>
-#include <cctype> /* isdigit */
+#include <array>
+#include <cctype> /* isdigit, tolower */
 #include <cerrno>
 #include <cstdlib> /* strtol */
 #include <cstring> /* strcmp */
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 #ifndef ZLIB_CONST
 #define ZLIB_CONST
@@ -18,28 +24,36 @@
 #include <zlib.h>
 
 #include <event2/buffer.h>
+#include <event2/util.h> /* evutil_ascii_strcasecmp() */
 
 #include "transmission.h"
+#include "cache.h"
 #include "completion.h"
+#include "crypto.h"
 #include "crypto-utils.h"
 #include "error.h"
 #include "fdlimit.h"
 #include "file.h"
+#include "handshake.h"
 #include "log.h"
+#include "peer-io.h" /* tr_peerIoGetWriteStats() */
+#include "perf.h"
 #include "platform-quota.h" /* tr_device_info_get_free_space() */
 #include "rpcimpl.h"
+#include "rpc-server.h" /* tr_rpcOnEventsPublished() */
 #include "session.h"
 #include "session-id.h"
 #include "stats.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "tr-macros.h"
+#include "trevent.h" /* tr_runInEventThread() */
 #include "utils.h"
 #include "variant.h"
 #include "version.h"
 #include "web.h"
 
-#define RPC_VERSION 16
+#define RPC_VERSION 17
 #define RPC_VERSION_MIN 1
 
 #define RECENTLY_ACTIVE_SECONDS 60
@@ -64,6 +78,8 @@ static tr_rpc_callback_status notify(tr_session* session, tr_rpc_callback_type t
 {
     tr_rpc_callback_status status = TR_RPC_OK;
 
+    tr_rpc_events_publish(session, type, tor);
+
     if (session->rpc_func != nullptr)
     {
         status = (*session->rpc_func)(session, type, tor, session->rpc_func_user_data);
@@ -72,6 +88,145 @@ static tr_rpc_callback_status notify(tr_session* session, tr_rpc_callback_type t
     return status;
 }
 
+/***
+****  Event journal for the "session-events" method
+***/
+
+enum
+{
+    /* how many events to keep for clients that fall behind */
+    RPC_EVENTS_MAX = 1024
+};
+
+static void pushEvent(tr_session* session, tr_rpc_event&& event)
+{
+    auto& events = session->rpcEvents;
+
+    event.seq = ++session->rpcEventSeq;
+    event.date = tr_time();
+    events.push_back(std::move(event));
+
+    if (std::size(events) > RPC_EVENTS_MAX)
+    {
+        events.pop_front();
+    }
+
+    if (session->rpcServer != nullptr)
+    {
+        tr_rpcOnEventsPublished(session->rpcServer);
+    }
+}
+
+struct publish_data
+{
+    tr_session* session;
+    tr_rpc_event event;
+};
+
+static void publishInEventThread(void* vdata)
+{
+    auto* data = static_cast<struct publish_data*>(vdata);
+    pushEvent(data->session, std::move(data->event));
+    delete data;
+}
+
+void tr_rpc_events_publish(tr_session* session, tr_rpc_callback_type type, tr_torrent const* tor)
+{
+    auto* data = new publish_data{};
+    data->session = session;
+    data->event.kind = TR_RPC_EVENT_NOTIFY;
+    data->event.type = type;
+    data->event.torrentId = tor != nullptr ? tr_torrentId(tor) : 0;
+    tr_runInEventThread(session, publishInEventThread, data);
+}
+
+void tr_rpc_events_publish_log(tr_session* session, tr_log_level level, char const* name, char const* message)
+{
+    auto* data = new publish_data{};
+    data->session = session;
+    data->event.kind = TR_RPC_EVENT_LOG;
+    data->event.level = level;
+    data->event.name = name != nullptr ? name : "";
+    data->event.message = message;
+    tr_runInEventThread(session, publishInEventThread, data);
+}
+
+void tr_rpc_events_publish_stats(tr_session* session)
+{
+    TR_ASSERT(tr_amInEventThread(session));
+
+    auto stats = tr_rpc_event_stats{};
+    stats.downloadSpeed_Bps = tr_sessionGetPieceSpeed_Bps(session, TR_DOWN);
+    stats.uploadSpeed_Bps = tr_sessionGetPieceSpeed_Bps(session, TR_UP);
+
+    for (auto const* tor : session->torrents)
+    {
+        if (tor->isRunning)
+        {
+            ++stats.activeTorrentCount;
+        }
+        else
+        {
+            ++stats.pausedTorrentCount;
+        }
+    }
+
+    /* only journal the numbers when they've changed, so an idle session stays quiet */
+    if (stats != session->rpcEventStats)
+    {
+        session->rpcEventStats = stats;
+
+        auto event = tr_rpc_event{};
+        event.kind = TR_RPC_EVENT_SESSION_STATS;
+        event.stats = stats;
+        pushEvent(session, std::move(event));
+    }
+}
+
+static char const* getEventTypeName(tr_rpc_event const& event)
+{
+    if (event.kind == TR_RPC_EVENT_SESSION_STATS)
+    {
+        return "session-stats";
+    }
+
+    if (event.kind == TR_RPC_EVENT_LOG)
+    {
+        return "log";
+    }
+
+    switch (event.type)
+    {
+    case TR_RPC_TORRENT_ADDED:
+        return "torrent-added";
+
+    case TR_RPC_TORRENT_STARTED:
+        return "torrent-started";
+
+    case TR_RPC_TORRENT_STOPPED:
+        return "torrent-stopped";
+
+    case TR_RPC_TORRENT_REMOVING:
+    case TR_RPC_TORRENT_TRASHING:
+        return "torrent-removed";
+
+    case TR_RPC_TORRENT_MOVED:
+        return "torrent-moved";
+
+    case TR_RPC_SESSION_CHANGED:
+        return "session-changed";
+
+    case TR_RPC_SESSION_QUEUE_POSITIONS_CHANGED:
+        return "queue-changed";
+
+    case TR_RPC_SESSION_CLOSE:
+        return "session-close";
+
+    default:
+        return "torrent-changed";
+    }
+}
+
 /***
 ****
 ***/
@@ -925,7 +1080,7 @@ static void addTorrentInfo(tr_torrent* tor, tr_format format, tr_variant* entry,
     if (fieldCount > 0)
     {
         tr_info const* const inf = tr_torrentInfo(tor);
-        tr_stat const* const st = tr_torrentStat(tor);
+        tr_stat const* const st = tr_torrentStatCached(tor);
 
         for (size_t i = 0; i < fieldCount; ++i)
         {
@@ -936,6 +1091,347 @@ static void addTorrentInfo(tr_torrent* tor, tr_format format, tr_variant* entry,
     }
 }
 
+/***
+****  torrent-get: server-side filtering, sorting, and paging
+***/
+
+struct TorrentFilter
+{
+    std::vector<int64_t> statuses;
+    std::vector<std::string_view> labels;
+    char const* name = nullptr;
+    std::string_view tracker_host;
+    double ratio_min = 0;
+    double ratio_max = 0;
+    bool has_ratio_min = false;
+    bool has_ratio_max = false;
+};
+
+/* the torrent-get fields that can be used as a "sort" key */
+static auto constexpr SortKeys = std::array<tr_quark, 18>{
+    TR_KEY_activityDate,
+    TR_KEY_addedDate,
+    TR_KEY_doneDate,
+    TR_KEY_downloadedEver,
+    TR_KEY_eta,
+    TR_KEY_id,
+    TR_KEY_leftUntilDone,
+    TR_KEY_name,
+    TR_KEY_peersConnected,
+    TR_KEY_percentDone,
+    TR_KEY_queuePosition,
+    TR_KEY_rateDownload,
+    TR_KEY_rateUpload,
+    TR_KEY_sizeWhenDone,
+    TR_KEY_status,
+    TR_KEY_totalSize,
+    TR_KEY_uploadedEver,
+    TR_KEY_uploadRatio,
+};
+
+static void parseTorrentFilter(tr_variant* dict, TorrentFilter* setme)
+{
+    int64_t i;
+    char const* str;
+    size_t len;
+    double d;
+    tr_variant* list;
+
+    if (tr_variantDictFindList(dict, TR_KEY_status, &list))
+    {
+        for (size_t n = 0, count = tr_variantListSize(list); n < count; ++n)
+        {
+            if (tr_variantGetInt(tr_variantListChild(list, n), &i))
+            {
+                setme->statuses.push_back(i);
+            }
+        }
+    }
+    else if (tr_variantDictFindInt(dict, TR_KEY_status, &i))
+    {
+        setme->statuses.push_back(i);
+    }
+
+    if (tr_variantDictFindList(dict, TR_KEY_labels, &list))
+    {
+        for (size_t n = 0, count = tr_variantListSize(list); n < count; ++n)
+        {
+            if (tr_variantGetStr(tr_variantListChild(list, n), &str, &len))
+            {
+                setme->labels.emplace_back(str, len);
+            }
+        }
+    }
+
+    if (tr_variantDictFindStr(dict, TR_KEY_name, &str, &len) && len > 0)
+    {
+        setme->name = str;
+    }
+
+    if (tr_variantDictFindStr(dict, TR_KEY_trackerHost, &str, &len) && len > 0)
+    {
+        setme->tracker_host = std::string_view{ str, len };
+    }
+
+    if (tr_variantDictFindReal(dict, TR_KEY_ratioMin, &d))
+    {
+        setme->ratio_min = d;
+        setme->has_ratio_min = true;
+    }
+
+    if (tr_variantDictFindReal(dict, TR_KEY_ratioMax, &d))
+    {
+        setme->ratio_max = d;
+        setme->has_ratio_max = true;
+    }
+}
+
+/* map TR_RATIO_NA to zero and TR_RATIO_INF to infinity so that ratios are ordered */
+static double getComparableRatio(tr_stat const* st)
+{
+    if (st->ratio == TR_RATIO_INF)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    return st->ratio < 0 ? 0.0 : st->ratio;
+}
+
+static std::string_view getAnnounceHost(char const* announce)
+{
+    auto host = std::string_view{ announce != nullptr ? announce : "" };
+
+    if (auto const pos = host.find("://"); pos != std::string_view::npos)
+    {
+        host.remove_prefix(pos + 3);
+    }
+
+    if (auto const pos = host.find_first_of(":/?"); pos != std::string_view::npos)
+    {
+        host = host.substr(0, pos);
+    }
+
+    return host;
+}
+
+static bool containsIgnoringCase(std::string_view haystack, std::string_view needle)
+{
+    auto const it = std::search(
+        std::begin(haystack),
+        std::end(haystack),
+        std::begin(needle),
+        std::end(needle),
+        [](char a, char b) { return tolower(static_cast<unsigned char>(a)) == tolower(static_cast<unsigned char>(b)); });
+
+    return it != std::end(haystack);
+}
+
+static bool torrentMatchesFilter(tr_torrent const* tor, tr_stat const* st, TorrentFilter const& filter)
+{
+    if (!std::empty(filter.statuses) &&
+        std::find(std::begin(filter.statuses), std::end(filter.statuses), st->activity) == std::end(filter.statuses))
+    {
+        return false;
+    }
+
+    if (!std::empty(filter.labels) &&
+        std::none_of(
+            std::begin(filter.labels),
+            std::end(filter.labels),
+            [tor](auto const& label) { return tor->labels.count(std::string{ label }) != 0; }))
+    {
+        return false;
+    }
+
+    if (filter.name != nullptr && tr_strcasestr(tr_torrentName(tor), filter.name) == nullptr)
+    {
+        return false;
+    }
+
+    if (!std::empty(filter.tracker_host))
+    {
+        auto const* const begin = tor->info.trackers;
+        auto const* const end = begin + tor->info.trackerCount;
+        auto const matches = [&filter](tr_tracker_info const& tracker)
+        {
+            return containsIgnoringCase(getAnnounceHost(tracker.announce), filter.tracker_host);
+        };
+
+        if (std::none_of(begin, end, matches))
+        {
+            return false;
+        }
+    }
+
+    if (filter.has_ratio_min && getComparableRatio(st) < filter.ratio_min)
+    {
+        return false;
+    }
+
+    if (filter.has_ratio_max && getComparableRatio(st) > filter.ratio_max)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+static double getTorrentSortValue(tr_torrent const* tor, tr_stat const* st, tr_quark key)
+{
+    switch (key)
+    {
+    case TR_KEY_activityDate:
+        return st->activityDate;
+
+    case TR_KEY_addedDate:
+        return st->addedDate;
+
+    case TR_KEY_doneDate:
+        return st->doneDate;
+
+    case TR_KEY_downloadedEver:
+        return st->downloadedEver;
+
+    case TR_KEY_eta:
+        return st->eta;
+
+    case TR_KEY_leftUntilDone:
+        return st->leftUntilDone;
+
+    case TR_KEY_peersConnected:
+        return st->peersConnected;
+
+    case TR_KEY_percentDone:
+        return st->percentDone;
+
+    case TR_KEY_queuePosition:
+        return st->queuePosition;
+
+    case TR_KEY_rateDownload:
+        return st->pieceDownloadSpeed_KBps;
+
+    case TR_KEY_rateUpload:
+        return st->pieceUploadSpeed_KBps;
+
+    case TR_KEY_sizeWhenDone:
+        return st->sizeWhenDone;
+
+    case TR_KEY_status:
+        return st->activity;
+
+    case TR_KEY_totalSize:
+        return tor->info.totalSize;
+
+    case TR_KEY_uploadedEver:
+        return st->uploadedEver;
+
+    case TR_KEY_uploadRatio:
+        return getComparableRatio(st);
+
+    default: /* TR_KEY_id */
+        return st->id;
+    }
+}
+
+static int compareTorrentsByKey(tr_torrent const* a, tr_stat const* sa, tr_torrent const* b, tr_stat const* sb, tr_quark key)
+{
+    if (key == TR_KEY_name)
+    {
+        return evutil_ascii_strcasecmp(tr_torrentName(a), tr_torrentName(b));
+    }
+
+    auto const va = getTorrentSortValue(a, sa, key);
+    auto const vb = getTorrentSortValue(b, sb, key);
+    return va < vb ? -1 : (va > vb ? 1 : 0);
+}
+
+/**
+ * Applies torrent-get's optional "filter", "sort", "sortReverse", "offset",
+ * and "limit" arguments to the torrents selected by "ids". The selection is
+ * compacted in place and its new size is returned via `setmeCount`.
+ * Filtering and sorting use the cached tr_stat so that a UI paging through
+ * a large session doesn't force a fresh stat of every torrent.
+ *
+ * @return the number of torrents that matched the filter, before paging
+ */
+static int selectTorrents(tr_variant* args_in, tr_torrent** torrents, int* setmeCount, char const** setme_errmsg)
+{
+    auto filter = TorrentFilter{};
+    tr_variant* filter_dict;
+    bool const has_filter = tr_variantDictFindDict(args_in, TR_KEY_filter, &filter_dict);
+    if (has_filter)
+    {
+        parseTorrentFilter(filter_dict, &filter);
+    }
+
+    auto sort_key = tr_quark{ TR_KEY_NONE };
+    char const* str;
+    size_t len;
+    if (tr_variantDictFindStr(args_in, TR_KEY_sort, &str, &len) && len > 0)
+    {
+        /* lookup, not new: don't let clients grow the quark table */
+        if (!tr_quark_lookup(str, len, &sort_key) ||
+            std::find(std::begin(SortKeys), std::end(SortKeys), sort_key) == std::end(SortKeys))
+        {
+            *setme_errmsg = "invalid sort key";
+            return *setmeCount;
+        }
+    }
+
+    /* filter */
+    auto selected = std::vector<std::pair<tr_torrent*, tr_stat const*>>{};
+    selected.reserve(*setmeCount);
+    for (int i = 0; i < *setmeCount; ++i)
+    {
+        tr_torrent* const tor = torrents[i];
+        tr_stat const* const st = tr_torrentStatCached(tor);
+
+        if (!has_filter || torrentMatchesFilter(tor, st, filter))
+        {
+            selected.emplace_back(tor, st);
+        }
+    }
+
+    /* sort */
+    if (sort_key != TR_KEY_NONE)
+    {
+        bool reverse = false;
+        (void)tr_variantDictFindBool(args_in, TR_KEY_sortReverse, &reverse);
+
+        auto const compare = [sort_key, reverse](auto const& a, auto const& b)
+        {
+            int ret = compareTorrentsByKey(a.first, a.second, b.first, b.second, sort_key);
+
+            if (ret == 0)
+            {
+                ret = a.first->uniqueId - b.first->uniqueId;
+            }
+
+            return reverse ? ret > 0 : ret < 0;
+        };
+
+        std::sort(std::begin(selected), std::end(selected), compare);
+    }
+
+    /* page */
+    int const total = std::size(selected);
+    int64_t offset = 0;
+    int64_t limit = -1;
+    (void)tr_variantDictFindInt(args_in, TR_KEY_offset, &offset);
+    (void)tr_variantDictFindInt(args_in, TR_KEY_limit, &limit);
+    offset = std::clamp(offset, int64_t{ 0 }, int64_t{ total });
+    int64_t const end = limit < 0 ? total : std::min(offset + limit, int64_t{ total });
+
+    int n = 0;
+    for (int64_t i = offset; i < end; ++i)
+    {
+        torrents[n++] = selected[i].first;
+    }
+
+    *setmeCount = n;
+    return total;
+}
+
 static char const* torrentGet(
     tr_session* session,
     tr_variant* args_in,
@@ -944,12 +1440,26 @@ static char const* torrentGet(
 {
     int torrentCount;
     tr_torrent** torrents = getTorrents(session, args_in, &torrentCount);
-    tr_variant* list = tr_variantDictAddList(args_out, TR_KEY_torrents, torrentCount + 1);
     tr_variant* fields;
     char const* strVal;
     char const* errmsg = nullptr;
     tr_format format;
 
+    if (tr_variantDictFind(args_in, TR_KEY_filter) != nullptr || tr_variantDictFind(args_in, TR_KEY_sort) != nullptr ||
+        tr_variantDictFind(args_in, TR_KEY_offset) != nullptr || tr_variantDictFind(args_in, TR_KEY_limit) != nullptr)
+    {
+        int const totalCount = selectTorrents(args_in, torrents, &torrentCount, &errmsg);
+        tr_variantDictAddInt(args_out, TR_KEY_totalCount, totalCount);
+
+        if (errmsg != nullptr)
+        {
+            tr_free(torrents);
+            return errmsg;
+        }
+    }
+
+    tr_variant* list = tr_variantDictAddList(args_out, TR_KEY_torrents, torrentCount + 1);
+
     if (tr_variantDictFindStr(args_in, TR_KEY_format, &strVal, nullptr) && strcmp(strVal, "table") == 0)
     {
         format = TR_FORMAT_TABLE;
@@ -2287,6 +2797,13 @@ static char const* sessionStats(
 {
     auto currentStats = tr_session_stats{};
     auto cumulativeStats = tr_session_stats{};
+    auto fileCacheStats = tr_fd_file_cache_stats{};
+    auto readAheadStats = tr_cache_read_ahead_stats{};
+    auto handshakeStats = tr_handshake_stats{};
+    auto keyPoolStats = tr_dh_key_pool_stats{};
+    auto writeStats = tr_peer_write_stats{};
+    auto eventQueueStats = tr_event_queue_stats{};
+    auto lockStats = tr_lock_stats{};
 
     int const total = std::size(session->torrents);
     int const running = std::count_if(
@@ -2296,6 +2813,13 @@ static char const* sessionStats(
 
     tr_sessionGetStats(session, &currentStats);
     tr_sessionGetCumulativeStats(session, &cumulativeStats);
+    tr_fdGetFileCacheStats(session, &fileCacheStats);
+    tr_cacheGetReadAheadStats(session->cache, &readAheadStats);
+    tr_handshakeGetStats(session, &handshakeStats);
+    tr_dhKeyPoolGetStats(session->dhKeyPool, &keyPoolStats);
+    tr_peerIoGetWriteStats(session, &writeStats);
+    tr_eventGetQueueStats(session, &eventQueueStats);
+    tr_sessionGetLockStats(session, &lockStats);
 
     tr_variantDictAddInt(args_out, TR_KEY_activeTorrentCount, running);
     tr_variantDictAddReal(args_out, TR_KEY_downloadSpeed, tr_sessionGetPieceSpeed_Bps(session, TR_DOWN));
@@ -2317,6 +2841,84 @@ static char const* sessionStats(
     tr_variantDictAddInt(d, TR_KEY_sessionCount, currentStats.sessionCount);
     tr_variantDictAddInt(d, TR_KEY_uploadedBytes, currentStats.uploadedBytes);
 
+    d = tr_variantDictAddDict(args_out, TR_KEY_file_cache_stats, 4);
+    tr_variantDictAddInt(d, TR_KEY_evictions, fileCacheStats.evictions);
+    tr_variantDictAddInt(d, TR_KEY_hits, fileCacheStats.hits);
+    tr_variantDictAddInt(d, TR_KEY_misses, fileCacheStats.misses);
+    tr_variantDictAddInt(d, TR_KEY_openFiles, fileCacheStats.open_files);
+
+    d = tr_variantDictAddDict(args_out, TR_KEY_read_ahead_stats, 4);
+    tr_variantDictAddInt(d, TR_KEY_blocksLoaded, readAheadStats.blocks_loaded);
+    tr_variantDictAddInt(d, TR_KEY_blocksWasted, readAheadStats.blocks_wasted);
+    tr_variantDictAddInt(d, TR_KEY_diskReads, readAheadStats.disk_reads);
+    tr_variantDictAddInt(d, TR_KEY_hits, readAheadStats.hits);
+
+    d = tr_variantDictAddDict(args_out, TR_KEY_handshake_stats, 4);
+    tr_variantDictAddInt(d, TR_KEY_dhKeyPoolHits, keyPoolStats.hits);
+    tr_variantDictAddInt(d, TR_KEY_dhKeyPoolMisses, keyPoolStats.misses);
+    tr_variant* l = tr_variantDictAddList(d, TR_KEY_dhUsec, TR_HANDSHAKE_HISTOGRAM_SIZE);
+    for (auto const n : handshakeStats.dh_usec)
+    {
+        tr_variantListAddInt(l, n);
+    }
+    l = tr_variantDictAddList(d, TR_KEY_durationMsec, TR_HANDSHAKE_HISTOGRAM_SIZE);
+    for (auto const n : handshakeStats.duration_msec)
+    {
+        tr_variantListAddInt(l, n);
+    }
+
+    d = tr_variantDictAddDict(args_out, TR_KEY_peer_write_stats, 3);
+    tr_variantDictAddInt(d, TR_KEY_bytesWritten, writeStats.bytes);
+    tr_variantDictAddInt(d, TR_KEY_havesSuppressed, writeStats.haves_suppressed);
+    tr_variantDictAddInt(d, TR_KEY_writeCalls, writeStats.calls);
+
+    d = tr_variantDictAddDict(args_out, TR_KEY_event_queue_stats, 4);
+    tr_variantDictAddInt(d, TR_KEY_calls, eventQueueStats.calls);
+    tr_variantDictAddInt(d, TR_KEY_maxDepth, eventQueueStats.max_depth);
+    tr_variantDictAddInt(d, TR_KEY_wakeups, eventQueueStats.wakeups);
+    l = tr_variantDictAddList(d, TR_KEY_latencyUsec, TR_EVENT_QUEUE_HISTOGRAM_SIZE);
+    for (auto const n : eventQueueStats.latency_usec)
+    {
+        tr_variantListAddInt(l, n);
+    }
+
+    d = tr_variantDictAddDict(args_out, TR_KEY_session_lock_stats, 4);
+    tr_variantDictAddInt(d, TR_KEY_acquisitions, lockStats.acquisitions);
+    tr_variantDictAddInt(d, TR_KEY_contended, lockStats.contended);
+    tr_variantDictAddInt(d, TR_KEY_maxWaitUsec, lockStats.max_wait_usec);
+    tr_variantDictAddInt(d, TR_KEY_waitUsec, lockStats.wait_usec);
+
+    return nullptr;
+}
+
+static char const* sessionPerf(
+    tr_session* session,
+    [[maybe_unused]] tr_variant* args_in,
+    tr_variant* args_out,
+    [[maybe_unused]] struct tr_rpc_idle_data* idle_data)
+{
+    auto constexpr Keys = std::array<tr_quark, TR_PERF_PROBE_COUNT>{
+        TR_KEY_event_loop, TR_KEY_bandwidth_pulse, TR_KEY_cache_flush, TR_KEY_disk_read,
+        TR_KEY_disk_write, TR_KEY_hash,            TR_KEY_rpc,         TR_KEY_handshake,
+    };
+
+    auto stats = tr_perf_stats{};
+    tr_perfGetStats(session, &stats);
+
+    for (int i = 0; i < TR_PERF_PROBE_COUNT; ++i)
+    {
+        auto const& counter = stats.probes[i];
+        tr_variant* d = tr_variantDictAddDict(args_out, Keys[i], 4);
+        tr_variantDictAddInt(d, TR_KEY_count, counter.count);
+        tr_variantDictAddInt(d, TR_KEY_maxUsec, counter.max_usec);
+        tr_variantDictAddInt(d, TR_KEY_totalUsec, counter.total_usec);
+        tr_variant* l = tr_variantDictAddList(d, TR_KEY_histogram, TR_PERF_HISTOGRAM_SIZE);
+        for (auto const n : counter.usec)
+        {
+            tr_variantListAddInt(l, n);
+        }
+    }
+
     return nullptr;
 }
 
@@ -2642,6 +3244,70 @@ static char const* freeSpace(
 ****
 ***/
 
+static char const* sessionEvents(
+    tr_session* session,
+    tr_variant* args_in,
+    tr_variant* args_out,
+    [[maybe_unused]] struct tr_rpc_idle_data* idle_data)
+{
+    auto const& events = session->rpcEvents;
+    auto const latest = int64_t(session->rpcEventSeq);
+    auto const oldest = std::empty(events) ? latest + 1 : int64_t(events.front().seq);
+
+    /* default to "nothing new" so that a first call just fetches the cursor */
+    int64_t cursor = latest;
+    (void)tr_variantDictFindInt(args_in, TR_KEY_cursor, &cursor);
+
+    /* if events were dropped, or the cursor is from an earlier session,
+     * the client needs to refresh its state from scratch */
+    tr_variantDictAddBool(args_out, TR_KEY_overflow, cursor + 1 < oldest || cursor > latest);
+    tr_variantDictAddInt(args_out, TR_KEY_cursor, latest);
+
+    tr_variant* list = tr_variantDictAddList(args_out, TR_KEY_events, 0);
+
+    for (auto const& event : events)
+    {
+        if (int64_t(event.seq) > cursor)
+        {
+            tr_variant* d = tr_variantListAddDict(list, 7);
+            tr_variantDictAddInt(d, TR_KEY_cursor, event.seq);
+            tr_variantDictAddInt(d, TR_KEY_date, event.date);
+            tr_variantDictAddStr(d, TR_KEY_type, getEventTypeName(event));
+
+            switch (event.kind)
+            {
+            case TR_RPC_EVENT_NOTIFY:
+                if (event.torrentId != 0)
+                {
+                    tr_variantDictAddInt(d, TR_KEY_id, event.torrentId);
+                }
+
+                break;
+
+            case TR_RPC_EVENT_SESSION_STATS:
+                tr_variantDictAddInt(d, TR_KEY_downloadSpeed, event.stats.downloadSpeed_Bps);
+                tr_variantDictAddInt(d, TR_KEY_uploadSpeed, event.stats.uploadSpeed_Bps);
+                tr_variantDictAddInt(d, TR_KEY_activeTorrentCount, event.stats.activeTorrentCount);
+                tr_variantDictAddInt(d, TR_KEY_pausedTorrentCount, event.stats.pausedTorrentCount);
+                break;
+
+            case TR_RPC_EVENT_LOG:
+                tr_variantDictAddInt(d, TR_KEY_level, event.level);
+                tr_variantDictAddStr(d, TR_KEY_message, event.message.c_str());
+
+                if (!std::empty(event.name))
+                {
+                    tr_variantDictAddStr(d, TR_KEY_name, event.name.c_str());
+                }
+
+                break;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
 static char const* sessionClose(
     tr_session* session,
     [[maybe_unused]] tr_variant* args_in,
@@ -2668,7 +3334,9 @@ static struct method
     { "blocklist-update", false, blocklistUpdate },
     { "free-space", true, freeSpace },
     { "session-close", true, sessionClose },
+    { "session-events", true, sessionEvents },
     { "session-get", true, sessionGet },
+    { "session-perf", true, sessionPerf },
     { "session-set", true, sessionSet },
     { "session-stats", true, sessionStats },
     { "torrent-add", false, torrentAdd },
@@ -2706,6 +3374,7 @@ void tr_rpc_request_exec_json(
     tr_variant* args_in = tr_variantDictFind(mutable_request, TR_KEY_arguments);
     char const* result = nullptr;
     struct method const* method = nullptr;
+    auto const perf = tr_perf_scope{ session, TR_PERF_RPC };
 
     if (callback == nullptr)
     {
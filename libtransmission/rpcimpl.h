@@ -34,3 +34,12 @@ void tr_rpc_request_exec_uri(
     void* callback_user_data);
 
 void tr_rpc_parse_list_str(tr_variant* setme, char const* list_str, size_t list_str_len);
+
+/* record an event for clients of the "session-events" method */
+void tr_rpc_events_publish(tr_session* session, tr_rpc_callback_type type, tr_torrent const* tor);
+
+/* record a logged message for clients of the "session-events" method */
+void tr_rpc_events_publish_log(tr_session* session, tr_log_level level, char const* name, char const* message);
+
+/* record the session's speeds and torrent counts if they've changed since the last call */
+void tr_rpc_events_publish_stats(tr_session* session);
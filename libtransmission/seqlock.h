@@ -0,0 +1,105 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <array>
+#include <atomic>
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <cstring> // memcpy()
+#include <thread>
+#include <type_traits>
+
+/**
+ * A value that one thread publishes and any thread can read without locking.
+ *
+ * store() bumps a sequence number to odd, writes the value, and bumps it
+ * back to even. load() copies the value out and retries if the sequence
+ * number was odd or changed while it copied, so readers never block the
+ * writer and never see a half-written value. The value is kept in atomic
+ * words, so the copies aren't data races.
+ *
+ * Only one thread may call store(). T must be trivially copyable.
+ */
+template<typename T>
+class tr_seqlock
+{
+    static_assert(std::is_trivially_copyable_v<T>, "tr_seqlock copies its value with memcpy()");
+
+public:
+    tr_seqlock() = default;
+    tr_seqlock(tr_seqlock const&) = delete;
+    tr_seqlock& operator=(tr_seqlock const&) = delete;
+
+    void store(T const& value)
+    {
+        auto words = Words{};
+        std::memcpy(std::data(words), &value, sizeof(T));
+
+        auto const seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i = 0; i < WordCount; ++i)
+        {
+            words_[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    T load() const
+    {
+        auto words = Words{};
+
+        for (;;)
+        {
+            auto const before = seq_.load(std::memory_order_acquire);
+
+            if ((before & 1) == 0)
+            {
+                for (size_t i = 0; i < WordCount; ++i)
+                {
+                    words[i] = words_[i].load(std::memory_order_relaxed);
+                }
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (seq_.load(std::memory_order_relaxed) == before)
+                {
+                    break;
+                }
+            }
+
+            /* the writer is partway through a store; it's only a few stores long */
+            std::this_thread::yield();
+        }
+
+        auto value = T{};
+        std::memcpy(&value, std::data(words), sizeof(T));
+        return value;
+    }
+
+    /* how many times store() has been called */
+    uint64_t version() const
+    {
+        return seq_.load(std::memory_order_acquire) / 2;
+    }
+
+private:
+    inline auto static constexpr WordCount = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    using Words = std::array<uint64_t, WordCount>;
+
+    std::atomic<uint64_t> seq_{ 0 };
+    std::array<std::atomic<uint64_t>, WordCount> words_ = {};
+};
@@ -8,14 +8,18 @@
 
 #include <algorithm> // std::partial_sort(), std::min(), std::max()
 #include <cerrno> /* ENOENT */
+#include <chrono>
 #include <climits> /* INT_MAX */
+#include <condition_variable>
 #include <csignal>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring> /* memcpy */
 #include <iterator> // std::back_inserter
 #include <list>
+#include <mutex>
 #include <numeric> // std::acumulate()
+#include <thread>
 #include <vector>
 
 #ifndef _WIN32
@@ -34,23 +38,30 @@
 #include "bandwidth.h"
 #include "blocklist.h"
 #include "cache.h"
+#include "crypto.h"
 #include "crypto-utils.h"
 #include "error.h"
 #include "error-types.h"
 #include "fdlimit.h"
 #include "file.h"
 #include "log.h"
+#include "metainfo.h" /* tr_metainfoParse() */
 #include "net.h"
 #include "peer-io.h"
 #include "peer-mgr.h"
+#include "perf.h"
 #include "platform.h" /* tr_lock, tr_getTorrentDir() */
 #include "platform-quota.h" /* tr_device_info_free() */
 #include "port-forwarding.h"
+#include "resume.h" /* tr_torrentPreloadResume() */
 #include "rpc-server.h"
+#include "rpcimpl.h" /* tr_rpc_events_publish_log(), tr_rpc_events_publish_stats() */
 #include "session.h"
 #include "session-id.h"
 #include "stats.h"
+#include "timer-wheel.h"
 #include "torrent.h"
+#include "torrent-magnet.h"
 #include "tr-assert.h"
 #include "tr-dht.h" /* tr_dhtUpkeep() */
 #include "tr-udp.h"
@@ -68,11 +79,19 @@ enum
 #ifdef TR_LIGHTWEIGHT
     DEFAULT_CACHE_SIZE_MB = 2,
     DEFAULT_PREFETCH_ENABLED = false,
+    DEFAULT_READ_AHEAD_DEPTH = 0,
+    DH_KEY_POOL_SIZE = 4,
 #else
     DEFAULT_CACHE_SIZE_MB = 4,
     DEFAULT_PREFETCH_ENABLED = true,
+    DEFAULT_READ_AHEAD_DEPTH = 32,
+    DH_KEY_POOL_SIZE = 32,
 #endif
-    SAVE_INTERVAL_SECS = 360
+    SAVE_INTERVAL_SECS = 360,
+    /* how long a stopped torrent keeps its piece hashes in memory */
+    PIECE_HASHES_IDLE_SECS = 1800,
+    /* how long an info dict stays in memory after a peer last asked for it */
+    INFO_DICT_IDLE_SECS = 600
 };
 
 #define dbgmsg(...) tr_logAddDeepNamed(nullptr, __VA_ARGS__)
@@ -344,7 +363,7 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 63);
+    tr_variantDictReserve(d, 66);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, false);
     tr_variantDictAddStr(d, TR_KEY_blocklist_url, "http://www.example.com/blocklist");
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, DEFAULT_CACHE_SIZE_MB);
@@ -360,6 +379,7 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddStr(d, TR_KEY_incomplete_dir, tr_getDefaultDownloadDir());
     tr_variantDictAddBool(d, TR_KEY_incomplete_dir_enabled, false);
     tr_variantDictAddInt(d, TR_KEY_message_level, TR_LOG_INFO);
+    tr_variantDictAddInt(d, TR_KEY_open_file_limit, TR_DEFAULT_OPEN_FILE_LIMIT);
     tr_variantDictAddInt(d, TR_KEY_download_queue_size, 5);
     tr_variantDictAddBool(d, TR_KEY_download_queue_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_peer_limit_global, atoi(TR_DEFAULT_PEER_LIMIT_GLOBAL_STR));
@@ -373,6 +393,8 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_preallocation, TR_PREALLOCATE_SPARSE);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, DEFAULT_PREFETCH_ENABLED);
+    tr_variantDictAddBool(d, TR_KEY_mmap_enabled, false);
+    tr_variantDictAddInt(d, TR_KEY_read_ahead_depth, DEFAULT_READ_AHEAD_DEPTH);
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, 6);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, 30);
@@ -418,7 +440,7 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 63);
+    tr_variantDictReserve(d, 66);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, tr_blocklistIsEnabled(s));
     tr_variantDictAddStr(d, TR_KEY_blocklist_url, tr_blocklistGetURL(s));
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, tr_sessionGetCacheLimit_MB(s));
@@ -436,6 +458,7 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
     tr_variantDictAddStr(d, TR_KEY_incomplete_dir, tr_sessionGetIncompleteDir(s));
     tr_variantDictAddBool(d, TR_KEY_incomplete_dir_enabled, tr_sessionIsIncompleteDirEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_message_level, tr_logGetLevel());
+    tr_variantDictAddInt(d, TR_KEY_open_file_limit, tr_fdGetFileLimit(s));
     tr_variantDictAddInt(d, TR_KEY_peer_limit_global, s->peerLimit);
     tr_variantDictAddInt(d, TR_KEY_peer_limit_per_torrent, s->peerLimitPerTorrent);
     tr_variantDictAddInt(d, TR_KEY_peer_port, tr_sessionGetPeerPort(s));
@@ -448,6 +471,8 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, tr_sessionIsPortForwardingEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_preallocation, s->preallocationMode);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, s->isPrefetchEnabled);
+    tr_variantDictAddBool(d, TR_KEY_mmap_enabled, s->isMmapEnabled);
+    tr_variantDictAddInt(d, TR_KEY_read_ahead_depth, s->readAheadDepth);
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, s->peer_id_ttl_hours);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, tr_sessionGetQueueStalledEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, tr_sessionGetQueueStalledMinutes(s));
@@ -592,6 +617,8 @@ static void onSaveTimer([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] sh
     for (auto* tor : session->torrents)
     {
         tr_torrentSave(tor);
+        tr_torrentUnloadPieceHashes(tor, PIECE_HASHES_IDLE_SECS);
+        tr_torrentUnloadInfoDict(tor, INFO_DICT_IDLE_SECS);
     }
 
     tr_statsSaveDirty(session);
@@ -629,6 +656,7 @@ tr_session* tr_sessionInit(char const* configDir, bool messageQueuingEnabled, tr
     session->udp6_socket = TR_BAD_SOCKET;
     session->lock = tr_lockNew();
     session->cache = tr_cacheNew(1024 * 1024 * 2);
+    session->dhKeyPool = tr_dhKeyPoolNew(DH_KEY_POOL_SIZE);
     session->magicNumber = SESSION_MAGIC_NUMBER;
     session->session_id = tr_session_id_new();
     session->bandwidth = new Bandwidth(nullptr);
@@ -663,6 +691,9 @@ tr_session* tr_sessionInit(char const* configDir, bool messageQueuingEnabled, tr
 
 static void turtleCheckClock(tr_session* s, struct tr_turtle_info* t);
 
+/* how stale tr_torrentStatSnapshot() can get for an idle torrent */
+static auto constexpr StatSnapshotMaxAgeSecs = time_t{ 10 };
+
 static void onNowTimer([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vsession)
 {
     auto* session = static_cast<tr_session*>(vsession);
@@ -707,6 +738,26 @@ static void onNowTimer([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] sho
         }
     }
 
+    /* republish the stat snapshots of torrents that were marked dirty or are
+       active since the last second. Idle ones are refreshed every
+       StatSnapshotMaxAgeSecs, staggered by id so that they don't all come
+       due in the same second. tr_torrentStat() reads state that the other
+       threads change under the session lock */
+    tr_sessionLock(session);
+
+    for (auto* tor : session->torrents)
+    {
+        if (tor->statSnapshotWanted.exchange(false, std::memory_order_relaxed) || tr_torrentStatSnapshotIsStale(tor) ||
+            (now + tor->uniqueId) % StatSnapshotMaxAgeSecs == 0)
+        {
+            tr_torrentPublishStatSnapshot(tor);
+        }
+    }
+
+    tr_rpc_events_publish_stats(session);
+
+    tr_sessionUnlock(session);
+
     /**
     ***  Set the timer
     **/
@@ -728,8 +779,98 @@ static void onNowTimer([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] sho
     tr_timerAdd(session->nowTimer, 0, usec);
 }
 
+/***
+****  Timer wheel
+***/
+
+/* a monotonic clock, like the one libevent uses for its own timers */
+static uint64_t timerWheelNow()
+{
+    auto const now = std::chrono::steady_clock::now().time_since_epoch();
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+}
+
+static void armTimerWheel(tr_session* session, uint64_t now)
+{
+    auto const wakeup = session->timerWheel->next_wakeup_msec();
+    session->timerWheelWakeupMsec = wakeup;
+
+    if (wakeup == 0)
+    {
+        evtimer_del(session->timerWheelEvent);
+    }
+    else
+    {
+        tr_timerAddMsec(session->timerWheelEvent, wakeup > now ? int(wakeup - now) : 0);
+    }
+}
+
+static void onTimerWheel([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vsession)
+{
+    auto* session = static_cast<tr_session*>(vsession);
+
+    tr_sessionLock(session);
+
+    /* timers that the callbacks schedule are picked up by armTimerWheel() below.
+       tr_perfNowUsec() reads the same clock as timerWheelNow(), just in usec */
+    auto const now_usec = tr_perfNowUsec();
+    auto const now = now_usec / 1000;
+
+    /* how long the loop was busy with other work when these timers were due */
+    if (auto const due = session->timerWheelWakeupMsec; due != 0)
+    {
+        auto const due_usec = due * 1000;
+        tr_perfAdd(session, TR_PERF_EVENT_LOOP, now_usec > due_usec ? now_usec - due_usec : 0);
+    }
+
+    session->timerWheelWakeupMsec = now;
+    session->timerWheel->advance(now);
+    armTimerWheel(session, timerWheelNow());
+
+    tr_sessionUnlock(session);
+}
+
+void tr_sessionAddTimer(tr_session* session, tr_timer* timer, uint64_t delay_msec)
+{
+    TR_ASSERT(tr_isSession(session));
+    TR_ASSERT(session->timerWheel != nullptr);
+
+    tr_sessionLock(session);
+
+    auto const now = timerWheelNow();
+    session->timerWheel->schedule(timer, now, delay_msec);
+
+    if (session->timerWheelWakeupMsec == 0 || now + delay_msec < session->timerWheelWakeupMsec)
+    {
+        armTimerWheel(session, now);
+    }
+
+    tr_sessionUnlock(session);
+}
+
+void tr_sessionRemoveTimer(tr_session* session, tr_timer* timer)
+{
+    if (!tr_timer_wheel::is_scheduled(timer))
+    {
+        return;
+    }
+
+    tr_sessionLock(session);
+
+    /* an early wakeup is harmless, so the event is left armed */
+    session->timerWheel->cancel(timer);
+
+    tr_sessionUnlock(session);
+}
+
 static void loadBlocklists(tr_session* session);
 
+/* journal errors and info messages for clients of the "session-events" method */
+static void onLogMessage(tr_log_level level, char const* name, char const* message, void* vsession)
+{
+    tr_rpc_events_publish_log(static_cast<tr_session*>(vsession), level, name, message);
+}
+
 static void tr_sessionInitImpl(void* vdata)
 {
     auto* data = static_cast<struct init_data*>(vdata);
@@ -751,12 +892,16 @@ static void tr_sessionInitImpl(void* vdata)
     session->nowTimer = evtimer_new(session->event_base, onNowTimer, session);
     onNowTimer(0, 0, session);
 
+    session->timerWheel = new tr_timer_wheel(timerWheelNow());
+    session->timerWheelEvent = evtimer_new(session->event_base, onTimerWheel, session);
+
 #ifndef _WIN32
     /* Don't exit when writing on a broken socket */
     signal(SIGPIPE, SIG_IGN);
 #endif
 
     tr_logSetQueueEnabled(data->messageQueuingEnabled);
+    tr_logSetListener(onLogMessage, session);
 
     tr_setConfigDir(session, data->configDir);
 
@@ -843,6 +988,11 @@ static void sessionSetImpl(void* vdata)
         tr_sessionSetCacheLimit_MB(session, i);
     }
 
+    if (tr_variantDictFindInt(settings, TR_KEY_open_file_limit, &i))
+    {
+        tr_fdSetFileLimit(session, i);
+    }
+
     if (tr_variantDictFindInt(settings, TR_KEY_peer_limit_per_torrent, &i))
     {
         tr_sessionSetPeerLimitPerTorrent(session, i);
@@ -949,6 +1099,16 @@ static void sessionSetImpl(void* vdata)
         session->isPrefetchEnabled = boolVal;
     }
 
+    if (tr_variantDictFindBool(settings, TR_KEY_mmap_enabled, &boolVal))
+    {
+        session->isMmapEnabled = boolVal;
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_read_ahead_depth, &i))
+    {
+        session->readAheadDepth = std::max(0, (int)i);
+    }
+
     if (tr_variantDictFindInt(settings, TR_KEY_preallocation, &i))
     {
         session->preallocationMode = tr_preallocation_mode(i);
@@ -1306,6 +1466,15 @@ bool tr_sessionIsLocked(tr_session const* session)
     return tr_isSession(session) && tr_lockHave(session->lock);
 }
 
+void tr_sessionGetLockStats(tr_session* session, tr_lock_stats* setme)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_sessionLock(session);
+    tr_lockGetStats(session->lock, setme);
+    tr_sessionUnlock(session);
+}
+
 /***
 ****  Peer Port
 ***/
@@ -1918,6 +2087,8 @@ static void sessionCloseImplStart(tr_session* session)
 {
     session->isClosing = true;
 
+    tr_logSetListener(nullptr, nullptr);
+
     free_incoming_peer_port(session);
 
     if (session->isLPDEnabled)
@@ -2011,6 +2182,16 @@ static void sessionCloseImplFinish(tr_session* session)
     tr_statsClose(session);
     tr_peerMgrFree(session->peerMgr);
 
+    /* no new handshakes now. secrets that are still being computed
+     * are handed to the event thread, which is still running */
+    tr_dhKeyPoolFree(session->dhKeyPool);
+    session->dhKeyPool = nullptr;
+
+    event_free(session->timerWheelEvent);
+    session->timerWheelEvent = nullptr;
+    delete session->timerWheel;
+    session->timerWheel = nullptr;
+
     closeBlocklists(session);
 
     tr_fdClose(session);
@@ -2121,29 +2302,112 @@ void tr_sessionClose(tr_session* session)
     delete session;
 }
 
+/* one .torrent file from the torrents dir, read and parsed off the event thread */
+struct tr_torrent_preload
+{
+    char* path;
+    bool isParsed;
+    bool hasResume;
+    bool hasInfo;
+    size_t infoDictLength;
+    tr_variant metainfo;
+    tr_info info;
+    tr_variant resume;
+};
+
 struct sessionLoadTorrentsData
 {
     tr_session* session;
     tr_ctor* ctor;
-    int* setmeCount;
-    tr_torrent** torrents;
-    bool done;
+    std::vector<tr_torrent_preload>* preloads;
+    std::vector<tr_torrent*> torrents;
+
+    /* how many preloads the event thread has registered so far */
+    size_t registered;
+    std::mutex mutex;
+    std::condition_variable cv;
 };
 
-static void sessionLoadTorrents(void* vdata)
+/* how many torrents to register per trip to the event thread,
+   so that the event loop stays responsive during startup */
+static auto constexpr LoadTorrentsBatchSize = size_t{ 64 };
+
+static void preloadTorrent(tr_session const* session, tr_torrent_preload* preload)
+{
+    if (tr_ctorLoadMetainfoFile(preload->path, &preload->metainfo) != 0)
+    {
+        return;
+    }
+
+    if (!tr_metainfoParse(session, &preload->metainfo, &preload->info, &preload->hasInfo, &preload->infoDictLength))
+    {
+        tr_variantFree(&preload->metainfo);
+        return;
+    }
+
+    preload->isParsed = true;
+    preload->hasResume = tr_torrentPreloadResume(session, &preload->info, &preload->resume);
+}
+
+static void registerPreloadedTorrents(void* vdata)
 {
     auto* data = static_cast<struct sessionLoadTorrentsData*>(vdata);
     TR_ASSERT(tr_isSession(data->session));
 
-    tr_ctorSetSave(data->ctor, false); /* since we already have them */
+    auto& preloads = *data->preloads;
+    size_t const begin = data->registered;
+    size_t const end = std::min(begin + LoadTorrentsBatchSize, std::size(preloads));
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        auto& preload = preloads[i];
+
+        if (!preload.isParsed)
+        {
+            continue;
+        }
+
+        tr_ctorSetPreparsed(
+            data->ctor,
+            preload.path,
+            &preload.metainfo,
+            &preload.info,
+            preload.hasInfo,
+            preload.infoDictLength,
+            preload.hasResume ? &preload.resume : nullptr);
+
+        tr_torrent* const tor = tr_torrentNew(data->ctor, nullptr, nullptr);
+
+        if (tor != nullptr)
+        {
+            data->torrents.push_back(tor);
+        }
+        else if (preload.info.hashString[0] != '\0')
+        {
+            /* tr_torrentNew() didn't take it, e.g. a duplicate */
+            tr_metainfoFree(&preload.info);
+        }
+    }
 
+    auto const lock = std::lock_guard(data->mutex);
+    data->registered = end;
+    data->cv.notify_all();
+}
+
+tr_torrent** tr_sessionLoadTorrents(tr_session* session, tr_ctor* ctor, int* setmeCount)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_ctorSetSave(ctor, false); /* since we already have them */
+
+    /* list the .torrent files */
+    auto preloads = std::vector<tr_torrent_preload>{};
     tr_sys_path_info info;
-    char const* dirname = tr_getTorrentDir(data->session);
+    char const* dirname = tr_getTorrentDir(session);
     tr_sys_dir_t odir = (tr_sys_path_get_info(dirname, 0, &info, nullptr) && info.type == TR_SYS_PATH_IS_DIRECTORY) ?
         tr_sys_dir_open(dirname, nullptr) :
         TR_BAD_SYS_DIR;
 
-    auto torrents = std::list<tr_torrent*>{};
     if (odir != TR_BAD_SYS_DIR)
     {
         char const* name;
@@ -2152,57 +2416,104 @@ static void sessionLoadTorrents(void* vdata)
         {
             if (tr_str_has_suffix(name, ".torrent"))
             {
-                tr_torrent* tor;
-                char* path = tr_buildPath(dirname, name, nullptr);
-                tr_ctorSetMetainfoFromFile(data->ctor, path);
+                auto preload = tr_torrent_preload{};
+                preload.path = tr_buildPath(dirname, name, nullptr);
+                preloads.push_back(preload);
+            }
+        }
+
+        tr_sys_dir_close(odir, nullptr);
+    }
+
+    /* read and parse the .torrent and .resume files on a pool of threads.
+       this is where the time goes, and none of it needs the event thread */
+    {
+        auto next = size_t{ 0 };
+        auto next_mutex = std::mutex{};
+        auto const worker = [session, &preloads, &next, &next_mutex]()
+        {
+            for (;;)
+            {
+                size_t i;
 
-                if ((tor = tr_torrentNew(data->ctor, nullptr, nullptr)) != nullptr)
                 {
-                    torrents.push_back(tor);
+                    auto const lock = std::lock_guard(next_mutex);
+                    i = next++;
                 }
 
-                tr_free(path);
+                if (i >= std::size(preloads))
+                {
+                    return;
+                }
+
+                preloadTorrent(session, &preloads[i]);
             }
+        };
+
+        size_t const threadCount = std::min(size_t{ std::max(1U, std::thread::hardware_concurrency()) }, std::size(preloads));
+        auto threads = std::vector<std::thread>{};
+
+        for (size_t i = 0; i < threadCount; ++i)
+        {
+            threads.emplace_back(worker);
         }
 
-        tr_sys_dir_close(odir, nullptr);
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
     }
 
-    int const n = std::size(torrents);
-    data->torrents = tr_new(tr_torrent*, n);
-    std::copy(std::begin(torrents), std::end(torrents), data->torrents);
+    /* register them on the event thread, a batch at a time */
+    auto data = sessionLoadTorrentsData{};
+    data.session = session;
+    data.ctor = ctor;
+    data.preloads = &preloads;
+    data.registered = 0;
 
-    if (n != 0)
+    while (data.registered < std::size(preloads))
     {
-        tr_logAddInfo(_("Loaded %d torrents"), n);
+        size_t const wanted = std::min(data.registered + LoadTorrentsBatchSize, std::size(preloads));
+
+        tr_runInEventThread(session, registerPreloadedTorrents, &data);
+
+        auto lock = std::unique_lock(data.mutex);
+        data.cv.wait(lock, [&data, wanted]() { return data.registered >= wanted; });
     }
 
-    if (data->setmeCount != nullptr)
+    /* don't leave the ctor pointing at our preloads */
+    tr_ctorSetPreparsed(ctor, nullptr, nullptr, nullptr, false, 0, nullptr);
+
+    for (auto& preload : preloads)
     {
-        *data->setmeCount = n;
-    }
+        if (preload.isParsed)
+        {
+            tr_variantFree(&preload.metainfo);
 
-    data->done = true;
-}
+            if (preload.hasResume)
+            {
+                tr_variantFree(&preload.resume);
+            }
+        }
 
-tr_torrent** tr_sessionLoadTorrents(tr_session* session, tr_ctor* ctor, int* setmeCount)
-{
-    struct sessionLoadTorrentsData data;
+        tr_free(preload.path);
+    }
 
-    data.session = session;
-    data.ctor = ctor;
-    data.setmeCount = setmeCount;
-    data.torrents = nullptr;
-    data.done = false;
+    int const n = std::size(data.torrents);
+    auto** torrents = tr_new(tr_torrent*, n);
+    std::copy(std::begin(data.torrents), std::end(data.torrents), torrents);
 
-    tr_runInEventThread(session, sessionLoadTorrents, &data);
+    if (n != 0)
+    {
+        tr_logAddInfo(_("Loaded %d torrents"), n);
+    }
 
-    while (!data.done)
+    if (setmeCount != nullptr)
     {
-        tr_wait_msec(100);
+        *setmeCount = n;
     }
 
-    return data.torrents;
+    return torrents;
 }
 
 /***
@@ -2403,6 +2714,16 @@ static bool tr_stringEndsWith(char const* strval, char const* end)
     return slen >= elen && memcmp(&strval[slen - elen], end, elen) == 0;
 }
 
+/* The peer manager looks addresses up while holding the session lock,
+   so the old index is only swapped out and freed while we hold it too. */
+static void rebuildBlocklistIndex(tr_session* session)
+{
+    tr_sessionLock(session);
+    tr_blocklistIndexFree(session->blocklistIndex);
+    session->blocklistIndex = tr_blocklistIndexNew(session->blocklists);
+    tr_sessionUnlock(session);
+}
+
 static void loadBlocklists(tr_session* session)
 {
     tr_sys_dir_t odir;
@@ -2501,6 +2822,7 @@ static void loadBlocklists(tr_session* session)
         std::end(loadme),
         std::back_inserter(session->blocklists),
         [&isEnabled](auto const& path) { return tr_blocklistFileNew(path.c_str(), isEnabled); });
+    rebuildBlocklistIndex(session);
 
     /* cleanup */
     tr_sys_dir_close(odir, nullptr);
@@ -2512,6 +2834,11 @@ static void closeBlocklists(tr_session* session)
     auto& src = session->blocklists;
     std::for_each(std::begin(src), std::end(src), [](auto* b) { tr_blocklistFileFree(b); });
     src.clear();
+
+    tr_sessionLock(session);
+    tr_blocklistIndexFree(session->blocklistIndex);
+    session->blocklistIndex = nullptr;
+    tr_sessionUnlock(session);
 }
 
 void tr_sessionReloadBlocklists(tr_session* session)
@@ -2545,6 +2872,10 @@ void tr_blocklistSetEnabled(tr_session* session, bool enabled)
 {
     TR_ASSERT(tr_isSession(session));
 
+    /* this is called from the GUI threads too, while the
+       session thread is checking peers against the blocklists */
+    tr_sessionLock(session);
+
     session->isBlocklistEnabled = enabled;
 
     auto& src = session->blocklists;
@@ -2552,6 +2883,9 @@ void tr_blocklistSetEnabled(tr_session* session, bool enabled)
         std::begin(src),
         std::end(src),
         [enabled](auto* blocklist) { tr_blocklistFileSetEnabled(blocklist, enabled); });
+    rebuildBlocklistIndex(session);
+
+    tr_sessionUnlock(session);
 }
 
 bool tr_blocklistExists(tr_session const* session)
@@ -2587,17 +2921,14 @@ int tr_blocklistSetContent(tr_session* session, char const* contentFilename)
 
     // set the default blocklist's content
     int const ruleCount = tr_blocklistFileSetContent(b, contentFilename);
+    rebuildBlocklistIndex(session);
     tr_sessionUnlock(session);
     return ruleCount;
 }
 
 bool tr_sessionIsAddressBlocked(tr_session const* session, tr_address const* addr)
 {
-    auto& src = session->blocklists;
-    return std::any_of(
-        std::begin(src),
-        std::end(src),
-        [&addr](auto* blocklist) { return tr_blocklistFileHasAddress(blocklist, addr); });
+    return tr_blocklistIndexHasAddress(session->blocklistIndex, addr);
 }
 
 void tr_blocklistSetURL(tr_session* session, char const* url)
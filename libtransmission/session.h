@@ -15,8 +15,10 @@
 #define TR_NAME "Transmission"
 
 #include <cstring> // memcmp()
+#include <deque>
 #include <list>
 #include <map>
+#include <string>
 #include <unordered_set>
 #include <vector>
 
@@ -24,7 +26,11 @@
 
 #include "bandwidth.h"
 #include "bitfield.h"
+#include "handshake.h"
 #include "net.h"
+#include "peer-io.h"
+#include "perf.h"
+#include "platform.h" /* tr_lock_stats */
 #include "tr-macros.h"
 #include "utils.h"
 #include "variant.h"
@@ -58,9 +64,13 @@ struct tr_announcer;
 struct tr_announcer_udp;
 struct tr_bindsockets;
 struct tr_blocklistFile;
+struct tr_blocklist_index;
 struct tr_cache;
+struct tr_dh_key_pool;
 struct tr_fdInfo;
 struct tr_device_info;
+struct tr_timer;
+class tr_timer_wheel;
 
 struct tr_turtle_info
 {
@@ -103,6 +113,53 @@ struct tr_turtle_info
     tr_auto_switch_state_t autoTurtleState;
 };
 
+enum tr_rpc_event_kind
+{
+    TR_RPC_EVENT_NOTIFY,
+    TR_RPC_EVENT_SESSION_STATS,
+    TR_RPC_EVENT_LOG
+};
+
+/* the session-wide numbers carried by a TR_RPC_EVENT_SESSION_STATS event */
+struct tr_rpc_event_stats
+{
+    unsigned int downloadSpeed_Bps;
+    unsigned int uploadSpeed_Bps;
+    int activeTorrentCount;
+    int pausedTorrentCount;
+
+    bool operator==(tr_rpc_event_stats const& that) const
+    {
+        return downloadSpeed_Bps == that.downloadSpeed_Bps && uploadSpeed_Bps == that.uploadSpeed_Bps &&
+            activeTorrentCount == that.activeTorrentCount && pausedTorrentCount == that.pausedTorrentCount;
+    }
+
+    bool operator!=(tr_rpc_event_stats const& that) const
+    {
+        return !(*this == that);
+    }
+};
+
+/* an entry in the session's journal of rpc notifications */
+struct tr_rpc_event
+{
+    uint64_t seq;
+    time_t date;
+    tr_rpc_event_kind kind;
+
+    /* TR_RPC_EVENT_NOTIFY */
+    tr_rpc_callback_type type;
+    int torrentId;
+
+    /* TR_RPC_EVENT_SESSION_STATS */
+    tr_rpc_event_stats stats;
+
+    /* TR_RPC_EVENT_LOG */
+    tr_log_level level;
+    std::string name;
+    std::string message;
+};
+
 struct CompareHash
 {
     bool operator()(uint8_t const* const a, uint8_t const* const b) const
@@ -129,6 +186,7 @@ struct tr_session
     bool isLPDEnabled;
     bool isBlocklistEnabled;
     bool isPrefetchEnabled;
+    bool isMmapEnabled; /* serve reads of complete files from memory maps */
     bool isTorrentDoneScriptEnabled;
     bool isClosing;
     bool isClosed;
@@ -142,6 +200,9 @@ struct tr_session
 
     uint8_t peer_id_ttl_hours;
 
+    /* how many queued upload requests per peer to load into the cache ahead of time */
+    int readAheadDepth;
+
     tr_variant removedTorrents;
 
     bool stalledEnabled;
@@ -217,11 +278,24 @@ struct tr_session
     struct tr_device_info* downloadDir;
 
     std::list<tr_blocklistFile*> blocklists;
+    struct tr_blocklist_index* blocklistIndex;
     struct tr_peerMgr* peerMgr;
     struct tr_shared* shared;
 
     struct tr_cache* cache;
 
+    /* bytes of info dicts kept in memory; see tr_torrentAddMetadataPiece() */
+    size_t infoDictCacheBytes;
+
+    /* Diffie-Hellman key pairs and secrets for encrypted handshakes */
+    struct tr_dh_key_pool* dhKeyPool;
+    struct tr_handshake_stats handshakeStats;
+
+    struct tr_peer_write_stats peerWriteStats;
+
+    /* timings of the hot paths; see perf.h */
+    tr_perf_counters perfCounters;
+
     struct tr_lock* lock;
 
     struct tr_web* web;
@@ -231,6 +305,11 @@ struct tr_session
     tr_rpc_func rpc_func;
     void* rpc_func_user_data;
 
+    /* recent rpc notifications, served by the "session-events" method */
+    std::deque<tr_rpc_event> rpcEvents;
+    uint64_t rpcEventSeq;
+    tr_rpc_event_stats rpcEventStats;
+
     struct tr_stats_handle* sessionStats;
 
     struct tr_announcer* announcer;
@@ -241,6 +320,11 @@ struct tr_session
     struct event* nowTimer;
     struct event* saveTimer;
 
+    /* per-peer and per-torrent timeouts; see tr_sessionAddTimer() */
+    tr_timer_wheel* timerWheel;
+    struct event* timerWheelEvent;
+    uint64_t timerWheelWakeupMsec;
+
     /* monitors the "global pool" speeds */
     // Changed to non-owning pointer temporarily till tr_session becomes C++-constructible and destructible
     // TODO: change tr_bandwidth* to owning pointer to the bandwidth, or remove * and own the value
@@ -267,6 +351,7 @@ char const* tr_sessionFindTorrentFile(tr_session const* session, char const* has
 
 void tr_sessionSetTorrentFile(tr_session* session, char const* hashString, char const* filename);
 
+/* the caller must hold the session lock; the blocklist index is replaced under it */
 bool tr_sessionIsAddressBlocked(tr_session const* session, struct tr_address const* addr);
 
 void tr_sessionLock(tr_session*);
@@ -275,6 +360,14 @@ void tr_sessionUnlock(tr_session*);
 
 bool tr_sessionIsLocked(tr_session const*);
 
+/* how often the session lock was taken, and how long threads waited for it */
+void tr_sessionGetLockStats(tr_session* session, tr_lock_stats* setme);
+
+/* (re)schedule `timer` to call its callback once, `delay_msec` from now. The callback runs in the event thread */
+void tr_sessionAddTimer(tr_session* session, struct tr_timer* timer, uint64_t delay_msec);
+
+void tr_sessionRemoveTimer(tr_session* session, struct tr_timer* timer);
+
 struct tr_address const* tr_sessionGetPublicAddress(tr_session const* session, int tr_af_type, bool* is_default_value);
 
 struct tr_bindsockets* tr_sessionGetBindSockets(tr_session*);
@@ -0,0 +1,260 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <algorithm> // std::max(), std::min()
+#include <array>
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
+#include "tr-assert.h"
+
+/**
+ * A timeout scheduled on a tr_timer_wheel.
+ *
+ * The owner embeds it in its own struct, so scheduling it doesn't allocate.
+ * A zero-filled tr_timer is a valid unscheduled one.
+ */
+struct tr_timer
+{
+    using callback_t = void (*)(void* user_data);
+
+    callback_t callback = nullptr;
+    void* user_data = nullptr;
+
+    /* private to tr_timer_wheel */
+    tr_timer* prev = nullptr;
+    tr_timer* next = nullptr;
+    tr_timer** slot = nullptr;
+    uint64_t expires_at = 0;
+};
+
+/**
+ * A hashed hierarchical timer wheel.
+ *
+ * Time is counted in ticks of TickMsec. The first level has a slot for
+ * each of the next Slots ticks; each level above it has a slot for Slots
+ * times as long a span. Scheduling and cancelling a timer only link or
+ * unlink it in a slot, so both are O(1) no matter how many timers are
+ * pending. When the first level wraps around, the next level's current
+ * slot is redistributed into the levels below it.
+ *
+ * The wheel doesn't read the clock: the owner calls advance() with the
+ * current time, and can use next_wakeup_msec() to decide when to do so.
+ */
+class tr_timer_wheel
+{
+public:
+    inline auto static constexpr TickMsec = uint64_t{ 10 };
+
+    explicit tr_timer_wheel(uint64_t now_msec)
+        : now_{ now_msec / TickMsec }
+    {
+    }
+
+    ~tr_timer_wheel()
+    {
+        for (auto& level : slots_)
+        {
+            for (auto& head : level)
+            {
+                while (head != nullptr)
+                {
+                    unlink(head);
+                }
+            }
+        }
+    }
+
+    tr_timer_wheel(tr_timer_wheel const&) = delete;
+    tr_timer_wheel& operator=(tr_timer_wheel const&) = delete;
+
+    /* (re)schedule `timer` to fire `delay_msec` from now. Timeouts longer than the wheel is clamped */
+    void schedule(tr_timer* timer, uint64_t now_msec, uint64_t delay_msec)
+    {
+        TR_ASSERT(timer->callback != nullptr);
+
+        cancel(timer);
+        resync(now_msec);
+
+        auto const expires_at = (now_msec + delay_msec + TickMsec - 1) / TickMsec;
+        timer->expires_at = std::min(std::max(expires_at, now_ + 1), now_ + MaxTicks);
+        place(timer);
+        ++size_;
+    }
+
+    void cancel(tr_timer* timer)
+    {
+        if (is_scheduled(timer))
+        {
+            unlink(timer);
+            --size_;
+        }
+    }
+
+    static bool is_scheduled(tr_timer const* timer)
+    {
+        return timer->slot != nullptr;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    /* fire every timer that is due by `now_msec`. Callbacks may schedule or cancel timers */
+    void advance(uint64_t now_msec)
+    {
+        auto const target = now_msec / TickMsec;
+
+        resync(now_msec);
+
+        while (now_ < target)
+        {
+            ++now_;
+
+            if ((now_ & SlotMask) == 0)
+            {
+                cascade();
+            }
+
+            auto& head = slots_[0][now_ & SlotMask];
+
+            while (head != nullptr)
+            {
+                auto* const timer = head;
+                unlink(timer);
+                --size_;
+                timer->callback(timer->user_data);
+            }
+        }
+    }
+
+    /* the earliest time advance() needs to be called, or 0 if no timers are scheduled */
+    uint64_t next_wakeup_msec() const
+    {
+        if (empty())
+        {
+            return 0;
+        }
+
+        /* look ahead in the first level until it wraps; after that a cascade is due */
+        auto tick = now_ + 1;
+
+        for (; (tick & SlotMask) != 0; ++tick)
+        {
+            if (slots_[0][tick & SlotMask] != nullptr)
+            {
+                break;
+            }
+        }
+
+        return tick * TickMsec;
+    }
+
+private:
+    inline auto static constexpr SlotBits = 6;
+    inline auto static constexpr Slots = size_t{ 1 } << SlotBits;
+    inline auto static constexpr SlotMask = uint64_t{ Slots - 1 };
+    inline auto static constexpr Levels = 4;
+    inline auto static constexpr MaxTicks = (uint64_t{ 1 } << (SlotBits * Levels)) - 1;
+
+    void place(tr_timer* timer)
+    {
+        /* cascade() can re-place a timer that is due in the current tick; it lands in the slot about to fire */
+        TR_ASSERT(timer->expires_at >= now_);
+        auto const delta = timer->expires_at - now_;
+        TR_ASSERT(delta <= MaxTicks);
+
+        auto level = 0;
+        while (delta >= (uint64_t{ 1 } << (SlotBits * (level + 1))))
+        {
+            ++level;
+        }
+
+        auto& head = slots_[level][(timer->expires_at >> (SlotBits * level)) & SlotMask];
+        timer->slot = &head;
+        timer->prev = nullptr;
+        timer->next = head;
+
+        if (head != nullptr)
+        {
+            head->prev = timer;
+        }
+
+        head = timer;
+    }
+
+    /* an empty wheel has nothing to fire or cascade, so after an idle spell it
+     * jumps to the current tick instead of walking every tick it missed. This
+     * also keeps new timers from being clamped against a stale tick. */
+    void resync(uint64_t now_msec)
+    {
+        if (empty())
+        {
+            now_ = std::max(now_, now_msec / TickMsec);
+        }
+    }
+
+    static void unlink(tr_timer* timer)
+    {
+        if (timer->prev != nullptr)
+        {
+            timer->prev->next = timer->next;
+        }
+        else
+        {
+            *timer->slot = timer->next;
+        }
+
+        if (timer->next != nullptr)
+        {
+            timer->next->prev = timer->prev;
+        }
+
+        timer->prev = nullptr;
+        timer->next = nullptr;
+        timer->slot = nullptr;
+    }
+
+    /* move the timers in each upper level's current slot down to the levels below */
+    void cascade()
+    {
+        for (int level = 1; level < Levels; ++level)
+        {
+            auto& head = slots_[level][(now_ >> (SlotBits * level)) & SlotMask];
+
+            while (head != nullptr)
+            {
+                auto* const timer = head;
+                unlink(timer);
+                place(timer);
+            }
+
+            /* the next level only turns over when this one wraps too */
+            if (((now_ >> (SlotBits * level)) & SlotMask) != 0)
+            {
+                break;
+            }
+        }
+    }
+
+    std::array<std::array<tr_timer*, Slots>, Levels> slots_ = {};
+    uint64_t now_ = 0;
+    size_t size_ = 0;
+};
@@ -42,6 +42,12 @@ struct tr_ctor
     tr_variant metainfo;
     char* sourceFile;
 
+    /* set by tr_ctorSetPreparsed(); owned by the caller */
+    tr_info* preparsedInfo;
+    bool preparsedHasInfo;
+    size_t preparsedInfoDictLength;
+    tr_variant* preloadedResume;
+
     struct optional_args optionalArgs[2];
 
     char* cookies;
@@ -77,6 +83,11 @@ static void clearMetainfo(tr_ctor* ctor)
         tr_variantFree(&ctor->metainfo);
     }
 
+    ctor->preparsedInfo = nullptr;
+    ctor->preparsedHasInfo = false;
+    ctor->preparsedInfoDictLength = 0;
+    ctor->preloadedResume = nullptr;
+
     setSourceFile(ctor, nullptr);
 }
 
@@ -122,32 +133,27 @@ int tr_ctorSetMetainfoFromMagnetLink(tr_ctor* ctor, char const* magnet_link)
     return err;
 }
 
-int tr_ctorSetMetainfoFromFile(tr_ctor* ctor, char const* filename)
+int tr_ctorLoadMetainfoFile(char const* filename, tr_variant* setme)
 {
-    uint8_t* metainfo;
     size_t len;
     int err;
-
-    metainfo = tr_loadFile(filename, &len, nullptr);
+    uint8_t* const metainfo = tr_loadFile(filename, &len, nullptr);
 
     if (metainfo != nullptr && len != 0)
     {
-        err = tr_ctorSetMetainfo(ctor, metainfo, len);
+        err = tr_variantFromBenc(setme, metainfo, len);
     }
     else
     {
-        clearMetainfo(ctor);
         err = 1;
     }
 
-    setSourceFile(ctor, filename);
-
     /* if no `name' field was set, then set it from the filename */
-    if (ctor->isSet_metainfo)
+    if (err == 0)
     {
         tr_variant* info;
 
-        if (tr_variantDictFindDict(&ctor->metainfo, TR_KEY_info, &info))
+        if (tr_variantDictFindDict(setme, TR_KEY_info, &info))
         {
             char const* name;
 
@@ -174,6 +180,59 @@ int tr_ctorSetMetainfoFromFile(tr_ctor* ctor, char const* filename)
     return err;
 }
 
+int tr_ctorSetMetainfoFromFile(tr_ctor* ctor, char const* filename)
+{
+    clearMetainfo(ctor);
+
+    int const err = tr_ctorLoadMetainfoFile(filename, &ctor->metainfo);
+    ctor->isSet_metainfo = err == 0;
+
+    setSourceFile(ctor, filename);
+    return err;
+}
+
+void tr_ctorSetPreparsed(
+    tr_ctor* ctor,
+    char const* sourceFile,
+    tr_variant* metainfo,
+    tr_info* info,
+    bool hasInfo,
+    size_t infoDictLength,
+    tr_variant* resume)
+{
+    clearMetainfo(ctor);
+
+    if (metainfo != nullptr)
+    {
+        ctor->metainfo = *metainfo;
+        ctor->isSet_metainfo = true;
+        tr_variantInitBool(metainfo, false);
+
+        ctor->preparsedInfo = info;
+        ctor->preparsedHasInfo = hasInfo;
+        ctor->preparsedInfoDictLength = infoDictLength;
+        ctor->preloadedResume = resume;
+
+        setSourceFile(ctor, sourceFile);
+    }
+}
+
+tr_info* tr_ctorGetPreparsedInfo(tr_ctor const* ctor, bool* setmeHasInfo, size_t* setmeInfoDictLength)
+{
+    if (ctor->preparsedInfo != nullptr)
+    {
+        *setmeHasInfo = ctor->preparsedHasInfo;
+        *setmeInfoDictLength = ctor->preparsedInfoDictLength;
+    }
+
+    return ctor->preparsedInfo;
+}
+
+tr_variant* tr_ctorGetPreloadedResume(tr_ctor const* ctor)
+{
+    return ctor->preloadedResume;
+}
+
 int tr_ctorSetMetainfoFromHash(tr_ctor* ctor, char const* hashString)
 {
     int err;
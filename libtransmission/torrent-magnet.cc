@@ -6,6 +6,8 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <limits.h> /* INT_MAX */
 #include <string.h> /* memcpy(), memset(), memcmp() */
 
@@ -18,6 +20,7 @@
 #include "magnet.h"
 #include "metainfo.h"
 #include "resume.h"
+#include "session.h"
 #include "torrent.h"
 #include "torrent-magnet.h"
 #include "tr-assert.h"
@@ -34,7 +37,13 @@
 enum
 {
     /* don't ask for the same metadata piece more than this often */
-    MIN_REPEAT_INTERVAL_SECS = 3
+    MIN_REPEAT_INTERVAL_SECS = 3,
+#ifdef TR_LIGHTWEIGHT
+    /* how many bytes of info dicts the session keeps in memory for serving metadata */
+    INFO_DICT_CACHE_MAX_BYTES = 1024 * 1024 * 2
+#else
+    INFO_DICT_CACHE_MAX_BYTES = 1024 * 1024 * 16
+#endif
 };
 
 struct metadata_node
@@ -111,48 +120,166 @@ bool tr_torrentSetMetadataSizeHint(tr_torrent* tor, int64_t size)
     return true;
 }
 
-static size_t findInfoDictOffset(tr_torrent const* tor)
+static size_t findInfoDictOffset(uint8_t const* fileContents, size_t fileLen)
 {
-    size_t fileLen;
-    uint8_t* fileContents;
     size_t offset = 0;
+    tr_variant top;
 
-    /* load the file, and find the info dict's offset inside the file */
-    if ((fileContents = tr_loadFile(tor->info.torrent, &fileLen, nullptr)) != nullptr)
+    /* find the info dict's offset inside the file */
+    if (tr_variantFromBenc(&top, fileContents, fileLen) == 0)
     {
-        tr_variant top;
+        tr_variant* infoDict;
 
-        if (tr_variantFromBenc(&top, fileContents, fileLen) == 0)
+        if (tr_variantDictFindDict(&top, TR_KEY_info, &infoDict))
         {
-            tr_variant* infoDict;
+            size_t infoLen;
+            char* infoContents = tr_variantToStr(infoDict, TR_VARIANT_FMT_BENC, &infoLen);
+            uint8_t const* i = (uint8_t const*)tr_memmem((char const*)fileContents, fileLen, infoContents, infoLen);
+            offset = i != nullptr ? i - fileContents : 0;
+            tr_free(infoContents);
+        }
+
+        tr_variantFree(&top);
+    }
+
+    return offset;
+}
+
+/***
+****  The info dict, kept in memory for serving ut_metadata requests.
+****
+****  The buffer is refcounted so that outgoing messages can reference it
+****  without copying; it stays alive until the last of them is sent even
+****  if the torrent drops its own reference in the meantime.
+***/
+
+struct tr_info_dict_buffer
+{
+    std::atomic<int> refcount;
+    size_t len;
+    uint8_t* data;
+};
 
-            if (tr_variantDictFindDict(&top, TR_KEY_info, &infoDict))
+static struct tr_info_dict_buffer* infoDictBufferNew(uint8_t* data, size_t len)
+{
+    auto* buf = new tr_info_dict_buffer{};
+    buf->refcount = 1;
+    buf->data = data;
+    buf->len = len;
+    return buf;
+}
+
+static void infoDictBufferUnref(struct tr_info_dict_buffer* buf)
+{
+    if (--buf->refcount == 0)
+    {
+        tr_free(buf->data);
+        delete buf;
+    }
+}
+
+static void onInfoDictReferenceDone([[maybe_unused]] void const* data, [[maybe_unused]] size_t len, void* vbuf)
+{
+    infoDictBufferUnref(static_cast<struct tr_info_dict_buffer*>(vbuf));
+}
+
+static void infoDictDrop(tr_torrent* tor)
+{
+    if (tor->infoDictBuffer != nullptr)
+    {
+        tor->session->infoDictCacheBytes -= tor->infoDictBuffer->len;
+        infoDictBufferUnref(tor->infoDictBuffer);
+        tor->infoDictBuffer = nullptr;
+    }
+}
+
+/* drop the least-recently-used info dicts until `incoming' more bytes fit in the budget */
+static void infoDictCacheMakeRoom(tr_session* session, size_t incoming)
+{
+    while (session->infoDictCacheBytes > 0 && session->infoDictCacheBytes + incoming > INFO_DICT_CACHE_MAX_BYTES)
+    {
+        tr_torrent* oldest = nullptr;
+
+        for (auto* tor : session->torrents)
+        {
+            if (tor->infoDictBuffer != nullptr && (oldest == nullptr || tor->infoDictUsedAt < oldest->infoDictUsedAt))
             {
-                size_t infoLen;
-                char* infoContents = tr_variantToStr(infoDict, TR_VARIANT_FMT_BENC, &infoLen);
-                uint8_t const* i = (uint8_t const*)tr_memmem((char*)fileContents, fileLen, infoContents, infoLen);
-                offset = i != nullptr ? i - fileContents : 0;
-                tr_free(infoContents);
+                oldest = tor;
             }
+        }
 
-            tr_variantFree(&top);
+        if (oldest == nullptr)
+        {
+            break;
         }
 
-        tr_free(fileContents);
+        infoDictDrop(oldest);
     }
+}
 
-    return offset;
+static void infoDictSet(tr_torrent* tor, uint8_t* data, size_t len)
+{
+    infoDictDrop(tor);
+    infoDictCacheMakeRoom(tor->session, len);
+
+    tor->infoDictBuffer = infoDictBufferNew(data, len);
+    tor->infoDictUsedAt = tr_time();
+    tor->session->infoDictCacheBytes += len;
 }
 
-static void ensureInfoDictOffsetIsCached(tr_torrent* tor)
+static struct tr_info_dict_buffer* ensureInfoDictIsLoaded(tr_torrent* tor)
 {
     TR_ASSERT(tr_torrentHasMetadata(tor));
 
-    if (!tor->infoDictOffsetIsCached)
+    if (tor->infoDictBuffer == nullptr && tor->infoDictLength > 0)
+    {
+        size_t fileLen;
+        uint8_t* fileContents = tr_loadFile(tor->info.torrent, &fileLen, nullptr);
+
+        if (fileContents != nullptr)
+        {
+            if (!tor->infoDictOffsetIsCached)
+            {
+                tor->infoDictOffset = findInfoDictOffset(fileContents, fileLen);
+                tor->infoDictOffsetIsCached = true;
+            }
+
+            if (tor->infoDictOffset + tor->infoDictLength <= fileLen)
+            {
+                auto* data = static_cast<uint8_t*>(tr_memdup(fileContents + tor->infoDictOffset, tor->infoDictLength));
+                infoDictSet(tor, data, tor->infoDictLength);
+            }
+
+            tr_free(fileContents);
+        }
+    }
+
+    if (tor->infoDictBuffer != nullptr)
     {
-        tor->infoDictOffset = findInfoDictOffset(tor);
-        tor->infoDictOffsetIsCached = true;
+        tor->infoDictUsedAt = tr_time();
     }
+
+    return tor->infoDictBuffer;
+}
+
+static bool getMetadataPieceRange(tr_torrent* tor, int piece, size_t* setmeOffset, size_t* setmeLen)
+{
+    if (piece < 0 || !tr_torrentHasMetadata(tor) || ensureInfoDictIsLoaded(tor) == nullptr)
+    {
+        return false;
+    }
+
+    size_t const o = (size_t)piece * METADATA_PIECE_SIZE;
+    size_t const total = tor->infoDictBuffer->len;
+
+    if (o >= total)
+    {
+        return false;
+    }
+
+    *setmeOffset = o;
+    *setmeLen = std::min(total - o, size_t{ METADATA_PIECE_SIZE });
+    return true;
 }
 
 void* tr_torrentGetMetadataPiece(tr_torrent* tor, int piece, size_t* len)
@@ -161,49 +288,59 @@ void* tr_torrentGetMetadataPiece(tr_torrent* tor, int piece, size_t* len)
     TR_ASSERT(piece >= 0);
     TR_ASSERT(len != nullptr);
 
-    char* ret = nullptr;
+    size_t o;
+    size_t l;
 
-    if (tr_torrentHasMetadata(tor))
+    if (!getMetadataPieceRange(tor, piece, &o, &l))
     {
-        tr_sys_file_t fd;
-
-        ensureInfoDictOffsetIsCached(tor);
-
-        TR_ASSERT(tor->infoDictLength > 0);
+        return nullptr;
+    }
 
-        fd = tr_sys_file_open(tor->info.torrent, TR_SYS_FILE_READ, 0, nullptr);
+    *len = l;
+    return tr_memdup(tor->infoDictBuffer->data + o, l);
+}
 
-        if (fd != TR_BAD_SYS_FILE)
-        {
-            size_t const o = piece * METADATA_PIECE_SIZE;
+size_t tr_torrentAddMetadataPiece(tr_torrent* tor, int piece, struct evbuffer* out, bool zeroCopy)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(out != nullptr);
 
-            if (tr_sys_file_seek(fd, tor->infoDictOffset + o, TR_SEEK_SET, nullptr, nullptr))
-            {
-                size_t const l = o + METADATA_PIECE_SIZE <= tor->infoDictLength ? METADATA_PIECE_SIZE : tor->infoDictLength - o;
+    size_t o;
+    size_t l;
 
-                if (0 < l && l <= METADATA_PIECE_SIZE)
-                {
-                    char* buf = tr_new(char, l);
-                    uint64_t n;
+    if (!getMetadataPieceRange(tor, piece, &o, &l))
+    {
+        return 0;
+    }
 
-                    if (tr_sys_file_read(fd, buf, l, &n, nullptr) && n == l)
-                    {
-                        *len = l;
-                        ret = buf;
-                        buf = nullptr;
-                    }
+    struct tr_info_dict_buffer* buf = tor->infoDictBuffer;
 
-                    tr_free(buf);
-                }
-            }
+    if (!zeroCopy)
+    {
+        evbuffer_add(out, buf->data + o, l);
+    }
+    else
+    {
+        ++buf->refcount;
 
-            tr_sys_file_close(fd, nullptr);
+        if (evbuffer_add_reference(out, buf->data + o, l, onInfoDictReferenceDone, buf) != 0)
+        {
+            infoDictBufferUnref(buf);
+            return 0;
         }
     }
 
-    TR_ASSERT(ret == nullptr || *len > 0);
+    return l;
+}
 
-    return ret;
+void tr_torrentUnloadInfoDict(tr_torrent* tor, time_t idleSecs)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+
+    if (tor->infoDictBuffer != nullptr && tr_time() - tor->infoDictUsedAt >= idleSecs)
+    {
+        infoDictDrop(tor);
+    }
 }
 
 static int getPieceNeededIndex(struct tr_incomplete_metadata const* m, int piece)
@@ -322,6 +459,7 @@ void tr_torrentSetMetadataPiece(tr_torrent* tor, int piece, void const* data, in
                         /* keep the new info */
                         tor->info = info;
                         tor->infoDictLength = infoDictLength;
+                        tor->infoDictOffsetIsCached = false;
 
                         /* save the new .torrent file */
                         tr_variantToFile(&newMetainfo, TR_VARIANT_FMT_BENC, tor->info.torrent);
@@ -340,6 +478,17 @@ void tr_torrentSetMetadataPiece(tr_torrent* tor, int piece, void const* data, in
 
         if (success)
         {
+            /* the verified metadata is exactly the info dict that peers will ask us for */
+            if (tor->infoDictLength == (size_t)m->metadata_size)
+            {
+                infoDictSet(tor, m->metadata, m->metadata_size);
+                m->metadata = nullptr;
+            }
+            else
+            {
+                infoDictDrop(tor);
+            }
+
             incompleteMetadataFree(tor->incompleteMetadata);
             tor->incompleteMetadata = nullptr;
             tor->isStopping = true;
@@ -18,8 +18,28 @@
 // defined by BEP #9
 inline constexpr int METADATA_PIECE_SIZE = 1024 * 16;
 
+struct evbuffer;
+
 void* tr_torrentGetMetadataPiece(tr_torrent* tor, int piece, size_t* len);
 
+/**
+ * @brief append metadata piece `piece' to `out'
+ *
+ * The info dict is loaded from the .torrent file once and kept in memory.
+ * If `zeroCopy' is set, `out' references that memory instead of copying it,
+ * so it must not be modified in place (e.g. encrypted) afterwards.
+ *
+ * @return the number of bytes appended, or 0 if the piece isn't available
+ */
+size_t tr_torrentAddMetadataPiece(tr_torrent* tor, int piece, struct evbuffer* out, bool zeroCopy);
+
+/**
+ * @brief Free the in-memory info dict if it hasn't been used for `idleSecs' seconds
+ *
+ * Pending zero-copy messages keep their own reference to it.
+ */
+void tr_torrentUnloadInfoDict(tr_torrent* tor, time_t idleSecs);
+
 void tr_torrentSetMetadataPiece(tr_torrent* tor, int piece, void const* data, int len);
 
 bool tr_torrentGetNextMetadataRequest(tr_torrent* tor, time_t now, int* setme);
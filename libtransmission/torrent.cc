@@ -44,6 +44,7 @@
 #include "peer-mgr.h"
 #include "platform.h" /* TR_PATH_DELIMITER_STR */
 #include "resume.h"
+#include "rpcimpl.h" /* tr_rpc_events_publish() */
 #include "session.h"
 #include "subprocess.h"
 #include "torrent.h"
@@ -272,6 +273,7 @@ void tr_torrentSetRatioMode(tr_torrent* tor, tr_ratiolimit mode)
         tor->ratioLimitMode = mode;
 
         tr_torrentSetDirty(tor);
+        tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
     }
 }
 
@@ -291,6 +293,7 @@ void tr_torrentSetRatioLimit(tr_torrent* tor, double desiredRatio)
         tor->desiredRatio = desiredRatio;
 
         tr_torrentSetDirty(tor);
+        tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
     }
 }
 
@@ -389,6 +392,7 @@ void tr_torrentSetIdleMode(tr_torrent* tor, tr_idlelimit mode)
         tor->idleLimitMode = mode;
 
         tr_torrentSetDirty(tor);
+        tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
     }
 }
 
@@ -408,6 +412,7 @@ void tr_torrentSetIdleLimit(tr_torrent* tor, uint16_t idleMinutes)
         tor->idleLimitMinutes = idleMinutes;
 
         tr_torrentSetDirty(tor);
+        tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
     }
 }
 
@@ -514,6 +519,7 @@ void tr_torrentSetLocalError(tr_torrent* tor, char const* fmt, ...)
     va_start(ap, fmt);
     tor->error = TR_STAT_LOCAL_ERROR;
     tor->errorTracker[0] = '\0';
+    tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
     evutil_vsnprintf(tor->errorString, sizeof(tor->errorString), fmt, ap);
     va_end(ap);
 
@@ -525,11 +531,12 @@ void tr_torrentSetLocalError(tr_torrent* tor, char const* fmt, ...)
     }
 }
 
-static constexpr void tr_torrentClearError(tr_torrent* tor)
+static void tr_torrentClearError(tr_torrent* tor)
 {
     tor->error = TR_STAT_OK;
     tor->errorString[0] = '\0';
     tor->errorTracker[0] = '\0';
+    tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
 }
 
 static void onTrackerResponse(tr_torrent* tor, tr_tracker_event const* event, [[maybe_unused]] void* user_data)
@@ -552,6 +559,7 @@ static void onTrackerResponse(tr_torrent* tor, tr_tracker_event const* event, [[
     case TR_TRACKER_WARNING:
         tr_logAddTorErr(tor, _("Tracker warning: \"%s\""), event->text);
         tor->error = TR_STAT_TRACKER_WARNING;
+        tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
         tr_strlcpy(tor->errorTracker, event->tracker, sizeof(tor->errorTracker));
         tr_strlcpy(tor->errorString, event->text, sizeof(tor->errorString));
         break;
@@ -559,6 +567,7 @@ static void onTrackerResponse(tr_torrent* tor, tr_tracker_event const* event, [[
     case TR_TRACKER_ERROR:
         tr_logAddTorErr(tor, _("Tracker error: \"%s\""), event->text);
         tor->error = TR_STAT_TRACKER_ERROR;
+        tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
         tr_strlcpy(tor->errorTracker, event->tracker, sizeof(tor->errorTracker));
         tr_strlcpy(tor->errorString, event->text, sizeof(tor->errorString));
         break;
@@ -613,30 +622,17 @@ static constexpr bool pieceHasFile(tr_piece_index_t piece, tr_file const* file)
     return file->firstPiece <= piece && piece <= file->lastPiece;
 }
 
-static tr_priority_t calculatePiecePriority(tr_torrent const* tor, tr_piece_index_t piece, tr_file_index_t file_hint)
+static tr_priority_t calculatePiecePriority(tr_torrent const* tor, tr_piece_index_t piece)
 {
-    // safeguard against a bad arg
     tr_info const* const inf = tr_torrentInfo(tor);
-    file_hint = std::min(file_hint, inf->fileCount - 1);
-
-    // find the first file with data in this piece
-    tr_file_index_t first = file_hint;
-    while (first > 0 && pieceHasFile(piece, &inf->files[first - 1]))
-    {
-        --first;
-    }
+    auto const span = tr_torrentPieceFileSpan(tor, piece);
 
     // the priority is the max of all the file priorities in the piece
     tr_priority_t priority = TR_PRI_LOW;
-    for (tr_file_index_t i = first; i < inf->fileCount; ++i)
+    for (tr_file_index_t i = span.first; i <= span.last; ++i)
     {
         tr_file const* file = &inf->files[i];
 
-        if (!pieceHasFile(piece, file))
-        {
-            break;
-        }
-
         priority = std::max(priority, file->priority);
 
         /* When dealing with multimedia files, getting the first and
@@ -664,8 +660,10 @@ static void tr_torrentInitFilePieces(tr_torrent* tor)
         initFilePieces(inf, f);
     }
 
-    /* build the array of first-file hints to give calculatePiecePriority */
-    tr_file_index_t* firstFiles = tr_new(tr_file_index_t, inf->pieceCount);
+    /* build the piece -> first file table that tr_torrentPieceFileSpan() uses */
+    tr_free(tor->pieceFirstFile);
+    tor->pieceFirstFile = tr_new(tr_file_index_t, inf->pieceCount);
+    tr_file_index_t* firstFiles = tor->pieceFirstFile;
     tr_file_index_t f = 0;
 
     for (tr_piece_index_t p = 0; p < inf->pieceCount; ++p)
@@ -680,7 +678,7 @@ static void tr_torrentInitFilePieces(tr_torrent* tor)
 
 #if 0
 
-    /* test to confirm the first-file hints are correct */
+    /* test to confirm the first-file table is correct */
     for (tr_piece_index_t p = 0; p < inf->pieceCount; ++p)
     {
         tr_file_index_t f = firstFiles[p];
@@ -710,10 +708,8 @@ static void tr_torrentInitFilePieces(tr_torrent* tor)
 
     for (tr_piece_index_t p = 0; p < inf->pieceCount; ++p)
     {
-        inf->pieces[p].priority = calculatePiecePriority(tor, p, firstFiles[p]);
+        inf->pieces[p].priority = calculatePiecePriority(tor, p);
     }
-
-    tr_free(firstFiles);
 }
 
 static void torrentStart(tr_torrent* tor, bool bypass_queue);
@@ -768,6 +764,8 @@ static void torrentInitFromInfo(tr_torrent* tor)
         tor->lastBlockSize = tor->blockSize;
     }
 
+    tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_ALL);
+
     tor->blockCount = tor->blockSize != 0 ? (info->totalSize + tor->blockSize - 1) / tor->blockSize : 0;
     tor->blockCountInPiece = tor->blockSize != 0 ? info->pieceSize / tor->blockSize : 0;
     tor->blockCountInLastPiece = tor->blockSize != 0 ? (tor->lastPieceSize + tor->blockSize - 1) / tor->blockSize : 0;
@@ -978,6 +976,13 @@ static void torrentInit(tr_torrent* tor, tr_ctor const* ctor)
     {
         tr_torrentStart(tor);
     }
+    else
+    {
+        /* it'll be a while before a stopped torrent needs these */
+        tr_torrentUnloadPieceHashes(tor, 0);
+    }
+
+    tr_torrentPublishStatSnapshot(tor);
 
     tr_sessionUnlock(session);
 }
@@ -1009,7 +1014,25 @@ static tr_parse_result torrentParseImpl(
         return TR_PARSE_ERR;
     }
 
-    didParse = tr_metainfoParse(session, metainfo, setmeInfo, &hasInfo, dictLength);
+    size_t preparsedDictLength = 0;
+    tr_info* const preparsed = tr_ctorGetPreparsedInfo(ctor, &hasInfo, &preparsedDictLength);
+
+    if (preparsed != nullptr && preparsed->hashString[0] != '\0')
+    {
+        /* already parsed off the event thread; take it */
+        *setmeInfo = *preparsed;
+        memset(preparsed, 0, sizeof(tr_info));
+        didParse = true;
+
+        if (dictLength != nullptr)
+        {
+            *dictLength = preparsedDictLength;
+        }
+    }
+    else
+    {
+        didParse = tr_metainfoParse(session, metainfo, setmeInfo, &hasInfo, dictLength);
+    }
     doFree = didParse && (setmeInfo == &tmp);
 
     if (!didParse)
@@ -1173,7 +1196,9 @@ tr_stat const* tr_torrentStatCached(tr_torrent* tor)
 {
     time_t const now = tr_time();
 
-    return (tr_isTorrent(tor) && now == tor->lastStatTime) ? &tor->stats : tr_torrentStat(tor);
+    return (tr_isTorrent(tor) && now == tor->lastStatTime && (tor->statDirty & TR_STAT_DIRTY_STATE) == 0) ?
+        &tor->stats :
+        tr_torrentStat(tor);
 }
 
 void tr_torrentSetVerifyState(tr_torrent* tor, tr_verify_state state)
@@ -1183,6 +1208,7 @@ void tr_torrentSetVerifyState(tr_torrent* tor, tr_verify_state state)
 
     tor->verifyState = state;
     tor->anyDate = tr_time();
+    tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE | TR_STAT_DIRTY_VERIFY_PROGRESS);
 }
 
 tr_torrent_activity tr_torrentGetActivity(tr_torrent const* tor)
@@ -1259,6 +1285,7 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
     uint64_t const now = tr_time_msec();
 
     tr_stat* s;
+    tr_torrent_activity previousActivity;
     uint64_t seedRatioBytesLeft;
     uint64_t seedRatioBytesGoal;
     bool seedRatioApplies;
@@ -1275,6 +1302,7 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
     }
 
     s = &tor->stats;
+    previousActivity = s->activity;
     s->id = tor->uniqueId;
     s->activity = tr_torrentGetActivity(tor);
     s->error = tor->error;
@@ -1307,7 +1335,16 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
     s->percentDone = tr_cpPercentDone(&tor->completion);
     s->leftUntilDone = tr_torrentGetLeftUntilDone(tor);
     s->sizeWhenDone = tr_cpSizeWhenDone(&tor->completion);
-    s->recheckProgress = s->activity == TR_STATUS_CHECK ? getVerifyProgress(tor) : 0;
+
+    if (s->activity != TR_STATUS_CHECK)
+    {
+        s->recheckProgress = 0;
+    }
+    else if ((tor->statDirty & TR_STAT_DIRTY_VERIFY_PROGRESS) != 0 || previousActivity != TR_STATUS_CHECK)
+    {
+        s->recheckProgress = getVerifyProgress(tor);
+    }
+
     s->activityDate = tor->activityDate;
     s->addedDate = tor->addedDate;
     s->doneDate = tor->doneDate;
@@ -1321,7 +1358,14 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
     s->uploadedEver = tor->uploadedCur + tor->uploadedPrev;
     s->haveValid = tr_cpHaveValid(&tor->completion);
     s->haveUnchecked = tr_torrentHaveTotal(tor) - s->haveValid;
-    s->desiredAvailable = tr_peerMgrGetDesiredAvailable(tor);
+
+    /* walking the swarm's piece availability is the most expensive part of
+       building a tr_stat, so only redo it when one of its inputs changed */
+    if ((tor->statDirty & TR_STAT_DIRTY_DESIRED_AVAILABLE) != 0 || s->activity != previousActivity)
+    {
+        s->desiredAvailable = tr_peerMgrGetDesiredAvailable(tor);
+    }
+
 
     s->ratio = tr_getRatio(s->uploadedEver, s->downloadedEver != 0 ? s->downloadedEver : s->haveValid);
 
@@ -1422,58 +1466,65 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
     TR_ASSERT(s->leftUntilDone <= s->sizeWhenDone);
     TR_ASSERT(s->desiredAvailable <= s->leftUntilDone);
 
+    tor->statDirty = 0;
+
     return s;
 }
 
-/***
-****
-***/
+void tr_torrentPublishStatSnapshot(tr_torrent* tor)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(tr_sessionIsLocked(tor->session));
+
+    auto snapshot = tr_torrent::StatSnapshot{};
+    snapshot.stat = *tr_torrentStat(tor);
+    tr_strlcpy(snapshot.errorString, tor->errorString, sizeof(snapshot.errorString));
+    snapshot.stat.errorString = nullptr;
+    tor->statSnapshot.store(snapshot);
+    tor->statSnapshotActivity = snapshot.stat.activity;
+    tor->statSnapshotTransferring = snapshot.stat.pieceUploadSpeed_KBps > 0 || snapshot.stat.pieceDownloadSpeed_KBps > 0;
+}
 
-static uint64_t countFileBytesCompleted(tr_torrent const* tor, tr_file_index_t index)
+bool tr_torrentStatSnapshotIsStale(tr_torrent const* tor)
 {
-    uint64_t total = 0;
-    tr_file const* f = &tor->info.files[index];
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(tr_sessionIsLocked(tor->session));
 
-    if (f->length != 0)
+    if (tr_torrentGetActivity(tor) != tor->statSnapshotActivity)
     {
-        tr_block_index_t first;
-        tr_block_index_t last;
-        tr_torGetFileBlockRange(tor, index, &first, &last);
+        return true;
+    }
 
-        if (first == last)
-        {
-            if (tr_torrentBlockIsComplete(tor, first))
-            {
-                total = f->length;
-            }
-        }
-        else
-        {
-            /* the first block */
-            if (tr_torrentBlockIsComplete(tor, first))
-            {
-                total += tor->blockSize - f->offset % tor->blockSize;
-            }
+    /* progress, ratio and eta change with every second that data moves */
+    uint64_t const now = tr_time_msec();
+    bool const transferring = tor->bandwidth->getPieceSpeedBytesPerSecond(now, TR_UP) > 0 ||
+        tor->bandwidth->getPieceSpeedBytesPerSecond(now, TR_DOWN) > 0;
+    return transferring || tor->statSnapshotTransferring;
+}
 
-            /* the middle blocks */
-            if (first + 1 < last)
-            {
-                uint64_t u = tor->completion.blockBitfield->countRange(first + 1, last);
-                u *= tor->blockSize;
-                total += u;
-            }
+void tr_torrentStatSnapshot(tr_torrent const* tor, tr_stat* setme, char* errbuf, size_t errbuflen)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(setme != nullptr);
 
-            /* the last block */
-            if (tr_torrentBlockIsComplete(tor, last))
-            {
-                total += f->offset + f->length - (uint64_t)tor->blockSize * last;
-            }
-        }
-    }
+    auto const snapshot = tor->statSnapshot.load();
+    *setme = snapshot.stat;
 
-    return total;
+    if (errbuf != nullptr && errbuflen > 0)
+    {
+        tr_strlcpy(errbuf, snapshot.errorString, errbuflen);
+        setme->errorString = errbuf;
+    }
+    else
+    {
+        setme->errorString = "";
+    }
 }
 
+/***
+****
+***/
+
 tr_file_stat* tr_torrentFiles(tr_torrent const* tor, tr_file_index_t* fileCount)
 {
     TR_ASSERT(tr_isTorrent(tor));
@@ -1481,12 +1532,11 @@ tr_file_stat* tr_torrentFiles(tr_torrent const* tor, tr_file_index_t* fileCount)
     tr_file_index_t const n = tor->info.fileCount;
     tr_file_stat* files = tr_new0(tr_file_stat, n);
     tr_file_stat* walk = files;
-    bool const isSeed = tor->completeness == TR_SEED;
 
     for (tr_file_index_t i = 0; i < n; ++i)
     {
         uint64_t const length = tor->info.files[i].length;
-        uint64_t const b = isSeed ? length : countFileBytesCompleted(tor, i);
+        uint64_t const b = tr_cpFileBytesCompleted(&tor->completion, i);
         walk->bytesCompleted = b;
         walk->progress = length > 0 ? (float)b / (float)length : 1.0F;
         ++walk;
@@ -1567,6 +1617,7 @@ static void tr_torrentResetTransferStats(tr_torrent* tor)
     tor->corruptCur = 0;
 
     tr_torrentSetDirty(tor);
+    tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
 
     tr_torrentUnlock(tor);
 }
@@ -1629,6 +1680,8 @@ static void freeTorrent(tr_torrent* tor)
 
     delete tor->bandwidth;
 
+    tr_torrentUnloadInfoDict(tor, 0);
+    tr_free(tor->pieceFirstFile);
     tr_metainfoFree(inf);
     delete tor;
 
@@ -1649,9 +1702,22 @@ static void torrentStartImpl(void* vtor)
 
     tr_sessionLock(tor->session);
 
-    tr_torrentRecheckCompleteness(tor);
     torrentSetQueued(tor, false);
 
+    /* torrentStart() loaded these, and running torrents keep them,
+       but don't leave a torrent looking like it's running without them */
+    if (!tr_torrentLoadPieceHashes(tor))
+    {
+        tor->isRunning = false;
+        tr_torrentSetLocalError(tor, "%s", _("Unable to read piece hashes from the torrent file"));
+        tr_torrentSetDirty(tor);
+        tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
+        tr_sessionUnlock(tor->session);
+        return;
+    }
+
+    tr_torrentRecheckCompleteness(tor);
+
     time_t const now = tr_time();
 
     tor->isRunning = true;
@@ -1755,8 +1821,19 @@ static void torrentStart(tr_torrent* tor, bool bypass_queue)
      * change the peerid. It would help sometimes if a stopped event
      * was missed to ensure that we didn't think someone was cheating. */
     tr_torrentUnsetPeerId(tor);
+
+    /* a stopped torrent may have dropped its piece hashes, so get
+       them back before it's marked as running */
+    if (!tr_torrentLoadPieceHashes(tor))
+    {
+        tr_torrentSetLocalError(tor, "%s", _("Unable to read piece hashes from the torrent file"));
+        tr_sessionUnlock(tor->session);
+        return;
+    }
+
     tor->isRunning = true;
     tr_torrentSetDirty(tor);
+    tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
     tr_runInEventThread(tor->session, torrentStartImpl, tor);
 
     tr_sessionUnlock(tor->session);
@@ -1858,6 +1935,12 @@ static void verifyTorrent(void* vdata)
     {
         tor->startAfterVerify = false;
     }
+    else if (!tr_torrentLoadPieceHashes(tor))
+    {
+        tr_torrentSetLocalError(tor, "%s", _("Unable to read piece hashes from the torrent file"));
+        tor->startAfterVerify = false;
+        tr_free(data);
+    }
     else
     {
         tr_verifyAdd(tor, onVerifyDone, data);
@@ -1911,6 +1994,7 @@ static void stopTorrent(void* vtor)
     }
 
     torrentSetQueued(tor, false);
+    tor->pieceHashesUsedAt = tr_time();
 
     tr_torrentUnlock(tor);
 
@@ -1935,6 +2019,7 @@ void tr_torrentStop(tr_torrent* tor)
         tor->isStopping = false;
         tor->prefetchMagnetMetadata = false;
         tr_torrentSetDirty(tor);
+        tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
         tr_runInEventThread(tor->session, stopTorrent, tor);
 
         tr_sessionUnlock(tor->session);
@@ -2183,6 +2268,7 @@ void tr_torrentRecheckCompleteness(tr_torrent* tor)
         }
 
         tor->completeness = completeness;
+        tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
         tr_fdTorrentClose(tor->session, tor->uniqueId);
 
         if (tr_torrentIsSeed(tor))
@@ -2206,6 +2292,7 @@ void tr_torrentRecheckCompleteness(tr_torrent* tor)
         }
 
         fireCompletenessChange(tor, completeness, wasRunning);
+        tr_rpc_events_publish(tor->session, TR_RPC_TORRENT_CHANGED, tor);
 
         if (tr_torrentIsSeed(tor) && wasLeeching && wasRunning)
         {
@@ -2265,7 +2352,7 @@ void tr_torrentInitFilePriority(tr_torrent* tor, tr_file_index_t fileIndex, tr_p
 
     for (tr_piece_index_t i = file->firstPiece; i <= file->lastPiece; ++i)
     {
-        tor->info.pieces[i].priority = calculatePiecePriority(tor, i, fileIndex);
+        tor->info.pieces[i].priority = calculatePiecePriority(tor, i);
     }
 }
 
@@ -2391,6 +2478,7 @@ void tr_torrentInitFileDLs(tr_torrent* tor, tr_file_index_t const* files, tr_fil
     }
 
     tr_cpInvalidateDND(&tor->completion);
+    tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_DESIRED_AVAILABLE);
 
     tr_torrentUnlock(tor);
 }
@@ -2608,6 +2696,7 @@ void tr_torrentSetPieceChecked(tr_torrent* tor, tr_piece_index_t pieceIndex)
     TR_ASSERT(pieceIndex < tor->info.pieceCount);
 
     tor->info.pieces[pieceIndex].timeChecked = tr_time();
+    tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_VERIFY_PROGRESS);
 }
 
 void tr_torrentSetChecked(tr_torrent* tor, time_t when)
@@ -2618,11 +2707,13 @@ void tr_torrentSetChecked(tr_torrent* tor, time_t when)
     {
         tor->info.pieces[i].timeChecked = when;
     }
+
+    tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_VERIFY_PROGRESS);
 }
 
 bool tr_torrentCheckPiece(tr_torrent* tor, tr_piece_index_t pieceIndex)
 {
-    bool const pass = tr_ioTestPiece(tor, pieceIndex);
+    bool const pass = tr_torrentLoadPieceHashes(tor) && tr_ioTestPiece(tor, pieceIndex);
 
     tr_deeplog_tor(tor, "[LAZY] tr_torrentCheckPiece tested piece %zu, pass==%d", (size_t)pieceIndex, (int)pass);
     tr_torrentSetHasPiece(tor, pieceIndex, pass);
@@ -2633,6 +2724,39 @@ bool tr_torrentCheckPiece(tr_torrent* tor, tr_piece_index_t pieceIndex)
     return pass;
 }
 
+bool tr_torrentLoadPieceHashes(tr_torrent* tor)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+
+    tor->pieceHashesUsedAt = tr_time();
+
+    return !tr_torrentHasMetadata(tor) || tr_metainfoLoadPieceHashes(&tor->info);
+}
+
+void tr_torrentUnloadPieceHashes(tr_torrent* tor, time_t idleSecs)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+
+    if (tor->info.pieceHashes == nullptr || tor->isRunning || tor->verifyState != TR_VERIFY_NONE)
+    {
+        return;
+    }
+
+    if (tr_time() - tor->pieceHashesUsedAt < idleSecs)
+    {
+        return;
+    }
+
+    /* only drop them if we can get them back */
+    if (tor->info.torrent == nullptr || !tr_sys_path_exists(tor->info.torrent, nullptr))
+    {
+        return;
+    }
+
+    tr_free(tor->info.pieceHashes);
+    tor->info.pieceHashes = nullptr;
+}
+
 time_t tr_torrentGetFileMTime(tr_torrent const* tor, tr_file_index_t i)
 {
     time_t mtime = 0;
@@ -2662,11 +2786,9 @@ bool tr_torrentPieceNeedsCheck(tr_torrent const* tor, tr_piece_index_t p)
     /* If we think we've completed one of the files in this piece,
      * but it's been modified since we last checked it,
      * then it needs to be rechecked */
-    tr_file_index_t f;
-    uint64_t unused;
-    tr_ioFindFileLocation(tor, p, 0, &f, &unused);
+    auto const span = tr_torrentPieceFileSpan(tor, p);
 
-    for (tr_file_index_t i = f; i < inf->fileCount && pieceHasFile(p, &inf->files[i]); ++i)
+    for (tr_file_index_t i = span.first; i <= span.last; ++i)
     {
         if (tr_cpFileIsComplete(&tor->completion, i) && (tr_torrentGetFileMTime(tor, i) > inf->pieces[p].timeChecked))
         {
@@ -3623,12 +3745,14 @@ void tr_torrentSetQueuePosition(tr_torrent* tor, int pos)
         {
             walk->queuePosition--;
             walk->anyDate = now;
+            tr_torrentMarkStatDirty(walk, TR_STAT_DIRTY_STATE);
         }
 
         if ((old_pos > pos) && (pos <= walk->queuePosition) && (walk->queuePosition < old_pos))
         {
             walk->queuePosition++;
             walk->anyDate = now;
+            tr_torrentMarkStatDirty(walk, TR_STAT_DIRTY_STATE);
         }
 
         if (back < walk->queuePosition)
@@ -3639,6 +3763,7 @@ void tr_torrentSetQueuePosition(tr_torrent* tor, int pos)
 
     tor->queuePosition = std::min(pos, back + 1);
     tor->anyDate = now;
+    tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
 
     TR_ASSERT(queueIsSequenced(tor->session));
 }
@@ -3704,6 +3829,7 @@ static void torrentSetQueued(tr_torrent* tor, bool queued)
         tor->isQueued = queued;
         tor->anyDate = tr_time();
         tr_torrentSetDirty(tor);
+        tr_torrentMarkStatDirty(tor, TR_STAT_DIRTY_STATE);
     }
 }
 
@@ -3861,8 +3987,7 @@ static void renameTorrentFileString(tr_torrent* tor, char const* oldpath, char c
     }
     else
     {
-        tr_free(file->name);
-        file->name = name;
+        tr_metainfoSetFileName(&tor->info, fileIndex, name);
         file->is_renamed = true;
     }
 }
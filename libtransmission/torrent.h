@@ -12,11 +12,13 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <atomic>
 #include <string>
 #include <unordered_set>
 
 #include "bandwidth.h" /* tr_bandwidth */
 #include "completion.h" /* tr_completion */
+#include "seqlock.h"
 #include "session.h" /* tr_sessionLock(), tr_sessionUnlock() */
 #include "tr-assert.h"
 #include "tr-macros.h"
@@ -40,6 +42,29 @@ void tr_ctorInitTorrentPriorities(tr_ctor const* ctor, tr_torrent* tor);
 
 void tr_ctorInitTorrentWanted(tr_ctor const* ctor, tr_torrent* tor);
 
+/** Read and decode a .torrent file the way tr_ctorSetMetainfoFromFile() does.
+    Doesn't touch a ctor or session, so it's safe to call from any thread. */
+int tr_ctorLoadMetainfoFile(char const* filename, tr_variant* setme);
+
+/**
+ * Use metainfo that was already decoded and parsed, e.g. on a worker thread.
+ * The ctor takes the contents of `metainfo'. `info' and `resume' stay owned
+ * by the caller, but the next tr_torrentNew() moves their contents out.
+ * `resume' may be nullptr if the .resume file wasn't read ahead of time.
+ */
+void tr_ctorSetPreparsed(
+    tr_ctor* ctor,
+    char const* sourceFile,
+    tr_variant* metainfo,
+    tr_info* info,
+    bool hasInfo,
+    size_t infoDictLength,
+    tr_variant* resume);
+
+tr_info* tr_ctorGetPreparsedInfo(tr_ctor const* ctor, bool* setmeHasInfo, size_t* setmeInfoDictLength);
+
+tr_variant* tr_ctorGetPreloadedResume(tr_ctor const* ctor);
+
 /**
 ***
 **/
@@ -124,6 +149,22 @@ void tr_torrentSetVerifyState(tr_torrent* tor, tr_verify_state state);
 
 tr_torrent_activity tr_torrentGetActivity(tr_torrent const* tor);
 
+/* bits for tr_torrent.statDirty */
+enum tr_stat_dirty : uint8_t
+{
+    /* something a client expects to see right away (activity, error,
+       queue position, settings) changed, so don't serve a cached tr_stat */
+    TR_STAT_DIRTY_STATE = (1 << 0),
+
+    /* the swarm's piece availability or our wanted pieces changed */
+    TR_STAT_DIRTY_DESIRED_AVAILABLE = (1 << 1),
+
+    /* a piece's timeChecked changed */
+    TR_STAT_DIRTY_VERIFY_PROGRESS = (1 << 2),
+
+    TR_STAT_DIRTY_ALL = 0xFF
+};
+
 struct tr_incomplete_metadata;
 
 /** @brief Torrent object */
@@ -171,6 +212,11 @@ struct tr_torrent
      * This field is lazy-generated and might not be initialized yet. */
     size_t infoDictOffset;
 
+    /* The info dict, cached in memory for serving metainfo to peers.
+     * See tr_torrentAddMetadataPiece() and tr_torrentUnloadInfoDict(). */
+    struct tr_info_dict_buffer* infoDictBuffer;
+    time_t infoDictUsedAt;
+
     /* Where the files are now.
      * This pointer will be equal to downloadDir or incompleteDir */
     char const* currentDir;
@@ -185,6 +231,10 @@ struct tr_torrent
     uint16_t blockCountInPiece;
     uint16_t blockCountInLastPiece;
 
+    /* for each piece, the index of the first file with data in it.
+       see tr_torrentPieceFileSpan() */
+    tr_file_index_t* pieceFirstFile;
+
     struct tr_completion completion;
 
     tr_completeness completeness;
@@ -217,6 +267,9 @@ struct tr_torrent
     time_t editDate;
     time_t startDate;
 
+    /* the last time info.pieceHashes was needed; see tr_torrentUnloadPieceHashes() */
+    time_t pieceHashesUsedAt;
+
     int secondsDownloading;
     int secondsSeeding;
 
@@ -256,6 +309,26 @@ struct tr_torrent
     time_t lastStatTime;
     tr_stat stats;
 
+    /* tr_stat fields whose inputs changed since tr_torrentStat() last ran.
+       a mask of tr_stat_dirty bits; see tr_torrentMarkStatDirty() */
+    uint8_t statDirty;
+
+    /* the stats most recently published for tr_torrentStatSnapshot().
+       tr_torrentMarkStatDirty() sets statSnapshotWanted so that it gets
+       republished on the next second. errorString is copied along with
+       the stats because tor->errorString can change after publishing.
+       The activity and whether data was moving are kept to notice the
+       changes that don't mark anything dirty; see tr_torrentStatSnapshotIsStale() */
+    struct StatSnapshot
+    {
+        tr_stat stat;
+        char errorString[128];
+    };
+    tr_seqlock<StatSnapshot> statSnapshot;
+    std::atomic<bool> statSnapshotWanted;
+    tr_torrent_activity statSnapshotActivity;
+    bool statSnapshotTransferring;
+
     int uniqueId;
 
     // Changed to non-owning pointer temporarily till tr_torrent becomes C++-constructible and destructible
@@ -280,6 +353,30 @@ constexpr tr_piece_index_t tr_torBlockPiece(tr_torrent const* tor, tr_block_inde
     return block / tor->blockCountInPiece;
 }
 
+/* a range of files, tor->info.files[first...last] */
+struct tr_file_span
+{
+    tr_file_index_t first;
+    tr_file_index_t last;
+};
+
+/* which files have data in this piece? */
+constexpr tr_file_span tr_torrentPieceFileSpan(tr_torrent const* tor, tr_piece_index_t const piece)
+{
+    TR_ASSERT(piece < tor->info.pieceCount);
+
+    tr_file_index_t const first = tor->pieceFirstFile[piece];
+
+    if (piece + 1 == tor->info.pieceCount)
+    {
+        return { first, tor->info.fileCount - 1 };
+    }
+
+    /* the next piece's first file is either still in this piece or starts the next one */
+    tr_file_index_t const next = tor->pieceFirstFile[piece + 1];
+    return { first, tor->info.files[next].firstPiece <= piece ? next : next - 1 };
+}
+
 /* how many bytes are in this piece? */
 constexpr uint32_t tr_torPieceCountBytes(tr_torrent const* tor, tr_piece_index_t const piece)
 {
@@ -356,6 +453,20 @@ constexpr bool tr_isTorrent(tr_torrent const* tor)
     return tor != nullptr && tor->magicNumber == TORRENT_MAGIC_NUMBER && tr_isSession(tor->session);
 }
 
+/* note that some of the inputs to tr_torrentStat() have changed */
+static inline void tr_torrentMarkStatDirty(tr_torrent* tor, uint8_t fields)
+{
+    tor->statDirty |= fields;
+    tor->statSnapshotWanted.store(true, std::memory_order_relaxed);
+}
+
+/* refresh the stats that tr_torrentStatSnapshot() reads. The caller must hold the session lock */
+void tr_torrentPublishStatSnapshot(tr_torrent* tor);
+
+/* true if the torrent's activity changed, or data is moving or just stopped moving,
+   since the last tr_torrentPublishStatSnapshot(). The caller must hold the session lock */
+bool tr_torrentStatSnapshotIsStale(tr_torrent const* tor);
+
 /* set a flag indicating that the torrent's .resume file
  * needs to be saved when the torrent is closed */
 constexpr void tr_torrentSetDirty(tr_torrent* tor)
@@ -419,6 +530,31 @@ bool tr_torrentPieceNeedsCheck(tr_torrent const* tor, tr_piece_index_t pieceInde
  */
 bool tr_torrentCheckPiece(tr_torrent* tor, tr_piece_index_t pieceIndex);
 
+/* the piece's SHA1 digest, or nullptr if tor->info.pieceHashes isn't loaded */
+static inline uint8_t const* tr_torrentPieceHash(tr_torrent const* tor, tr_piece_index_t pieceIndex)
+{
+    TR_ASSERT(pieceIndex < tor->info.pieceCount);
+
+    auto const* const hashes = tor->info.pieceHashes;
+    return hashes != nullptr ? hashes + size_t{ pieceIndex } * SHA_DIGEST_LENGTH : nullptr;
+}
+
+/**
+ * @brief Make sure tor->info.pieceHashes is loaded, rereading it from
+ *        the torrent's .torrent file if it was unloaded
+ * @return true if the piece hashes are available
+ */
+bool tr_torrentLoadPieceHashes(tr_torrent* tor);
+
+/**
+ * @brief Free tor->info.pieceHashes if the torrent is stopped, hasn't
+ *        needed them for `idleSecs' seconds, and they can be reloaded later
+ *
+ * The piece hashes are most of a torrent's tr_info, and a stopped
+ * torrent doesn't use them. Called periodically for every torrent.
+ */
+void tr_torrentUnloadPieceHashes(tr_torrent* tor, time_t idleSecs);
+
 time_t tr_torrentGetFileMTime(tr_torrent const* tor, tr_file_index_t i);
 
 uint64_t tr_torrentGetCurrentSizeOnDisk(tr_torrent const* tor);
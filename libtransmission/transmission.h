@@ -1394,6 +1394,13 @@ struct tr_peer_stat
 
     /* how many requests we've made and are currently awaiting a response for */
     int pendingReqsToPeer;
+
+    /* how many requests we try to keep outstanding, sized from the peer's
+     * delivery rate and round-trip time */
+    int requestWindow;
+
+    /* smoothed time in msec between requesting a block and receiving it, or 0 if unknown */
+    uint32_t rttMsec;
 };
 
 tr_peer_stat* tr_torrentPeers(tr_torrent const* torrent, int* peerCount);
@@ -1587,11 +1594,14 @@ struct tr_file
     uint64_t offset; /* file begins at the torrent's nth byte */
 };
 
-/** @brief a part of tr_info that represents a single piece of the torrent's content */
+/** @brief a part of tr_info that represents a single piece of the torrent's content
+
+    Note: this used to hold the piece's SHA1 hash too. That's in
+    tr_info.pieceHashes now, and it's only loaded while it's needed,
+    so code that read tr_piece.hash must switch to it. */
 struct tr_piece
 {
     time_t timeChecked; /* the last time we tested this piece */
-    uint8_t hash[SHA_DIGEST_LENGTH]; /* pieces hash */
     int8_t priority; /* TR_PRI_HIGH, _NORMAL, or _LOW */
     bool dnd; /* "do not download" flag */
 };
@@ -1619,6 +1629,17 @@ struct tr_info
     tr_file* files;
     tr_piece* pieces;
 
+    /* One allocation that holds the files' names as parsed from the metainfo.
+     * CLIENT CODE: NOT USE THESE FIELDS. */
+    char* fileNamePool;
+    size_t fileNamePoolSize;
+
+    /* pieceCount SHA1 digests, back to back.
+     * The session only keeps these in memory while a torrent is running or
+     * being verified, so this is nullptr for a torrent that's been stopped
+     * for a while. */
+    uint8_t* pieceHashes;
+
     /* these trackers are sorted by tier */
     tr_tracker_info* trackers;
 
@@ -1866,10 +1887,25 @@ struct tr_stat
 tr_stat const* tr_torrentStat(tr_torrent* torrent);
 
 /** Like tr_torrentStat(), but only recalculates the statistics if it's
-    been longer than a second since they were last calculated. This can
-    reduce the CPU load if you're calling tr_torrentStat() frequently. */
+    been longer than a second since they were last calculated, or if the
+    torrent's state (activity, error, queue position, settings) changed.
+    This can reduce the CPU load if you're calling tr_torrentStat() frequently. */
 tr_stat const* tr_torrentStatCached(tr_torrent* torrent);
 
+/** Like tr_torrentStat(), but copies the statistics that the session thread
+    last published instead of calculating them. It never takes the session
+    lock, so it's the one to use when refreshing many torrents from a GUI thread.
+
+    The session thread republishes them on the next second after the
+    torrent's state (activity, error, queue position, settings, progress)
+    changes, every second while it's transferring data, and at least every
+    ten seconds otherwise. So changes show up within a second, and idle
+    torrents don't cost the session thread anything between refreshes.
+
+    The error text is copied into errbuf, and setme->errorString points to
+    it. If errbuf is nullptr, errorString is empty. */
+void tr_torrentStatSnapshot(tr_torrent const* torrent, tr_stat* setme, char* errbuf, size_t errbuflen);
+
 /** @deprecated because this should only be accessible to libtransmission.
     private code, use tr_torentSetDateAdded() instead */
 TR_DEPRECATED void tr_torrentSetAddedDate(tr_torrent* torrent, time_t addedDate);
@@ -11,22 +11,31 @@
 
 #include <signal.h>
 
+#include <algorithm> // std::max()
+#include <atomic>
+#include <chrono>
+
 #ifdef _WIN32
 #include <winsock2.h>
 #else
 #include <unistd.h> /* read(), write(), pipe() */
 #endif
 
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
 #include <event2/dns.h>
 #include <event2/event.h>
 
 #include "transmission.h"
 #include "log.h"
+#include "mpsc-queue.h"
 #include "net.h"
 #include "session.h"
 
 #include "transmission.h"
-#include "platform.h" /* tr_lockLock() */
+#include "platform.h" /* tr_threadNew() */
 #include "tr-assert.h"
 #include "trevent.h"
 #include "utils.h"
@@ -148,74 +157,173 @@ using tr_pipe_end_t = int;
 ****
 ***/
 
+struct tr_run_data : tr_mpsc_node
+{
+    void (*func)(void*);
+    void* user_data;
+    uint64_t queued_at_usec;
+};
+
 struct tr_event_handle
 {
-    bool die;
+    std::atomic<bool> die;
+
+    /* wakes the event thread. With an eventfd both ends are the same descriptor */
     tr_pipe_end_t fds[2];
-    tr_lock* lock;
+    bool is_eventfd;
+    std::atomic<bool> wakeup_pending;
+
+    tr_mpsc_queue<tr_run_data> queue;
+    std::atomic<size_t> depth;
+    tr_event_queue_stats stats;
+
     tr_session* session;
     tr_thread* thread;
     struct event_base* base;
-    struct event* pipeEvent;
+    struct event* wakeupEvent;
 };
 
-struct tr_run_data
+#define dbgmsg(...) tr_logAddDeepNamed("event", __VA_ARGS__)
+
+/* a wakeup drains at most this many calls before letting other events run */
+static auto constexpr MaxCallsPerWakeup = size_t{ 256 };
+
+static uint64_t nowUsec()
 {
-    void (*func)(void*);
-    void* user_data;
-};
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
 
-#define dbgmsg(...) tr_logAddDeepNamed("event", __VA_ARGS__)
+static void histogramAdd(uint64_t* histogram, uint64_t value)
+{
+    size_t bucket = 0;
+
+    while (value != 0 && bucket + 1 < TR_EVENT_QUEUE_HISTOGRAM_SIZE)
+    {
+        value >>= 1;
+        ++bucket;
+    }
+
+    ++histogram[bucket];
+}
 
-static void readFromPipe(evutil_socket_t fd, short eventType, void* veh)
+static bool openWakeup(tr_event_handle* eh)
 {
-    auto* eh = static_cast<tr_event_handle*>(veh);
+#ifdef HAVE_EVENTFD
+    if (int const fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); fd != -1)
+    {
+        eh->fds[0] = eh->fds[1] = fd;
+        eh->is_eventfd = true;
+        return true;
+    }
+#endif
+
+    if (pipe(eh->fds) == -1)
+    {
+        return false;
+    }
 
-    dbgmsg("readFromPipe: eventType is %hd", eventType);
+    evutil_make_socket_nonblocking(eh->fds[0]);
+    return true;
+}
 
-    /* read the command type */
-    char ch = '\0';
+static void closeWakeup(tr_event_handle* eh)
+{
+    tr_netCloseSocket(eh->fds[0]);
 
-    int ret;
-    do
+    if (eh->fds[1] != eh->fds[0])
     {
-        ret = piperead(fd, &ch, 1);
-    } while (!eh->die && ret == -1 && errno == EAGAIN);
+        tr_netCloseSocket(eh->fds[1]);
+    }
+}
 
-    dbgmsg("command is [%c], ret is %d, errno is %d", ch, ret, (int)errno);
+static void wakeEventThread(tr_event_handle* eh)
+{
+    ev_ssize_t res;
 
-    switch (ch)
+#ifdef HAVE_EVENTFD
+    if (eh->is_eventfd)
     {
-    case 'r': /* run in libevent thread */
-        {
-            struct tr_run_data data;
-            size_t const nwant = sizeof(data);
-            ev_ssize_t const ngot = piperead(fd, &data, nwant);
+        uint64_t const one = 1;
+        res = write(eh->fds[1], &one, sizeof(one));
+    }
+    else
+#endif
+    {
+        char const ch = 'w';
+        res = pipewrite(eh->fds[1], &ch, 1);
+    }
 
-            if (!eh->die && ngot == (ev_ssize_t)nwant)
-            {
-                dbgmsg("invoking function in libevent thread");
-                (*data.func)(data.user_data);
-            }
+    if (res == -1)
+    {
+        tr_logAddError("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+    }
+}
 
-            break;
+static void onWakeup(evutil_socket_t fd, short eventType, void* veh)
+{
+    auto* eh = static_cast<tr_event_handle*>(veh);
+
+    dbgmsg("onWakeup: eventType is %hd", eventType);
+
+    /* reset the wakeup before draining, so that anything queued from here on wakes us again */
+#ifdef HAVE_EVENTFD
+    if (eh->is_eventfd)
+    {
+        uint64_t count = 0;
+        [[maybe_unused]] auto const ngot = read(fd, &count, sizeof(count));
+    }
+    else
+#endif
+    {
+        char buf[64];
+        while (piperead(fd, buf, sizeof(buf)) == sizeof(buf))
+        {
         }
+    }
+
+    eh->wakeup_pending = false;
 
-    case '\0': /* eof */
+    if (eh->die)
+    {
+        dbgmsg("event queue closed... removing event listener");
+        event_free(eh->wakeupEvent);
+        eh->wakeupEvent = nullptr;
+        event_base_loopexit(eh->base, nullptr);
+        return;
+    }
+
+    ++eh->stats.wakeups;
+    eh->stats.max_depth = std::max(eh->stats.max_depth, uint64_t{ eh->depth });
+
+    for (size_t i = 0; i < MaxCallsPerWakeup; ++i)
+    {
+        auto* const data = eh->queue.pop();
+
+        if (data == nullptr)
         {
-            dbgmsg("pipe eof reached... removing event listener");
-            event_free(eh->pipeEvent);
-            tr_netCloseSocket(eh->fds[0]);
-            event_base_loopexit(eh->base, nullptr);
-            break;
+            return;
         }
 
-    default:
+        --eh->depth;
+        ++eh->stats.calls;
+        histogramAdd(eh->stats.latency_usec, nowUsec() - data->queued_at_usec);
+
+        auto const func = data->func;
+        auto* const user_data = data->user_data;
+        delete data;
+
+        dbgmsg("invoking function in libevent thread");
+        (*func)(user_data);
+
+        if (eh->die)
         {
-            TR_ASSERT_MSG(false, "unhandled command type %d", (int)ch);
-            break;
+            return;
         }
     }
+
+    /* there may be more; let other events have a turn before draining them */
+    event_active(eh->wakeupEvent, EV_READ, 0);
 }
 
 static void logFunc(int severity, char const* message)
@@ -248,9 +356,9 @@ static void libeventThreadFunc(void* veh)
     eh->session->evdns_base = evdns_base_new(base, true);
     eh->session->events = eh;
 
-    /* listen to the pipe's read fd */
-    eh->pipeEvent = event_new(base, eh->fds[0], EV_READ | EV_PERSIST, readFromPipe, veh);
-    event_add(eh->pipeEvent, nullptr);
+    /* listen for wakeups */
+    eh->wakeupEvent = event_new(base, eh->fds[0], EV_READ | EV_PERSIST, onWakeup, veh);
+    event_add(eh->wakeupEvent, nullptr);
     event_set_log_callback(logFunc);
 
     /* loop until all the events are done */
@@ -259,24 +367,26 @@ static void libeventThreadFunc(void* veh)
         event_base_dispatch(base);
     }
 
-    /* shut down the thread */
-    tr_lockFree(eh->lock);
+    /* shut down the thread. Calls still queued are dropped */
+    while (auto* const data = eh->queue.pop())
+    {
+        delete data;
+    }
+
+    closeWakeup(eh);
     event_base_free(base);
     eh->session->events = nullptr;
-    tr_free(eh);
+    delete eh;
     tr_logAddDebug("Closing libevent thread");
 }
 
 void tr_eventInit(tr_session* session)
 {
-    tr_event_handle* eh;
-
     session->events = nullptr;
 
-    eh = tr_new0(tr_event_handle, 1);
-    eh->lock = tr_lockNew();
+    auto* const eh = new tr_event_handle{};
 
-    if (pipe(eh->fds) == -1)
+    if (!openWakeup(eh))
     {
         tr_logAddError("Unable to write to pipe() in libtransmission: %s", tr_strerror(errno));
     }
@@ -303,10 +413,18 @@ void tr_eventClose(tr_session* session)
     session->events->die = true;
     if (tr_logGetDeepEnabled())
     {
-        tr_logAddDeep(__FILE__, __LINE__, nullptr, "closing trevent pipe");
+        tr_logAddDeep(__FILE__, __LINE__, nullptr, "closing trevent queue");
     }
 
-    tr_netCloseSocket(session->events->fds[1]);
+    wakeEventThread(session->events);
+}
+
+void tr_eventGetQueueStats(tr_session const* session, tr_event_queue_stats* setme)
+{
+    TR_ASSERT(tr_isSession(session));
+    TR_ASSERT(session->events != nullptr);
+
+    *setme = session->events->stats;
 }
 
 /**
@@ -336,28 +454,20 @@ void tr_runInEventThread(tr_session* session, void (*func)(void*), void* user_da
     }
     else
     {
-        tr_pipe_end_t fd;
-        char ch;
-        ev_ssize_t res_1;
-        ev_ssize_t res_2;
         tr_event_handle* e = session->events;
-        struct tr_run_data data;
-
-        tr_lockLock(e->lock);
-
-        fd = e->fds[1];
-        ch = 'r';
-        res_1 = pipewrite(fd, &ch, 1);
 
-        data.func = func;
-        data.user_data = user_data;
-        res_2 = pipewrite(fd, &data, sizeof(data));
+        auto* const data = new tr_run_data{};
+        data->func = func;
+        data->user_data = user_data;
+        data->queued_at_usec = nowUsec();
 
-        tr_lockUnlock(e->lock);
+        ++e->depth;
+        e->queue.push(data);
 
-        if (res_1 == -1 || res_2 == -1)
+        /* only the first call queued since the thread last woke up needs to wake it */
+        if (!e->wakeup_pending.exchange(true))
         {
-            tr_logAddError("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+            wakeEventThread(e);
         }
     }
 }
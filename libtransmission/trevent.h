@@ -12,6 +12,8 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstdint> // uint64_t
+
 #include "tr-macros.h"
 
 void tr_eventInit(tr_session*);
@@ -21,3 +23,24 @@ void tr_eventClose(tr_session*);
 bool tr_amInEventThread(tr_session const*);
 
 void tr_runInEventThread(tr_session*, void (*func)(void*), void* user_data);
+
+enum
+{
+    TR_EVENT_QUEUE_HISTOGRAM_SIZE = 16
+};
+
+struct tr_event_queue_stats
+{
+    /* calls queued by tr_runInEventThread() from other threads, and the wakeups it took to run them */
+    uint64_t calls;
+    uint64_t wakeups;
+
+    /* the most calls found waiting by a wakeup */
+    uint64_t max_depth;
+
+    /* how long each call waited to be run, in usec */
+    uint64_t latency_usec[TR_EVENT_QUEUE_HISTOGRAM_SIZE];
+};
+
+/* only call this from the event thread */
+void tr_eventGetQueueStats(tr_session const*, tr_event_queue_stats* setme);
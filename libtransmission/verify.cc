@@ -16,6 +16,7 @@
 #include "crypto-utils.h"
 #include "file.h"
 #include "log.h"
+#include "perf.h"
 #include "platform.h" /* tr_lock() */
 #include "torrent.h"
 #include "tr-assert.h"
@@ -44,6 +45,9 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
     tr_piece_index_t pieceIndex = 0;
     time_t const begin = tr_time();
     size_t const buflen = 1024 * 128; // 128 KiB buffer
+    uint64_t hash_usec = 0;
+
+    TR_ASSERT(tor->info.pieceHashes != nullptr);
     auto* const buffer = static_cast<uint8_t*>(tr_malloc(buflen));
 
     tr_sha1_ctx_t sha = tr_sha1_init();
@@ -88,7 +92,9 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
             if (tr_sys_file_read_at(fd, buffer, bytesThisPass, filePos, &numRead, nullptr) && numRead > 0)
             {
                 bytesThisPass = numRead;
+                auto const hash_begin = tr_perfNowUsec();
                 tr_sha1_update(sha, buffer, bytesThisPass);
+                hash_usec += tr_perfNowUsec() - hash_begin;
                 tr_sys_file_advise(fd, filePos, bytesThisPass, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
             }
         }
@@ -106,8 +112,11 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
             bool hasPiece;
             uint8_t hash[SHA_DIGEST_LENGTH];
 
+            auto const hash_begin = tr_perfNowUsec();
             tr_sha1_final(sha, hash);
-            hasPiece = memcmp(hash, tor->info.pieces[pieceIndex].hash, SHA_DIGEST_LENGTH) == 0;
+            tr_perfAdd(tor->session, TR_PERF_HASH, hash_usec + tr_perfNowUsec() - hash_begin);
+            hash_usec = 0;
+            hasPiece = memcmp(hash, tr_torrentPieceHash(tor, pieceIndex), SHA_DIGEST_LENGTH) == 0;
 
             if (hasPiece || hadPiece)
             {
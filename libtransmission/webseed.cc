@@ -18,6 +18,8 @@
 #include "cache.h"
 #include "inout.h" /* tr_ioFindFileLocation() */
 #include "peer-mgr.h"
+#include "session.h"
+#include "timer-wheel.h"
 #include "torrent.h"
 #include "trevent.h" /* tr_runInEventThread() */
 #include "utils.h"
@@ -53,7 +55,7 @@ auto constexpr MAX_CONSECUTIVE_FAILURES = 5;
 
 auto constexpr MAX_WEBSEED_CONNECTIONS = 4;
 
-void webseed_timer_func(evutil_socket_t fd, short what, void* vw);
+void webseed_timer_func(void* vw);
 
 struct tr_webseed : public tr_peer
 {
@@ -72,8 +74,9 @@ public:
 
         file_urls.resize(tr_torrentInfo(tor)->fileCount);
 
-        timer = evtimer_new(session->event_base, webseed_timer_func, this);
-        tr_timerAddMsec(timer, TR_IDLE_TIMER_MSEC);
+        timer.callback = webseed_timer_func;
+        timer.user_data = this;
+        tr_sessionAddTimer(session, &timer, TR_IDLE_TIMER_MSEC);
     }
 
     ~tr_webseed() override
@@ -82,7 +85,7 @@ public:
         std::for_each(std::begin(tasks), std::end(tasks), [](auto* task) { task->dead = true; });
         tasks.clear();
 
-        event_free(timer);
+        tr_sessionRemoveTimer(session, &timer);
     }
 
     bool is_transferring_pieces(uint64_t now, tr_direction direction, unsigned int* setme_Bps) const override
@@ -111,7 +114,7 @@ public:
 
     Bandwidth bandwidth;
     std::set<tr_webseed_task*> tasks;
-    struct event* timer = nullptr;
+    tr_timer timer;
     int consecutive_failures = 0;
     int retry_tickcount = 0;
     int retry_challenge = 0;
@@ -556,7 +559,7 @@ static void task_request_next_chunk(struct tr_webseed_task* t)
 namespace
 {
 
-void webseed_timer_func([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] short what, void* vw)
+void webseed_timer_func(void* vw)
 {
     auto* w = static_cast<tr_webseed*>(vw);
 
@@ -567,7 +570,7 @@ void webseed_timer_func([[maybe_unused]] evutil_socket_t fd, [[maybe_unused]] sh
 
     on_idle(w);
 
-    tr_timerAddMsec(w->timer, TR_IDLE_TIMER_MSEC);
+    tr_sessionAddTimer(w->session, &w->timer, TR_IDLE_TIMER_MSEC);
 }
 
 } // unnamed namespace
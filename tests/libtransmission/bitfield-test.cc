@@ -13,6 +13,8 @@
 
 #include "gtest/gtest.h"
 
+#include <vector>
+
 TEST(Bitfield, countRange)
 {
     auto constexpr IterCount = int{ 10000 };
@@ -206,3 +208,87 @@ TEST(Bitfields, hasAllNone)
         EXPECT_TRUE(!field.hasNone());
     }
 }
+
+TEST(Bitfields, sparse)
+{
+    auto constexpr BitCount = size_t{ 100000 };
+    Bitfield field(BitCount);
+
+    // a few bits are stored as indices, not as a 12500-byte bitmap
+    field.setBit(99999);
+    field.setBit(5);
+    field.setBit(50000);
+    EXPECT_EQ(3U, field.countBits());
+    EXPECT_GE(64U, field.getAllocatedBytes());
+    EXPECT_TRUE(field.readBit(5));
+    EXPECT_FALSE(field.readBit(6));
+    EXPECT_EQ(2U, field.countRange(0, 99999));
+    EXPECT_EQ(1U, field.countRange(50000, 50001));
+
+    auto byte_count = size_t{};
+    auto* raw = static_cast<uint8_t*>(field.getRaw(&byte_count));
+    EXPECT_EQ(BitCount / 8, byte_count);
+    EXPECT_EQ(0x04, raw[0]);
+    EXPECT_EQ(0x80, raw[50000 / 8]);
+    EXPECT_EQ(0x01, raw[99999 / 8]);
+
+    // a sparse bitmap from the wire is stored as indices too
+    Bitfield copy(BitCount);
+    copy.setRaw(raw, byte_count, true);
+    tr_free(raw);
+    EXPECT_EQ(3U, copy.countBits());
+    EXPECT_GE(64U, copy.getAllocatedBytes());
+    EXPECT_TRUE(copy.readBit(50000));
+
+    // clearing the last bit frees the storage
+    field.clearBit(5);
+    field.clearBit(50000);
+    field.clearBit(99999);
+    EXPECT_TRUE(field.hasNone());
+    EXPECT_EQ(0U, field.getAllocatedBytes());
+
+    // compare every representation against a plain vector
+    auto expected = std::vector<bool>(BitCount);
+    auto const check = [&field, &expected]()
+    {
+        auto count = size_t{};
+        for (size_t i = 0; i < BitCount; ++i)
+        {
+            EXPECT_EQ(expected[i], field.readBit(i));
+            count += expected[i] ? 1 : 0;
+        }
+        EXPECT_EQ(count, field.countBits());
+        EXPECT_EQ(count, field.countRange(0, BitCount));
+
+        Bitfield field_copy(BitCount);
+        field_copy.setFromBitfield(field);
+        EXPECT_EQ(count, field_copy.countRange(0, BitCount));
+    };
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        auto const bit = size_t(tr_rand_int_weak(BitCount));
+        field.setBit(bit);
+        expected[bit] = true;
+
+        if (i % 3 == 0)
+        {
+            field.clearBit(bit);
+            expected[bit] = false;
+        }
+
+        if (i % 100 == 0)
+        {
+            check();
+        }
+    }
+
+    // ranges switch to a bitmap
+    field.setBitRange(10, 2000);
+    std::fill(std::begin(expected) + 10, std::begin(expected) + 2000, true);
+    check();
+    field.clearBitRange(0, BitCount);
+    std::fill(std::begin(expected), std::end(expected), false);
+    check();
+    EXPECT_TRUE(field.hasNone());
+}
@@ -6,8 +6,13 @@
  *
  */
 
+#include <chrono>
 #include <cstdio>
 #include <cstring> // strlen()
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 // #include <unistd.h> // sync()
 
 #include "transmission.h"
@@ -44,6 +49,11 @@ protected:
         "Fox Speed Channel:216.79.131.192-216.79.131.223\n"
         "Evilcorp:216.88.88.0-216.88.88.255\n";
 
+    static char const constexpr* const Contents3 =
+        "2001:db8::/32\n"
+        "fe80::10-fe80::1f\n"
+        "Austin Law Firm:216.16.1.144-216.16.1.151\n";
+
 #if 0
     void createFileWithContents(char const* path, char const* contents)
     {
@@ -66,7 +76,15 @@ protected:
     bool addressIsBlocked(char const* address_str)
     {
         struct tr_address addr = {};
-        return !tr_address_from_string(&addr, address_str) || tr_sessionIsAddressBlocked(session_, &addr);
+        if (!tr_address_from_string(&addr, address_str))
+        {
+            return true;
+        }
+
+        tr_sessionLock(session_);
+        auto const blocked = tr_sessionIsAddressBlocked(session_, &addr);
+        tr_sessionUnlock(session_);
+        return blocked;
     }
 };
 
@@ -104,6 +122,133 @@ TEST_F(BlocklistTest, parsing)
     EXPECT_FALSE(addressIsBlocked("255.0.0.1"));
 }
 
+TEST_F(BlocklistTest, ipv6AndMultipleLists)
+{
+    auto const path1 = makeString(tr_buildPath(tr_sessionGetConfigDir(session_), "blocklists", "level1", nullptr));
+    auto const path2 = makeString(tr_buildPath(tr_sessionGetConfigDir(session_), "blocklists", "ipv6", nullptr));
+    createFileWithContents(path1, Contents1);
+    createFileWithContents(path2, Contents3);
+    tr_sessionReloadBlocklists(session_);
+    EXPECT_EQ(8, tr_blocklistGetRuleCount(session_));
+
+    // nothing is blocked while the blocklists are disabled
+    EXPECT_FALSE(addressIsBlocked("2001:db8::1"));
+    EXPECT_FALSE(addressIsBlocked("10.1.2.3"));
+    tr_blocklistSetEnabled(session_, true);
+
+    // IPv6 CIDR
+    EXPECT_FALSE(addressIsBlocked("2001:db7:ffff:ffff:ffff:ffff:ffff:ffff"));
+    EXPECT_TRUE(addressIsBlocked("2001:db8::"));
+    EXPECT_TRUE(addressIsBlocked("2001:db8:1234::5678"));
+    EXPECT_TRUE(addressIsBlocked("2001:db8:ffff:ffff:ffff:ffff:ffff:ffff"));
+    EXPECT_FALSE(addressIsBlocked("2001:db9::"));
+
+    // IPv6 range
+    EXPECT_FALSE(addressIsBlocked("fe80::f"));
+    EXPECT_TRUE(addressIsBlocked("fe80::10"));
+    EXPECT_TRUE(addressIsBlocked("fe80::1f"));
+    EXPECT_FALSE(addressIsBlocked("fe80::20"));
+    EXPECT_FALSE(addressIsBlocked("::1"));
+
+    // IPv4 rules from both lists, including the one they share
+    EXPECT_TRUE(addressIsBlocked("10.1.2.3"));
+    EXPECT_TRUE(addressIsBlocked("216.16.1.144"));
+    EXPECT_TRUE(addressIsBlocked("216.79.131.200"));
+    EXPECT_FALSE(addressIsBlocked("216.16.1.152"));
+
+    // removing a list takes its rules with it
+    tr_sys_path_remove(path2.c_str(), nullptr);
+    tr_sys_path_remove((path2 + ".bin").c_str(), nullptr);
+    tr_sessionReloadBlocklists(session_);
+    EXPECT_EQ(5, tr_blocklistGetRuleCount(session_));
+    EXPECT_FALSE(addressIsBlocked("2001:db8::1"));
+    EXPECT_TRUE(addressIsBlocked("10.1.2.3"));
+}
+
+TEST_F(BlocklistTest, toggleWhilePeersAreChecked)
+{
+    auto const path = makeString(tr_buildPath(tr_sessionGetConfigDir(session_), "blocklists", "level1", nullptr));
+    createFileWithContents(path, Contents1);
+    tr_sessionReloadBlocklists(session_);
+
+    // a GUI thread flips the setting while the session checks addresses
+    auto toggler = std::thread(
+        [this]()
+        {
+            for (int i = 0; i < 200; ++i)
+            {
+                tr_blocklistSetEnabled(session_, i % 2 == 0);
+            }
+        });
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        EXPECT_FALSE(addressIsBlocked("217.0.0.1"));
+        addressIsBlocked("10.1.2.3");
+    }
+
+    toggler.join();
+
+    EXPECT_FALSE(tr_blocklistIsEnabled(session_));
+    EXPECT_FALSE(addressIsBlocked("10.1.2.3"));
+    tr_blocklistSetEnabled(session_, true);
+    EXPECT_TRUE(addressIsBlocked("10.1.2.3"));
+}
+
+// Measures lookups of random addresses against several large blocklists.
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*lookupThroughput*
+TEST_F(BlocklistTest, DISABLED_lookupThroughput)
+{
+    auto constexpr ListCount = int{ 4 };
+    auto constexpr RangesPerList = int{ 250000 };
+    auto constexpr Lookups = int{ 10000000 };
+
+    auto rng = std::mt19937{ 42 };
+    auto random_ipv4 = std::uniform_int_distribution<uint32_t>{};
+
+    for (int i = 0; i < ListCount; ++i)
+    {
+        auto contents = std::string{};
+        for (int j = 0; j < RangesPerList; ++j)
+        {
+            auto const begin = random_ipv4(rng);
+            contents += std::to_string(begin >> 24) + '.' + std::to_string((begin >> 16) & 0xFF) + '.' +
+                std::to_string((begin >> 8) & 0xFF) + '.' + std::to_string(begin & 0xF0) + "/28\n";
+        }
+
+        auto const name = std::string{ "list" } + std::to_string(i);
+        auto const path = makeString(tr_buildPath(tr_sessionGetConfigDir(session_), "blocklists", name.c_str(), nullptr));
+        createFileWithContents(path, contents.c_str());
+    }
+
+    tr_sessionReloadBlocklists(session_);
+    tr_blocklistSetEnabled(session_, true);
+
+    auto addresses = std::vector<tr_address>(4096);
+    for (auto& addr : addresses)
+    {
+        addr.type = TR_AF_INET;
+        addr.addr.addr4.s_addr = random_ipv4(rng);
+    }
+
+    auto blocked = int{};
+    auto const begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < Lookups; ++i)
+    {
+        blocked += tr_sessionIsAddressBlocked(session_, &addresses[i % std::size(addresses)]) ? 1 : 0;
+    }
+
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    fprintf(
+        stderr,
+        "%d lookups against %d rules in %.3f s (%.0f lookups/s, %d blocked)\n",
+        Lookups,
+        tr_blocklistGetRuleCount(session_),
+        elapsed,
+        Lookups / elapsed,
+        blocked);
+}
+
 /***
 ****
 ***/
@@ -0,0 +1,161 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "cache.h"
+#include "file.h"
+#include "inout.h"
+#include "session.h"
+#include "torrent.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+#include <event2/buffer.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using CacheTest = SessionTest;
+
+TEST_F(CacheTest, readAhead)
+{
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    EXPECT_EQ(tr_block_index_t{ 65 }, tor->blockCount);
+
+    // give the blocks distinct contents
+    auto contents = std::vector<uint8_t>(tor->info.files[0].length);
+    for (size_t i = 0; i < std::size(contents); ++i)
+    {
+        contents[i] = i % 251;
+    }
+
+    auto const path = makeString(tr_torrentFindFile(tor, 0));
+    auto fd = tr_sys_file_open(path.c_str(), TR_SYS_FILE_WRITE, 0, nullptr);
+    EXPECT_TRUE(tr_sys_file_write(fd, std::data(contents), std::size(contents), nullptr, nullptr));
+    tr_sys_file_close(fd, nullptr);
+
+    runInEventThread(
+        [this, tor]()
+        {
+            auto* cache = session_->cache;
+            auto stats = tr_cache_read_ahead_stats{};
+            auto budget = size_t{ 100 };
+
+            // duplicates are skipped and neighbors are coalesced: [3...5], [10], [64]
+            auto blocks = std::vector<tr_block_index_t>{ 5, 3, 4, 10, 3, 64 };
+            EXPECT_EQ(0, tr_cacheReadAhead(cache, tor, std::data(blocks), std::size(blocks), &budget));
+            tr_cacheGetReadAheadStats(cache, &stats);
+            EXPECT_EQ(5U, stats.blocks_loaded);
+            EXPECT_EQ(3U, stats.disk_reads);
+            EXPECT_EQ(0U, stats.hits);
+
+            auto const readBlock = [cache, tor](tr_block_index_t block)
+            {
+                auto const piece = tr_torBlockPiece(tor, block);
+                auto const offset = (block % tor->blockCountInPiece) * tor->blockSize;
+                auto const len = tr_torBlockCountBytes(tor, block);
+                auto from_cache = std::vector<uint8_t>(len);
+                auto from_disk = std::vector<uint8_t>(len);
+                EXPECT_EQ(0, tr_cacheReadBlock(cache, tor, piece, offset, len, std::data(from_cache)));
+                EXPECT_EQ(0, tr_ioRead(tor, piece, offset, len, std::data(from_disk)));
+                EXPECT_EQ(from_disk, from_cache);
+            };
+
+            // reading a loaded block is a hit
+            readBlock(4);
+            tr_cacheGetReadAheadStats(cache, &stats);
+            EXPECT_EQ(1U, stats.hits);
+
+            // loaded blocks aren't loaded again
+            blocks = { 3, 4, 5, 10, 64 };
+            EXPECT_EQ(0, tr_cacheReadAhead(cache, tor, std::data(blocks), std::size(blocks), &budget));
+            tr_cacheGetReadAheadStats(cache, &stats);
+            EXPECT_EQ(5U, stats.blocks_loaded);
+            EXPECT_EQ(3U, stats.disk_reads);
+
+            // shrinking the cache drops blocks that were read, then the oldest unread ones
+            tr_cacheSetLimit(cache, 2 * tor->blockSize);
+            tr_cacheGetReadAheadStats(cache, &stats);
+            EXPECT_EQ(2U, stats.blocks_wasted);
+            readBlock(3);
+            readBlock(64);
+            tr_cacheGetReadAheadStats(cache, &stats);
+            EXPECT_EQ(2U, stats.hits);
+
+            // flushing the torrent drops the rest
+            tr_cacheFlushTorrent(cache, tor);
+            readBlock(10);
+            tr_cacheGetReadAheadStats(cache, &stats);
+            EXPECT_EQ(2U, stats.hits);
+            EXPECT_EQ(3U, stats.blocks_wasted);
+            EXPECT_EQ(95U, budget);
+
+            // no more than the budget is read; the rest is left for the next call
+            tr_cacheSetLimit(cache, 1024 * 1024);
+            budget = 2;
+            blocks = { 20, 21, 22, 23 };
+            EXPECT_EQ(0, tr_cacheReadAhead(cache, tor, std::data(blocks), std::size(blocks), &budget));
+            tr_cacheGetReadAheadStats(cache, &stats);
+            EXPECT_EQ(7U, stats.blocks_loaded);
+            EXPECT_EQ(0U, budget);
+
+            budget = 100;
+            blocks = { 20, 21, 22, 23 };
+            EXPECT_EQ(0, tr_cacheReadAhead(cache, tor, std::data(blocks), std::size(blocks), &budget));
+            tr_cacheGetReadAheadStats(cache, &stats);
+            EXPECT_EQ(9U, stats.blocks_loaded);
+            EXPECT_EQ(98U, budget);
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(CacheTest, readBlocks)
+{
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+
+    runInEventThread(
+        [this, tor]()
+        {
+            auto* cache = session_->cache;
+            auto const block_size = tor->blockSize;
+
+            // an unwritten block in the middle of the span is read from the cache
+            auto* evbuf = evbuffer_new();
+            auto const dirty = std::vector<uint8_t>(block_size, 0xAB);
+            evbuffer_add(evbuf, std::data(dirty), std::size(dirty));
+            EXPECT_EQ(0, tr_cacheWriteBlock(cache, tor, 0, block_size, block_size, evbuf));
+            evbuffer_free(evbuf);
+
+            auto data = std::vector<uint8_t>(3 * block_size, 0xFF);
+            EXPECT_EQ(0, tr_cacheReadBlocks(cache, tor, 0, 0, std::size(data), std::data(data)));
+
+            auto expected = std::vector<uint8_t>(3 * block_size, 0);
+            std::fill_n(std::begin(expected) + block_size, block_size, 0xAB);
+            EXPECT_EQ(expected, data);
+
+            tr_cacheFlushTorrent(cache, tor);
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+} // namespace test
+
+} // namespace libtransmission
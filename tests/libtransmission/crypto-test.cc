@@ -13,13 +13,16 @@
 
 #include "crypto-test-ref.h"
 
-#include "gtest/gtest.h"
+#include "test-fixtures.h"
 
 #include <array>
+#include <atomic>
 #include <cstring>
 #include <string>
 #include <unordered_set>
 
+using libtransmission::test::waitFor;
+
 TEST(Crypto, torrentHash)
 {
     auto a = tr_crypto{};
@@ -100,6 +103,61 @@ TEST(Crypto, encryptDecrypt)
     tr_cryptoDestruct(&a);
 }
 
+TEST(Crypto, keyPool)
+{
+    auto* pool = tr_dhKeyPoolNew(1);
+
+    auto hash = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    auto a = tr_crypto{};
+    tr_cryptoConstruct(&a, hash.data(), false);
+    tr_cryptoSetKeyPool(&a, pool);
+    auto b = tr_crypto{};
+    tr_cryptoConstruct(&b, hash.data(), true);
+    tr_cryptoSetKeyPool(&b, pool);
+
+    // the pool is refilled in the background,
+    // so every key pair is either a hit or a miss
+    auto key_length = int{};
+    auto const* const key_a = tr_cryptoGetMyPublicKey(&a, &key_length);
+    auto const* const key_b = tr_cryptoGetMyPublicKey(&b, &key_length);
+    EXPECT_NE(0, memcmp(key_a, key_b, KEY_LEN));
+    auto stats = tr_dh_key_pool_stats{};
+    tr_dhKeyPoolGetStats(pool, &stats);
+    EXPECT_EQ(2U, stats.hits + stats.misses);
+
+    // a secret computed on the worker matches one computed here
+    auto secret = tr_dh_secret_t{};
+    auto done = std::atomic<bool>{ false };
+    tr_dhKeyPoolRun(
+        pool,
+        [&]()
+        {
+            secret = tr_cryptoAgree(&a, key_b);
+            done = true;
+        });
+    EXPECT_TRUE(waitFor([&done]() { return done.load(); }, 5000));
+    EXPECT_TRUE(tr_cryptoSetSecret(&a, secret));
+    EXPECT_TRUE(tr_cryptoComputeSecret(&b, key_a));
+
+    auto const input = std::string{ "test" };
+    auto encrypted = std::array<char, 128>{};
+    auto decrypted = std::array<char, 128>{};
+    tr_cryptoEncryptInit(&a);
+    tr_cryptoEncrypt(&a, input.size(), input.data(), encrypted.data());
+    tr_cryptoDecryptInit(&b);
+    tr_cryptoDecrypt(&b, input.size(), encrypted.data(), decrypted.data());
+    EXPECT_EQ(input, std::string(decrypted.data(), input.size()));
+
+    // jobs that are still queued get run before the pool goes away
+    auto ran = false;
+    tr_dhKeyPoolRun(pool, [&ran]() { ran = true; });
+    tr_dhKeyPoolFree(pool);
+    EXPECT_TRUE(ran);
+
+    tr_cryptoDestruct(&b);
+    tr_cryptoDestruct(&a);
+}
+
 TEST(Crypto, sha1)
 {
     auto hash1 = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
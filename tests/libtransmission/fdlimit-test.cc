@@ -0,0 +1,146 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "fdlimit.h"
+#include "file.h"
+#include "inout.h"
+#include "session.h"
+#include "torrent.h"
+
+#include "test-fixtures.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using FdlimitTest = SessionTest;
+
+TEST_F(FdlimitTest, fileCacheIsLru)
+{
+    auto constexpr TorrentId = int{ 1 };
+    auto const paths = std::array<std::string, 3>{
+        sandboxDir() + "/a",
+        sandboxDir() + "/b",
+        sandboxDir() + "/c",
+    };
+
+    tr_fdSetFileLimit(session_, 2);
+    EXPECT_EQ(2, tr_fdGetFileLimit(session_));
+
+    auto const checkout = [this, &paths](tr_file_index_t i)
+    {
+        auto const fd = tr_fdFileCheckout(session_, TorrentId, i, paths[i].c_str(), true, TR_PREALLOCATE_NONE, 0);
+        EXPECT_NE(TR_BAD_SYS_FILE, fd);
+        return fd;
+    };
+    auto const is_cached = [this](tr_file_index_t i)
+    {
+        return tr_fdFileGetCached(session_, TorrentId, i, false) != TR_BAD_SYS_FILE;
+    };
+
+    auto const fd0 = checkout(0);
+    checkout(1);
+    EXPECT_EQ(fd0, tr_fdFileGetCached(session_, TorrentId, 0, true)); // 0 is now the most recently used
+
+    // opening a third file evicts the least recently used one
+    checkout(2);
+    EXPECT_TRUE(is_cached(0));
+    EXPECT_FALSE(is_cached(1));
+    EXPECT_TRUE(is_cached(2));
+
+    auto stats = tr_fd_file_cache_stats{};
+    tr_fdGetFileCacheStats(session_, &stats);
+    EXPECT_EQ(uint64_t{ 3 }, stats.hits);
+    EXPECT_EQ(uint64_t{ 1 }, stats.misses);
+    EXPECT_EQ(uint64_t{ 1 }, stats.evictions);
+    EXPECT_EQ(size_t{ 2 }, stats.open_files);
+
+    // a closed slot gets reused before any open file is evicted
+    tr_sessionLock(session_);
+    tr_fdTorrentClose(session_, TorrentId + 1);
+    tr_fdTorrentClose(session_, TorrentId);
+    tr_sessionUnlock(session_);
+    tr_fdGetFileCacheStats(session_, &stats);
+    EXPECT_EQ(size_t{ 0 }, stats.open_files);
+    checkout(1);
+    checkout(0);
+    tr_fdGetFileCacheStats(session_, &stats);
+    EXPECT_EQ(uint64_t{ 1 }, stats.evictions);
+    EXPECT_EQ(size_t{ 2 }, stats.open_files);
+
+    // changing the limit closes everything
+    tr_fdSetFileLimit(session_, 8);
+    EXPECT_FALSE(is_cached(0));
+    EXPECT_FALSE(is_cached(1));
+}
+
+TEST_F(FdlimitTest, fileMapping)
+{
+    auto constexpr TorrentId = int{ 1 };
+    auto const path = sandboxDir() + "/mapped";
+    auto const contents = std::string{ "hello, mapped world" };
+    createFileWithContents(path, std::data(contents), std::size(contents));
+
+    // nothing to map until the file's open
+    EXPECT_EQ(nullptr, tr_fdFileGetMapping(session_, TorrentId, 0, std::size(contents)));
+
+    auto const fd = tr_fdFileCheckout(session_, TorrentId, 0, path.c_str(), false, TR_PREALLOCATE_NONE, std::size(contents));
+    EXPECT_NE(TR_BAD_SYS_FILE, fd);
+    auto const* map = tr_fdFileGetMapping(session_, TorrentId, 0, std::size(contents));
+    EXPECT_NE(nullptr, map);
+    EXPECT_EQ(contents, std::string(reinterpret_cast<char const*>(map), std::size(contents)));
+    EXPECT_EQ(map, tr_fdFileGetMapping(session_, TorrentId, 0, std::size(contents)));
+
+    // don't map a file whose size isn't what we expect
+    auto const fd2 = tr_fdFileCheckout(session_, TorrentId, 1, path.c_str(), false, TR_PREALLOCATE_NONE, std::size(contents));
+    EXPECT_NE(TR_BAD_SYS_FILE, fd2);
+    EXPECT_EQ(nullptr, tr_fdFileGetMapping(session_, TorrentId, 1, std::size(contents) + 1));
+
+    // closing the file releases the mapping
+    tr_sessionLock(session_);
+    tr_fdTorrentClose(session_, TorrentId);
+    tr_sessionUnlock(session_);
+    EXPECT_EQ(nullptr, tr_fdFileGetMapping(session_, TorrentId, 0, std::size(contents)));
+}
+
+TEST_F(FdlimitTest, torrentReadsUseMappings)
+{
+    session_->isMmapEnabled = true;
+
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    EXPECT_EQ(TR_SEED, tr_torrentGetCompleteness(tor));
+
+    // read the last piece, which spans two files
+    auto const piece = tr_piece_index_t{ tor->info.pieceCount - 1 };
+    auto const len = tr_torPieceCountBytes(tor, piece);
+    auto buf = std::vector<uint8_t>(len, 0xFF);
+    EXPECT_EQ(0, tr_ioRead(tor, piece, 0, len, std::data(buf)));
+    EXPECT_EQ(std::vector<uint8_t>(len, 0), buf);
+
+    // ...and the complete files that it read are now mapped
+    auto const span = tr_torrentPieceFileSpan(tor, piece);
+    for (auto i = span.first; i <= span.last; ++i)
+    {
+        EXPECT_NE(nullptr, tr_fdFileGetMapping(session_, tr_torrentId(tor), i, tor->info.files[i].length));
+    }
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+} // namespace test
+
+} // namespace libtransmission
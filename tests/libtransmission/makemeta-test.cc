@@ -18,6 +18,7 @@
 #include <cstdlib> // mktemp()
 #include <cstring> // strlen()
 #include <string>
+#include <vector>
 
 namespace libtransmission
 {
@@ -261,6 +262,66 @@ TEST_F(MakemetaTest, singleDirectoryRandomPayload)
     }
 }
 
+TEST_F(MakemetaTest, parallelHashingMatchesSerial)
+{
+    // a few files whose boundaries don't line up with the 16 KiB pieces
+    auto* top = tr_buildPath(sandboxDir().data(), "parallel", nullptr);
+    tr_sys_dir_create(top, 0, 0700, nullptr);
+    for (auto const size : { 70000, 1, 0, 50000, 16384 })
+    {
+        auto payload = std::vector<char>(size);
+        if (!std::empty(payload))
+        {
+            tr_rand_buffer(std::data(payload), std::size(payload));
+        }
+
+        auto const path = makeString(tr_strdup_printf("%s/file-%d", top, size));
+        createFileWithContents(path, std::data(payload), std::size(payload));
+    }
+
+    sync();
+
+    auto const makeHashes = [this, top](uint32_t thread_count)
+    {
+        auto* builder = tr_metaInfoBuilderCreate(top);
+        EXPECT_TRUE(tr_metaInfoBuilderSetPieceSize(builder, 16384));
+        tr_metaInfoBuilderSetThreadCount(builder, thread_count);
+        EXPECT_EQ(thread_count, builder->threadCount);
+
+        auto* torrent_file = tr_strdup_printf("%s-%u.torrent", top, thread_count);
+        tr_makeMetaInfo(builder, torrent_file, nullptr, 0, nullptr, false);
+        EXPECT_TRUE(waitFor([builder]() { return builder->isDone; }, 5000));
+        EXPECT_EQ(TR_MAKEMETA_OK, builder->result);
+        EXPECT_EQ(builder->pieceCount, builder->pieceIndex);
+
+        auto* ctor = tr_ctorNew(nullptr);
+        tr_ctorSetMetainfoFromFile(ctor, torrent_file);
+        auto inf = tr_info{};
+        EXPECT_EQ(TR_PARSE_OK, tr_torrentParse(ctor, &inf));
+
+        auto hashes = std::vector<std::string>{};
+        for (tr_piece_index_t i = 0; i < inf.pieceCount; ++i)
+        {
+            hashes.emplace_back(reinterpret_cast<char const*>(inf.pieceHashes) + i * SHA_DIGEST_LENGTH, SHA_DIGEST_LENGTH);
+        }
+
+        tr_free(torrent_file);
+        tr_ctorFree(ctor);
+        tr_metainfoFree(&inf);
+        tr_metaInfoBuilderFree(builder);
+        return hashes;
+    };
+
+    auto const serial = makeHashes(1);
+    EXPECT_EQ(size_t{ 9 }, std::size(serial));
+    EXPECT_EQ(serial, makeHashes(4));
+
+    // asking for more threads than there are cores doesn't start them all
+    EXPECT_EQ(serial, makeHashes(1024));
+
+    tr_free(top);
+}
+
 } // namespace test
 
 } // namespace libtransmission
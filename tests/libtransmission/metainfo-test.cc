@@ -7,14 +7,20 @@
  */
 
 #include "transmission.h"
+#include "crypto-utils.h"
+#include "inout.h"
 #include "metainfo.h"
+#include "torrent.h"
 #include "utils.h"
+#include "variant.h"
 
-#include "gtest/gtest.h"
+#include "test-fixtures.h"
 
 #include <array>
 #include <cerrno>
 #include <cstring>
+#include <string>
+#include <vector>
 
 TEST(Metainfo, magnetLink)
 {
@@ -161,3 +167,153 @@ TEST(Metainfo, sanitize)
         tr_free(result);
     }
 }
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using MetainfoTest = SessionTest;
+
+TEST_F(MetainfoTest, fileNamePool)
+{
+    auto* tor = zeroTorrentInit();
+    auto* inf = &tor->info;
+    EXPECT_EQ(tr_file_index_t{ 3 }, inf->fileCount);
+
+    // the parsed names are stored back to back in one allocation
+    auto expected_pool = std::string{};
+    for (tr_file_index_t i = 0; i < inf->fileCount; ++i)
+    {
+        EXPECT_EQ(inf->fileNamePool + std::size(expected_pool), inf->files[i].name);
+        expected_pool.append(inf->files[i].name);
+        expected_pool.push_back('\0');
+    }
+
+    EXPECT_EQ(expected_pool, std::string(inf->fileNamePool, inf->fileNamePoolSize));
+    EXPECT_STREQ("files-filled-with-zeroes/4096", inf->files[1].name);
+
+    // replacing a name doesn't disturb its neighbours
+    tr_metainfoSetFileName(inf, 1, tr_strdup("files-filled-with-zeroes/renamed"));
+    tr_metainfoSetFileName(inf, 1, tr_strdup("files-filled-with-zeroes/renamed-again"));
+    EXPECT_STREQ("files-filled-with-zeroes/1048576", inf->files[0].name);
+    EXPECT_STREQ("files-filled-with-zeroes/renamed-again", inf->files[1].name);
+    EXPECT_STREQ("files-filled-with-zeroes/512", inf->files[2].name);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(MetainfoTest, pieceHashesReload)
+{
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    EXPECT_EQ(TR_SEED, tr_torrentGetCompleteness(tor));
+    EXPECT_NE(nullptr, tor->info.pieceHashes);
+    auto const* const begin = tor->info.pieceHashes;
+    auto const hashes = std::vector<uint8_t>(begin, begin + size_t{ tor->info.pieceCount } * SHA_DIGEST_LENGTH);
+
+    // a stopped torrent keeps them until they've been idle long enough
+    tr_torrentUnloadPieceHashes(tor, 3600);
+    EXPECT_NE(nullptr, tor->info.pieceHashes);
+    tr_torrentUnloadPieceHashes(tor, 0);
+    EXPECT_EQ(nullptr, tor->info.pieceHashes);
+    EXPECT_EQ(nullptr, tr_torrentPieceHash(tor, 0));
+
+    // checking a piece reloads them from the .torrent file
+    EXPECT_TRUE(tr_torrentCheckPiece(tor, 0));
+    EXPECT_NE(nullptr, tor->info.pieceHashes);
+    EXPECT_EQ(0, memcmp(std::data(hashes), tor->info.pieceHashes, std::size(hashes)));
+
+    // so does verifying, and the torrent is still complete afterwards
+    tr_torrentUnloadPieceHashes(tor, 0);
+    blockingTorrentVerify(tor);
+    EXPECT_NE(nullptr, tor->info.pieceHashes);
+    EXPECT_EQ(TR_SEED, tr_torrentGetCompleteness(tor));
+
+    // don't trust a .torrent file that no longer matches the info hash
+    tr_torrentUnloadPieceHashes(tor, 0);
+    auto const junk = std::string{ "d4:infod6:pieces0:ee" };
+    createFileWithContents(tor->info.torrent, std::data(junk), std::size(junk));
+    EXPECT_FALSE(tr_torrentLoadPieceHashes(tor));
+    EXPECT_EQ(nullptr, tor->info.pieceHashes);
+
+    // so starting it fails without leaving it marked as running
+    tr_torrentStart(tor);
+    EXPECT_FALSE(tor->isRunning);
+    EXPECT_EQ(TR_STAT_LOCAL_ERROR, tr_torrentStat(tor)->error);
+    EXPECT_EQ(TR_STATUS_STOPPED, tr_torrentStat(tor)->activity);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(MetainfoTest, pieceFileSpan)
+{
+    // lots of tiny and empty files, some of them on piece boundaries
+    auto constexpr PieceSize = uint64_t{ 16384 };
+    auto const lengths = std::array<uint64_t, 12>{ 5, 0, 3, 40000, 0, 1, 8383, 0, 16384, 1, 24000, 0 };
+    auto total = uint64_t{};
+    auto top = tr_variant{};
+    tr_variantInitDict(&top, 2);
+    tr_variantDictAddStr(&top, TR_KEY_announce, "http://www.example.com/announce");
+    auto* info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+    auto* files = tr_variantDictAddList(info, TR_KEY_files, std::size(lengths));
+    for (size_t i = 0; i < std::size(lengths); ++i)
+    {
+        auto* file = tr_variantListAddDict(files, 2);
+        tr_variantDictAddInt(file, TR_KEY_length, lengths[i]);
+        auto* path = tr_variantDictAddList(file, TR_KEY_path, 1);
+        tr_variantListAddStr(path, makeString(tr_strdup_printf("file-%zu", i)).c_str());
+        total += lengths[i];
+    }
+    tr_variantDictAddStr(info, TR_KEY_name, "spans");
+    tr_variantDictAddInt(info, TR_KEY_piece_length, PieceSize);
+    auto const pieces = std::vector<char>((total + PieceSize - 1) / PieceSize * SHA_DIGEST_LENGTH);
+    tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+    auto len = size_t{};
+    auto* benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, &len);
+    tr_variantFree(&top);
+
+    auto* ctor = tr_ctorNew(session_);
+    tr_ctorSetMetainfo(ctor, benc, len);
+    tr_ctorSetPaused(ctor, TR_FORCE, true);
+    tr_ctorSetSave(ctor, false);
+    tr_free(benc);
+    auto* tor = tr_torrentNew(ctor, nullptr, nullptr);
+    tr_ctorFree(ctor);
+    EXPECT_NE(nullptr, tor);
+    auto const* inf = &tor->info;
+
+    for (tr_piece_index_t p = 0; p < inf->pieceCount; ++p)
+    {
+        // the span is exactly the files whose piece range includes p
+        auto const span = tr_torrentPieceFileSpan(tor, p);
+        for (tr_file_index_t f = 0; f < inf->fileCount; ++f)
+        {
+            auto const in_piece = inf->files[f].firstPiece <= p && p <= inf->files[f].lastPiece;
+            EXPECT_EQ(in_piece, span.first <= f && f <= span.last) << "piece " << p << " file " << f;
+        }
+
+        // and every byte in the piece maps to the file that holds it
+        for (uint32_t offset = 0; offset < tr_torPieceCountBytes(tor, p); ++offset)
+        {
+            auto file_index = tr_file_index_t{};
+            auto file_offset = uint64_t{};
+            tr_ioFindFileLocation(tor, p, offset, &file_index, &file_offset);
+            auto const byte = p * PieceSize + offset;
+            auto const& file = inf->files[file_index];
+            EXPECT_LE(file.offset, byte);
+            EXPECT_LT(byte, file.offset + file.length);
+            EXPECT_EQ(byte - file.offset, file_offset);
+        }
+    }
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,252 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "mpsc-queue.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+namespace
+{
+
+struct Item : tr_mpsc_node
+{
+    int producer = 0;
+    int seq = 0;
+};
+
+} // namespace
+
+TEST(MpscQueue, fifo)
+{
+    auto queue = tr_mpsc_queue<Item>{};
+    EXPECT_EQ(nullptr, queue.pop());
+
+    auto items = std::vector<Item>(3);
+    for (int i = 0; i < 3; ++i)
+    {
+        items[i].seq = i;
+        queue.push(&items[i]);
+    }
+
+    EXPECT_EQ(&items[0], queue.pop());
+    EXPECT_EQ(&items[1], queue.pop());
+
+    // the last item can be taken, and the queue still works afterwards
+    EXPECT_EQ(&items[2], queue.pop());
+    EXPECT_EQ(nullptr, queue.pop());
+
+    queue.push(&items[1]);
+    queue.push(&items[0]);
+    EXPECT_EQ(&items[1], queue.pop());
+    EXPECT_EQ(&items[0], queue.pop());
+    EXPECT_EQ(nullptr, queue.pop());
+}
+
+TEST(MpscQueue, manyProducers)
+{
+    auto constexpr Producers = 4;
+    auto constexpr PerProducer = 100000;
+
+    auto queue = tr_mpsc_queue<Item>{};
+    auto items = std::vector<Item>(Producers * PerProducer);
+    auto threads = std::vector<std::thread>{};
+
+    for (int p = 0; p < Producers; ++p)
+    {
+        threads.emplace_back(
+            [&queue, &items, p]()
+            {
+                for (int i = 0; i < PerProducer; ++i)
+                {
+                    auto& item = items[p * PerProducer + i];
+                    item.producer = p;
+                    item.seq = i;
+                    queue.push(&item);
+                }
+            });
+    }
+
+    // each producer's items come out in the order they went in
+    auto next_seq = std::vector<int>(Producers);
+    for (int popped = 0; popped < Producers * PerProducer;)
+    {
+        auto const* const item = queue.pop();
+        if (item == nullptr)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        ASSERT_EQ(next_seq[item->producer], item->seq);
+        ++next_seq[item->producer];
+        ++popped;
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(nullptr, queue.pop());
+}
+
+using EventQueueTest = SessionTest;
+
+TEST_F(EventQueueTest, callsFromManyThreadsRunInOrder)
+{
+    auto constexpr Threads = 4;
+    auto constexpr PerThread = 1000;
+
+    struct Call
+    {
+        std::vector<int>* log;
+        std::atomic<int>* done;
+        int thread;
+        int seq;
+    };
+
+    auto before = tr_event_queue_stats{};
+    runInEventThread([this, &before]() { tr_eventGetQueueStats(session_, &before); });
+
+    // only the event thread touches the logs
+    auto logs = std::vector<std::vector<int>>(Threads);
+    auto calls = std::vector<Call>(Threads * PerThread);
+    auto done = std::atomic<int>{};
+    auto threads = std::vector<std::thread>{};
+
+    for (int t = 0; t < Threads; ++t)
+    {
+        threads.emplace_back(
+            [this, &logs, &calls, &done, t]()
+            {
+                for (int i = 0; i < PerThread; ++i)
+                {
+                    auto& call = calls[t * PerThread + i];
+                    call = Call{ &logs[t], &done, t, i };
+                    tr_runInEventThread(
+                        session_,
+                        [](void* vcall)
+                        {
+                            auto* c = static_cast<Call*>(vcall);
+                            c->log->push_back(c->seq);
+                            ++*c->done;
+                        },
+                        &call);
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_TRUE(waitFor([&done]() { return done == Threads * PerThread; }, 5000));
+
+    auto expected = std::vector<int>(PerThread);
+    for (int i = 0; i < PerThread; ++i)
+    {
+        expected[i] = i;
+    }
+
+    for (auto const& log : logs)
+    {
+        EXPECT_EQ(expected, log);
+    }
+
+    auto after = tr_event_queue_stats{};
+    runInEventThread([this, &after]() { tr_eventGetQueueStats(session_, &after); });
+
+    // runInEventThread() queues a call of its own
+    auto const n_calls = after.calls - before.calls;
+    EXPECT_LE(uint64_t{ Threads * PerThread }, n_calls);
+    EXPECT_GE(after.wakeups - before.wakeups, uint64_t{ 1 });
+    EXPECT_LE(after.wakeups - before.wakeups, n_calls);
+
+    auto latencies = uint64_t{};
+    for (size_t i = 0; i < TR_EVENT_QUEUE_HISTOGRAM_SIZE; ++i)
+    {
+        latencies += after.latency_usec[i] - before.latency_usec[i];
+    }
+    EXPECT_EQ(n_calls, latencies);
+}
+
+// Measures how fast other threads can hand calls to the event thread.
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*crossThreadCalls*
+TEST_F(EventQueueTest, DISABLED_crossThreadCalls)
+{
+    auto constexpr Threads = 4;
+    auto constexpr PerThread = 250000;
+
+    auto done = std::atomic<int>{};
+    auto before = tr_event_queue_stats{};
+    runInEventThread([this, &before]() { tr_eventGetQueueStats(session_, &before); });
+
+    auto const begin = std::chrono::steady_clock::now();
+
+    auto threads = std::vector<std::thread>{};
+    for (int t = 0; t < Threads; ++t)
+    {
+        threads.emplace_back(
+            [this, &done]()
+            {
+                for (int i = 0; i < PerThread; ++i)
+                {
+                    tr_runInEventThread(
+                        session_,
+                        [](void* vdone) { ++*static_cast<std::atomic<int>*>(vdone); },
+                        &done);
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    auto const queued = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    EXPECT_TRUE(waitFor([&done]() { return done == Threads * PerThread; }, 60000));
+    auto const ran = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    auto after = tr_event_queue_stats{};
+    runInEventThread([this, &after]() { tr_eventGetQueueStats(session_, &after); });
+    auto const n_calls = after.calls - before.calls;
+    auto const n_wakeups = after.wakeups - before.wakeups;
+
+    fprintf(
+        stderr,
+        "%d threads queued %d calls in %.3f s (%.0f ns per call); all ran after %.3f s\n"
+        "%llu wakeups (%.1f calls each), at most %llu calls waiting\n",
+        Threads,
+        Threads * PerThread,
+        queued,
+        queued * 1e9 / (Threads * PerThread),
+        ran,
+        static_cast<unsigned long long>(n_wakeups),
+        double(n_calls) / n_wakeups,
+        static_cast<unsigned long long>(after.max_depth));
+}
+
+} // namespace test
+
+} // namespace libtransmission
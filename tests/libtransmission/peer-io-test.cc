@@ -0,0 +1,442 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "crypto.h"
+#include "fdlimit.h"
+#include "net.h"
+#include "peer-common.h" // MAX_BLOCK_SIZE
+#include "peer-io.h"
+#include "peer-socket.h"
+#include "session.h"
+#include "utils.h"
+
+#include "test-fixtures.h"
+
+#include <event2/buffer.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using PeerIoTest = SessionTest;
+
+namespace
+{
+
+tr_peerIo* newIncomingIo(tr_session* session, tr_socket_t fd)
+{
+    auto addr = tr_address{};
+    tr_address_from_string(&addr, "127.0.0.1");
+    return tr_peerIoNewIncoming(session, session->bandwidth, &addr, tr_port(6881), tr_peer_socket_tcp_create(fd));
+}
+
+} // namespace
+
+TEST_F(PeerIoTest, readBytesDecryptsAcrossChains)
+{
+    runInEventThread(
+        [this]()
+        {
+            auto hash = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+            hash.fill(0xAB);
+
+            // the socket isn't connected; this test only reads from a buffer of its own
+            auto* io = newIncomingIo(session_, tr_fdSocketCreate(session_, AF_INET, SOCK_STREAM));
+            auto* io_crypto = tr_peerIoGetCrypto(io);
+            tr_cryptoSetTorrentHash(io_crypto, std::data(hash));
+
+            auto remote = tr_crypto{};
+            tr_cryptoConstruct(&remote, std::data(hash), false);
+            auto key_len = int{};
+            EXPECT_TRUE(tr_cryptoComputeSecret(io_crypto, tr_cryptoGetMyPublicKey(&remote, &key_len)));
+            EXPECT_TRUE(tr_cryptoComputeSecret(&remote, tr_cryptoGetMyPublicKey(io_crypto, &key_len)));
+            tr_cryptoDecryptInit(io_crypto);
+            tr_cryptoEncryptInit(&remote);
+            tr_peerIoSetEncryption(io, PEER_ENCRYPTION_RC4);
+
+            auto plain = std::vector<uint8_t>(4500);
+            for (size_t i = 0; i < std::size(plain); ++i)
+            {
+                plain[i] = uint8_t(i * 7);
+            }
+
+            auto encrypted = std::vector<uint8_t>(std::size(plain));
+            tr_cryptoEncrypt(&remote, std::size(plain), std::data(plain), std::data(encrypted));
+
+            // put the ciphertext in separate chains of 1000, 3000 and 500 bytes
+            auto const encrypted_copy = encrypted;
+            auto* inbuf = evbuffer_new();
+            evbuffer_add_reference(inbuf, std::data(encrypted), 1000, nullptr, nullptr);
+            evbuffer_add_reference(inbuf, std::data(encrypted) + 1000, 3000, nullptr, nullptr);
+            evbuffer_add_reference(inbuf, std::data(encrypted) + 4000, 500, nullptr, nullptr);
+
+            // read it back in pieces that straddle the chains
+            auto decrypted = std::vector<uint8_t>(std::size(plain));
+            tr_peerIoReadBytes(io, inbuf, std::data(decrypted), 1);
+            tr_peerIoReadBytes(io, inbuf, std::data(decrypted) + 1, 2499);
+            tr_peerIoReadBytes(io, inbuf, std::data(decrypted) + 2500, 2000);
+            EXPECT_EQ(0U, evbuffer_get_length(inbuf));
+            EXPECT_EQ(plain, decrypted);
+
+            // it's decrypted on the way out, not in place
+            EXPECT_EQ(encrypted_copy, encrypted);
+
+            evbuffer_free(inbuf);
+            tr_cryptoDestruct(&remote);
+            tr_peerIoUnref(io);
+        });
+}
+
+#ifndef _WIN32
+
+namespace
+{
+
+// a listening loopback TCP socket; `sin` is set to its address
+tr_socket_t listenOnLoopback(sockaddr_in* sin)
+{
+    auto const listener = socket(AF_INET, SOCK_STREAM, 0);
+    *sin = {};
+    sin->sin_family = AF_INET;
+    sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    EXPECT_EQ(0, bind(listener, reinterpret_cast<sockaddr*>(sin), sizeof(*sin)));
+    EXPECT_EQ(0, listen(listener, 1));
+    auto sin_len = socklen_t{ sizeof(*sin) };
+    getsockname(listener, reinterpret_cast<sockaddr*>(sin), &sin_len);
+    return listener;
+}
+
+} // namespace
+
+TEST_F(PeerIoTest, writesQueuedMessagesTogether)
+{
+    auto sin = sockaddr_in{};
+    auto const listener = listenOnLoopback(&sin);
+    auto const fd = tr_fdSocketCreate(session_, AF_INET, SOCK_STREAM);
+    EXPECT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+    auto const peer_fd = accept(listener, nullptr, nullptr);
+    evutil_make_socket_nonblocking(fd);
+
+    auto block = std::vector<uint8_t>(MAX_BLOCK_SIZE);
+    for (size_t i = 0; i < std::size(block); ++i)
+    {
+        block[i] = uint8_t(i * 13);
+    }
+
+    auto const have = std::array<uint8_t, 9>{ 0, 0, 0, 5, 4, 0, 0, 0, 7 };
+    auto expected = std::vector<uint8_t>{};
+
+    runInEventThread(
+        [this, fd, &block, &have, &expected]()
+        {
+            auto* io = newIncomingIo(session_, fd);
+            auto before = tr_peer_write_stats{};
+            tr_peerIoGetWriteStats(session_, &before);
+
+            // protocol messages and piece data queued separately...
+            for (int i = 0; i < 3; ++i)
+            {
+                tr_peerIoWriteBytes(io, std::data(have), std::size(have), false);
+                expected.insert(std::end(expected), std::begin(have), std::end(have));
+            }
+
+            tr_peerIoWriteBytes(io, std::data(block), std::size(block), true);
+            expected.insert(std::end(expected), std::begin(block), std::end(block));
+
+            // ...go out in a single syscall
+            auto const total = int(std::size(expected));
+            EXPECT_EQ(total, tr_peerIoFlush(io, TR_UP, INT_MAX));
+
+            auto after = tr_peer_write_stats{};
+            tr_peerIoGetWriteStats(session_, &after);
+            EXPECT_EQ(before.calls + 1, after.calls);
+            EXPECT_EQ(before.bytes + total, after.bytes);
+
+            // a write cut short by its limit leaves the rest queued
+            tr_peerIoWriteBytes(io, std::data(block), std::size(block), true);
+            expected.insert(std::end(expected), std::begin(block), std::end(block));
+            EXPECT_EQ(1000, tr_peerIoFlush(io, TR_UP, 1000));
+            EXPECT_EQ(int(std::size(block)) - 1000, tr_peerIoFlush(io, TR_UP, INT_MAX));
+
+            tr_peerIoUnref(io);
+        });
+
+    auto received = std::vector<uint8_t>(std::size(expected));
+    for (size_t got = 0; got < std::size(received);)
+    {
+        auto const n = recv(peer_fd, reinterpret_cast<char*>(std::data(received)) + got, std::size(received) - got, 0);
+        ASSERT_GT(n, 0);
+        got += size_t(n);
+    }
+
+    EXPECT_EQ(expected, received);
+
+    evutil_closesocket(peer_fd);
+    evutil_closesocket(listener);
+}
+
+// Counts the write syscalls it takes to upload piece data through the bandwidth allocator,
+// with and without a speed limit that rations it to every peer a few kilobytes at a time.
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*uploadWriteCalls*
+TEST_F(PeerIoTest, DISABLED_uploadWriteCalls)
+{
+    auto constexpr Rounds = size_t{ 512 };
+    auto constexpr BlocksPerRound = size_t{ 32 }; // 512 KiB; what one allocation period of a 1 MiB/s peer sends
+
+    auto const run = [this](char const* label, bool limited)
+    {
+        auto sin = sockaddr_in{};
+        auto const listener = listenOnLoopback(&sin);
+        auto const fd = tr_fdSocketCreate(session_, AF_INET, SOCK_STREAM);
+        EXPECT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+        auto const peer_fd = accept(listener, nullptr, nullptr);
+        evutil_make_socket_nonblocking(fd);
+
+        // a limit high enough that it never throttles, so only the rationing differs
+        tr_sessionSetSpeedLimit_KBps(session_, TR_UP, 1000000);
+        tr_sessionLimitSpeed(session_, TR_UP, limited);
+
+        auto received = std::atomic<uint64_t>{};
+        auto reader = std::thread(
+            [peer_fd, &received]()
+            {
+                auto buf = std::vector<char>(256 * 1024);
+                for (;;)
+                {
+                    auto const n = recv(peer_fd, std::data(buf), std::size(buf), 0);
+                    if (n <= 0)
+                    {
+                        break;
+                    }
+
+                    received += size_t(n);
+                }
+            });
+
+        auto* io = static_cast<tr_peerIo*>(nullptr);
+        runInEventThread([this, fd, &io]() { io = newIncomingIo(session_, fd); });
+
+        auto block = std::vector<uint8_t>(sizeof(uint32_t) + 9 + MAX_BLOCK_SIZE, 0xEE);
+        auto const have = std::array<uint8_t, 9>{ 0, 0, 0, 5, 4, 0, 0, 0, 7 };
+        auto before = tr_peer_write_stats{};
+        tr_peerIoGetWriteStats(session_, &before);
+        auto expected = uint64_t{};
+
+        for (size_t round = 0; round < Rounds; ++round)
+        {
+            runInEventThread(
+                [this, io, &block, &have, &expected]()
+                {
+                    for (size_t i = 0; i < BlocksPerRound; ++i)
+                    {
+                        tr_peerIoWriteBytes(io, std::data(have), std::size(have), false);
+                        tr_peerIoWriteBytes(io, std::data(block), std::size(block), true);
+                        expected += std::size(have) + std::size(block);
+                    }
+
+                    session_->bandwidth->allocate(TR_UP, 500);
+                });
+
+            EXPECT_TRUE(waitFor([&received, &expected]() { return received == expected; }, 10000));
+        }
+
+        auto after = tr_peer_write_stats{};
+        tr_peerIoGetWriteStats(session_, &after);
+        auto const mib = double(after.bytes - before.bytes) / (1024 * 1024);
+        fprintf(stderr, "%s: %.1f write calls per MiB\n", label, (after.calls - before.calls) / mib);
+
+        runInEventThread([io]() { tr_peerIoUnref(io); });
+        reader.join();
+        evutil_closesocket(peer_fd);
+        evutil_closesocket(listener);
+        tr_sessionLimitSpeed(session_, TR_UP, false);
+    };
+
+    run("rationed by a speed limit", true);
+    run("no speed limit", false);
+}
+
+namespace
+{
+
+// reads length-prefixed blocks the way readBtPiece() does and keeps them the way the cache does
+struct BlockReader
+{
+    // move the data through a temporary buffer, like tr_peerIoReadBytesToBuf() used to
+    bool via_temporary_buffer = false;
+
+    uint32_t block_length = 0;
+    struct evbuffer* block = evbuffer_new();
+
+    // blocks are flushed in runs, like tr_cache does
+    struct evbuffer* cache = evbuffer_new();
+    std::vector<uint8_t> flushed = std::vector<uint8_t>(64 * MAX_BLOCK_SIZE);
+
+    std::atomic<uint64_t> payload_bytes = {};
+
+    ~BlockReader()
+    {
+        evbuffer_free(cache);
+        evbuffer_free(block);
+    }
+
+    static ReadState canRead(tr_peerIo* io, void* vreader, size_t* piece)
+    {
+        auto* const r = static_cast<BlockReader*>(vreader);
+        auto* const inbuf = tr_peerIoGetReadBuffer(io);
+        auto const inlen = evbuffer_get_length(inbuf);
+
+        if (r->block_length == 0)
+        {
+            if (inlen < sizeof(uint32_t))
+            {
+                return READ_LATER;
+            }
+
+            tr_peerIoReadUint32(io, inbuf, &r->block_length);
+            return READ_NOW;
+        }
+
+        auto const left = r->block_length - evbuffer_get_length(r->block);
+        auto const n = std::min(left, inlen);
+        if (n == 0)
+        {
+            return READ_LATER;
+        }
+
+        if (r->via_temporary_buffer)
+        {
+            auto* tmp = evbuffer_new();
+            evbuffer_remove_buffer(inbuf, tmp, n);
+            evbuffer_add_buffer(r->block, tmp);
+            evbuffer_free(tmp);
+        }
+        else
+        {
+            tr_peerIoReadBytesToBuf(io, inbuf, r->block, n);
+        }
+
+        *piece = n;
+
+        if (left != n)
+        {
+            return READ_LATER;
+        }
+
+        evbuffer_remove_buffer(r->block, r->cache, r->block_length);
+
+        if (evbuffer_get_length(r->cache) >= std::size(r->flushed))
+        {
+            evbuffer_remove(r->cache, std::data(r->flushed), std::size(r->flushed));
+        }
+
+        r->payload_bytes += r->block_length;
+        r->block_length = 0;
+        return READ_NOW;
+    }
+};
+
+} // namespace
+
+// Measures how fast piece data moves from a loopback socket into cache-style buffers.
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*pieceReadThroughput*
+TEST_F(PeerIoTest, DISABLED_pieceReadThroughput)
+{
+    auto constexpr BlockCount = size_t{ 64 * 1024 }; // 1 GiB
+    auto constexpr BlockSize = uint32_t{ MAX_BLOCK_SIZE };
+
+    auto const run = [this](char const* label, bool via_temporary_buffer)
+    {
+        // connect a loopback socket pair
+        auto sin = sockaddr_in{};
+        auto const listener = listenOnLoopback(&sin);
+
+        auto const writer_fd = tr_fdSocketCreate(session_, AF_INET, SOCK_STREAM);
+        connect(writer_fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin));
+
+        auto reader = BlockReader{};
+        reader.via_temporary_buffer = via_temporary_buffer;
+        tr_peerIo* io = nullptr;
+
+        runInEventThread(
+            [this, listener, &io, &reader]()
+            {
+                auto addr = tr_address{};
+                auto port = tr_port{};
+                auto const fd = tr_fdSocketAccept(session_, listener, &addr, &port);
+                evutil_make_socket_nonblocking(fd);
+                io = newIncomingIo(session_, fd);
+                tr_peerIoSetIOFuncs(io, BlockReader::canRead, nullptr, nullptr, &reader);
+                tr_peerIoSetEnabled(io, TR_DOWN, true);
+            });
+
+        auto const begin = std::chrono::steady_clock::now();
+
+        auto writer = std::thread(
+            [writer_fd]()
+            {
+                auto frame = std::vector<uint8_t>(sizeof(uint32_t) + BlockSize, 0xEE);
+                auto const len = htonl(BlockSize);
+                memcpy(std::data(frame), &len, sizeof(len));
+
+                for (size_t i = 0; i < BlockCount; ++i)
+                {
+                    for (size_t sent = 0; sent < std::size(frame);)
+                    {
+                        auto const n = send(writer_fd, std::data(frame) + sent, std::size(frame) - sent, 0);
+                        if (n > 0)
+                        {
+                            sent += size_t(n);
+                        }
+                        else
+                        {
+                            std::this_thread::yield();
+                        }
+                    }
+                }
+            });
+
+        auto const total = uint64_t{ BlockCount } * BlockSize;
+        EXPECT_TRUE(waitFor([&reader, total]() { return reader.payload_bytes == total; }, 120000));
+        auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        writer.join();
+
+        fprintf(stderr, "%s: %.0f MiB/s\n", label, total / elapsed / (1024 * 1024));
+
+        runInEventThread([io]() { tr_peerIoUnref(io); });
+        tr_netClose(session_, writer_fd);
+        evutil_closesocket(listener);
+    };
+
+    run("through a temporary evbuffer", true);
+    run("tr_peerIoReadBytesToBuf", false);
+}
+
+#endif
+
+} // namespace test
+
+} // namespace libtransmission
@@ -7,10 +7,25 @@
  */
 
 #include "transmission.h"
+#include "fdlimit.h"
+#include "net.h"
+#include "peer-io.h"
+#include "peer-mgr.h"
 #include "peer-msgs.h"
+#include "peer-socket.h"
+#include "torrent.h"
 #include "utils.h"
 
-#include "gtest/gtest.h"
+#include "test-fixtures.h"
+
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h> // mallinfo2()
+#define HAVE_MALLINFO2
+#endif
 
 TEST(PeerMsgs, placeholder)
 {
@@ -40,3 +55,144 @@ TEST(PeerMsgs, placeholder)
 
 #endif
 }
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class PeerMsgsTest : public SessionTest
+{
+protected:
+    auto static constexpr PeerLimit = int{ 1000 };
+
+    void SetUp() override
+    {
+        tr_variantDictAddInt(settings(), TR_KEY_peer_limit_global, PeerLimit);
+
+        SessionTest::SetUp();
+    }
+};
+
+TEST_F(PeerMsgsTest, pexSnapshotIsShared)
+{
+    auto* tor = zeroTorrentInit();
+
+    auto const snapshot = tr_peerMgrGetPexSnapshot(tor, 50);
+    EXPECT_NE(nullptr, snapshot);
+    EXPECT_TRUE(std::empty(snapshot->pex));
+    EXPECT_TRUE(std::empty(snapshot->pex6));
+    EXPECT_EQ(nullptr, snapshot->previous);
+
+    // every peer of the torrent gets the same one
+    EXPECT_EQ(snapshot, tr_peerMgrGetPexSnapshot(tor, 50));
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(PeerMsgsTest, redundantHavesAreSuppressed)
+{
+    auto* tor = zeroTorrentInit();
+
+    runInEventThread(
+        [this, tor]()
+        {
+            auto addr = tr_address{};
+            tr_address_from_string(&addr, "10.0.0.1");
+
+            // the socket isn't connected; nothing is flushed to it in this test
+            auto const fd = tr_fdSocketCreate(session_, AF_INET, SOCK_STREAM);
+            auto* io = tr_peerIoNewIncoming(session_, tor->bandwidth, &addr, tr_port(6881), tr_peer_socket_tcp_create(fd));
+            auto* peer = tr_peerMsgsNew(tor, nullptr, io, nullptr, nullptr);
+            peer->have.setBit(1);
+
+            auto stats = tr_peer_write_stats{};
+            tr_peerIoGetWriteStats(session_, &stats);
+            auto const suppressed = stats.haves_suppressed;
+
+            // the peer doesn't have piece 0, so it's told about it...
+            peer->on_piece_completed(0);
+            tr_peerIoGetWriteStats(session_, &stats);
+            EXPECT_EQ(suppressed, stats.haves_suppressed);
+
+            // ...but not about piece 1, which it already has
+            peer->on_piece_completed(1);
+            tr_peerIoGetWriteStats(session_, &stats);
+            EXPECT_EQ(suppressed + 1, stats.haves_suppressed);
+
+            delete peer;
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+// Accounts for the heap used by idle peer connections.
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*idlePeerMemory*
+TEST_F(PeerMsgsTest, DISABLED_idlePeerMemory)
+{
+#ifndef HAVE_MALLINFO2
+    GTEST_SKIP();
+#else
+    auto constexpr PeerCount = PeerLimit;
+
+    auto* tor = zeroTorrentInit();
+
+    runInEventThread(
+        [this, tor]()
+        {
+            auto const heapInUse = []()
+            {
+                return mallinfo2().uordblks;
+            };
+
+            auto addr = tr_address{};
+            tr_address_from_string(&addr, "10.0.0.1");
+
+            // the sockets aren't connected, but nothing is read or written in this test
+            auto ios = std::vector<tr_peerIo*>{};
+            auto const before_io = heapInUse();
+
+            for (int i = 0; i < PeerCount; ++i)
+            {
+                auto const fd = tr_fdSocketCreate(session_, AF_INET, SOCK_STREAM);
+                EXPECT_NE(TR_BAD_SOCKET, fd);
+                auto const socket = tr_peer_socket_tcp_create(fd);
+                ios.push_back(tr_peerIoNewIncoming(session_, tor->bandwidth, &addr, tr_port(6881 + i), socket));
+            }
+
+            auto const before_msgs = heapInUse();
+
+            auto peers = std::vector<tr_peerMsgs*>{};
+            for (auto* io : ios)
+            {
+                peers.push_back(tr_peerMsgsNew(tor, nullptr, io, nullptr, nullptr));
+            }
+
+            auto const after = heapInUse();
+
+            fprintf(
+                stderr,
+                "%d idle peers: %zu bytes each (tr_peerIo %zu, tr_peerMsgs %zu)\n",
+                PeerCount,
+                (after - before_io) / PeerCount,
+                (before_msgs - before_io) / PeerCount,
+                (after - before_msgs) / PeerCount);
+
+            // deleting a peer closes its socket
+            for (auto* peer : peers)
+            {
+                delete peer;
+            }
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+#endif
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,142 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "inout.h"
+#include "perf.h"
+#include "session.h"
+#include "torrent.h"
+
+#include "test-fixtures.h"
+
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using PerfTest = SessionTest;
+
+namespace
+{
+
+tr_perf_counter getCounter(tr_session const* session, tr_perf_probe probe)
+{
+    auto stats = tr_perf_stats{};
+    tr_perfGetStats(session, &stats);
+    return stats.probes[probe];
+}
+
+} // namespace
+
+TEST_F(PerfTest, countsAndHistogram)
+{
+    // nothing in the session handles handshakes here, so the probe starts out empty
+    auto const probe = TR_PERF_HANDSHAKE;
+    auto counter = getCounter(session_, probe);
+    EXPECT_EQ(uint64_t{ 0 }, counter.count);
+
+    auto constexpr Huge = uint64_t{ 1 } << 40;
+    for (auto const usec : { uint64_t{ 0 }, uint64_t{ 1 }, uint64_t{ 3 }, uint64_t{ 1000 }, uint64_t{ 2500000 }, Huge })
+    {
+        tr_perfAdd(session_, probe, usec);
+    }
+
+    counter = getCounter(session_, probe);
+    EXPECT_EQ(uint64_t{ 6 }, counter.count);
+    EXPECT_EQ(2501004 + Huge, counter.total_usec);
+    EXPECT_EQ(Huge, counter.max_usec);
+    EXPECT_EQ(uint64_t{ 1 }, counter.usec[0]); // 0
+    EXPECT_EQ(uint64_t{ 1 }, counter.usec[1]); // [1, 2)
+    EXPECT_EQ(uint64_t{ 1 }, counter.usec[2]); // [2, 4)
+    EXPECT_EQ(uint64_t{ 1 }, counter.usec[10]); // [512, 1024)
+    EXPECT_EQ(uint64_t{ 1 }, counter.usec[22]); // a 2.5 second stall gets a bucket of its own
+    EXPECT_EQ(uint64_t{ 1 }, counter.usec[TR_PERF_HISTOGRAM_SIZE - 1]); // everything bigger
+    EXPECT_EQ(counter.count, std::accumulate(std::begin(counter.usec), std::end(counter.usec), uint64_t{}));
+}
+
+TEST_F(PerfTest, scopesFromManyThreads)
+{
+    auto constexpr ThreadCount = 4;
+    auto constexpr ScopesPerThread = 10000;
+
+    auto const probe = TR_PERF_HANDSHAKE;
+    auto const before = getCounter(session_, probe);
+
+    auto threads = std::vector<std::thread>{};
+    for (int i = 0; i < ThreadCount; ++i)
+    {
+        threads.emplace_back(
+            [this]()
+            {
+                for (int j = 0; j < ScopesPerThread; ++j)
+                {
+                    auto const perf = tr_perf_scope{ session_, probe };
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    auto const after = getCounter(session_, probe);
+    EXPECT_EQ(before.count + ThreadCount * ScopesPerThread, after.count);
+    EXPECT_EQ(after.count, std::accumulate(std::begin(after.usec), std::end(after.usec), uint64_t{}));
+}
+
+TEST_F(PerfTest, diskAndHashProbes)
+{
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+    zeroTorrentPopulate(tor, true);
+
+    auto const reads = getCounter(session_, TR_PERF_DISK_READ).count;
+    auto const writes = getCounter(session_, TR_PERF_DISK_WRITE).count;
+    auto const hashes = getCounter(session_, TR_PERF_HASH).count;
+
+    auto buf = std::vector<uint8_t>(tor->blockSize);
+    EXPECT_EQ(0, tr_ioRead(tor, 0, 0, std::size(buf), std::data(buf)));
+    EXPECT_EQ(0, tr_ioWrite(tor, 0, 0, std::size(buf), std::data(buf)));
+    EXPECT_TRUE(tr_ioTestPiece(tor, 0));
+
+    // testing the piece reads it too
+    EXPECT_LT(reads + 1, getCounter(session_, TR_PERF_DISK_READ).count);
+    EXPECT_EQ(writes + 1, getCounter(session_, TR_PERF_DISK_WRITE).count);
+    EXPECT_EQ(hashes + 1, getCounter(session_, TR_PERF_HASH).count);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+// Measures what a probe costs.
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*DISABLED_probeOverhead*
+TEST_F(PerfTest, DISABLED_probeOverhead)
+{
+    auto constexpr Scopes = int{ 10000000 };
+
+    auto const begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < Scopes; ++i)
+    {
+        auto const perf = tr_perf_scope{ session_, TR_PERF_HANDSHAKE };
+    }
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    fprintf(stderr, "%d probe scopes in %.3f s (%.1f ns each)\n", Scopes, elapsed, elapsed * 1e9 / Scopes);
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -13,6 +13,8 @@
 
 #include <cstring>
 #include <string>
+#include <thread>
+#include <vector>
 
 class QuarkTest : public ::testing::Test
 {
@@ -45,3 +47,46 @@ TEST_F(QuarkTest, newEmptyQuarkReturnsNone)
     EXPECT_EQ(TR_KEY_NONE, q);
     EXPECT_EQ(std::string{ "" }, quarkGetString(q));
 }
+
+TEST_F(QuarkTest, runtimeQuarksFromManyThreads)
+{
+    auto constexpr ThreadCount = 4;
+    auto constexpr KeysPerThread = 500;
+
+    auto const makeKey = [](int i)
+    {
+        return "quark-test-runtime-key-" + std::to_string(i);
+    };
+
+    // every thread adds the same keys, so they race to create each one
+    auto quarks = std::vector<std::vector<tr_quark>>(ThreadCount);
+    auto threads = std::vector<std::thread>{};
+    for (int i = 0; i < ThreadCount; ++i)
+    {
+        threads.emplace_back(
+            [&makeKey, &setme = quarks[i]]()
+            {
+                for (int j = 0; j < KeysPerThread; ++j)
+                {
+                    auto const key = makeKey(j);
+                    setme.push_back(tr_quark_new(key.data(), key.size()));
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    for (int j = 0; j < KeysPerThread; ++j)
+    {
+        auto const q = quarks.front()[j];
+        EXPECT_EQ(makeKey(j), quarkGetString(q));
+
+        for (auto const& thread_quarks : quarks)
+        {
+            EXPECT_EQ(q, thread_quarks[j]);
+        }
+    }
+}
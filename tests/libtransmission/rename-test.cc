@@ -9,6 +9,7 @@
 #include "transmission.h"
 #include "crypto-utils.h"
 #include "file.h"
+#include "metainfo.h"
 #include "resume.h"
 #include "torrent.h" // tr_isTorrent()
 #include "tr-assert.h"
@@ -329,8 +330,7 @@ TEST_F(RenameTest, multifileTorrent)
     // (while the branch is renamed: confirm that the .resume file remembers the changes)
     tr_torrentSaveResume(tor);
     // this is a bit dodgy code-wise, but let's make sure the .resume file got the name
-    tr_free(files[1].name);
-    tor->info.files[1].name = tr_strdup("gabba gabba hey");
+    tr_metainfoSetFileName(&tor->info, 1, tr_strdup("gabba gabba hey"));
     auto const loaded = tr_torrentLoadResume(tor, ~0, ctor, nullptr);
     EXPECT_NE(decltype(loaded){ 0 }, (loaded & TR_FR_FILENAMES));
     EXPECT_EQ(expected_files[0], files[0].name);
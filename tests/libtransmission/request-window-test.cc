@@ -0,0 +1,124 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "request-window.h"
+
+#include "gtest/gtest.h"
+
+#include <deque>
+#include <utility>
+
+namespace
+{
+
+auto constexpr BlockSize = uint32_t{ 16384 };
+
+// A peer that serves one block every `serve_msec' and is `rtt_msec' away.
+// Returns the window after `duration_msec' of keeping it full.
+tr_request_window simulate(uint64_t rtt_msec, uint64_t serve_msec, uint64_t duration_msec, uint32_t rate_limit_Bps = 0)
+{
+    auto window = tr_request_window{};
+    auto at_peer = std::deque<std::pair<uint64_t, tr_block_index_t>>{};
+    auto in_flight = std::deque<std::pair<uint64_t, tr_block_index_t>>{};
+    auto peer_free_at = uint64_t{ 0 };
+    auto outstanding = int{ 0 };
+    auto next_block = tr_block_index_t{ 0 };
+
+    for (uint64_t now = 1000; now < 1000 + duration_msec; ++now)
+    {
+        while (!std::empty(in_flight) && in_flight.front().first <= now)
+        {
+            window.block_received(now, in_flight.front().second, BlockSize);
+            in_flight.pop_front();
+            --outstanding;
+        }
+
+        if (peer_free_at <= now && !std::empty(at_peer) && at_peer.front().first <= now)
+        {
+            peer_free_at = now + serve_msec;
+            in_flight.emplace_back(peer_free_at + rtt_msec / 2, at_peer.front().second);
+            at_peer.pop_front();
+        }
+
+        while (outstanding < window.size(BlockSize, rate_limit_Bps, tr_request_window::MaxWindow))
+        {
+            window.request_sent(now, next_block);
+            at_peer.emplace_back(now + rtt_msec / 2, next_block);
+            ++next_block;
+            ++outstanding;
+        }
+    }
+
+    return window;
+}
+
+} // namespace
+
+TEST(RequestWindow, slowStart)
+{
+    auto window = tr_request_window{};
+    EXPECT_EQ(tr_request_window::MinWindow, window.size(BlockSize, 0, tr_request_window::MaxWindow));
+    EXPECT_EQ(0U, window.rtt_msec());
+
+    // every block received grows the window by one
+    for (tr_block_index_t block = 0; block < 4; ++block)
+    {
+        window.request_sent(1000, block);
+    }
+
+    for (tr_block_index_t block = 0; block < 4; ++block)
+    {
+        window.block_received(1100, block, BlockSize);
+    }
+
+    EXPECT_TRUE(window.in_slow_start());
+    EXPECT_EQ(2 * tr_request_window::MinWindow, window.size(BlockSize, 0, tr_request_window::MaxWindow));
+    EXPECT_EQ(100U, window.rtt_msec());
+
+    // the peer's reqq is honored
+    EXPECT_EQ(5, window.size(BlockSize, 0, 5));
+}
+
+TEST(RequestWindow, droppedProbeIsReplaced)
+{
+    auto window = tr_request_window{};
+
+    // the first request is timed, and it's rejected or cancelled...
+    window.request_sent(1000, 0);
+    window.request_sent(1000, 1);
+    window.request_dropped(1);
+    window.request_dropped(0);
+
+    // ...so the next one is timed instead of waiting out the probe timeout
+    window.request_sent(1050, 2);
+    window.block_received(1150, 2, BlockSize);
+    EXPECT_EQ(100U, window.rtt_msec());
+}
+
+TEST(RequestWindow, coversBandwidthDelayProduct)
+{
+    // 100 blocks per second and a 200 msec round trip, so about 20 blocks in flight
+    auto const window = simulate(200, 10, 30000);
+    EXPECT_FALSE(window.in_slow_start());
+    EXPECT_LE(200U, window.min_rtt_msec());
+    EXPECT_GE(260U, window.min_rtt_msec());
+
+    auto const n = window.size(BlockSize, 0, tr_request_window::MaxWindow);
+    EXPECT_LE(20, n);
+    EXPECT_GE(60, n);
+}
+
+TEST(RequestWindow, honorsSpeedLimit)
+{
+    // a 10 blocks per second limit on the same link needs far fewer requests
+    auto const window = simulate(200, 10, 30000);
+    auto const limited = window.size(BlockSize, 10 * BlockSize, tr_request_window::MaxWindow);
+    EXPECT_GT(window.size(BlockSize, 0, tr_request_window::MaxWindow), limited);
+    EXPECT_GE(6, limited);
+}
@@ -0,0 +1,89 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "ring-buffer.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+
+namespace
+{
+
+std::vector<int> contents(tr_ring_buffer<int> const& ring)
+{
+    auto ret = std::vector<int>{};
+    for (size_t i = 0; i < std::size(ring); ++i)
+    {
+        ret.push_back(ring[i]);
+    }
+    return ret;
+}
+
+} // namespace
+
+TEST(RingBuffer, pushAndPop)
+{
+    auto ring = tr_ring_buffer<int>{};
+    EXPECT_TRUE(std::empty(ring));
+    EXPECT_EQ(size_t{ 0 }, ring.capacity());
+
+    // wrap around the end of the buffer a few times
+    auto expected = std::vector<int>{};
+    for (int i = 0; i < 100; ++i)
+    {
+        ring.push_back(i);
+        expected.push_back(i);
+
+        if (i % 3 == 0)
+        {
+            EXPECT_EQ(expected.front(), ring.front());
+            ring.pop_front();
+            expected.erase(std::begin(expected));
+        }
+    }
+
+    EXPECT_EQ(expected, contents(ring));
+
+    // erase keeps the order of the other items
+    ring.erase(5);
+    expected.erase(std::begin(expected) + 5);
+    ring.erase(0);
+    expected.erase(std::begin(expected));
+    EXPECT_EQ(expected, contents(ring));
+}
+
+TEST(RingBuffer, capacityFollowsDemand)
+{
+    auto ring = tr_ring_buffer<int>{};
+
+    for (int i = 0; i < 512; ++i)
+    {
+        ring.push_back(i);
+    }
+
+    EXPECT_EQ(size_t{ 512 }, ring.capacity());
+
+    // shrinks as it drains...
+    while (std::size(ring) > 16)
+    {
+        ring.pop_front();
+    }
+
+    EXPECT_GE(size_t{ 64 }, ring.capacity());
+    EXPECT_EQ(496, ring.front());
+
+    // ...and holds nothing once it's empty
+    while (!std::empty(ring))
+    {
+        ring.pop_front();
+    }
+
+    EXPECT_EQ(size_t{ 0 }, ring.capacity());
+}
@@ -7,7 +7,10 @@
  */
 
 #include "transmission.h"
+#include "log.h"
+#include "quark.h"
 #include "rpcimpl.h"
+#include "session.h"
 #include "utils.h"
 #include "variant.h"
 
@@ -15,7 +18,10 @@
 
 #include <algorithm>
 #include <array>
+#include <cstring>
 #include <set>
+#include <string>
+#include <tuple>
 #include <vector>
 
 namespace libtransmission
@@ -190,6 +196,279 @@ TEST_F(RpcTest, sessionGet)
     tr_torrentRemove(tor, false, nullptr);
 }
 
+TEST_F(RpcTest, torrentGetFilterSortAndPage)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+    tr_torrentSetLabels(tor, tr_labels_t{ "linux" });
+
+    // returns the result string, "totalCount", and the ids of a torrent-get with the given extra arguments
+    auto const torrentGet = [this, &rpc_response_func](std::string const& extra_args)
+    {
+        auto const json = std::string{ R"({ "method": "torrent-get", "arguments": { "fields": [ "id" ], )" } + extra_args +
+            " } }";
+        tr_variant request;
+        EXPECT_EQ(0, tr_variantFromJson(&request, json.data(), json.size()));
+
+        tr_variant response;
+        tr_rpc_request_exec_json(session_, &request, rpc_response_func, &response);
+        tr_variantFree(&request);
+
+        char const* result = "";
+        (void)tr_variantDictFindStr(&response, TR_KEY_result, &result, nullptr);
+        auto total = int64_t{ -1 };
+        auto ids = std::vector<int64_t>{};
+        tr_variant* args = nullptr;
+        tr_variant* torrents = nullptr;
+        if (tr_variantDictFindDict(&response, TR_KEY_arguments, &args))
+        {
+            (void)tr_variantDictFindInt(args, TR_KEY_totalCount, &total);
+
+            if (tr_variantDictFindList(args, TR_KEY_torrents, &torrents))
+            {
+                for (size_t i = 0, n = tr_variantListSize(torrents); i < n; ++i)
+                {
+                    auto id = int64_t{};
+                    EXPECT_TRUE(tr_variantDictFindInt(tr_variantListChild(torrents, i), TR_KEY_id, &id));
+                    ids.push_back(id);
+                }
+            }
+        }
+
+        auto ret = std::make_tuple(std::string{ result }, total, ids);
+        tr_variantFree(&response);
+        return ret;
+    };
+
+    auto const match = std::make_tuple(std::string{ "success" }, int64_t{ 1 }, std::vector<int64_t>{ tr_torrentId(tor) });
+    auto const no_match = std::make_tuple(std::string{ "success" }, int64_t{ 0 }, std::vector<int64_t>{});
+
+    // filters
+    EXPECT_EQ(match, torrentGet(R"("filter": { "name": "ZEROES" })"));
+    EXPECT_EQ(no_match, torrentGet(R"("filter": { "name": "no-such-name" })"));
+    EXPECT_EQ(match, torrentGet(R"("filter": { "trackerHost": "example.com" })"));
+    EXPECT_EQ(no_match, torrentGet(R"("filter": { "trackerHost": "announce" })"));
+    // a new torrent may still be in its initial verify: stopped, check-wait, or checking
+    EXPECT_EQ(match, torrentGet(R"("filter": { "status": [ 0, 1, 2 ] })"));
+    EXPECT_EQ(no_match, torrentGet(R"("filter": { "status": 4 })"));
+    EXPECT_EQ(match, torrentGet(R"("filter": { "labels": [ "bsd", "linux" ] })"));
+    EXPECT_EQ(no_match, torrentGet(R"("filter": { "labels": [ "bsd" ] })"));
+    EXPECT_EQ(match, torrentGet(R"("filter": { "ratioMin": 0, "ratioMax": 1.5 })"));
+    EXPECT_EQ(no_match, torrentGet(R"("filter": { "ratioMin": 2 })"));
+
+    // sorting and paging
+    EXPECT_EQ(match, torrentGet(R"("sort": "name", "sortReverse": true, "limit": 10)"));
+    EXPECT_EQ(
+        std::make_tuple(std::string{ "success" }, int64_t{ 1 }, std::vector<int64_t>{}),
+        torrentGet(R"("offset": 1)"));
+    EXPECT_EQ("invalid sort key", std::get<0>(torrentGet(R"("sort": "no-such-key")")));
+    EXPECT_EQ("invalid sort key", std::get<0>(torrentGet(R"("sort": "announce")")));
+
+    // unknown sort keys don't get added to the quark table
+    auto unused = tr_quark{};
+    EXPECT_FALSE(tr_quark_lookup("no-such-key", strlen("no-such-key"), &unused));
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(RpcTest, sessionEvents)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+
+    auto const exec = [this, &rpc_response_func](std::string const& json, tr_variant* setme)
+    {
+        tr_variant request;
+        EXPECT_EQ(0, tr_variantFromJson(&request, json.data(), json.size()));
+        tr_rpc_request_exec_json(session_, &request, rpc_response_func, setme);
+        tr_variantFree(&request);
+    };
+
+    // with no cursor, session-events returns the current cursor and no events
+    tr_variant response;
+    exec(R"({ "method": "session-events" })", &response);
+    tr_variant* args = nullptr;
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+    auto cursor = int64_t{ -1 };
+    EXPECT_TRUE(tr_variantDictFindInt(args, TR_KEY_cursor, &cursor));
+    EXPECT_LE(0, cursor);
+    tr_variant* events = nullptr;
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_events, &events));
+    EXPECT_EQ(0, tr_variantListSize(events));
+    tr_variantFree(&response);
+
+    // changing a torrent via rpc publishes an event
+    exec(R"({ "method": "torrent-set", "arguments": { "bandwidthPriority": 1 } })", &response);
+    tr_variantFree(&response);
+    auto const published = [this, &cursor]()
+    {
+        return int64_t(session_->rpcEventSeq) > cursor;
+    };
+    EXPECT_TRUE(waitFor(published, 2000));
+
+    // the session-stats events published once a second may be interleaved,
+    // so look for events by type
+    auto const find_event = [](tr_variant* events, char const* type) -> tr_variant*
+    {
+        for (size_t i = 0, n = tr_variantListSize(events); i < n; ++i)
+        {
+            auto* const event = tr_variantListChild(events, i);
+            char const* event_type = nullptr;
+
+            if (tr_variantDictFindStr(event, TR_KEY_type, &event_type, nullptr) && strcmp(event_type, type) == 0)
+            {
+                return event;
+            }
+        }
+
+        return nullptr;
+    };
+
+    exec(R"({ "method": "session-events", "arguments": { "cursor": )" + std::to_string(cursor) + " } }", &response);
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_events, &events));
+    auto* event = find_event(events, "torrent-changed");
+    EXPECT_NE(nullptr, event);
+    auto id = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(event, TR_KEY_id, &id));
+    EXPECT_EQ(tr_torrentId(tor), id);
+    auto overflow = true;
+    EXPECT_TRUE(tr_variantDictFindBool(args, TR_KEY_overflow, &overflow));
+    EXPECT_FALSE(overflow);
+    EXPECT_TRUE(tr_variantDictFindInt(args, TR_KEY_cursor, &cursor));
+    tr_variantFree(&response);
+
+    // logged errors are published as "log" events
+    tr_logAddNamedError("rpc-test", "something went wrong");
+    EXPECT_TRUE(waitFor(published, 2000));
+    exec(R"({ "method": "session-events", "arguments": { "cursor": )" + std::to_string(cursor) + " } }", &response);
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_events, &events));
+    event = find_event(events, "log");
+    EXPECT_NE(nullptr, event);
+    auto level = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(event, TR_KEY_level, &level));
+    EXPECT_EQ(TR_LOG_ERROR, level);
+    char const* str = nullptr;
+    EXPECT_TRUE(tr_variantDictFindStr(event, TR_KEY_name, &str, nullptr));
+    EXPECT_STREQ("rpc-test", str);
+    EXPECT_TRUE(tr_variantDictFindStr(event, TR_KEY_message, &str, nullptr));
+    EXPECT_STREQ("something went wrong", str);
+    tr_variantFree(&response);
+
+    // the session's torrent counts are published as "session-stats" events
+    auto const stats_published = [this]()
+    {
+        return session_->rpcEventStats.pausedTorrentCount == 1;
+    };
+    EXPECT_TRUE(waitFor(stats_published, 3000));
+    exec(R"({ "method": "session-events", "arguments": { "cursor": 0 } })", &response);
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_events, &events));
+    event = find_event(events, "session-stats");
+    EXPECT_NE(nullptr, event);
+    auto count = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(event, TR_KEY_pausedTorrentCount, &count));
+    EXPECT_EQ(1, count);
+    EXPECT_TRUE(tr_variantDictFindInt(event, TR_KEY_activeTorrentCount, &count));
+    EXPECT_EQ(0, count);
+    tr_variantFree(&response);
+
+    // a cursor from the future, e.g. from before a restart, is reported as an overflow
+    exec(R"({ "method": "session-events", "arguments": { "cursor": 1000000 } })", &response);
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+    EXPECT_TRUE(tr_variantDictFindBool(args, TR_KEY_overflow, &overflow));
+    EXPECT_TRUE(overflow);
+    tr_variantFree(&response);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(RpcTest, sessionPerf)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    // populating it verifies the torrent, which hashes every piece
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+    zeroTorrentPopulate(tor, true);
+
+    auto const getPerf = [this, &rpc_response_func](tr_variant* setme)
+    {
+        tr_variant request;
+        tr_variantInitDict(&request, 1);
+        tr_variantDictAddStr(&request, TR_KEY_method, "session-perf");
+        tr_rpc_request_exec_json(session_, &request, rpc_response_func, setme);
+        tr_variantFree(&request);
+    };
+
+    auto const probes = std::array<tr_quark, 8>{
+        TR_KEY_event_loop, TR_KEY_bandwidth_pulse, TR_KEY_cache_flush, TR_KEY_disk_read,
+        TR_KEY_disk_write, TR_KEY_hash,            TR_KEY_rpc,         TR_KEY_handshake,
+    };
+
+    auto rpc_counts = std::vector<int64_t>{};
+
+    for (int i = 0; i < 2; ++i)
+    {
+        tr_variant response;
+        getPerf(&response);
+        tr_variant* args = nullptr;
+        EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+
+        for (auto const key : probes)
+        {
+            tr_variant* d = nullptr;
+            EXPECT_TRUE(tr_variantDictFindDict(args, key, &d)) << tr_quark_get_string(key, nullptr);
+            auto count = int64_t{ -1 };
+            auto max = int64_t{ -1 };
+            auto total = int64_t{ -1 };
+            tr_variant* histogram = nullptr;
+            EXPECT_TRUE(tr_variantDictFindInt(d, TR_KEY_count, &count));
+            EXPECT_TRUE(tr_variantDictFindInt(d, TR_KEY_maxUsec, &max));
+            EXPECT_TRUE(tr_variantDictFindInt(d, TR_KEY_totalUsec, &total));
+            EXPECT_TRUE(tr_variantDictFindList(d, TR_KEY_histogram, &histogram));
+            EXPECT_EQ(32, tr_variantListSize(histogram));
+
+            if (key == TR_KEY_hash)
+            {
+                EXPECT_LE(int64_t{ tor->info.pieceCount }, count);
+            }
+            else if (key == TR_KEY_rpc)
+            {
+                rpc_counts.push_back(count);
+            }
+        }
+
+        tr_variantFree(&response);
+    }
+
+    // the first request was counted by the time the second one ran
+    EXPECT_EQ(2, std::size(rpc_counts));
+    EXPECT_LT(rpc_counts.front(), rpc_counts.back());
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
 } // namespace test
 
 } // namespace libtransmission
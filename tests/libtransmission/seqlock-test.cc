@@ -0,0 +1,112 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "seqlock.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// a value that's bigger than a word, so a torn read would show up as mismatched fields
+struct Payload
+{
+    std::array<uint64_t, 31> words;
+    uint32_t tail;
+};
+
+Payload makePayload(uint64_t n)
+{
+    auto ret = Payload{};
+    std::fill(std::begin(ret.words), std::end(ret.words), n);
+    ret.tail = uint32_t(n);
+    return ret;
+}
+
+} // namespace
+
+TEST(Seqlock, storeAndLoad)
+{
+    auto lock = tr_seqlock<Payload>{};
+    EXPECT_EQ(uint64_t{ 0 }, lock.version());
+    EXPECT_EQ(uint64_t{ 0 }, lock.load().words.front());
+
+    lock.store(makePayload(7));
+    EXPECT_EQ(uint64_t{ 1 }, lock.version());
+    auto const value = lock.load();
+    EXPECT_EQ(makePayload(7).words, value.words);
+    EXPECT_EQ(uint32_t{ 7 }, value.tail);
+
+    lock.store(makePayload(8));
+    EXPECT_EQ(uint64_t{ 2 }, lock.version());
+    EXPECT_EQ(uint32_t{ 8 }, lock.load().tail);
+}
+
+TEST(Seqlock, readersNeverSeeTornValues)
+{
+    auto constexpr Stores = uint64_t{ 200000 };
+    auto constexpr ReaderCount = 4;
+
+    auto lock = tr_seqlock<Payload>{};
+    auto done = std::atomic<bool>{ false };
+    auto torn = std::atomic<int>{ 0 };
+    auto went_backwards = std::atomic<int>{ 0 };
+
+    auto readers = std::vector<std::thread>{};
+    for (int i = 0; i < ReaderCount; ++i)
+    {
+        readers.emplace_back(
+            [&lock, &done, &torn, &went_backwards]()
+            {
+                auto prev = uint64_t{};
+
+                while (!done)
+                {
+                    auto const value = lock.load();
+                    auto const n = value.words.front();
+
+                    if (value.tail != uint32_t(n) ||
+                        std::any_of(std::begin(value.words), std::end(value.words), [n](auto w) { return w != n; }))
+                    {
+                        ++torn;
+                    }
+
+                    if (n < prev)
+                    {
+                        ++went_backwards;
+                    }
+
+                    prev = n;
+                }
+            });
+    }
+
+    for (uint64_t n = 1; n <= Stores; ++n)
+    {
+        lock.store(makePayload(n));
+    }
+
+    done = true;
+    for (auto& reader : readers)
+    {
+        reader.join();
+    }
+
+    EXPECT_EQ(0, torn);
+    EXPECT_EQ(0, went_backwards);
+    EXPECT_EQ(Stores, lock.version());
+    EXPECT_EQ(Stores, lock.load().words.back());
+}
@@ -7,19 +7,26 @@
  */
 
 #include "transmission.h"
+#include "crypto-utils.h"
+#include "platform.h"
 #include "session.h"
 #include "session-id.h"
+#include "torrent.h"
 #include "utils.h"
+#include "variant.h"
 #include "version.h"
 
-#include "gtest/gtest.h"
+#include "test-fixtures.h"
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <thread>
+#include <vector>
 
 TEST(Session, peerId)
 {
@@ -128,3 +135,186 @@ TEST(Session, sessionId)
     tr_free(const_cast<char*>(session_id_str_2));
     tr_free(const_cast<char*>(session_id_str_1));
 }
+
+TEST(Session, lockStatsCountOutermostAcquisitions)
+{
+    auto* lock = tr_lockNew();
+
+    tr_lockLock(lock);
+    tr_lockLock(lock);
+    auto stats = tr_lock_stats{};
+    tr_lockGetStats(lock, &stats);
+    tr_lockUnlock(lock);
+    tr_lockUnlock(lock);
+    EXPECT_EQ(uint64_t{ 1 }, stats.acquisitions);
+    EXPECT_EQ(uint64_t{ 0 }, stats.contended);
+
+    tr_lockLock(lock);
+    tr_lockGetStats(lock, &stats);
+    tr_lockUnlock(lock);
+    EXPECT_EQ(uint64_t{ 2 }, stats.acquisitions);
+
+    tr_lockFree(lock);
+}
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using SessionLoadTest = SessionTest;
+using SessionLockTest = SessionTest;
+
+namespace
+{
+
+// a small single-file torrent whose info hash is made unique by `name'
+std::string makeTorrentBenc(std::string const& name)
+{
+    auto top = tr_variant{};
+    tr_variantInitDict(&top, 2);
+    tr_variantDictAddStr(&top, TR_KEY_announce, "http://www.example.com/announce");
+    auto* info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+    tr_variantDictAddInt(info, TR_KEY_length, 1048576);
+    tr_variantDictAddStr(info, TR_KEY_name, name.c_str());
+    tr_variantDictAddInt(info, TR_KEY_piece_length, 32768);
+    auto const pieces = std::vector<char>(32 * SHA_DIGEST_LENGTH);
+    tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+
+    auto len = size_t{};
+    auto* benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, &len);
+    tr_variantFree(&top);
+    auto ret = std::string{ benc, len };
+    tr_free(benc);
+    return ret;
+}
+
+std::string hashStringOf(tr_session* session, std::string const& benc)
+{
+    auto* ctor = tr_ctorNew(session);
+    tr_ctorSetMetainfo(ctor, std::data(benc), std::size(benc));
+    auto inf = tr_info{};
+    EXPECT_EQ(TR_PARSE_OK, tr_torrentParse(ctor, &inf));
+    auto ret = std::string{ inf.hashString };
+    tr_metainfoFree(&inf);
+    tr_ctorFree(ctor);
+    return ret;
+}
+
+} // namespace
+
+TEST_F(SessionLockTest, contentionIsCounted)
+{
+    auto before = tr_lock_stats{};
+    tr_sessionGetLockStats(session_, &before);
+
+    // hold the lock while another thread waits for it
+    tr_sessionLock(session_);
+    auto waiter = std::thread(
+        [this]()
+        {
+            tr_sessionLock(session_);
+            tr_sessionUnlock(session_);
+        });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    tr_sessionUnlock(session_);
+    waiter.join();
+
+    auto after = tr_lock_stats{};
+    tr_sessionGetLockStats(session_, &after);
+    EXPECT_LT(before.contended, after.contended);
+    EXPECT_LE(before.acquisitions + 3, after.acquisitions);
+    EXPECT_LE(uint64_t{ 20000 }, after.max_wait_usec);
+    EXPECT_LE(after.max_wait_usec, after.wait_usec);
+}
+
+TEST_F(SessionLoadTest, loadTorrents)
+{
+    auto const torrent_dir = std::string{ tr_getTorrentDir(session_) };
+    auto const resume_dir = std::string{ tr_getResumeDir(session_) };
+
+    // three good torrents, a copy of one of them, and a corrupt one
+    auto constexpr GoodCount = int{ 3 };
+    auto hashes = std::vector<std::string>{};
+    for (int i = 0; i < GoodCount; ++i)
+    {
+        auto const benc = makeTorrentBenc(makeString(tr_strdup_printf("torrent-%d", i)));
+        hashes.push_back(hashStringOf(session_, benc));
+        createFileWithContents(torrent_dir + "/" + hashes.back() + ".torrent", std::data(benc), std::size(benc));
+    }
+
+    auto const dupe = makeTorrentBenc("torrent-0");
+    createFileWithContents(torrent_dir + "/dupe.torrent", std::data(dupe), std::size(dupe));
+    auto const junk = std::string{ "d8:announce" };
+    createFileWithContents(torrent_dir + "/junk.torrent", std::data(junk), std::size(junk));
+
+    // give the second torrent some resume data
+    auto constexpr AddedDate = time_t{ 1234567 };
+    auto resume = tr_variant{};
+    tr_variantInitDict(&resume, 1);
+    tr_variantDictAddInt(&resume, TR_KEY_added_date, AddedDate);
+    auto const resume_file = resume_dir + "/" + hashes[1] + ".resume";
+    EXPECT_EQ(0, tr_variantToFile(&resume, TR_VARIANT_FMT_BENC, resume_file.c_str()));
+    tr_variantFree(&resume);
+
+    auto* ctor = tr_ctorNew(session_);
+    tr_ctorSetPaused(ctor, TR_FORCE, true);
+    auto n = int{};
+    auto* torrents = tr_sessionLoadTorrents(session_, ctor, &n);
+    tr_ctorFree(ctor);
+    EXPECT_EQ(GoodCount, n);
+    EXPECT_EQ(GoodCount, tr_sessionCountTorrents(session_));
+
+    for (int i = 0; i < n; ++i)
+    {
+        auto const* const tor = torrents[i];
+        auto const hash = std::string{ tor->info.hashString };
+        EXPECT_NE(std::end(hashes), std::find(std::begin(hashes), std::end(hashes), hash));
+        EXPECT_EQ(hash == hashes[1], tor->addedDate == AddedDate);
+    }
+
+    // cleanup
+    for (int i = 0; i < n; ++i)
+    {
+        tr_torrentRemove(torrents[i], false, nullptr);
+    }
+
+    tr_free(torrents);
+}
+
+// Measures tr_sessionLoadTorrents() with a large torrents directory.
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*startupThroughput*
+TEST_F(SessionLoadTest, DISABLED_startupThroughput)
+{
+    auto constexpr TorrentCount = int{ 10000 };
+
+    auto const torrent_dir = std::string{ tr_getTorrentDir(session_) };
+    for (int i = 0; i < TorrentCount; ++i)
+    {
+        auto const name = makeString(tr_strdup_printf("torrent-%d", i));
+        auto const benc = makeTorrentBenc(name);
+        createFileWithContents(torrent_dir + "/" + name + ".torrent", std::data(benc), std::size(benc));
+    }
+
+    auto const begin = std::chrono::steady_clock::now();
+    auto* ctor = tr_ctorNew(session_);
+    tr_ctorSetPaused(ctor, TR_FORCE, true);
+    auto n = int{};
+    auto* torrents = tr_sessionLoadTorrents(session_, ctor, &n);
+    tr_ctorFree(ctor);
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    EXPECT_EQ(TorrentCount, n);
+    fprintf(stderr, "loaded %d torrents in %.3f s (%.0f torrents/s)\n", n, elapsed, n / elapsed);
+
+    for (int i = 0; i < n; ++i)
+    {
+        tr_torrentRemove(torrents[i], false, nullptr);
+    }
+
+    tr_free(torrents);
+}
+
+} // namespace test
+
+} // namespace libtransmission
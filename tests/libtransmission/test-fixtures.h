@@ -17,12 +17,15 @@
 #include "torrent.h"
 #include "variant.h"
 
+#include <atomic>
 #include <chrono>
 #include <cstring> // strlen()
+#include <functional>
 #include <memory>
 #include <thread>
 #include <mutex> // std::once_flag()
 #include <string>
+#include <utility> // std::move()
 #include <cstdlib> // getenv()
 
 #include "gtest/gtest.h"
@@ -458,6 +461,34 @@ protected:
         EXPECT_TRUE(waitFor(test, 2000));
     }
 
+    void runInEventThread(std::function<void()> func)
+    {
+        struct Data
+        {
+            std::function<void()> func;
+            std::atomic<bool> done = false;
+        };
+
+        auto data = Data{ std::move(func) };
+        auto const threadfunc = [](void* vdata) noexcept
+        {
+            auto* d = static_cast<Data*>(vdata);
+            d->func();
+            d->done = true;
+        };
+
+        tr_runInEventThread(session_, threadfunc, &data);
+
+        if (!waitFor([&data]() { return data.done.load(); }, 5000))
+        {
+            // func and data live on this stack frame, and func may capture
+            // the caller's locals, so returning while it might still run
+            // would let it write to memory that's been reused
+            ADD_FAILURE() << "timed out waiting for the event thread";
+            std::abort();
+        }
+    }
+
     tr_session* session_ = nullptr;
 
     tr_variant* settings()
@@ -0,0 +1,390 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "session.h"
+#include "timer-wheel.h"
+
+#include "test-fixtures.h"
+
+#include <event2/event.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+namespace
+{
+
+// a timer that logs its id and the time it fired
+struct TestTimer
+{
+    tr_timer timer;
+    int id = 0;
+    uint64_t const* now = nullptr;
+    std::vector<std::pair<int, uint64_t>>* log = nullptr;
+
+    void init(int id_in, uint64_t const* now_in, std::vector<std::pair<int, uint64_t>>* log_in)
+    {
+        id = id_in;
+        now = now_in;
+        log = log_in;
+        timer.callback = onFired;
+        timer.user_data = this;
+    }
+
+    static void onFired(void* vt)
+    {
+        auto* t = static_cast<TestTimer*>(vt);
+        t->log->emplace_back(t->id, *t->now);
+    }
+};
+
+using FiredLog = std::vector<std::pair<int, uint64_t>>;
+
+} // namespace
+
+TEST(TimerWheel, firesInOrder)
+{
+    auto now = uint64_t{ 1000 };
+    auto wheel = tr_timer_wheel{ now };
+    auto log = FiredLog{};
+
+    auto const delays = std::vector<uint64_t>{ 500, 20, 300, 10 };
+    auto timers = std::vector<TestTimer>(std::size(delays));
+    for (size_t i = 0; i < std::size(timers); ++i)
+    {
+        timers[i].init(int(i), &now, &log);
+        wheel.schedule(&timers[i].timer, now, delays[i]);
+    }
+
+    EXPECT_EQ(size_t{ 4 }, std::size(wheel));
+    EXPECT_EQ(now + 10, wheel.next_wakeup_msec());
+
+    for (; now <= 2000; now += tr_timer_wheel::TickMsec)
+    {
+        wheel.advance(now);
+    }
+
+    // each one fires in the tick its deadline falls in
+    EXPECT_EQ((FiredLog{ { 3, 1010 }, { 1, 1020 }, { 2, 1300 }, { 0, 1500 } }), log);
+    EXPECT_TRUE(std::empty(wheel));
+    EXPECT_EQ(uint64_t{ 0 }, wheel.next_wakeup_msec());
+}
+
+TEST(TimerWheel, cancelAndReschedule)
+{
+    auto now = uint64_t{ 0 };
+    auto wheel = tr_timer_wheel{ now };
+    auto log = FiredLog{};
+
+    auto a = TestTimer{};
+    a.init(1, &now, &log);
+    auto b = TestTimer{};
+    b.init(2, &now, &log);
+
+    wheel.schedule(&a.timer, now, 100);
+    wheel.schedule(&b.timer, now, 200);
+    EXPECT_TRUE(tr_timer_wheel::is_scheduled(&a.timer));
+    EXPECT_EQ(size_t{ 2 }, std::size(wheel));
+
+    // cancelling is idempotent
+    wheel.cancel(&a.timer);
+    wheel.cancel(&a.timer);
+    EXPECT_FALSE(tr_timer_wheel::is_scheduled(&a.timer));
+    EXPECT_EQ(size_t{ 1 }, std::size(wheel));
+
+    // rescheduling replaces the old deadline
+    wheel.schedule(&b.timer, now, 50);
+    EXPECT_EQ(size_t{ 1 }, std::size(wheel));
+
+    for (now = 0; now <= 500; now += tr_timer_wheel::TickMsec)
+    {
+        wheel.advance(now);
+    }
+
+    EXPECT_EQ((FiredLog{ { 2, 50 } }), log);
+    EXPECT_FALSE(tr_timer_wheel::is_scheduled(&b.timer));
+}
+
+TEST(TimerWheel, periodicFromCallback)
+{
+    struct Periodic
+    {
+        tr_timer timer;
+        tr_timer_wheel* wheel;
+        uint64_t const* now;
+        int count;
+    };
+
+    auto now = uint64_t{ 0 };
+    auto wheel = tr_timer_wheel{ now };
+    auto p = Periodic{ {}, &wheel, &now, 0 };
+    p.timer.user_data = &p;
+    p.timer.callback = [](void* vp)
+    {
+        auto* self = static_cast<Periodic*>(vp);
+        if (++self->count < 5)
+        {
+            self->wheel->schedule(&self->timer, *self->now, 100);
+        }
+    };
+
+    wheel.schedule(&p.timer, now, 100);
+
+    // a big jump fires the timer once per advance() that reaches it
+    for (now = 0; now <= 1000; now += 50)
+    {
+        wheel.advance(now);
+    }
+
+    EXPECT_EQ(5, p.count);
+    EXPECT_TRUE(std::empty(wheel));
+}
+
+TEST(TimerWheel, longDelaysCascade)
+{
+    auto now = uint64_t{ 12345 };
+    auto const start = now;
+    auto wheel = tr_timer_wheel{ now };
+
+    // delays that land in every level of the wheel, and one past its end
+    auto const delays = std::vector<uint64_t>{ 630, 650, 40950, 41000, 2621430, 2700000, 3600000, 400000000 };
+    auto timers = std::vector<TestTimer>(std::size(delays));
+    auto log = FiredLog{};
+
+    for (size_t i = 0; i < std::size(delays); ++i)
+    {
+        timers[i].init(int(i), &now, &log);
+        wheel.schedule(&timers[i].timer, now, delays[i]);
+    }
+
+    auto const step = uint64_t{ 970 };
+    while (!std::empty(wheel))
+    {
+        auto const wakeup = wheel.next_wakeup_msec();
+        EXPECT_GT(wakeup, now - now % tr_timer_wheel::TickMsec);
+        now += step;
+        wheel.advance(now);
+    }
+
+    // they fire in order, never early, and no later than the advance() after their deadline
+    ASSERT_EQ(std::size(delays), std::size(log));
+    for (size_t i = 0; i + 1 < std::size(delays); ++i)
+    {
+        EXPECT_EQ(int(i), log[i].first);
+        EXPECT_GE(log[i].second, start + delays[i]);
+        EXPECT_LT(log[i].second, start + delays[i] + step + tr_timer_wheel::TickMsec);
+    }
+
+    // the last one was clamped to the longest timeout the wheel can hold
+    EXPECT_LT(log.back().second, start + delays.back());
+}
+
+TEST(TimerWheel, idleLongerThanTheWheel)
+{
+    auto now = uint64_t{ 0 };
+    auto wheel = tr_timer_wheel{ now };
+    auto log = FiredLog{};
+
+    auto a = TestTimer{};
+    a.init(1, &now, &log);
+    auto b = TestTimer{};
+    b.init(2, &now, &log);
+
+    wheel.schedule(&a.timer, now, 100);
+    now = 100;
+    wheel.advance(now);
+    EXPECT_TRUE(std::empty(wheel));
+
+    // nothing is scheduled for longer than the wheel's span, about 46.6 hours
+    now += uint64_t{ 72 } * 60 * 60 * 1000;
+
+    // a timer scheduled now isn't clamped against the stale tick and fired right away
+    auto const start = now;
+    wheel.schedule(&b.timer, now, 500);
+    EXPECT_EQ(start + 500, wheel.next_wakeup_msec());
+    now = start + 250;
+    wheel.advance(now);
+    EXPECT_EQ((FiredLog{ { 1, 100 } }), log);
+    now = start + 500;
+    wheel.advance(now);
+    EXPECT_EQ((FiredLog{ { 1, 100 }, { 2, start + 500 } }), log);
+}
+
+using TimerWheelSessionTest = SessionTest;
+
+TEST_F(TimerWheelSessionTest, sessionTimersFire)
+{
+    struct Flag
+    {
+        tr_timer timer;
+        std::atomic<bool> fired;
+    };
+
+    auto early = Flag{};
+    auto late = Flag{};
+    auto cancelled = Flag{};
+
+    for (auto* f : { &early, &late, &cancelled })
+    {
+        f->fired = false;
+        f->timer.user_data = f;
+        f->timer.callback = [](void* vf)
+        {
+            static_cast<Flag*>(vf)->fired = true;
+        };
+    }
+
+    // the event is armed for the earliest timer, so adding an earlier one must re-arm it
+    tr_sessionAddTimer(session_, &late.timer, 60);
+    tr_sessionAddTimer(session_, &cancelled.timer, 20);
+    tr_sessionAddTimer(session_, &early.timer, 10);
+    tr_sessionRemoveTimer(session_, &cancelled.timer);
+
+    EXPECT_TRUE(waitFor([&early]() { return early.fired.load(); }, 2000));
+    EXPECT_TRUE(waitFor([&late]() { return late.fired.load(); }, 2000));
+    EXPECT_FALSE(cancelled.fired);
+}
+
+// Measures schedule / reschedule / cancel / expiry with many pending timers,
+// next to libevent's own timers doing the same work.
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*DISABLED_stress*
+TEST(TimerWheel, DISABLED_stress)
+{
+    auto constexpr TimerCount = size_t{ 100000 };
+    auto constexpr Rounds = int{ 10 };
+
+    auto const elapsed = [](auto begin)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+
+    // delays spread between 1 and 120 seconds, like handshake and request timeouts
+    auto delays = std::vector<uint64_t>(TimerCount);
+    for (size_t i = 0; i < TimerCount; ++i)
+    {
+        delays[i] = 1000 + (i * 7919) % 119000;
+    }
+
+    // tr_timer_wheel
+    {
+        auto now = uint64_t{ 0 };
+        auto wheel = tr_timer_wheel{ now };
+        auto fired = size_t{};
+        auto timers = std::vector<tr_timer>(TimerCount);
+
+        for (auto& timer : timers)
+        {
+            timer.user_data = &fired;
+            timer.callback = [](void* vfired)
+            {
+                ++*static_cast<size_t*>(vfired);
+            };
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        for (int round = 0; round < Rounds; ++round)
+        {
+            // every peer re-arms its timeout when it hears from the peer
+            for (size_t i = 0; i < TimerCount; ++i)
+            {
+                wheel.schedule(&timers[i], now, delays[(i + round) % TimerCount]);
+            }
+        }
+        auto const schedule_secs = elapsed(begin);
+
+        begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < TimerCount; i += 2)
+        {
+            wheel.cancel(&timers[i]);
+        }
+        auto const cancel_secs = elapsed(begin);
+
+        begin = std::chrono::steady_clock::now();
+        while (!std::empty(wheel))
+        {
+            now += 100;
+            wheel.advance(now);
+        }
+        auto const expire_secs = elapsed(begin);
+
+        EXPECT_EQ(TimerCount / 2, fired);
+        fprintf(
+            stderr,
+            "tr_timer_wheel: %zu timers, %d schedules each in %.3f s; cancel half in %.3f s; expire the rest in %.3f s\n",
+            TimerCount,
+            Rounds,
+            schedule_secs,
+            cancel_secs,
+            expire_secs);
+    }
+
+    // libevent
+    {
+        auto* base = event_base_new();
+        auto fired = size_t{};
+        auto events = std::vector<struct event*>(TimerCount);
+
+        for (auto& ev : events)
+        {
+            ev = evtimer_new(
+                base,
+                [](evutil_socket_t, short, void* vfired)
+                {
+                    ++*static_cast<size_t*>(vfired);
+                },
+                &fired);
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        for (int round = 0; round < Rounds; ++round)
+        {
+            for (size_t i = 0; i < TimerCount; ++i)
+            {
+                auto const msec = delays[(i + round) % TimerCount];
+                auto tv = timeval{ time_t(msec / 1000), suseconds_t((msec % 1000) * 1000) };
+                evtimer_add(events[i], &tv);
+            }
+        }
+        auto const schedule_secs = elapsed(begin);
+
+        begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < TimerCount; i += 2)
+        {
+            evtimer_del(events[i]);
+        }
+        auto const cancel_secs = elapsed(begin);
+
+        for (auto* ev : events)
+        {
+            event_free(ev);
+        }
+        event_base_free(base);
+
+        fprintf(
+            stderr,
+            "libevent:       %zu timers, %d schedules each in %.3f s; cancel half in %.3f s\n",
+            TimerCount,
+            Rounds,
+            schedule_secs,
+            cancel_secs);
+    }
+}
+
+} // namespace test
+
+} // namespace libtransmission
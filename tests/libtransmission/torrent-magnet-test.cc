@@ -0,0 +1,82 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "session.h"
+#include "torrent.h"
+#include "torrent-magnet.h"
+#include "utils.h"
+
+#include "test-fixtures.h"
+
+#include <event2/buffer.h>
+
+#include <array>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using TorrentMagnetTest = SessionTest;
+
+TEST_F(TorrentMagnetTest, metadataPieces)
+{
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+    EXPECT_LT(size_t{ 0 }, tor->infoDictLength);
+
+    // the pieces put back together hash to the info hash
+    auto const n_pieces = int(tor->infoDictLength / METADATA_PIECE_SIZE + 1);
+    auto info_dict = std::vector<uint8_t>{};
+    for (int piece = 0; piece < n_pieces; ++piece)
+    {
+        auto len = size_t{};
+        auto* data = static_cast<uint8_t*>(tr_torrentGetMetadataPiece(tor, piece, &len));
+        EXPECT_NE(nullptr, data);
+        info_dict.insert(std::end(info_dict), data, data + len);
+        tr_free(data);
+    }
+
+    EXPECT_EQ(tor->infoDictLength, std::size(info_dict));
+    auto hash = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    EXPECT_TRUE(tr_sha1(std::data(hash), std::data(info_dict), int(std::size(info_dict)), nullptr));
+    EXPECT_EQ(0, memcmp(std::data(hash), tor->info.hash, SHA_DIGEST_LENGTH));
+    EXPECT_EQ(tor->infoDictLength, session_->infoDictCacheBytes);
+
+    // out-of-range pieces aren't served
+    auto len = size_t{};
+    EXPECT_EQ(nullptr, tr_torrentGetMetadataPiece(tor, n_pieces, &len));
+
+    // a zero-copy piece outlives the torrent's own reference
+    auto* out = evbuffer_new();
+    EXPECT_EQ(tor->infoDictLength, tr_torrentAddMetadataPiece(tor, 0, out, true));
+    tr_torrentUnloadInfoDict(tor, 0);
+    EXPECT_EQ(nullptr, tor->infoDictBuffer);
+    EXPECT_EQ(size_t{ 0 }, session_->infoDictCacheBytes);
+    auto sent = std::vector<uint8_t>(evbuffer_get_length(out));
+    evbuffer_remove(out, std::data(sent), std::size(sent));
+    EXPECT_EQ(info_dict, sent);
+    evbuffer_free(out);
+
+    // and the info dict is reloaded when needed again
+    out = evbuffer_new();
+    EXPECT_EQ(tor->infoDictLength, tr_torrentAddMetadataPiece(tor, 0, out, false));
+    EXPECT_EQ(tor->infoDictLength, session_->infoDictCacheBytes);
+    evbuffer_free(out);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+} // namespace test
+
+} // namespace libtransmission
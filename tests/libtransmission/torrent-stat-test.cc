@@ -0,0 +1,323 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "completion.h"
+#include "torrent.h"
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using TorrentStatTest = SessionTest;
+
+namespace
+{
+
+// force a full recount of the lazy fields that tr_completion keeps incrementally
+std::pair<uint64_t, uint64_t> recountCompletion(tr_completion* cp)
+{
+    cp->haveValidIsDirty = true;
+    cp->sizeWhenDoneIsDirty = true;
+    return std::make_pair(tr_cpHaveValid(cp), tr_cpSizeWhenDone(cp));
+}
+
+} // namespace
+
+TEST_F(TorrentStatTest, completionCountersMatchFullRecount)
+{
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+    auto* cp = &tor->completion;
+    EXPECT_LT(tr_piece_index_t{ 3 }, tor->info.pieceCount);
+
+    auto const check = [cp]()
+    {
+        auto const incremental = std::make_pair(tr_cpHaveValid(cp), tr_cpSizeWhenDone(cp));
+        EXPECT_EQ(recountCompletion(cp), incremental);
+    };
+
+    // prime the lazy fields so the following changes are applied incrementally
+    check();
+
+    // whole pieces
+    tr_cpPieceAdd(cp, 0);
+    tr_cpPieceAdd(cp, 2);
+    check();
+
+    // a partial piece doesn't count towards haveValid...
+    tr_block_index_t first;
+    tr_block_index_t last;
+    tr_torGetPieceBlockRange(tor, 1, &first, &last);
+    EXPECT_LT(first, last);
+    tr_cpBlockAdd(cp, first);
+    check();
+
+    // ...until its last block arrives
+    for (tr_block_index_t b = first + 1; b <= last; ++b)
+    {
+        tr_cpBlockAdd(cp, b);
+    }
+
+    check();
+
+    tr_cpPieceRem(cp, 2);
+    check();
+
+    // blocks in unwanted pieces count towards sizeWhenDone
+    // the last piece is shared by the last two files
+    auto const small_files = std::array<tr_file_index_t, 2>{ 1, 2 };
+    tr_torrentSetFileDLs(tor, std::data(small_files), std::size(small_files), false);
+    check();
+    auto const last_piece = tr_piece_index_t{ tor->info.pieceCount - 1 };
+    EXPECT_TRUE(tor->info.pieces[last_piece].dnd);
+    tr_cpPieceAdd(cp, last_piece);
+    check();
+    tr_cpPieceRem(cp, last_piece);
+    check();
+
+    auto const* const st = tr_torrentStat(tor);
+    EXPECT_EQ(tr_cpHaveValid(cp), st->haveValid);
+    EXPECT_EQ(tr_cpSizeWhenDone(cp), st->sizeWhenDone);
+    EXPECT_EQ(0, tor->statDirty);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(TorrentStatTest, fileBytesCompleted)
+{
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+    auto* cp = &tor->completion;
+
+    // 32 pieces of files-filled-with-zeroes/1048576, then one piece
+    // whose only block is shared by the 4096 and 512 byte files
+    EXPECT_EQ(tr_file_index_t{ 3 }, tor->info.fileCount);
+    EXPECT_EQ(tr_piece_index_t{ 33 }, tor->info.pieceCount);
+    auto const fileBytes = [tor]()
+    {
+        auto n = tr_file_index_t{};
+        auto* files = tr_torrentFiles(tor, &n);
+        auto ret = std::vector<uint64_t>{};
+        for (tr_file_index_t i = 0; i < n; ++i)
+        {
+            ret.push_back(files[i].bytesCompleted);
+        }
+        tr_torrentFilesFree(files, n);
+        return ret;
+    };
+
+    EXPECT_EQ((std::vector<uint64_t>{ 0, 0, 0 }), fileBytes());
+
+    tr_cpPieceAdd(cp, 0);
+    EXPECT_EQ((std::vector<uint64_t>{ 32768, 0, 0 }), fileBytes());
+
+    tr_cpPieceAdd(cp, 32);
+    EXPECT_EQ((std::vector<uint64_t>{ 32768, 4096, 512 }), fileBytes());
+    EXPECT_FALSE(tr_cpFileIsComplete(cp, 0));
+    EXPECT_TRUE(tr_cpFileIsComplete(cp, 1));
+    EXPECT_TRUE(tr_cpFileIsComplete(cp, 2));
+
+    tr_block_index_t first;
+    tr_block_index_t last;
+    tr_torGetPieceBlockRange(tor, 1, &first, &last);
+    tr_cpBlockAdd(cp, first);
+    EXPECT_EQ((std::vector<uint64_t>{ 32768 + tor->blockSize, 4096, 512 }), fileBytes());
+
+    tr_cpPieceRem(cp, 0);
+    tr_cpPieceRem(cp, 32);
+    EXPECT_EQ((std::vector<uint64_t>{ tor->blockSize, 0, 0 }), fileBytes());
+    EXPECT_FALSE(tr_cpFileIsComplete(cp, 1));
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(TorrentStatTest, cachedStatSeesStateChanges)
+{
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+
+    auto const* st = tr_torrentStatCached(tor);
+    EXPECT_EQ(TR_STAT_OK, st->error);
+    EXPECT_EQ(st, tr_torrentStatCached(tor));
+
+    // a state change must show up even within the same second
+    tr_torrentSetLocalError(tor, "%s", "boom");
+    st = tr_torrentStatCached(tor);
+    EXPECT_EQ(TR_STAT_LOCAL_ERROR, st->error);
+    EXPECT_STREQ("boom", st->errorString);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(TorrentStatTest, transfersKeepTheCachedStat)
+{
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+    tr_torrentStat(tor);
+    EXPECT_EQ(0, tor->statDirty & TR_STAT_DIRTY_STATE);
+
+    // every block that's sent or received marks the .resume file dirty...
+    tr_torrentSetDirty(tor);
+    EXPECT_EQ(0, tor->statDirty & TR_STAT_DIRTY_STATE);
+
+    // ...but only real state changes refresh the cached stat
+    tr_torrentSetRatioLimit(tor, 4.0);
+    EXPECT_NE(0, tor->statDirty & TR_STAT_DIRTY_STATE);
+    tr_torrentStat(tor);
+    tr_torrentStart(tor);
+    EXPECT_NE(0, tor->statDirty & TR_STAT_DIRTY_STATE);
+    tr_torrentStat(tor);
+    tr_torrentStop(tor);
+    EXPECT_NE(0, tor->statDirty & TR_STAT_DIRTY_STATE);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(TorrentStatTest, snapshotIsPublished)
+{
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+
+    // one is published when the torrent is added
+    auto snapshot = tr_stat{};
+    char errbuf[128];
+    tr_torrentStatSnapshot(tor, &snapshot, errbuf, sizeof(errbuf));
+    EXPECT_EQ(tor->uniqueId, snapshot.id);
+    EXPECT_EQ(TR_STAT_OK, snapshot.error);
+    EXPECT_EQ(tr_torrentStat(tor)->sizeWhenDone, snapshot.sizeWhenDone);
+    EXPECT_EQ(errbuf, snapshot.errorString);
+
+    // reading it doesn't ask for a republish...
+    tor->statSnapshotWanted = false;
+    tr_torrentStatSnapshot(tor, &snapshot, errbuf, sizeof(errbuf));
+    EXPECT_FALSE(tor->statSnapshotWanted);
+
+    // ...but a state change has the session thread republish it on the next second
+    auto const version = tor->statSnapshot.version();
+    tr_torrentSetLocalError(tor, "%s", "boom");
+    EXPECT_TRUE(tor->statSnapshotWanted);
+    EXPECT_TRUE(waitFor([tor, version]() { return tor->statSnapshot.version() > version; }, 3000));
+
+    // the error text is copied, so it doesn't change under the reader
+    tr_torrentStatSnapshot(tor, &snapshot, errbuf, sizeof(errbuf));
+    EXPECT_EQ(TR_STAT_LOCAL_ERROR, snapshot.error);
+    EXPECT_STREQ("boom", snapshot.errorString);
+    tr_torrentSetLocalError(tor, "%s", "bang");
+    EXPECT_STREQ("boom", snapshot.errorString);
+
+    // without a buffer, the text is left out
+    tr_torrentStatSnapshot(tor, &snapshot, nullptr, 0);
+    EXPECT_STREQ("", snapshot.errorString);
+
+    // cleanup
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+// Measures tr_torrentStat() throughput across a large session.
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*statThroughput*
+TEST_F(TorrentStatTest, DISABLED_statThroughput)
+{
+    auto constexpr TorrentCount = int{ 10000 };
+    auto constexpr Rounds = int{ 10 };
+
+    // build a small single-file torrent per iteration; the name makes each info hash unique
+    auto torrents = std::vector<tr_torrent*>{};
+    torrents.reserve(TorrentCount);
+    auto const pieces = std::array<char, SHA_DIGEST_LENGTH>{};
+
+    for (int i = 0; i < TorrentCount; ++i)
+    {
+        auto top = tr_variant{};
+        tr_variantInitDict(&top, 2);
+        tr_variantDictAddStr(&top, TR_KEY_announce, "http://www.example.com/announce");
+        auto* info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+        tr_variantDictAddInt(info, TR_KEY_length, 1048576);
+        tr_variantDictAddStr(info, TR_KEY_name, makeString(tr_strdup_printf("torrent-%d", i)).c_str());
+        tr_variantDictAddInt(info, TR_KEY_piece_length, 32768);
+        auto piece_hashes = std::vector<char>{};
+        for (int p = 0; p < 32; ++p)
+        {
+            piece_hashes.insert(std::end(piece_hashes), std::begin(pieces), std::end(pieces));
+        }
+        tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(piece_hashes), std::size(piece_hashes));
+
+        auto len = size_t{};
+        auto* benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, &len);
+        tr_variantFree(&top);
+
+        auto* ctor = tr_ctorNew(session_);
+        tr_ctorSetMetainfo(ctor, benc, len);
+        tr_ctorSetPaused(ctor, TR_FORCE, true);
+        tr_ctorSetSave(ctor, false);
+        tr_free(benc);
+
+        auto err = int{};
+        auto* tor = tr_torrentNew(ctor, &err, nullptr);
+        EXPECT_EQ(0, err);
+        tr_ctorFree(ctor);
+        torrents.push_back(tor);
+    }
+
+    auto const run = [&torrents](char const* label, tr_stat const* (*statFunc)(tr_torrent*))
+    {
+        auto const begin = std::chrono::steady_clock::now();
+
+        for (int round = 0; round < Rounds; ++round)
+        {
+            for (auto* tor : torrents)
+            {
+                statFunc(tor);
+            }
+        }
+
+        auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        fprintf(
+            stderr,
+            "%s: %d torrents x %d rounds in %.3f s (%.0f stats/s)\n",
+            label,
+            TorrentCount,
+            Rounds,
+            elapsed,
+            TorrentCount * Rounds / elapsed);
+    };
+
+    run("tr_torrentStat", tr_torrentStat);
+    run("tr_torrentStatCached", tr_torrentStatCached);
+    run("tr_torrentStatSnapshot",
+        [](tr_torrent* tor)
+        {
+            static auto snapshot = tr_stat{};
+            tr_torrentStatSnapshot(tor, &snapshot, nullptr, 0);
+            return static_cast<tr_stat const*>(&snapshot);
+        });
+
+    for (auto* tor : torrents)
+    {
+        tr_torrentRemove(tor, false, nullptr);
+    }
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -6,6 +6,7 @@
  *
  */
 
+#include <errno.h> /* errno */
 #include <stdio.h> /* fprintf() */
 #include <stdlib.h> /* strtoul(), EXIT_FAILURE */
 #include <inttypes.h> /* PRIu32 */
@@ -23,6 +24,7 @@
 #define MY_NAME "transmission-create"
 
 #define MAX_TRACKERS 128
+#define MAX_THREADS 1024
 static uint32_t const KiB = 1024;
 static tr_tracker_info trackers[MAX_TRACKERS];
 static int trackerCount = 0;
@@ -32,6 +34,7 @@ static char const* comment = nullptr;
 static char const* outfile = nullptr;
 static char const* infile = nullptr;
 static uint32_t piecesize_kib = 0;
+static uint32_t thread_count = 0;
 
 static tr_option options[] = {
     { 'p', "private", "Allow this torrent to only be used with the specified tracker(s)", "p", false, nullptr },
@@ -39,6 +42,7 @@ static tr_option options[] = {
     { 's', "piecesize", "Set how many KiB each piece should be, overriding the preferred default", "s", true, "<size in KiB>" },
     { 'c', "comment", "Add a comment", "c", true, "<comment>" },
     { 't', "tracker", "Add a tracker's announce URL", "t", true, "<url>" },
+    { 'T', "threads", "Use this many threads to hash pieces (default: one per CPU core)", "T", true, "<count>" },
     { 'V', "version", "Show version number and exit", "V", false, nullptr },
     { 0, nullptr, nullptr, nullptr, false, nullptr }
 };
@@ -97,6 +101,23 @@ static int parseCommandLine(int argc, char const* const* argv)
 
             break;
 
+        case 'T':
+            {
+                char* endptr = nullptr;
+                errno = 0;
+                unsigned long const n = strtoul(optarg, &endptr, 10);
+
+                if (endptr == optarg || *endptr != '\0' || errno != 0 || n < 1 || n > MAX_THREADS)
+                {
+                    fprintf(stderr, "ERROR: Thread count must be a number from 1 to %d, not \"%s\"\n", MAX_THREADS, optarg);
+                    return 1;
+                }
+
+                thread_count = n;
+            }
+
+            break;
+
         case TR_OPT_UNK:
             infile = optarg;
             break;
@@ -202,6 +223,11 @@ int tr_main(int argc, char* argv[])
         tr_metaInfoBuilderSetPieceSize(b, piecesize_kib * KiB);
     }
 
+    if (thread_count != 0)
+    {
+        tr_metaInfoBuilderSetThreadCount(b, thread_count);
+    }
+
     char buf[128];
     printf(
         b->fileCount > 1 ? " %" PRIu32 " files, %s\n" : " %" PRIu32 " file, %s\n",
@@ -223,6 +223,7 @@ enum
 {
     TAG_SESSION,
     TAG_STATS,
+    TAG_PERF,
     TAG_DETAILS,
     TAG_FILES,
     TAG_LIST,
@@ -293,6 +294,7 @@ static tr_option opts[] = {
     { 943, "info-trackers", "List the current torrent(s)' trackers", "it", false, nullptr },
     { 920, "session-info", "Show the session's details", "si", false, nullptr },
     { 921, "session-stats", "Show the session's statistics", "st", false, nullptr },
+    { 922, "session-perf", "Show where the session spends its time", "sp", false, nullptr },
     { 'l', "list", "List all torrents", "l", false, nullptr },
     { 'L', "labels", "Set the current torrents' labels", "L", true, "<label[,label...]>" },
     { 960, "move", "Move current torrent's data to a new folder", nullptr, true, "<path>" },
@@ -526,6 +528,7 @@ static int getOptMode(int val)
         return MODE_BLOCKLIST_UPDATE;
 
     case 921: /* session-stats */
+    case 922: /* session-perf */
         return MODE_SESSION_STATS;
 
     case 'v': /* verify */
@@ -2022,6 +2025,102 @@ static void printSessionStats(tr_variant* top)
     }
 }
 
+/* the index of the histogram bucket that the `fraction` of values fall in or below */
+static int getHistogramPercentile(tr_variant* histogram, int64_t count, double fraction)
+{
+    int64_t seen = 0;
+    int64_t const target = (int64_t)ceil(count * fraction);
+    tr_variant* bucket;
+
+    for (int i = 0; (bucket = tr_variantListChild(histogram, i)) != nullptr; ++i)
+    {
+        int64_t n;
+
+        if (tr_variantGetInt(bucket, &n))
+        {
+            seen += n;
+        }
+
+        if (seen >= target)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void printSessionPerf(tr_variant* top)
+{
+    static struct
+    {
+        tr_quark key;
+        char const* name;
+    } const probes[] = {
+        { TR_KEY_event_loop, "Event loop lag" },
+        { TR_KEY_bandwidth_pulse, "Bandwidth pulse" },
+        { TR_KEY_cache_flush, "Cache flush" },
+        { TR_KEY_disk_read, "Disk read" },
+        { TR_KEY_disk_write, "Disk write" },
+        { TR_KEY_hash, "Piece hash" },
+        { TR_KEY_rpc, "RPC request" },
+        { TR_KEY_handshake, "Handshake" },
+    };
+
+    tr_variant* args;
+
+    if (tr_variantDictFindDict(top, TR_KEY_arguments, &args))
+    {
+        printf("%-16s  %10s  %10s  %10s  %10s  %12s\n", "Probe", "Count", "Avg (us)", "p99 (us)", "Max (us)", "Total (ms)");
+
+        for (auto const& probe : probes)
+        {
+            tr_variant* d;
+            tr_variant* histogram;
+            int64_t count;
+            int64_t max;
+            int64_t total;
+
+            if (tr_variantDictFindDict(args, probe.key, &d) && tr_variantDictFindInt(d, TR_KEY_count, &count) &&
+                tr_variantDictFindInt(d, TR_KEY_maxUsec, &max) && tr_variantDictFindInt(d, TR_KEY_totalUsec, &total) &&
+                tr_variantDictFindList(d, TR_KEY_histogram, &histogram))
+            {
+                char p99[32] = "None";
+
+                if (count > 0)
+                {
+                    /* the histogram only knows which power of two the value is below.
+                       The last bucket has no upper bound, so show where it starts */
+                    int const bucket = getHistogramPercentile(histogram, count, 0.99);
+                    int const last = (int)tr_variantListSize(histogram) - 1;
+
+                    if (bucket == 0)
+                    {
+                        tr_strlcpy(p99, "0", sizeof(p99));
+                    }
+                    else if (bucket == last)
+                    {
+                        tr_snprintf(p99, sizeof(p99), ">=%" PRId64, int64_t{ 1 } << (bucket - 1));
+                    }
+                    else if (bucket > 0)
+                    {
+                        tr_snprintf(p99, sizeof(p99), "<%" PRId64, int64_t{ 1 } << bucket);
+                    }
+                }
+
+                printf(
+                    "%-16s  %10" PRId64 "  %10" PRId64 "  %10s  %10" PRId64 "  %12.1f\n",
+                    probe.name,
+                    count,
+                    count > 0 ? total / count : 0,
+                    p99,
+                    max,
+                    total / 1000.0);
+            }
+        }
+    }
+}
+
 static char id[4096];
 
 static int processResponse(char const* rpcurl, void const* response, size_t len)
@@ -2072,6 +2171,10 @@ static int processResponse(char const* rpcurl, void const* response, size_t len)
                     printSessionStats(&top);
                     break;
 
+                case TAG_PERF:
+                    printSessionPerf(&top);
+                    break;
+
                 case TAG_DETAILS:
                     printDetails(&top);
                     break;
@@ -2945,6 +3048,16 @@ static int processArgs(char const* rpcurl, int argc, char const* const* argv)
                     break;
                 }
 
+            case 922:
+                {
+                    tr_variant* top = tr_new0(tr_variant, 1);
+                    tr_variantInitDict(top, 2);
+                    tr_variantDictAddStr(top, TR_KEY_method, "session-perf");
+                    tr_variantDictAddInt(top, TR_KEY_tag, TAG_PERF);
+                    status |= flush(rpcurl, &top);
+                    break;
+                }
+
             case 962:
                 {
                     tr_variant* top = tr_new0(tr_variant, 1);